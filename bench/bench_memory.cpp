@@ -0,0 +1,220 @@
+// Memory footprint per credential of each API and cache mode.
+//
+//   bench_memory [credentials]
+//
+// Every mode runs in a child process of its own, so memory freed by one mode
+// cannot hide growth in the next. A mode first loads the credentials into a
+// MemoryBackend, then measures what the operation under test adds while its
+// results are still held: heap bytes in use (mallinfo2), resident set size,
+// locked memory (VmLck), and the library's own estimate (memory_usage()).
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libcred_memory.hpp>
+#include <libcred_store.hpp>
+
+const std::string service("libcred-bench-service");
+
+struct Sample
+{
+    long heap;
+    long rss;
+    long locked;
+};
+
+// Reads "<field>: <n> kB" from /proc/self/status, in bytes
+long
+status_bytes(const char* field)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    char line[256];
+    long kb = 0;
+    size_t length = strlen(field);
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (strncmp(line, field, length) == 0 && line[length] == ':')
+        {
+            kb = atol(line + length + 1);
+            break;
+        }
+    }
+    fclose(file);
+    return kb * 1024;
+}
+
+Sample
+sample()
+{
+    struct mallinfo2 info = mallinfo2();
+    Sample result;
+    result.heap = static_cast<long>(info.uordblks + info.hblkhd);
+    result.rss = status_bytes("VmRSS");
+    result.locked = status_bytes("VmLck");
+    return result;
+}
+
+std::string
+account_of(size_t i)
+{
+    return "account" + std::to_string(i) + "@example.org";
+}
+
+std::string
+password_of(size_t i)
+{
+    return "password-" + std::to_string(i) + "-0123456789";
+}
+
+// What a mode needs: a store over loaded credentials, and where to report
+struct Context
+{
+    size_t credentials;
+    libcred::Store* store;
+    Sample before;
+
+    // Records the baseline; call once the fixed setup is done
+    void start()
+    {
+        malloc_trim(0);
+        before = sample();
+    }
+
+    // What the store holds beyond the loaded backend: its cache and interned names
+    size_t store_bytes() const
+    {
+        libcred::MemoryUsage usage = store->memory_usage();
+        return usage.cache_bytes + usage.intern_bytes;
+    }
+
+    // Prints what was added since start(), with the operation's results still
+    // held, next to the library's own estimate
+    void stop(const char* mode, size_t library_bytes)
+    {
+        Sample after = sample();
+        double n = static_cast<double>(credentials);
+        printf("%-32s %10.1f %10.1f %10.1f %10.1f\n",
+               mode,
+               (after.heap - before.heap) / n,
+               (after.rss - before.rss) / n,
+               (after.locked - before.locked) / n,
+               library_bytes / n);
+    }
+};
+
+typedef std::function<void(Context&)> Mode;
+
+void
+run(size_t credentials, bool cached, const Mode& mode)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = cached ? 3600 * 1000 : 0;
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend()), options);
+
+    std::string error;
+    for (size_t i = 0; i < credentials; ++i)
+    {
+        store.set_password(service, account_of(i), password_of(i), &error);
+    }
+    store.clear_cache();
+
+    Context context;
+    context.credentials = credentials;
+    context.store = &store;
+    mode(context);
+    fflush(stdout);
+    _exit(0);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t credentials = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+
+    printf("bytes per credential, %zu credentials\n", credentials);
+    printf("%-32s %10s %10s %10s %10s\n", "mode", "heap", "rss", "locked", "libcred");
+
+    // The backend's own copy, as a reference for the rest.
+    run(credentials, false, [](Context& context) {
+        libcred::MemoryBackend backend;
+        context.start();
+        std::string error;
+        for (size_t i = 0; i < context.credentials; ++i)
+        {
+            backend.set_password(service, account_of(i), password_of(i), &error);
+        }
+        context.stop("memory backend", backend.memory_usage());
+    });
+
+    run(credentials, false, [](Context& context) {
+        context.start();
+        std::vector<libcred::Credentials> found;
+        std::string error;
+        context.store->find_credentials(service, &found, &error);
+        context.stop("find_credentials", context.store_bytes());
+    });
+
+    run(credentials, false, [](Context& context) {
+        context.start();
+        std::vector<libcred::Credentials> page;
+        std::string cursor, error;
+        do
+        {
+            page.clear();
+            context.store->find_credentials(service, 10000, cursor, &page, &cursor, &error);
+        } while (!cursor.empty());
+        context.stop("find_credentials, pages of 10000", context.store_bytes());
+    });
+
+    for (int cached = 0; cached <= 1; ++cached)
+    {
+        const char* name = cached ? "get_password, cache" : "get_password";
+        run(credentials, cached != 0, [name](Context& context) {
+            context.start();
+            std::string password, error;
+            for (size_t i = 0; i < context.credentials; ++i)
+            {
+                context.store->get_password(service, account_of(i), &password, &error);
+            }
+            context.stop(name, context.store_bytes());
+        });
+
+        const char* interned_name = cached ? "get_password ids, cache" : "get_password ids";
+        run(credentials, cached != 0, [interned_name](Context& context) {
+            context.start();
+            libcred::ServiceId service_id = libcred::intern_service(service);
+            std::string password, error;
+            for (size_t i = 0; i < context.credentials; ++i)
+            {
+                libcred::AccountId account_id = libcred::intern_account(account_of(i));
+                context.store->get_password(service_id, account_id, &password, &error);
+            }
+            context.stop(interned_name, context.store_bytes());
+        });
+    }
+
+    return 0;
+}
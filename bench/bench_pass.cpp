@@ -0,0 +1,112 @@
+// Cold versus warm lookups of PassBackend.
+//
+//   bench_pass [entries] [gpg-key-id]
+//
+// Without a key id, entries are "encrypted" with cat, which measures the
+// process round trip alone; with one, the store is encrypted to that key and
+// the default gpg commands are used (the key must not need a passphrase, or
+// gpg-agent must already have it cached).
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libcred_pass.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+double
+elapsed_us(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// Gets every entry once and returns the mean microseconds per lookup
+double
+lookup_all(libcred::PassBackend& backend, int entries)
+{
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < entries; ++i)
+    {
+        char account[32];
+        snprintf(account, sizeof(account), "account%04d", i);
+
+        std::string password, error;
+        if (backend.get_password("bench", account, &password, &error) != libcred::SUCCESS)
+        {
+            std::cerr << "lookup failed: " << error << std::endl;
+            exit(1);
+        }
+    }
+    return elapsed_us(start) / entries;
+}
+
+int
+main(int argc, char** argv)
+{
+    int entries = argc > 1 ? atoi(argv[1]) : 100;
+    std::string key_id = argc > 2 ? argv[2] : "";
+
+    char root_template[] = "/tmp/libcred-bench-XXXXXX";
+    std::string root = mkdtemp(root_template);
+
+    libcred::PassOptions options;
+    options.root = root;
+    if (key_id.empty())
+    {
+        options.decrypt_command = std::vector<std::string>(1, "cat");
+        options.encrypt_command.clear();
+        options.encrypt_command.push_back("sh");
+        options.encrypt_command.push_back("-c");
+        options.encrypt_command.push_back("cat");
+        options.encrypt_command.push_back("sh");
+    }
+    std::ofstream((root + "/.gpg-id").c_str()) << (key_id.empty() ? "bench" : key_id) << "\n";
+
+    {
+        libcred::PassBackend writer(options);
+        for (int i = 0; i < entries; ++i)
+        {
+            char account[32];
+            snprintf(account, sizeof(account), "account%04d", i);
+
+            std::string error;
+            if (writer.set_password("bench", account, "password", &error) != libcred::SUCCESS)
+            {
+                std::cerr << "set_password failed: " << error << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    Clock::time_point start = Clock::now();
+    libcred::PassBackend backend(options);
+    std::vector<libcred::Credentials> credentials;
+    std::string error;
+    backend.find_credentials("bench", 1, std::string(), &credentials, &error, &error);
+    double index_us = elapsed_us(start);
+
+    double cold_us = lookup_all(backend, entries);
+    double warm_us = lookup_all(backend, entries);
+
+    start = Clock::now();
+    libcred::PassBackend batch_backend(options);
+    credentials.clear();
+    batch_backend.find_credentials("bench", &credentials, &error);
+    double batch_us = elapsed_us(start) / entries;
+
+    std::cout << entries << " entries, " << (key_id.empty() ? "cat" : "gpg") << std::endl;
+    std::cout << "index + first page:      " << index_us << " us" << std::endl;
+    std::cout << "cold get_password:       " << cold_us << " us/lookup" << std::endl;
+    std::cout << "warm get_password:       " << warm_us << " us/lookup" << std::endl;
+    std::cout << "cold find_credentials:   " << batch_us << " us/entry" << std::endl;
+
+    std::string command = "rm -rf " + root;
+    return system(command.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+// CPU cost of the library's own code paths, with backends that do no I/O.
+//
+//   bench_store [--benchmark_filter=<regex>] [other Google Benchmark flags]
+//
+// Keyring round trips take tens of microseconds and hide what the library
+// adds to every call: the Store layer and its cache, label construction,
+// copying found credentials, building error strings, and the generic paging,
+// policy and multi-service implementations of Backend. These run here against
+// in-memory fakes, so the results are per-call overheads in nanoseconds.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcred_audit.hpp>
+#include <libcred_memory.hpp>
+#include <libcred_store.hpp>
+#include <libcred_trace.hpp>
+
+namespace
+{
+
+    const std::string service("libcred-bench-service");
+    const std::string account("libcred-bench@example.org");
+    const std::string secret("$uP3RseCr1t!");
+
+    // A backend that answers at once; a service holds `accounts` credentials.
+    // Writes build the item label as the Secret Service backend does, and
+    // reads of the account "missing" fail with an error message.
+    class FakeBackend : public libcred::Backend
+    {
+    public:
+        explicit FakeBackend(size_t accounts = 1)
+        {
+            for (size_t i = 0; i < accounts; ++i)
+            {
+                credentials_.push_back(
+                    libcred::Credentials("account" + std::to_string(i) + "@example.org", secret));
+            }
+        }
+
+        using Backend::delete_password;
+        using Backend::find_credentials;
+        using Backend::find_password;
+        using Backend::get_password;
+        using Backend::set_password;
+
+        libcred::LIBCRED_RESULT set_password(const std::string& service,
+                                             const std::string& account,
+                                             const std::string& password,
+                                             std::string* error)
+        {
+            std::string label = service + "/" + account;
+            benchmark::DoNotOptimize(label.c_str());
+            return libcred::SUCCESS;
+        }
+
+        libcred::LIBCRED_RESULT get_password(const std::string& service,
+                                             const std::string& account,
+                                             std::string* password,
+                                             std::string* error)
+        {
+            if (account == "missing")
+            {
+                *error = "No such secret item at path: /org/freedesktop/secrets/collection/"
+                         "login/" + account;
+                return libcred::FAIL_ERROR;
+            }
+            *password = secret;
+            return libcred::SUCCESS;
+        }
+
+        libcred::LIBCRED_RESULT delete_password(const std::string& service,
+                                                const std::string& account,
+                                                std::string* error)
+        {
+            return libcred::SUCCESS;
+        }
+
+        libcred::LIBCRED_RESULT find_password(const std::string& service,
+                                              std::string* password,
+                                              std::string* error)
+        {
+            *password = credentials_.front().second;
+            return libcred::SUCCESS;
+        }
+
+        libcred::LIBCRED_RESULT find_credentials(const std::string& service,
+                                                 std::vector<libcred::Credentials>* credentials,
+                                                 std::string* error)
+        {
+            credentials->insert(credentials->end(), credentials_.begin(), credentials_.end());
+            return libcred::SUCCESS;
+        }
+
+    private:
+        std::vector<libcred::Credentials> credentials_;
+    };
+
+    std::unique_ptr<libcred::Backend> fake(size_t accounts = 1)
+    {
+        return std::unique_ptr<libcred::Backend>(new FakeBackend(accounts));
+    }
+
+    libcred::StoreOptions cached()
+    {
+        libcred::StoreOptions options;
+        options.cache_ttl_ms = 3600 * 1000;
+        return options;
+    }
+
+}  // namespace
+
+// The Store layer alone: dispatch, probes and the disabled cache
+static void
+BM_GetPassword(benchmark::State& state)
+{
+    libcred::Store store(fake());
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service, account, &password, &error));
+    }
+}
+BENCHMARK(BM_GetPassword);
+
+static void
+BM_GetPasswordCacheHit(benchmark::State& state)
+{
+    // Shared by the benchmark's threads, to measure contention on the cache.
+    static libcred::Store store(fake(), cached());
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service, account, &password, &error));
+    }
+}
+BENCHMARK(BM_GetPasswordCacheHit)->ThreadRange(1, 4)->UseRealTime();
+
+static void
+BM_GetPasswordThreadCacheHit(benchmark::State& state)
+{
+    static libcred::StoreOptions options = [] {
+        libcred::StoreOptions options = cached();
+        options.thread_cache = true;
+        return options;
+    }();
+    static libcred::Store store(fake(), options);
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service, account, &password, &error));
+    }
+}
+BENCHMARK(BM_GetPasswordThreadCacheHit)->ThreadRange(1, 4)->UseRealTime();
+
+static void
+BM_GetPasswordError(benchmark::State& state)
+{
+    libcred::Store store(fake());
+    std::string password, error;
+    for (auto _ : state)
+    {
+        error.clear();
+        benchmark::DoNotOptimize(store.get_password(service, "missing", &password, &error));
+    }
+}
+BENCHMARK(BM_GetPasswordError);
+
+static void
+BM_GetPasswordInterned(benchmark::State& state)
+{
+    libcred::Store store(fake());
+    libcred::ServiceId service_id = libcred::intern_service(service);
+    libcred::AccountId account_id = libcred::intern_account(account);
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service_id, account_id, &password, &error));
+    }
+}
+BENCHMARK(BM_GetPasswordInterned);
+
+// Label construction, plus the cache update when caching
+static void
+BM_SetPassword(benchmark::State& state)
+{
+    libcred::Store store(fake(), state.range(0) ? cached() : libcred::StoreOptions());
+    std::string error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.set_password(service, account, secret, &error));
+    }
+}
+BENCHMARK(BM_SetPassword)->Arg(0)->Arg(1)->ArgName("cached");
+
+static void
+BM_SetPasswordInterned(benchmark::State& state)
+{
+    libcred::Store store(fake());
+    libcred::ServiceId service_id = libcred::intern_service(service);
+    libcred::AccountId account_id = libcred::intern_account(account);
+    std::string error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.set_password(service_id, account_id, secret, &error));
+    }
+}
+BENCHMARK(BM_SetPasswordInterned);
+
+// Copying found credentials out to the caller
+static void
+BM_FindCredentials(benchmark::State& state)
+{
+    libcred::Store store(fake(state.range(0)));
+    std::string error;
+    for (auto _ : state)
+    {
+        std::vector<libcred::Credentials> credentials;
+        benchmark::DoNotOptimize(store.find_credentials(service, &credentials, &error));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FindCredentials)->RangeMultiplier(16)->Range(1, 4096);
+
+// Backend's generic paging: load all, sort, slice a page of 16
+static void
+BM_FindCredentialsPaged(benchmark::State& state)
+{
+    libcred::Store store(fake(state.range(0)));
+    std::string next_cursor, error;
+    for (auto _ : state)
+    {
+        std::vector<libcred::Credentials> credentials;
+        benchmark::DoNotOptimize(
+            store.find_credentials(service, 16, std::string(), &credentials, &next_cursor, &error));
+    }
+}
+BENCHMARK(BM_FindCredentialsPaged)->RangeMultiplier(16)->Range(16, 4096);
+
+// Backend's generic FIND_FIRST_ACCOUNT policy
+static void
+BM_FindPasswordFirstAccount(benchmark::State& state)
+{
+    libcred::Store store(fake(state.range(0)));
+    std::string found_account, password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.find_password(
+            service, libcred::FIND_FIRST_ACCOUNT, &found_account, &password, &error));
+    }
+}
+BENCHMARK(BM_FindPasswordFirstAccount)->RangeMultiplier(16)->Range(1, 4096);
+
+// Backend's generic multi-service lookup, 16 accounts per service
+static void
+BM_FindCredentialsMulti(benchmark::State& state)
+{
+    libcred::Store store(fake(16));
+    std::vector<std::string> services;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        services.push_back(service + std::to_string(i));
+    }
+    std::string error;
+    for (auto _ : state)
+    {
+        std::map<std::string, std::vector<libcred::Credentials>> credentials;
+        benchmark::DoNotOptimize(store.find_credentials(services, &credentials, &error));
+    }
+}
+BENCHMARK(BM_FindCredentialsMulti)->RangeMultiplier(4)->Range(1, 64);
+
+// The audit and trace hooks on top of BM_GetPassword
+static void
+BM_GetPasswordAudited(benchmark::State& state)
+{
+    libcred::AuditOptions audit;
+    audit.path = "/dev/null";
+    libcred::StoreOptions options;
+    options.audit = std::make_shared<libcred::AuditLog>(audit);
+    libcred::Store store(fake(), options);
+
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service, account, &password, &error));
+    }
+    state.counters["dropped"] = static_cast<double>(options.audit->dropped());
+}
+BENCHMARK(BM_GetPasswordAudited);
+
+static void
+BM_GetPasswordTraced(benchmark::State& state)
+{
+    libcred::TraceOptions trace;
+    trace.path = "/dev/null";
+    libcred::StoreOptions options;
+    options.trace = std::make_shared<libcred::TraceRecorder>(trace);
+    libcred::Store store(fake(), options);
+
+    std::string password, error;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(store.get_password(service, account, &password, &error));
+    }
+}
+BENCHMARK(BM_GetPasswordTraced);
+
+// MemoryBackend's map lookups under its lock
+static void
+BM_MemoryBackendGetPassword(benchmark::State& state)
+{
+    libcred::MemoryBackend backend;
+    std::string password, error;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        backend.set_password(service, account + std::to_string(i), secret, &error);
+    }
+    backend.set_password(service, account, secret, &error);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(backend.get_password(service, account, &password, &error));
+    }
+}
+BENCHMARK(BM_MemoryBackendGetPassword)->RangeMultiplier(16)->Range(1, 4096);
+
+BENCHMARK_MAIN();
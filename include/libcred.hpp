@@ -1,6 +1,10 @@
 #ifndef SRC_KEYTAR_H_
 #define SRC_KEYTAR_H_
 
+#include <time.h>
+
+#include <cstdint>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -16,6 +20,37 @@ namespace libcred
         FAIL_NONFATAL
     };
 
+    /**
+     * Which credential find_password picks when a service has several.
+     */
+    enum LIBCRED_FIND_POLICY
+    {
+        FIND_ANY,            // Whatever the backend returns first.
+        FIND_MOST_RECENT,    // The most recently modified credential.
+        FIND_FIRST_ACCOUNT  // The lexicographically first account name.
+    };
+
+    /**
+     * Which credential a search of several collections keeps when an account
+     * is found in more than one of them.
+     */
+    enum LIBCRED_MERGE_POLICY
+    {
+        MERGE_FIRST_COLLECTION,  // The one in the collection listed first.
+        MERGE_MOST_RECENT,       // The most recently modified one.
+        MERGE_ALL                // Every one, in the order the collections are listed.
+    };
+
+    /**
+     * A credential and the collection it was found in, as it was named in
+     * the search.
+     */
+    struct CollectionCredentials
+    {
+        Credentials credentials;
+        std::string collection;
+    };
+
 #ifdef _WIN32
 #ifdef LIBCRED_STATIC_LIB
 #define LIBCRED_PUBLIC_API
@@ -35,6 +70,18 @@ namespace libcred
                                                    const std::string& password,
                                                    std::string* error);
 
+    /**
+     * Stores a password that expires at the given time, in seconds since the
+     * epoch. Once it has passed, get_password returns FAIL_NONFATAL without
+     * asking the keyring, and a background reaper deletes the credential.
+     * The expiry is known to this process only (see Store).
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT set_password(const std::string& service,
+                                                   const std::string& account,
+                                                   const std::string& password,
+                                                   time_t expires,
+                                                   std::string* error);
+
     LIBCRED_PUBLIC_API LIBCRED_RESULT get_password(const std::string& service,
                                                    const std::string& account,
                                                    std::string* password,
@@ -52,6 +99,165 @@ namespace libcred
                                                        std::vector<Credentials>*,
                                                        std::string* error);
 
+    /**
+     * Finds one password of a service, choosing among several credentials by
+     * `policy`. The choice is made from item metadata only, so exactly one
+     * secret is loaded however many accounts the service has. The chosen
+     * account is stored in *account unless it is NULL.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_password(const std::string& service,
+                                                    LIBCRED_FIND_POLICY policy,
+                                                    std::string* account,
+                                                    std::string* password,
+                                                    std::string* error);
+
+    /**
+     * Finds one page of a service's credentials, ordered by account name.
+     *
+     * Pass an empty cursor to get the first page and the returned
+     * *next_cursor to get the following one; *next_cursor is empty after the
+     * last page. Cursors are opaque and stay valid when items are added or
+     * removed between calls. Only the secrets of the returned page are
+     * loaded. A limit of zero returns all remaining credentials.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_credentials(const std::string& service,
+                                                       size_t limit,
+                                                       const std::string& cursor,
+                                                       std::vector<Credentials>*,
+                                                       std::string* next_cursor,
+                                                       std::string* error);
+
+    /**
+     * Finds the credentials of several services at once, grouped by service.
+     *
+     * Every requested service gets an entry in the result, empty if it has no
+     * credentials. Where the backend allows it the lookup is a single search
+     * and a single secret transfer regardless of the number of services.
+     * Returns FAIL_NONFATAL if none of the services has any credentials.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* error);
+
+    /**
+     * Finds the credentials of a service in several collections, each an
+     * alias ("login", "session", "default") or an object path, listed in
+     * order of precedence. On Linux every collection is searched at once
+     * rather than one after the other. Collections that do not exist hold
+     * nothing. Backends without collections keep everything in "default".
+     * Returns FAIL_NONFATAL if no collection has any credential of the
+     * service.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_credentials(const std::string& service,
+                                                       const std::vector<std::string>& collections,
+                                                       LIBCRED_MERGE_POLICY policy,
+                                                       std::vector<CollectionCredentials>* found,
+                                                       std::string* error);
+
+    /**
+     * Counts the credentials of a service without transferring any secret
+     * where the backend allows it. A service without credentials counts 0,
+     * with SUCCESS. Stores with count_ttl_ms answer repeated counts from
+     * memory (see Store).
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT count_credentials(const std::string& service,
+                                                        size_t* count,
+                                                        std::string* error);
+
+    /**
+     * Counts the credentials of several services at once. Every requested
+     * service gets an entry in *counts.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                                        std::map<std::string, size_t>* counts,
+                                                        std::string* error);
+
+    /**
+     * Deletes every credential of a service and stores how many were deleted
+     * in *deleted. The items are found from their attributes, so no secret is
+     * read, and where the backend allows it the deletions are sent without
+     * waiting for each to finish. Returns FAIL_NONFATAL if the service has no
+     * credentials. On FAIL_ERROR, *deleted counts those deleted before the
+     * failure.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT delete_credentials(const std::string& service,
+                                                         size_t* deleted,
+                                                         std::string* error);
+
+    /**
+     * Moves every credential of a service to another service name and
+     * appends the accounts moved to *accounts. Credentials of the new service
+     * under the same accounts are replaced. Where the backend can change
+     * item attributes (the Secret Service, the macOS keychain) this happens
+     * in place and no secret is transferred; elsewhere each credential is
+     * copied and the original deleted once every copy is written. Returns
+     * FAIL_NONFATAL if the service has no credentials. On FAIL_ERROR,
+     * *accounts lists those moved before the failure.
+     */
+    LIBCRED_PUBLIC_API LIBCRED_RESULT rename_service(const std::string& from,
+                                                     const std::string& to,
+                                                     std::vector<std::string>* accounts,
+                                                     std::string* error);
+
+    /**
+     * Compact process-wide identifiers for service and account names.
+     *
+     * Interning a name copies and hashes it once; the returned ID stays valid
+     * for the lifetime of the process and interning the same name again yields
+     * the same ID. The ID-based overloads below skip the per-call string copies
+     * and build the per-key attribute strings (labels, target names) only once.
+     */
+    typedef uint32_t ServiceId;
+    typedef uint32_t AccountId;
+
+    LIBCRED_PUBLIC_API ServiceId intern_service(const std::string& service);
+
+    LIBCRED_PUBLIC_API AccountId intern_account(const std::string& account);
+
+    LIBCRED_PUBLIC_API LIBCRED_RESULT set_password(ServiceId service,
+                                                   AccountId account,
+                                                   const std::string& password,
+                                                   std::string* error);
+
+    LIBCRED_PUBLIC_API LIBCRED_RESULT get_password(ServiceId service,
+                                                   AccountId account,
+                                                   std::string* password,
+                                                   std::string* error);
+
+    LIBCRED_PUBLIC_API LIBCRED_RESULT delete_password(ServiceId service,
+                                                      AccountId account,
+                                                      std::string* error);
+
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_password(ServiceId service,
+                                                    std::string* password,
+                                                    std::string* error);
+
+    LIBCRED_PUBLIC_API LIBCRED_RESULT find_credentials(ServiceId service,
+                                                       std::vector<Credentials>*,
+                                                       std::string* error);
+
+    /**
+     * Estimated heap memory the library holds itself. Results handed to
+     * callers are not included, nor is allocator overhead.
+     */
+    struct LIBCRED_PUBLIC_API MemoryUsage
+    {
+        MemoryUsage();
+
+        size_t cache_entries;  // Passwords in the store's cache.
+        size_t cache_bytes;    // The store's cache.
+        size_t backend_bytes;  // The backend's own caches and indexes.
+        size_t intern_bytes;   // Interned names and labels, shared by all stores.
+
+        size_t total() const;
+    };
+
+    /**
+     * Memory use of the default store and of the interned names.
+     */
+    LIBCRED_PUBLIC_API MemoryUsage memory_usage();
+
 }  // namespace keytar
 
 #endif  // SRC_KEYTAR_H_
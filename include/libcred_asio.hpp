@@ -0,0 +1,60 @@
+#ifndef SRC_LIBCRED_ASIO_H_
+#define SRC_LIBCRED_ASIO_H_
+
+#include "libcred_async.hpp"
+
+namespace libcred
+{
+
+    /**
+     * Drives an AsyncStore from an Asio io_context. Header only, and works
+     * with both standalone Asio and Boost.Asio:
+     *
+     *     asio::posix::stream_descriptor descriptor(io, dup(async.fd()));
+     *     libcred::asio_watch(async, descriptor);
+     *
+     * The descriptor must be a duplicate, as it closes what it holds, and
+     * must outlive the watch; cancel() or close() it to stop watching.
+     */
+    template <typename StreamDescriptor>
+    class AsioWatch
+    {
+    public:
+        AsioWatch(AsyncStore& store, StreamDescriptor& descriptor)
+            : store_(&store)
+            , descriptor_(&descriptor)
+        {
+        }
+
+        void start()
+        {
+            descriptor_->async_wait(StreamDescriptor::wait_read, *this);
+        }
+
+        template <typename ErrorCode>
+        void operator()(const ErrorCode& error)
+        {
+            // Asio polls edge-triggered, so the wait is renewed before the
+            // descriptor is cleared; a completion queued after that is then
+            // a fresh edge.
+            if (!error)
+            {
+                start();
+                store_->process_events();
+            }
+        }
+
+    private:
+        AsyncStore* store_;
+        StreamDescriptor* descriptor_;
+    };
+
+    template <typename StreamDescriptor>
+    void asio_watch(AsyncStore& store, StreamDescriptor& descriptor)
+    {
+        AsioWatch<StreamDescriptor>(store, descriptor).start();
+    }
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_ASIO_H_
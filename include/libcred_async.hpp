@@ -0,0 +1,137 @@
+#ifndef SRC_LIBCRED_ASYNC_H_
+#define SRC_LIBCRED_ASYNC_H_
+
+#include <functional>
+#include <memory>
+
+#include "libcred_store.hpp"
+
+namespace libcred
+{
+
+    enum LIBCRED_PRIORITY
+    {
+        PRIORITY_HIGH,    // Run before any queued normal or low priority call.
+        PRIORITY_NORMAL,  // The default.
+        PRIORITY_LOW,     // Run only while nothing else is queued.
+        PRIORITY_COUNT
+    };
+
+    struct LIBCRED_PUBLIC_API AsyncOptions
+    {
+        AsyncOptions();
+
+        size_t queue_capacity;  // Calls that may wait for the worker, per priority, 256.
+    };
+
+    /**
+     * Depth and load of an AsyncStore's queues, indexed by LIBCRED_PRIORITY.
+     */
+    struct LIBCRED_PUBLIC_API AsyncStats
+    {
+        AsyncStats();
+
+        size_t queued[PRIORITY_COUNT];                // Calls waiting for the worker.
+        size_t max_queued[PRIORITY_COUNT];            // The most ever waiting at once.
+        unsigned long long rejected[PRIORITY_COUNT];  // Calls refused as the queue was full.
+        size_t running;                               // Calls on the worker, 0 or 1.
+        size_t completed;                             // Callbacks awaiting process_events().
+    };
+
+    /**
+     * Calls on a Store completed from the caller's event loop (POSIX).
+     *
+     * Every call returns at once; its callback runs later, on the thread
+     * that calls process_events(). fd() becomes readable whenever callbacks
+     * are waiting, so a loop polls it with epoll, io_uring, Asio
+     * (libcred_asio.hpp) or libuv (libcred_uv.hpp) and calls
+     * process_events() when it fires.
+     *
+     * A get_password the store's cache can answer completes without leaving
+     * the calling thread. Backend calls block, so they run on one worker
+     * thread, started on first use, one at a time: highest priority first,
+     * in submission order within a priority.
+     *
+     * Each priority has a bounded queue. A call that finds its queue full is
+     * refused at once, returning false without its callback ever running,
+     * so a slow keyring makes callers shed load instead of piling up
+     * requests; on_capacity() tells them when to try again.
+     *
+     * Callbacks may submit further calls. Those still pending when the
+     * AsyncStore is destroyed are not run.
+     *
+     * After fork() the child keeps fd() but completes only its own calls;
+     * the parent's pending callbacks run in the parent alone.
+     */
+    class LIBCRED_PUBLIC_API AsyncStore
+    {
+    public:
+        typedef std::function<void(LIBCRED_RESULT result, const std::string& error)> Callback;
+        typedef std::function<void(
+            LIBCRED_RESULT result, const std::string& password, const std::string& error)>
+            PasswordCallback;
+        typedef std::function<void(LIBCRED_RESULT result,
+                                   const std::vector<Credentials>& credentials,
+                                   const std::string& error)>
+            CredentialsCallback;
+
+        /**
+         * Calls go to store, which must outlive this object.
+         */
+        explicit AsyncStore(Store& store, const AsyncOptions& options = AsyncOptions());
+        ~AsyncStore();
+
+        /**
+         * Readable while callbacks are waiting for process_events(), -1 if
+         * it could not be created. Owned by the AsyncStore. process_events()
+         * clears it before running callbacks, so an edge-triggered poller
+         * must be re-armed before calling it.
+         */
+        int fd() const;
+
+        /**
+         * Runs the callbacks of every call completed so far and returns how
+         * many ran. Never blocks.
+         */
+        size_t process_events();
+
+        /**
+         * Runs callback from process_events() once a call of the given
+         * priority has left its queue, or at once if the queue has room.
+         * Each freed place wakes one waiter, oldest first.
+         */
+        void on_capacity(LIBCRED_PRIORITY priority, const std::function<void()>& callback);
+
+        AsyncStats stats() const;
+
+        bool set_password(const std::string& service,
+                          const std::string& account,
+                          const std::string& password,
+                          const Callback& callback,
+                          LIBCRED_PRIORITY priority = PRIORITY_NORMAL);
+
+        bool get_password(const std::string& service,
+                          const std::string& account,
+                          const PasswordCallback& callback,
+                          LIBCRED_PRIORITY priority = PRIORITY_NORMAL);
+
+        bool delete_password(const std::string& service,
+                             const std::string& account,
+                             const Callback& callback,
+                             LIBCRED_PRIORITY priority = PRIORITY_NORMAL);
+
+        bool find_credentials(const std::string& service,
+                              const CredentialsCallback& callback,
+                              LIBCRED_PRIORITY priority = PRIORITY_NORMAL);
+
+    private:
+        AsyncStore(const AsyncStore&);
+        AsyncStore& operator=(const AsyncStore&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_ASYNC_H_
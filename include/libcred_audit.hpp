@@ -0,0 +1,74 @@
+#ifndef SRC_LIBCRED_AUDIT_H_
+#define SRC_LIBCRED_AUDIT_H_
+
+#include <memory>
+
+#include "libcred.hpp"
+
+namespace libcred
+{
+
+    struct LIBCRED_PUBLIC_API AuditOptions
+    {
+        AuditOptions();
+
+        std::string path;          // File records are appended to, empty for syslog (POSIX).
+        size_t max_file_bytes;     // Size from which the file is rotated, 10 MiB; 0 never.
+        int max_files;             // Rotated files kept as <path>.1 to <path>.<max_files>, 5.
+        size_t capacity;           // Records buffered, rounded up to a power of two, 4096.
+        long flush_interval_ms;    // How often buffered records are written out, 250.
+    };
+
+    /**
+     * A log of credential accesses: one line per operation with its time,
+     * operation, service, account, result and the process id.
+     *
+     * record() only copies the record into a lock-free ring buffer; a
+     * background thread writes the buffer out, so callers never wait for the
+     * file or syslog. When the buffer is full the record is dropped instead
+     * and counted; the count is written to the log with the next flush.
+     *
+     * Stores write to an AuditLog set in StoreOptions::audit. Several stores
+     * may share one.
+     */
+    class LIBCRED_PUBLIC_API AuditLog
+    {
+    public:
+        explicit AuditLog(const AuditOptions& options);
+
+        /**
+         * Writes out every queued record and stops the flush thread.
+         */
+        ~AuditLog();
+
+        /**
+         * Queues a record without blocking. operation must outlive the log,
+         * as string literals do.
+         */
+        void record(const char* operation,
+                    const std::string& service,
+                    const std::string& account,
+                    LIBCRED_RESULT result);
+
+        /**
+         * Returns once every record queued before the call is written out.
+         */
+        void flush();
+
+        /**
+         * Records lost so far, because the buffer was full or the log could
+         * not be written.
+         */
+        unsigned long long dropped() const;
+
+    private:
+        AuditLog(const AuditLog&);
+        AuditLog& operator=(const AuditLog&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_AUDIT_H_
@@ -0,0 +1,180 @@
+#ifndef SRC_LIBCRED_BACKEND_H_
+#define SRC_LIBCRED_BACKEND_H_
+
+#include <time.h>
+
+#include "libcred.hpp"
+
+namespace libcred
+{
+
+    /**
+     * Interface of a credential store other than the system keyring.
+     *
+     * Backends implement the five basic operations with the same semantics as
+     * the free functions in libcred.hpp. The paged, policy, multi-service,
+     * multi-collection, count, bulk delete and rename variants have generic
+     * implementations built on the basic operations, and the overloads
+     * taking interned IDs resolve the names and forward; backends override
+     * any of them when they can do better. Classes overriding only some
+     * overloads of an operation should add `using Backend::find_credentials;`
+     * (and likewise for the others) so the rest stay visible.
+     */
+    class LIBCRED_PUBLIC_API Backend
+    {
+    public:
+        virtual ~Backend();
+
+        virtual LIBCRED_RESULT set_password(const std::string& service,
+                                            const std::string& account,
+                                            const std::string& password,
+                                            std::string* error)
+            = 0;
+
+        virtual LIBCRED_RESULT get_password(const std::string& service,
+                                            const std::string& account,
+                                            std::string* password,
+                                            std::string* error)
+            = 0;
+
+        virtual LIBCRED_RESULT delete_password(const std::string& service,
+                                               const std::string& account,
+                                               std::string* error)
+            = 0;
+
+        virtual LIBCRED_RESULT find_password(const std::string& service,
+                                             std::string* password,
+                                             std::string* error)
+            = 0;
+
+        virtual LIBCRED_RESULT find_credentials(const std::string& service,
+                                                std::vector<Credentials>* credentials,
+                                                std::string* error)
+            = 0;
+
+        /**
+         * Generic version: FIND_ANY and FIND_FIRST_ACCOUNT are resolved from
+         * find_credentials; FIND_MOST_RECENT needs modification times and
+         * fails unless overridden.
+         */
+        virtual LIBCRED_RESULT find_password(const std::string& service,
+                                             LIBCRED_FIND_POLICY policy,
+                                             std::string* account,
+                                             std::string* password,
+                                             std::string* error);
+
+        /**
+         * Generic version: loads every credential of the service, then sorts
+         * and slices.
+         */
+        virtual LIBCRED_RESULT find_credentials(const std::string& service,
+                                                size_t limit,
+                                                const std::string& cursor,
+                                                std::vector<Credentials>* credentials,
+                                                std::string* next_cursor,
+                                                std::string* error);
+
+        /**
+         * Generic version: one find_credentials call per service.
+         */
+        virtual LIBCRED_RESULT find_credentials(
+            const std::vector<std::string>& services,
+            std::map<std::string, std::vector<Credentials>>* credentials,
+            std::string* error);
+
+        /**
+         * Generic version: the backend is a single collection, "default",
+         * searched once however often it is listed; other collections hold
+         * nothing.
+         */
+        virtual LIBCRED_RESULT find_credentials(const std::string& service,
+                                                const std::vector<std::string>& collections,
+                                                LIBCRED_MERGE_POLICY policy,
+                                                std::vector<CollectionCredentials>* found,
+                                                std::string* error);
+
+        /**
+         * Generic version: one find_credentials call, then one delete_password
+         * call per account. Backends override it to find the items from
+         * their attributes alone, without reading any secret.
+         */
+        virtual LIBCRED_RESULT delete_credentials(const std::string& service,
+                                                  size_t* deleted,
+                                                  std::string* error);
+
+        /**
+         * Generic version: the number of credentials find_credentials
+         * returns, so every secret of the service is loaded. Backends
+         * override it to count items from their attributes alone.
+         */
+        virtual LIBCRED_RESULT count_credentials(const std::string& service,
+                                                 size_t* count,
+                                                 std::string* error);
+
+        /**
+         * Generic version: one count_credentials call per service.
+         */
+        virtual LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                                 std::map<std::string, size_t>* counts,
+                                                 std::string* error);
+
+        /**
+         * Generic version: one find_credentials call, then the credentials
+         * are stored under the new name, and only then are the originals
+         * deleted. Backends override it to rewrite item attributes in place,
+         * without transferring secrets. A failure can leave the move partial:
+         * *accounts then lists the credentials moved, a failed copy leaves
+         * the rest under `from` alone, and a failed delete leaves the copied
+         * ones not yet listed under both names.
+         */
+        virtual LIBCRED_RESULT rename_service(const std::string& from,
+                                              const std::string& to,
+                                              std::vector<std::string>* accounts,
+                                              std::string* error);
+
+        /**
+         * Generic versions of the interned-ID overloads: resolve the IDs and
+         * call the string versions. Fail with FAIL_ERROR for unknown IDs.
+         */
+        virtual LIBCRED_RESULT set_password(ServiceId service,
+                                            AccountId account,
+                                            const std::string& password,
+                                            std::string* error);
+
+        virtual LIBCRED_RESULT get_password(ServiceId service,
+                                            AccountId account,
+                                            std::string* password,
+                                            std::string* error);
+
+        virtual LIBCRED_RESULT delete_password(ServiceId service,
+                                               AccountId account,
+                                               std::string* error);
+
+        virtual LIBCRED_RESULT find_password(ServiceId service,
+                                             std::string* password,
+                                             std::string* error);
+
+        virtual LIBCRED_RESULT find_credentials(ServiceId service,
+                                                std::vector<Credentials>* credentials,
+                                                std::string* error);
+
+        /**
+         * When a credential last changed, in seconds since the epoch, found
+         * without reading its secret. Store uses it to revalidate cache
+         * snapshots cheaply. FAIL_ERROR unless overridden.
+         */
+        virtual LIBCRED_RESULT get_modified(const std::string& service,
+                                            const std::string& account,
+                                            time_t* modified,
+                                            std::string* error);
+
+        /**
+         * Estimated heap bytes of the backend's own caches and indexes; 0
+         * unless overridden.
+         */
+        virtual size_t memory_usage() const;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_BACKEND_H_
@@ -0,0 +1,112 @@
+#ifndef SRC_LIBCRED_DIRECTORY_H_
+#define SRC_LIBCRED_DIRECTORY_H_
+
+#include <memory>
+
+#include "libcred_backend.hpp"
+
+namespace libcred
+{
+
+    /**
+     * Read-only backend over a directory of secret files, as mounted by
+     * Kubernetes (/run/secrets/...) or systemd ($CREDENTIALS_DIRECTORY).
+     *
+     * The file <root>/<service>/<account> holds the password of (service,
+     * account); a file directly in <root> is a credential of that service with
+     * an empty account. Names starting with '.' are ignored.
+     *
+     * Files are read lazily through mmap and their contents are cached. An
+     * inotify watch drops only the entries whose files change, so repeated
+     * lookups cost a map lookup. A change to a dot-file in <root> (the atomic
+     * "..data" swap of Kubernetes secret volumes) drops the whole cache.
+     */
+    class LIBCRED_PUBLIC_API DirectoryBackend : public Backend
+    {
+    public:
+        /**
+         * With `strip_newline` a single trailing newline is removed from file
+         * contents, as left behind by `echo secret > file`.
+         */
+        explicit DirectoryBackend(const std::string& root, bool strip_newline = true);
+        ~DirectoryBackend();
+
+        /**
+         * $CREDENTIALS_DIRECTORY if set, /run/secrets otherwise.
+         */
+        static std::string default_root();
+
+        using Backend::count_credentials;
+        using Backend::delete_password;
+        using Backend::find_credentials;
+        using Backend::find_password;
+        using Backend::get_password;
+        using Backend::set_password;
+
+        // Writes fail with FAIL_ERROR: mounted secrets are read-only.
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     LIBCRED_FIND_POLICY policy,
+                                     std::string* account,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        size_t limit,
+                                        const std::string& cursor,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* next_cursor,
+                                        std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::string& service,
+                                         size_t* count,
+                                         std::string* error);
+
+        LIBCRED_RESULT delete_credentials(const std::string& service,
+                                          size_t* deleted,
+                                          std::string* error);
+
+        LIBCRED_RESULT rename_service(const std::string& from,
+                                      const std::string& to,
+                                      std::vector<std::string>* accounts,
+                                      std::string* error);
+
+        LIBCRED_RESULT get_modified(const std::string& service,
+                                    const std::string& account,
+                                    time_t* modified,
+                                    std::string* error);
+
+        size_t memory_usage() const;
+
+    private:
+        DirectoryBackend(const DirectoryBackend&);
+        DirectoryBackend& operator=(const DirectoryBackend&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_DIRECTORY_H_
@@ -0,0 +1,117 @@
+#ifndef SRC_LIBCRED_HTTP_H_
+#define SRC_LIBCRED_HTTP_H_
+
+#include <memory>
+
+#include "libcred_backend.hpp"
+
+namespace libcred
+{
+
+    struct LIBCRED_PUBLIC_API HttpOptions
+    {
+        HttpOptions();
+
+        /**
+         * Defaults overridden by $VAULT_ADDR and $VAULT_TOKEN when set.
+         */
+        static HttpOptions from_environment();
+
+        std::string address;     // Server base URL, "http://127.0.0.1:8200".
+        std::string token;       // Sent as X-Vault-Token.
+        std::string mount;       // Mount point of the KV engine, "secret".
+        std::string prefix;      // Path under the mount holding the services.
+        long timeout_ms;         // Per-request timeout, 5000.
+        size_t max_connections;  // Keep-alive connections and batch parallelism, 8.
+        long cache_ttl_ms;       // Cache lifetime for responses without a lease, 0.
+    };
+
+    /**
+     * Backend for a Vault-style KV version 2 HTTP secrets engine.
+     *
+     * The credential (service, account) is the secret at
+     * <mount>/data/<prefix>/<service>/<account>, with the password in its
+     * "password" field. Connections are kept alive and pooled across calls;
+     * find_credentials lists the service and fetches its secrets over up to
+     * max_connections parallel requests, and delete_credentials deletes them
+     * the same way without reading them. Values are cached for their
+     * lease_duration when the server grants one, else for cache_ttl_ms.
+     */
+    class LIBCRED_PUBLIC_API HttpBackend : public Backend
+    {
+    public:
+        explicit HttpBackend(const HttpOptions& options);
+        ~HttpBackend();
+
+        using Backend::count_credentials;
+        using Backend::delete_password;
+        using Backend::find_credentials;
+        using Backend::find_password;
+        using Backend::get_password;
+        using Backend::set_password;
+
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     LIBCRED_FIND_POLICY policy,
+                                     std::string* account,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        size_t limit,
+                                        const std::string& cursor,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* next_cursor,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_credentials(
+            const std::vector<std::string>& services,
+            std::map<std::string, std::vector<Credentials>>* credentials,
+            std::string* error);
+
+        LIBCRED_RESULT delete_credentials(const std::string& service,
+                                          size_t* deleted,
+                                          std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::string& service,
+                                         size_t* count,
+                                         std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                         std::map<std::string, size_t>* counts,
+                                         std::string* error);
+
+        size_t memory_usage() const;
+
+    private:
+        HttpBackend(const HttpBackend&);
+        HttpBackend& operator=(const HttpBackend&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_HTTP_H_
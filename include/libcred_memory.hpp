@@ -0,0 +1,87 @@
+#ifndef SRC_LIBCRED_MEMORY_H_
+#define SRC_LIBCRED_MEMORY_H_
+
+#include <memory>
+
+#include "libcred_backend.hpp"
+
+namespace libcred
+{
+
+    /**
+     * Backend keeping credentials in process memory only, for tests and as a
+     * baseline when replaying traces. Safe to use from several threads.
+     */
+    class LIBCRED_PUBLIC_API MemoryBackend : public Backend
+    {
+    public:
+        MemoryBackend();
+        ~MemoryBackend();
+
+        using Backend::count_credentials;
+        using Backend::delete_password;
+        using Backend::find_credentials;
+        using Backend::find_password;
+        using Backend::get_password;
+        using Backend::set_password;
+
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        // Supports FIND_MOST_RECENT: the credential set last.
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     LIBCRED_FIND_POLICY policy,
+                                     std::string* account,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::string& service,
+                                         size_t* count,
+                                         std::string* error);
+
+        LIBCRED_RESULT delete_credentials(const std::string& service,
+                                          size_t* deleted,
+                                          std::string* error);
+
+        LIBCRED_RESULT rename_service(const std::string& from,
+                                      const std::string& to,
+                                      std::vector<std::string>* accounts,
+                                      std::string* error);
+
+        LIBCRED_RESULT get_modified(const std::string& service,
+                                    const std::string& account,
+                                    time_t* modified,
+                                    std::string* error);
+
+        size_t memory_usage() const;
+
+    private:
+        MemoryBackend(const MemoryBackend&);
+        MemoryBackend& operator=(const MemoryBackend&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_MEMORY_H_
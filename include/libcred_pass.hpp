@@ -0,0 +1,127 @@
+#ifndef SRC_LIBCRED_PASS_H_
+#define SRC_LIBCRED_PASS_H_
+
+#include <memory>
+
+#include "libcred_backend.hpp"
+
+namespace libcred
+{
+
+    struct LIBCRED_PUBLIC_API PassOptions
+    {
+        PassOptions();
+
+        /**
+         * Root from $PASSWORD_STORE_DIR, else ~/.password-store, as pass(1) does.
+         */
+        static PassOptions from_environment();
+
+        std::string root;  // Top of the password store.
+
+        // Filters run with the file on stdin and the result read from stdout.
+        // The encrypt command gets "--recipient <id>" appended for every id in
+        // the nearest .gpg-id file.
+        std::vector<std::string> decrypt_command;  // gpg -d ... --batch --use-agent
+        std::vector<std::string> encrypt_command;  // gpg -e ... --batch --use-agent
+
+        size_t max_processes;  // Decryptions run in parallel by batch reads, 4.
+        bool cache_plaintext;  // Keep decrypted passwords until their file changes, true.
+    };
+
+    /**
+     * Backend over a pass(1) password store.
+     *
+     * The entry <root>/<service>/<account>.gpg holds the password of (service,
+     * account) on its first line; services may be nested directories, and an
+     * entry directly under <root>, <service>.gpg, has an empty account. Names
+     * starting with '.' are ignored. New entries are encrypted to the ids in
+     * the nearest .gpg-id, so the store stays usable by pass itself.
+     *
+     * The tree is indexed once and kept current through inotify, and
+     * decrypted passwords are cached until their file changes, so gpg (and
+     * through it gpg-agent) only runs on the first lookup of each entry.
+     */
+    class LIBCRED_PUBLIC_API PassBackend : public Backend
+    {
+    public:
+        explicit PassBackend(const PassOptions& options);
+        ~PassBackend();
+
+        using Backend::count_credentials;
+        using Backend::delete_password;
+        using Backend::find_credentials;
+        using Backend::find_password;
+        using Backend::get_password;
+        using Backend::set_password;
+
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     LIBCRED_FIND_POLICY policy,
+                                     std::string* account,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        size_t limit,
+                                        const std::string& cursor,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* next_cursor,
+                                        std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::string& service,
+                                         size_t* count,
+                                         std::string* error);
+
+        LIBCRED_RESULT delete_credentials(const std::string& service,
+                                          size_t* deleted,
+                                          std::string* error);
+
+        /**
+         * Renames the entry files, without running gpg, unless the new
+         * location's .gpg-id names other recipients.
+         */
+        LIBCRED_RESULT rename_service(const std::string& from,
+                                      const std::string& to,
+                                      std::vector<std::string>* accounts,
+                                      std::string* error);
+
+        LIBCRED_RESULT get_modified(const std::string& service,
+                                    const std::string& account,
+                                    time_t* modified,
+                                    std::string* error);
+
+        size_t memory_usage() const;
+
+    private:
+        PassBackend(const PassBackend&);
+        PassBackend& operator=(const PassBackend&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_PASS_H_
@@ -0,0 +1,236 @@
+#ifndef SRC_LIBCRED_STORE_H_
+#define SRC_LIBCRED_STORE_H_
+
+#include <memory>
+
+#include "libcred_backend.hpp"
+
+namespace libcred
+{
+
+    class AuditLog;
+    class TraceRecorder;
+
+    struct LIBCRED_PUBLIC_API StoreOptions
+    {
+        StoreOptions();
+
+        // Used by the Secret Service keyring (Linux) only.
+        std::string collection;   // Alias or object path new items go to, "default".
+        std::string schema_name;  // Schema of the items, "org.freedesktop.Secret.Generic".
+        int timeout_ms;           // D-Bus call timeout, -1 for the bus default.
+
+        long cache_ttl_ms;  // How long get_password results are kept, 0 (no cache).
+        long stale_ttl_ms;  // How long after that they are served while refreshed, 0.
+        int refresh_ahead_percent;  // Share of the TTL after which read entries reload, 0.
+        std::string snapshot_path;  // Where the cache is kept across restarts, none (Linux).
+        bool thread_cache;          // Also keep hot entries per thread, false.
+        long reap_interval_ms;      // How often expired credentials are deleted, 1000.
+        long count_ttl_ms;          // How long count_credentials results are kept, 0.
+
+        std::shared_ptr<AuditLog> audit;       // Where every operation is recorded, none.
+        std::shared_ptr<TraceRecorder> trace;  // Where operations are traced for replay, none.
+    };
+
+    /**
+     * A credential store with its own backend connection, cache and options.
+     *
+     * The free functions in libcred.hpp operate on default_store(); separate
+     * Store instances share no state with it or with each other, so several
+     * configurations can be used side by side and calls on one never wait for
+     * locks of another. A Store is safe to use from several threads.
+     *
+     * With a cache, get_password results and passwords written through the
+     * store are kept for cache_ttl_ms. Writes and deletes through the same
+     * store update the cache immediately; changes made elsewhere are seen once
+     * the entry expires.
+     *
+     * With stale_ttl_ms, an entry past its TTL is still returned at once for
+     * up to stale_ttl_ms longer, while a single background lookup refreshes
+     * it; only after that limit do callers wait for the backend again. A
+     * refresh that finds the credential gone removes the entry.
+     *
+     * With refresh_ahead_percent, entries read since they were loaded are
+     * reloaded in the background once that share of their TTL has passed,
+     * less up to a fifth of it at random, so hot entries never expire and
+     * entries loaded together are not refreshed in one burst.
+     *
+     * With snapshot_path, the cache is saved there, encrypted, when the store
+     * is destroyed, and loaded back when the next store with that path is
+     * created. Loaded entries are served at once and revalidated in the
+     * background: by modification time where the backend reports one,
+     * otherwise by reading them again. The key lives in the kernel session
+     * keyring, so a snapshot outlives neither the login session nor a reboot.
+     * Credentials stored with an expiry are not saved.
+     *
+     * With thread_cache, each thread also keeps copies of the entries it read
+     * last, so repeated lookups of a hot key take no lock and write no shared
+     * memory. Any change to the shared cache invalidates every copy.
+     *
+     * Credentials stored with an expiry are deleted from the backend by a
+     * background reaper once it passes, in batches, at most reap_interval_ms
+     * late; until then get_password treats them as not found without asking
+     * the backend. The expiry is known to this store only: credentials left
+     * behind when the process exits are not reaped later.
+     *
+     * With count_ttl_ms, count_credentials results are kept that long, so
+     * repeated counts of a service cost a map lookup. Any write or delete
+     * through the store drops the count of its service; changes made
+     * elsewhere are seen once the count expires.
+     *
+     * With an audit log every call is recorded, including those answered
+     * from the cache and the reaper's deletions.
+     */
+    class LIBCRED_PUBLIC_API Store
+    {
+    public:
+        /**
+         * A store over the system keyring.
+         */
+        explicit Store(const StoreOptions& options = StoreOptions());
+
+        /**
+         * A store over another backend, such as a DirectoryBackend.
+         */
+        explicit Store(std::unique_ptr<Backend> backend,
+                       const StoreOptions& options = StoreOptions());
+
+        ~Store();
+
+        /**
+         * The store behind the free functions, created with default options on
+         * first use. It is never destroyed, so it stays usable from static
+         * destructors.
+         */
+        static Store& default_store();
+
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        /**
+         * Stores a password that expires at the given time, in seconds since
+         * the epoch, or in 100 years if that is sooner. Storing the
+         * credential again without one cancels it.
+         */
+        LIBCRED_RESULT set_password(const std::string& service,
+                                    const std::string& account,
+                                    const std::string& password,
+                                    time_t expires,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_password(const std::string& service,
+                                     LIBCRED_FIND_POLICY policy,
+                                     std::string* account,
+                                     std::string* password,
+                                     std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        size_t limit,
+                                        const std::string& cursor,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* next_cursor,
+                                        std::string* error);
+
+        LIBCRED_RESULT find_credentials(
+            const std::vector<std::string>& services,
+            std::map<std::string, std::vector<Credentials>>* credentials,
+            std::string* error);
+
+        LIBCRED_RESULT find_credentials(const std::string& service,
+                                        const std::vector<std::string>& collections,
+                                        LIBCRED_MERGE_POLICY policy,
+                                        std::vector<CollectionCredentials>* found,
+                                        std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::string& service,
+                                         size_t* count,
+                                         std::string* error);
+
+        LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                         std::map<std::string, size_t>* counts,
+                                         std::string* error);
+
+        LIBCRED_RESULT delete_credentials(const std::string& service,
+                                          size_t* deleted,
+                                          std::string* error);
+
+        /**
+         * Expiries move with the credentials they belong to.
+         */
+        LIBCRED_RESULT rename_service(const std::string& from,
+                                      const std::string& to,
+                                      std::vector<std::string>* accounts,
+                                      std::string* error);
+
+        LIBCRED_RESULT set_password(ServiceId service,
+                                    AccountId account,
+                                    const std::string& password,
+                                    std::string* error);
+
+        LIBCRED_RESULT get_password(ServiceId service,
+                                    AccountId account,
+                                    std::string* password,
+                                    std::string* error);
+
+        LIBCRED_RESULT delete_password(ServiceId service, AccountId account, std::string* error);
+
+        LIBCRED_RESULT find_password(ServiceId service, std::string* password, std::string* error);
+
+        LIBCRED_RESULT find_credentials(ServiceId service,
+                                        std::vector<Credentials>* credentials,
+                                        std::string* error);
+
+        /**
+         * get_password answered from the cache alone: false, without calling
+         * the backend, if the password is not cached.
+         */
+        bool get_cached_password(const std::string& service,
+                                 const std::string& account,
+                                 std::string* password);
+
+        /**
+         * Drops every cached password.
+         */
+        void clear_cache();
+
+        /**
+         * Saves the cache to snapshot_path now, as the destructor does.
+         */
+        LIBCRED_RESULT save_snapshot(std::string* error);
+
+        /**
+         * Estimated memory held by this store's cache and backend, and by the
+         * interned names.
+         */
+        MemoryUsage memory_usage() const;
+
+    private:
+        Store(const Store&);
+        Store& operator=(const Store&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_STORE_H_
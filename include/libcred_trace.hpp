@@ -0,0 +1,69 @@
+#ifndef SRC_LIBCRED_TRACE_H_
+#define SRC_LIBCRED_TRACE_H_
+
+#include <chrono>
+#include <memory>
+
+#include "libcred.hpp"
+
+namespace libcred
+{
+
+    struct LIBCRED_PUBLIC_API TraceOptions
+    {
+        TraceOptions();
+
+        std::string path;  // File the trace is written to, replacing it.
+        std::string salt;  // Mixed into the name hashes, empty.
+    };
+
+    /**
+     * Captures the operations of a store as a trace for libcred_replay:
+     * their timing, concurrency and outcome, without names or secrets.
+     *
+     * Stores write to a TraceRecorder set in StoreOptions::trace. The file is
+     * text, a header line followed by one line per operation, in the order
+     * they completed:
+     *
+     *   <start us> <thread> <operation> <service hash> <account hash> <size> <result> <latency us>
+     *
+     * Start times count from the first record; threads are numbered in order
+     * of their first record. Hashes are 64-bit FNV-1a of the salted name, in
+     * hex; size is the password length or the number of credentials found;
+     * result is the LIBCRED_RESULT value. rename_service records the new
+     * service name as its account.
+     */
+    class LIBCRED_PUBLIC_API TraceRecorder
+    {
+    public:
+        explicit TraceRecorder(const TraceOptions& options);
+        ~TraceRecorder();
+
+        /**
+         * False if the file could not be created.
+         */
+        bool ok() const;
+
+        void record(const char* operation,
+                    const std::string& service,
+                    const std::string& account,
+                    size_t size,
+                    std::chrono::steady_clock::time_point started,
+                    LIBCRED_RESULT result);
+
+        /**
+         * Writes buffered records to the file.
+         */
+        void flush();
+
+    private:
+        TraceRecorder(const TraceRecorder&);
+        TraceRecorder& operator=(const TraceRecorder&);
+
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_TRACE_H_
@@ -0,0 +1,40 @@
+#ifndef SRC_LIBCRED_UV_H_
+#define SRC_LIBCRED_UV_H_
+
+#include <uv.h>
+
+#include "libcred_async.hpp"
+
+namespace libcred
+{
+
+    /**
+     * Drives an AsyncStore from a libuv loop. Header only. handle must stay
+     * valid until it is stopped with uv_poll_stop() and closed with
+     * uv_close(); the store must outlive it. Returns a libuv error code.
+     */
+    inline int uv_watch(AsyncStore& store, uv_loop_t* loop, uv_poll_t* handle)
+    {
+        struct Readable
+        {
+            static void callback(uv_poll_t* handle, int status, int events)
+            {
+                if (status == 0)
+                {
+                    static_cast<AsyncStore*>(handle->data)->process_events();
+                }
+            }
+        };
+
+        int result = uv_poll_init(loop, handle, store.fd());
+        if (result != 0)
+        {
+            return result;
+        }
+        handle->data = &store;
+        return uv_poll_start(handle, UV_READABLE, &Readable::callback);
+    }
+
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_UV_H_
@@ -0,0 +1,158 @@
+#include "libcred.hpp"
+#include "libcred_store.hpp"
+
+namespace libcred
+{
+
+    // The free functions operate on the process-wide default store.
+
+    LIBCRED_RESULT set_password(const std::string& service,
+                                const std::string& account,
+                                const std::string& password,
+                                std::string* error)
+    {
+        return Store::default_store().set_password(service, account, password, error);
+    }
+
+    LIBCRED_RESULT set_password(const std::string& service,
+                                const std::string& account,
+                                const std::string& password,
+                                time_t expires,
+                                std::string* error)
+    {
+        return Store::default_store().set_password(service, account, password, expires, error);
+    }
+
+    LIBCRED_RESULT get_password(const std::string& service,
+                                const std::string& account,
+                                std::string* password,
+                                std::string* error)
+    {
+        return Store::default_store().get_password(service, account, password, error);
+    }
+
+    LIBCRED_RESULT delete_password(const std::string& service,
+                                   const std::string& account,
+                                   std::string* error)
+    {
+        return Store::default_store().delete_password(service, account, error);
+    }
+
+    LIBCRED_RESULT find_password(const std::string& service,
+                                 std::string* password,
+                                 std::string* error)
+    {
+        return Store::default_store().find_password(service, password, error);
+    }
+
+    LIBCRED_RESULT find_credentials(const std::string& service,
+                                    std::vector<Credentials>* credentials,
+                                    std::string* error)
+    {
+        return Store::default_store().find_credentials(service, credentials, error);
+    }
+
+    LIBCRED_RESULT find_password(const std::string& service,
+                                 LIBCRED_FIND_POLICY policy,
+                                 std::string* account,
+                                 std::string* password,
+                                 std::string* error)
+    {
+        return Store::default_store().find_password(service, policy, account, password, error);
+    }
+
+    LIBCRED_RESULT find_credentials(const std::string& service,
+                                    size_t limit,
+                                    const std::string& cursor,
+                                    std::vector<Credentials>* credentials,
+                                    std::string* next_cursor,
+                                    std::string* error)
+    {
+        return Store::default_store().find_credentials(
+            service, limit, cursor, credentials, next_cursor, error);
+    }
+
+    LIBCRED_RESULT find_credentials(const std::vector<std::string>& services,
+                                    std::map<std::string, std::vector<Credentials>>* credentials,
+                                    std::string* error)
+    {
+        return Store::default_store().find_credentials(services, credentials, error);
+    }
+
+    LIBCRED_RESULT find_credentials(const std::string& service,
+                                    const std::vector<std::string>& collections,
+                                    LIBCRED_MERGE_POLICY policy,
+                                    std::vector<CollectionCredentials>* found,
+                                    std::string* error)
+    {
+        return Store::default_store().find_credentials(service, collections, policy, found, error);
+    }
+
+    LIBCRED_RESULT count_credentials(const std::string& service,
+                                     size_t* count,
+                                     std::string* error)
+    {
+        return Store::default_store().count_credentials(service, count, error);
+    }
+
+    LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                     std::map<std::string, size_t>* counts,
+                                     std::string* error)
+    {
+        return Store::default_store().count_credentials(services, counts, error);
+    }
+
+    LIBCRED_RESULT delete_credentials(const std::string& service,
+                                      size_t* deleted,
+                                      std::string* error)
+    {
+        return Store::default_store().delete_credentials(service, deleted, error);
+    }
+
+    LIBCRED_RESULT rename_service(const std::string& from,
+                                  const std::string& to,
+                                  std::vector<std::string>* accounts,
+                                  std::string* error)
+    {
+        return Store::default_store().rename_service(from, to, accounts, error);
+    }
+
+    LIBCRED_RESULT set_password(ServiceId service,
+                                AccountId account,
+                                const std::string& password,
+                                std::string* error)
+    {
+        return Store::default_store().set_password(service, account, password, error);
+    }
+
+    LIBCRED_RESULT get_password(ServiceId service,
+                                AccountId account,
+                                std::string* password,
+                                std::string* error)
+    {
+        return Store::default_store().get_password(service, account, password, error);
+    }
+
+    LIBCRED_RESULT delete_password(ServiceId service, AccountId account, std::string* error)
+    {
+        return Store::default_store().delete_password(service, account, error);
+    }
+
+    LIBCRED_RESULT find_password(ServiceId service, std::string* password, std::string* error)
+    {
+        return Store::default_store().find_password(service, password, error);
+    }
+
+    LIBCRED_RESULT find_credentials(ServiceId service,
+                                    std::vector<Credentials>* credentials,
+                                    std::string* error)
+    {
+        return Store::default_store().find_credentials(service, credentials, error);
+    }
+
+    MemoryUsage memory_usage()
+    {
+        return Store::default_store().memory_usage();
+    }
+
+}  // namespace libcred
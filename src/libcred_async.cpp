@@ -0,0 +1,433 @@
+#include "libcred_async.hpp"
+#include "libcred_fork.hpp"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace libcred
+{
+
+    AsyncOptions::AsyncOptions()
+        : queue_capacity(256)
+    {
+    }
+
+    AsyncStats::AsyncStats()
+        : running(0)
+        , completed(0)
+    {
+        for (int i = 0; i < PRIORITY_COUNT; ++i)
+        {
+            queued[i] = 0;
+            max_queued[i] = 0;
+            rejected[i] = 0;
+        }
+    }
+
+    /**
+     * Queues under one lock: requests for the worker, one bounded queue per
+     * priority, and completions, which are callbacks bound to their results.
+     * fd() is readable exactly while completions is not empty: the first
+     * completion queued signals it and process_events() clears it as it
+     * takes the queue.
+     *
+     * A forked child gets its own descriptor, at the same number, and none
+     * of the parent's calls: those queued or running are the parent's to
+     * complete. Its worker starts on its first call.
+     */
+    class AsyncStore::Impl : public detail::ForkHandler
+    {
+    public:
+        typedef std::function<void()> Task;
+
+        Impl(Store& store, const AsyncOptions& options)
+            : store_(store)
+            , capacity_(options.queue_capacity)
+            , read_fd_(-1)
+            , write_fd_(-1)
+            , stopping_(false)
+        {
+            open_signal(&read_fd_, &write_fd_);
+            detail::register_fork_handler(this);
+        }
+
+        ~Impl()
+        {
+            detail::unregister_fork_handler(this);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            if (worker_)
+            {
+                worker_->join();
+            }
+
+            if (write_fd_ != read_fd_ && write_fd_ >= 0)
+            {
+                close(write_fd_);
+            }
+            if (read_fd_ >= 0)
+            {
+                close(read_fd_);
+            }
+        }
+
+        Store& store()
+        {
+            return store_;
+        }
+
+        int fd() const
+        {
+            return read_fd_;
+        }
+
+        /**
+         * Queues a blocking call for the worker, which queues its completion;
+         * false if the queue for its priority is full.
+         */
+        bool submit(LIBCRED_PRIORITY priority, const Task& request)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::deque<Task>& queue = requests_[priority];
+            if (queue.size() >= capacity_)
+            {
+                ++stats_.rejected[priority];
+                return false;
+            }
+
+            queue.push_back(request);
+            if (queue.size() > stats_.max_queued[priority])
+            {
+                stats_.max_queued[priority] = queue.size();
+            }
+            if (!worker_)
+            {
+                worker_.reset(new std::thread(&Impl::run, this));
+            }
+            wake_.notify_one();
+            return true;
+        }
+
+        void complete(const Task& completion)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_completion(completion);
+        }
+
+        void on_capacity(LIBCRED_PRIORITY priority, const Task& callback)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (requests_[priority].size() < capacity_)
+            {
+                queue_completion(callback);
+            }
+            else
+            {
+                waiters_[priority].push_back(callback);
+            }
+        }
+
+        AsyncStats stats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            AsyncStats stats = stats_;
+            for (int i = 0; i < PRIORITY_COUNT; ++i)
+            {
+                stats.queued[i] = requests_[i].size();
+            }
+            stats.completed = completions_.size();
+            return stats;
+        }
+
+        size_t process_events()
+        {
+            std::deque<Task> completions;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (completions_.empty())
+                {
+                    return 0;
+                }
+                completions.swap(completions_);
+                clear();
+            }
+
+            // Outside the lock: callbacks may submit further calls.
+            for (std::deque<Task>::iterator it = completions.begin(); it != completions.end();
+                 ++it)
+            {
+                (*it)();
+            }
+            return completions.size();
+        }
+
+        void prepare_fork()
+        {
+            mutex_.lock();
+        }
+
+        void parent_after_fork()
+        {
+            mutex_.unlock();
+        }
+
+        void child_after_fork()
+        {
+            // Neither joinable nor detachable in the child, so leaked; submit()
+            // starts another.
+            worker_.release();
+            // It may still count the lost thread as a waiter.
+            new (&wake_) std::condition_variable();
+
+            for (int i = 0; i < PRIORITY_COUNT; ++i)
+            {
+                requests_[i].clear();
+            }
+            completions_.clear();
+            stats_ = AsyncStats();
+
+            // The descriptor is shared with the parent, which would see the
+            // child's signals and lose its own to the child's reads. Replace
+            // it where the caller already polls it.
+            int read_fd;
+            int write_fd;
+            if (read_fd_ >= 0 && open_signal(&read_fd, &write_fd))
+            {
+                dup2(read_fd, read_fd_);
+                fcntl(read_fd_, F_SETFD, FD_CLOEXEC);
+                close(read_fd);
+                if (write_fd != read_fd)
+                {
+                    dup2(write_fd, write_fd_);
+                    fcntl(write_fd_, F_SETFD, FD_CLOEXEC);
+                    close(write_fd);
+                }
+            }
+
+            // The queues are empty now, so every on_capacity() caller may go.
+            for (int i = 0; i < PRIORITY_COUNT; ++i)
+            {
+                for (std::deque<Task>::iterator it = waiters_[i].begin(); it != waiters_[i].end();
+                     ++it)
+                {
+                    queue_completion(*it);
+                }
+                waiters_[i].clear();
+            }
+            mutex_.unlock();
+        }
+
+    private:
+        /**
+         * Opens a nonblocking, close-on-exec eventfd, or a pipe where there
+         * is none; false if that fails.
+         */
+        static bool open_signal(int* read_fd, int* write_fd)
+        {
+#ifdef __linux__
+            *read_fd = *write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            return *read_fd >= 0;
+#else
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                return false;
+            }
+            for (int i = 0; i < 2; ++i)
+            {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            }
+            *read_fd = fds[0];
+            *write_fd = fds[1];
+            return true;
+#endif
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;)
+            {
+                int priority;
+                while (!stopping_ && (priority = next_priority()) == PRIORITY_COUNT)
+                {
+                    wake_.wait(lock);
+                }
+                if (stopping_)
+                {
+                    return;
+                }
+
+                Task request = requests_[priority].front();
+                requests_[priority].pop_front();
+                if (!waiters_[priority].empty())
+                {
+                    queue_completion(waiters_[priority].front());
+                    waiters_[priority].pop_front();
+                }
+
+                stats_.running = 1;
+                lock.unlock();
+                request();
+                lock.lock();
+                stats_.running = 0;
+            }
+        }
+
+        /**
+         * The highest priority with a queued request, PRIORITY_COUNT if none.
+         */
+        int next_priority() const
+        {
+            int priority = 0;
+            while (priority < PRIORITY_COUNT && requests_[priority].empty())
+            {
+                ++priority;
+            }
+            return priority;
+        }
+
+        void queue_completion(const Task& completion)
+        {
+            if (completions_.empty())
+            {
+                signal();
+            }
+            completions_.push_back(completion);
+        }
+
+        void signal()
+        {
+            uint64_t one = 1;
+            ssize_t written = write(write_fd_, &one, write_fd_ == read_fd_ ? sizeof(one) : 1);
+            (void) written;
+        }
+
+        void clear()
+        {
+            char buffer[64];
+            while (read(read_fd_, buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+
+        Store& store_;
+        size_t capacity_;
+        int read_fd_;   // The eventfd on Linux, else a pipe's read end.
+        int write_fd_;  // The same eventfd, or the pipe's write end.
+
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<Task> requests_[PRIORITY_COUNT];
+        std::deque<Task> waiters_[PRIORITY_COUNT];  // on_capacity() callbacks.
+        std::deque<Task> completions_;
+        AsyncStats stats_;  // All but queued and completed, which are read off the queues.
+        bool stopping_;
+        std::unique_ptr<std::thread> worker_;
+    };
+
+    AsyncStore::AsyncStore(Store& store, const AsyncOptions& options)
+        : impl_(new Impl(store, options))
+    {
+    }
+
+    AsyncStore::~AsyncStore()
+    {
+    }
+
+    int AsyncStore::fd() const
+    {
+        return impl_->fd();
+    }
+
+    size_t AsyncStore::process_events()
+    {
+        return impl_->process_events();
+    }
+
+    void AsyncStore::on_capacity(LIBCRED_PRIORITY priority, const std::function<void()>& callback)
+    {
+        impl_->on_capacity(priority, callback);
+    }
+
+    AsyncStats AsyncStore::stats() const
+    {
+        return impl_->stats();
+    }
+
+    bool AsyncStore::set_password(const std::string& service,
+                                  const std::string& account,
+                                  const std::string& password,
+                                  const Callback& callback,
+                                  LIBCRED_PRIORITY priority)
+    {
+        Impl* impl = impl_.get();
+        return impl->submit(priority, [impl, service, account, password, callback] {
+            std::string error;
+            LIBCRED_RESULT result = impl->store().set_password(service, account, password, &error);
+            impl->complete(std::bind(callback, result, error));
+        });
+    }
+
+    bool AsyncStore::get_password(const std::string& service,
+                                  const std::string& account,
+                                  const PasswordCallback& callback,
+                                  LIBCRED_PRIORITY priority)
+    {
+        Impl* impl = impl_.get();
+        std::string password;
+        if (impl->store().get_cached_password(service, account, &password))
+        {
+            impl->complete(std::bind(callback, SUCCESS, password, std::string()));
+            return true;
+        }
+
+        return impl->submit(priority, [impl, service, account, callback] {
+            std::string password;
+            std::string error;
+            LIBCRED_RESULT result = impl->store().get_password(service, account, &password, &error);
+            impl->complete(std::bind(callback, result, password, error));
+        });
+    }
+
+    bool AsyncStore::delete_password(const std::string& service,
+                                     const std::string& account,
+                                     const Callback& callback,
+                                     LIBCRED_PRIORITY priority)
+    {
+        Impl* impl = impl_.get();
+        return impl->submit(priority, [impl, service, account, callback] {
+            std::string error;
+            LIBCRED_RESULT result = impl->store().delete_password(service, account, &error);
+            impl->complete(std::bind(callback, result, error));
+        });
+    }
+
+    bool AsyncStore::find_credentials(const std::string& service,
+                                      const CredentialsCallback& callback,
+                                      LIBCRED_PRIORITY priority)
+    {
+        Impl* impl = impl_.get();
+        return impl->submit(priority, [impl, service, callback] {
+            std::vector<Credentials> credentials;
+            std::string error;
+            LIBCRED_RESULT result = impl->store().find_credentials(service, &credentials, &error);
+            impl->complete(std::bind(callback, result, credentials, error));
+        });
+    }
+
+}  // namespace libcred
@@ -0,0 +1,536 @@
+#include "libcred_audit.hpp"
+#include "libcred_fork.hpp"
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <syslog.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        typedef std::chrono::system_clock Clock;
+
+        /**
+         * A ring buffer cell. sequence tells whose turn it is: equal to the
+         * position a producer may claim, position + 1 once filled, and
+         * position + capacity once the consumer is done with it. The strings
+         * keep their capacity between uses, so steady-state records don't
+         * allocate.
+         */
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            Clock::time_point time;
+            const char* operation;
+            std::string service;
+            std::string account;
+            LIBCRED_RESULT result;
+            long pid;
+        };
+
+        long current_pid()
+        {
+#ifdef _WIN32
+            return _getpid();
+#else
+            return getpid();
+#endif
+        }
+
+        const char* result_name(LIBCRED_RESULT result)
+        {
+            switch (result)
+            {
+                case SUCCESS:
+                    return "success";
+                case FAIL_NONFATAL:
+                    return "not_found";
+                default:
+                    return "error";
+            }
+        }
+
+        void append_timestamp(Clock::time_point time, std::string* line)
+        {
+            time_t seconds = Clock::to_time_t(time);
+            long millis = static_cast<long>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch())
+                    .count()
+                % 1000);
+
+            struct tm utc;
+#ifdef _WIN32
+            gmtime_s(&utc, &seconds);
+#else
+            gmtime_r(&seconds, &utc);
+#endif
+            char buffer[32];
+            size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+            snprintf(buffer + length, sizeof(buffer) - length, ".%03ldZ", millis);
+            line->append(buffer);
+        }
+
+        /**
+         * Appends value in double quotes, escaping quotes, backslashes and
+         * control characters so that every record stays on one line.
+         */
+        void append_quoted(const std::string& value, std::string* line)
+        {
+            line->push_back('"');
+            for (std::string::const_iterator it = value.begin(); it != value.end(); ++it)
+            {
+                unsigned char c = static_cast<unsigned char>(*it);
+                if (c == '"' || c == '\\')
+                {
+                    line->push_back('\\');
+                    line->push_back(*it);
+                }
+                else if (c < 0x20 || c == 0x7f)
+                {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\x%02x", c);
+                    line->append(escape);
+                }
+                else
+                {
+                    line->push_back(*it);
+                }
+            }
+            line->push_back('"');
+        }
+
+        size_t round_up_to_power_of_two(size_t value)
+        {
+            size_t result = 2;
+            while (result < value)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+
+    }  // namespace
+
+    AuditOptions::AuditOptions()
+        : max_file_bytes(10 * 1024 * 1024)
+        , max_files(5)
+        , capacity(4096)
+        , flush_interval_ms(250)
+    {
+    }
+
+    /**
+     * Producers claim slots with a CAS on tail_ (a bounded MPMC queue in the
+     * style of Vyukov's); the flush thread is the only consumer and owns
+     * head_, the file and the rotation state.
+     *
+     * A forked child inherits the buffered records but not the flush thread;
+     * it starts a new one on first use.
+     */
+    class AuditLog::Impl : public detail::ForkHandler
+    {
+    public:
+        explicit Impl(const AuditOptions& options)
+            : options_(options)
+            , mask_(round_up_to_power_of_two(options.capacity) - 1)
+            , slots_(new Slot[mask_ + 1])
+            , tail_(0)
+            , head_(0)
+            , dropped_(0)
+            , reported_dropped_(0)
+            , flush_target_(0)
+            , written_(0)
+            , stopping_(false)
+            , draining_(false)
+            , forked_(false)
+            , file_(NULL)
+            , file_bytes_(0)
+        {
+            for (size_t i = 0; i <= mask_; ++i)
+            {
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            thread_.reset(new std::thread(&Impl::run, this));
+            detail::register_fork_handler(this);
+        }
+
+        ~Impl()
+        {
+            detail::unregister_fork_handler(this);
+            restart_after_fork();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            thread_->join();
+
+            if (file_ != NULL)
+            {
+                fclose(file_);
+            }
+        }
+
+        void record(const char* operation,
+                    const std::string& service,
+                    const std::string& account,
+                    LIBCRED_RESULT result)
+        {
+            if (forked_.load(std::memory_order_relaxed))
+            {
+                restart_after_fork();
+            }
+
+            size_t position = tail_.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;)
+            {
+                slot = &slots_[position & mask_];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                if (sequence == position)
+                {
+                    if (tail_.compare_exchange_weak(position,
+                                                    position + 1,
+                                                    std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (sequence < position)
+                {
+                    // The slot a full lap back is still unread: the buffer is full.
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                else
+                {
+                    position = tail_.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->time = Clock::now();
+            slot->operation = operation;
+            slot->service.assign(service);
+            slot->account.assign(account);
+            slot->result = result;
+            slot->pid = current_pid();
+            slot->sequence.store(position + 1, std::memory_order_release);
+        }
+
+        void flush()
+        {
+            restart_after_fork();
+            std::unique_lock<std::mutex> lock(mutex_);
+            size_t target = tail_.load(std::memory_order_acquire);
+            if (flush_target_ < target)
+            {
+                flush_target_ = target;
+            }
+            wake_.notify_one();
+            flushed_.wait(lock, [this, target] { return written_ >= target; });
+        }
+
+        unsigned long long dropped() const
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Waits for the flush thread to finish writing, so the child gets
+         * the file and head_ in a consistent state, and keeps it waiting.
+         */
+        void prepare_fork()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            flushed_.wait(lock, [this] { return !draining_; });
+            lock.release();
+        }
+
+        void parent_after_fork()
+        {
+            mutex_.unlock();
+        }
+
+        void child_after_fork()
+        {
+            // Neither joinable nor detachable in the child, so leaked.
+            thread_.release();
+            // They may still count the lost thread as a waiter.
+            new (&wake_) std::condition_variable();
+            new (&flushed_) std::condition_variable();
+
+            // Records still buffered are the parent's to write. Those whose
+            // producer was halfway through may hold half assigned strings,
+            // which are replaced rather than freed.
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            for (size_t position = head_; position != tail; ++position)
+            {
+                Slot& slot = slots_[position & mask_];
+                if (slot.sequence.load(std::memory_order_relaxed) != position + 1)
+                {
+                    new (&slot.service) std::string();
+                    new (&slot.account) std::string();
+                }
+                slot.sequence.store(position + mask_ + 1, std::memory_order_relaxed);
+            }
+            head_ = tail;
+            written_ = tail;
+
+            forked_.store(true, std::memory_order_relaxed);
+            mutex_.unlock();
+        }
+
+    private:
+        void restart_after_fork()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (forked_.load(std::memory_order_relaxed))
+            {
+                thread_.reset(new std::thread(&Impl::run, this));
+                forked_.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;)
+            {
+                bool stopping = stopping_;
+                size_t target = stopping ? tail_.load(std::memory_order_acquire) : flush_target_;
+
+                draining_ = true;
+                lock.unlock();
+                drain(target);
+                lock.lock();
+                draining_ = false;
+
+                written_ = head_;
+                flushed_.notify_all();
+
+                if (stopping)
+                {
+                    return;
+                }
+                if (flush_target_ <= head_ && !stopping_)
+                {
+                    wake_.wait_for(lock, std::chrono::milliseconds(options_.flush_interval_ms));
+                }
+            }
+        }
+
+        /**
+         * Writes out published records, and keeps going until head_ reaches
+         * target: producers that claimed a slot before it finish filling it
+         * shortly.
+         */
+        void drain(size_t target)
+        {
+            std::string batch;
+            for (;;)
+            {
+                Slot& slot = slots_[head_ & mask_];
+                if (slot.sequence.load(std::memory_order_acquire) != head_ + 1)
+                {
+                    if (head_ >= target)
+                    {
+                        break;
+                    }
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                std::string line;
+                append_timestamp(slot.time, &line);
+                line.append(" pid=").append(std::to_string(slot.pid));
+                line.append(" op=").append(slot.operation);
+                line.append(" result=").append(result_name(slot.result));
+                line.append(" service=");
+                append_quoted(slot.service, &line);
+                line.append(" account=");
+                append_quoted(slot.account, &line);
+                line.push_back('\n');
+
+                slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+                ++head_;
+
+                write_line(line, &batch);
+            }
+
+            unsigned long long dropped = dropped_.load(std::memory_order_relaxed);
+            if (dropped != reported_dropped_)
+            {
+                std::string line;
+                append_timestamp(Clock::now(), &line);
+                line.append(" pid=").append(std::to_string(current_pid()));
+                line.append(" op=audit dropped=")
+                    .append(std::to_string(dropped - reported_dropped_))
+                    .push_back('\n');
+                reported_dropped_ = dropped;
+                write_line(line, &batch);
+            }
+
+            write_batch(batch);
+        }
+
+        void write_line(const std::string& line, std::string* batch)
+        {
+#ifndef _WIN32
+            if (options_.path.empty())
+            {
+                syslog(LOG_AUTHPRIV | LOG_INFO, "libcred: %.*s",
+                       static_cast<int>(line.size() - 1), line.data());
+                return;
+            }
+#endif
+            batch->append(line);
+        }
+
+        void write_batch(const std::string& batch)
+        {
+            if (batch.empty() || options_.path.empty())
+            {
+                return;
+            }
+
+            if (file_ == NULL && !open())
+            {
+                lose(batch);
+                return;
+            }
+
+            if (options_.max_file_bytes > 0 && file_bytes_ > 0
+                && file_bytes_ + batch.size() > options_.max_file_bytes)
+            {
+                fclose(file_);
+                rotate();
+                if (!open())
+                {
+                    lose(batch);
+                    return;
+                }
+            }
+
+            if (fwrite(batch.data(), 1, batch.size(), file_) != batch.size() || fflush(file_) != 0)
+            {
+                lose(batch);
+                return;
+            }
+            file_bytes_ += batch.size();
+        }
+
+        bool open()
+        {
+            file_ = fopen(options_.path.c_str(), "a");
+            if (file_ == NULL)
+            {
+                return false;
+            }
+            fseek(file_, 0, SEEK_END);
+            long size = ftell(file_);
+            file_bytes_ = size > 0 ? static_cast<size_t>(size) : 0;
+            return true;
+        }
+
+        /**
+         * Shifts <path>.N to <path>.N+1, dropping the oldest, and <path> to
+         * <path>.1.
+         */
+        void rotate()
+        {
+            const std::string& path = options_.path;
+            if (options_.max_files <= 0)
+            {
+                remove(path.c_str());
+                return;
+            }
+
+            remove((path + "." + std::to_string(options_.max_files)).c_str());
+            for (int i = options_.max_files - 1; i >= 1; --i)
+            {
+                rename((path + "." + std::to_string(i)).c_str(),
+                       (path + "." + std::to_string(i + 1)).c_str());
+            }
+            rename(path.c_str(), (path + ".1").c_str());
+        }
+
+        void lose(const std::string& batch)
+        {
+            size_t lines = 0;
+            for (std::string::const_iterator it = batch.begin(); it != batch.end(); ++it)
+            {
+                lines += *it == '\n';
+            }
+            // Counted as reported: writing the count would fail the same way.
+            dropped_.fetch_add(lines, std::memory_order_relaxed);
+            reported_dropped_ += lines;
+        }
+
+        AuditOptions options_;
+        const size_t mask_;
+        std::unique_ptr<Slot[]> slots_;
+
+        std::atomic<size_t> tail_;
+        size_t head_;  // Flush thread only.
+        std::atomic<unsigned long long> dropped_;
+        unsigned long long reported_dropped_;  // Flush thread only.
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable flushed_;
+        size_t flush_target_;  // Guarded by mutex_, as are the two below.
+        size_t written_;
+        bool stopping_;
+        bool draining_;             // The flush thread is writing, without the lock.
+        std::atomic<bool> forked_;  // This is a child that has no flush thread yet.
+
+        FILE* file_;  // Flush thread only, as is file_bytes_.
+        size_t file_bytes_;
+
+        std::unique_ptr<std::thread> thread_;
+    };
+
+    AuditLog::AuditLog(const AuditOptions& options)
+        : impl_(new Impl(options))
+    {
+    }
+
+    AuditLog::~AuditLog()
+    {
+    }
+
+    void AuditLog::record(const char* operation,
+                          const std::string& service,
+                          const std::string& account,
+                          LIBCRED_RESULT result)
+    {
+        impl_->record(operation, service, account, result);
+    }
+
+    void AuditLog::flush()
+    {
+        impl_->flush();
+    }
+
+    unsigned long long AuditLog::dropped() const
+    {
+        return impl_->dropped();
+    }
+
+}  // namespace libcred
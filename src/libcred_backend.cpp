@@ -0,0 +1,386 @@
+#include "libcred_backend.hpp"
+#include "libcred_internal.hpp"
+
+#include <algorithm>
+#include <set>
+
+namespace libcred
+{
+
+    Backend::~Backend()
+    {
+    }
+
+    void detail::merge_collections(const std::vector<std::string>& collections,
+                                   const std::vector<std::vector<Credentials>>& credentials,
+                                   const std::vector<std::vector<time_t>>& modified,
+                                   LIBCRED_MERGE_POLICY policy,
+                                   std::vector<CollectionCredentials>* found,
+                                   std::vector<std::pair<size_t, size_t>>* origins)
+    {
+        // Account to the index in *found of the credential kept for it, and
+        // when that credential changed.
+        std::map<std::string, std::pair<size_t, time_t>> kept;
+        size_t before = found->size();
+        if (origins != NULL)
+        {
+            origins->clear();
+        }
+
+        for (size_t i = 0; i < collections.size(); ++i)
+        {
+            for (size_t j = 0; j < credentials[i].size(); ++j)
+            {
+                const Credentials& candidate = credentials[i][j];
+                time_t changed = policy == MERGE_MOST_RECENT ? modified[i][j] : 0;
+
+                std::map<std::string, std::pair<size_t, time_t>>::iterator it
+                    = kept.find(candidate.first);
+                if (policy == MERGE_ALL || it == kept.end())
+                {
+                    if (policy != MERGE_ALL)
+                    {
+                        kept[candidate.first] = std::make_pair(found->size(), changed);
+                    }
+                    found->push_back(CollectionCredentials());
+                    found->back().credentials = candidate;
+                    found->back().collection = collections[i];
+                    if (origins != NULL)
+                    {
+                        origins->push_back(std::make_pair(i, j));
+                    }
+                }
+                else if (changed > it->second.second)
+                {
+                    CollectionCredentials& replaced = (*found)[it->second.first];
+                    replaced.credentials = candidate;
+                    replaced.collection = collections[i];
+                    it->second.second = changed;
+                    if (origins != NULL)
+                    {
+                        (*origins)[it->second.first - before] = std::make_pair(i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    LIBCRED_RESULT Backend::find_password(const std::string& service,
+                                          LIBCRED_FIND_POLICY policy,
+                                          std::string* account,
+                                          std::string* password,
+                                          std::string* error)
+    {
+        if (policy == FIND_ANY && account == NULL)
+        {
+            return find_password(service, password, error);
+        }
+
+        if (policy == FIND_MOST_RECENT)
+        {
+            *error = "This backend does not track modification times";
+            return FAIL_ERROR;
+        }
+
+        std::vector<Credentials> credentials;
+        LIBCRED_RESULT result = find_credentials(service, &credentials, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        if (credentials.empty())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        std::vector<Credentials>::const_iterator chosen = credentials.begin();
+        if (policy == FIND_FIRST_ACCOUNT)
+        {
+            chosen = std::min_element(credentials.begin(), credentials.end());
+        }
+
+        if (account != NULL)
+        {
+            *account = chosen->first;
+        }
+        *password = chosen->second;
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT Backend::find_credentials(const std::string& service,
+                                             size_t limit,
+                                             const std::string& cursor,
+                                             std::vector<Credentials>* credentials,
+                                             std::string* next_cursor,
+                                             std::string* error)
+    {
+        std::vector<Credentials> all;
+        LIBCRED_RESULT result = find_credentials(service, &all, error);
+        if (result == FAIL_ERROR)
+        {
+            return result;
+        }
+        std::sort(all.begin(), all.end());
+
+        std::vector<std::string> accounts;
+        accounts.reserve(all.size());
+        for (size_t i = 0; i < all.size(); ++i)
+        {
+            accounts.push_back(all[i].first);
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        credentials->insert(credentials->end(), all.begin() + begin, all.begin() + end);
+        return result;
+    }
+
+    LIBCRED_RESULT Backend::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* error)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+
+        size_t found = 0;
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            std::vector<Credentials>& group = (*credentials)[*it];
+            if (find_credentials(*it, &group, error) == FAIL_ERROR)
+            {
+                return FAIL_ERROR;
+            }
+            found += group.size();
+        }
+
+        return found != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT Backend::find_credentials(const std::string& service,
+                                             const std::vector<std::string>& collections,
+                                             LIBCRED_MERGE_POLICY policy,
+                                             std::vector<CollectionCredentials>* found,
+                                             std::string* error)
+    {
+        std::vector<std::vector<Credentials>> credentials(collections.size());
+        std::vector<std::vector<time_t>> modified(collections.size());
+
+        std::vector<Credentials> all;
+        bool searched = false;
+        for (size_t i = 0; i < collections.size(); ++i)
+        {
+            if (collections[i] != "default")
+            {
+                continue;
+            }
+            if (!searched && find_credentials(service, &all, error) == FAIL_ERROR)
+            {
+                return FAIL_ERROR;
+            }
+            searched = true;
+
+            // Copies of the same credentials: all equally recent.
+            credentials[i] = all;
+            modified[i].resize(all.size());
+        }
+
+        size_t before = found->size();
+        detail::merge_collections(collections, credentials, modified, policy, found, NULL);
+        return found->size() != before ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT Backend::delete_credentials(const std::string& service,
+                                               size_t* deleted,
+                                               std::string* error)
+    {
+        *deleted = 0;
+
+        std::vector<Credentials> credentials;
+        LIBCRED_RESULT result = find_credentials(service, &credentials, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        for (std::vector<Credentials>::const_iterator it = credentials.begin();
+             it != credentials.end();
+             ++it)
+        {
+            result = delete_password(service, it->first, error);
+            if (result == FAIL_ERROR)
+            {
+                return result;
+            }
+            if (result == SUCCESS)
+            {
+                ++*deleted;
+            }
+        }
+
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT Backend::count_credentials(const std::string& service,
+                                              size_t* count,
+                                              std::string* error)
+    {
+        std::vector<Credentials> credentials;
+        LIBCRED_RESULT result = find_credentials(service, &credentials, error);
+        if (result == FAIL_ERROR)
+        {
+            return result;
+        }
+
+        *count = credentials.size();
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT Backend::count_credentials(const std::vector<std::string>& services,
+                                              std::map<std::string, size_t>* counts,
+                                              std::string* error)
+    {
+        for (std::vector<std::string>::const_iterator it = services.begin(); it != services.end();
+             ++it)
+        {
+            if (count_credentials(*it, &(*counts)[*it], error) == FAIL_ERROR)
+            {
+                return FAIL_ERROR;
+            }
+        }
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT Backend::rename_service(const std::string& from,
+                                           const std::string& to,
+                                           std::vector<std::string>* accounts,
+                                           std::string* error)
+    {
+        if (from == to)
+        {
+            *error = "A service cannot be renamed to itself";
+            return FAIL_ERROR;
+        }
+
+        std::vector<Credentials> credentials;
+        LIBCRED_RESULT result = find_credentials(from, &credentials, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        // Every copy is written before any original is deleted, so that a
+        // failure leaves each credential under at least one of the names.
+        size_t copied;
+        for (copied = 0; copied < credentials.size(); ++copied)
+        {
+            result = set_password(to, credentials[copied].first, credentials[copied].second, error);
+            if (result != SUCCESS)
+            {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < copied; ++i)
+        {
+            std::string delete_error;
+            if (delete_password(from, credentials[i].first, &delete_error) == FAIL_ERROR)
+            {
+                *error = delete_error;
+                return FAIL_ERROR;
+            }
+            accounts->push_back(credentials[i].first);
+        }
+
+        return result;
+    }
+
+    LIBCRED_RESULT Backend::set_password(ServiceId service,
+                                         AccountId account,
+                                         const std::string& password,
+                                         std::string* error)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        return set_password(*service_str, *account_str, password, error);
+    }
+
+    LIBCRED_RESULT Backend::get_password(ServiceId service,
+                                         AccountId account,
+                                         std::string* password,
+                                         std::string* error)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        return get_password(*service_str, *account_str, password, error);
+    }
+
+    LIBCRED_RESULT Backend::delete_password(ServiceId service,
+                                            AccountId account,
+                                            std::string* error)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        return delete_password(*service_str, *account_str, error);
+    }
+
+    LIBCRED_RESULT Backend::find_password(ServiceId service,
+                                          std::string* password,
+                                          std::string* error)
+    {
+        const std::string* service_str;
+        if (!detail::resolve_service(service, &service_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        return find_password(*service_str, password, error);
+    }
+
+    LIBCRED_RESULT Backend::find_credentials(ServiceId service,
+                                             std::vector<Credentials>* credentials,
+                                             std::string* error)
+    {
+        const std::string* service_str;
+        if (!detail::resolve_service(service, &service_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        return find_credentials(*service_str, credentials, error);
+    }
+
+    LIBCRED_RESULT Backend::get_modified(const std::string& service,
+                                         const std::string& account,
+                                         time_t* modified,
+                                         std::string* error)
+    {
+        *error = "Modification times are not available from this backend";
+        return FAIL_ERROR;
+    }
+
+    size_t Backend::memory_usage() const
+    {
+        return 0;
+    }
+
+}  // namespace libcred
@@ -0,0 +1,585 @@
+#include "libcred_directory.hpp"
+#include "libcred_inotify.hpp"
+#include "libcred_internal.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        const uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE
+                                    | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF
+                                    | IN_MOVE_SELF;
+
+        /**
+         * Service and account names map to single path components, so reject
+         * anything that could escape the root or name a hidden entry.
+         */
+        bool valid_name(const std::string& name)
+        {
+            return !name.empty() && name[0] != '.' && name.find('/') == std::string::npos;
+        }
+
+        /**
+         * Reads a regular file through mmap. Returns FAIL_NONFATAL if there is
+         * no such regular file.
+         */
+        LIBCRED_RESULT read_file(const std::string& path,
+                                 bool strip_newline,
+                                 std::string* contents,
+                                 std::string* errStr)
+        {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == ENOENT || errno == ENOTDIR || errno == EISDIR)
+                {
+                    return FAIL_NONFATAL;
+                }
+
+                *errStr = "Unable to open " + path;
+                return FAIL_ERROR;
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            {
+                close(fd);
+                return FAIL_NONFATAL;
+            }
+
+            contents->clear();
+            if (st.st_size > 0)
+            {
+                void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                {
+                    close(fd);
+                    *errStr = "Unable to map " + path;
+                    return FAIL_ERROR;
+                }
+
+                contents->assign(static_cast<const char*>(data), st.st_size);
+                munmap(data, st.st_size);
+            }
+            close(fd);
+
+            if (strip_newline && !contents->empty() && (*contents)[contents->size() - 1] == '\n')
+            {
+                contents->erase(contents->size() - 1);
+            }
+
+            return SUCCESS;
+        }
+
+        struct Entry
+        {
+            bool present;
+            std::string value;
+        };
+
+        typedef std::pair<std::string, std::string> Key;
+
+    }  // namespace
+
+    class DirectoryBackend::Impl
+    {
+    public:
+        Impl(const std::string& root, bool strip_newline)
+            : root_(root)
+            , strip_newline_(strip_newline)
+            , root_wd_(-1)
+            , watcher_(std::bind(&Impl::handle_event,
+                                 this,
+                                 std::placeholders::_1,
+                                 std::placeholders::_2,
+                                 std::placeholders::_3))
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            root_wd_ = watcher_.add_watch(root_, watch_mask);
+        }
+
+        LIBCRED_RESULT read(const std::string& service,
+                            const std::string& account,
+                            std::string* value,
+                            std::string* errStr)
+        {
+            if (!valid_name(service) || (!account.empty() && !valid_name(account)))
+            {
+                return FAIL_NONFATAL;
+            }
+
+            Key key(service, account);
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            std::map<Key, Entry>::const_iterator it = entries_.find(key);
+            if (it != entries_.end())
+            {
+                if (!it->second.present)
+                {
+                    return FAIL_NONFATAL;
+                }
+
+                *value = it->second.value;
+                return SUCCESS;
+            }
+
+            // Watch before reading so a change racing with the read is seen.
+            bool cacheable = account.empty() ? root_wd_ >= 0 : watch_service(service);
+
+            Entry entry;
+            LIBCRED_RESULT result
+                = read_file(path_of(service, account), strip_newline_, &entry.value, errStr);
+            if (result == FAIL_ERROR)
+            {
+                return result;
+            }
+
+            entry.present = result == SUCCESS;
+            if (entry.present)
+            {
+                *value = entry.value;
+            }
+
+            if (cacheable)
+            {
+                entries_.insert(std::make_pair(key, entry));
+            }
+
+            return result;
+        }
+
+        /**
+         * Lists the accounts of a service in ascending order.
+         */
+        LIBCRED_RESULT list(const std::string& service,
+                            std::vector<std::string>* accounts,
+                            std::string* errStr)
+        {
+            if (!valid_name(service))
+            {
+                return FAIL_NONFATAL;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            std::map<std::string, std::vector<std::string>>::const_iterator it
+                = listings_.find(service);
+            if (it != listings_.end())
+            {
+                *accounts = it->second;
+                return accounts->empty() ? FAIL_NONFATAL : SUCCESS;
+            }
+
+            bool cacheable = watch_service(service);
+
+            std::vector<std::string> listing;
+            std::string dir = root_ + "/" + service;
+            DIR* handle = opendir(dir.c_str());
+            if (handle != NULL)
+            {
+                struct dirent* entry;
+                while ((entry = readdir(handle)) != NULL)
+                {
+                    struct stat st;
+                    if (valid_name(entry->d_name)
+                        && fstatat(dirfd(handle), entry->d_name, &st, 0) == 0
+                        && S_ISREG(st.st_mode))
+                    {
+                        listing.push_back(entry->d_name);
+                    }
+                }
+                closedir(handle);
+                std::sort(listing.begin(), listing.end());
+            }
+            else if (errno == ENOTDIR)
+            {
+                // A file directly in the root: one credential, empty account.
+                listing.push_back(std::string());
+            }
+            else if (errno != ENOENT)
+            {
+                *errStr = "Unable to list " + dir;
+                return FAIL_ERROR;
+            }
+
+            if (cacheable)
+            {
+                listings_[service] = listing;
+            }
+
+            *accounts = listing;
+            return accounts->empty() ? FAIL_NONFATAL : SUCCESS;
+        }
+
+        bool modified_time(const std::string& service, const std::string& account, time_t* mtime)
+        {
+            struct stat st;
+            if (stat(path_of(service, account).c_str(), &st) != 0)
+            {
+                return false;
+            }
+
+            *mtime = st.st_mtime;
+            return true;
+        }
+
+
+        size_t memory_usage()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            size_t bytes
+                = entries_.size() * (sizeof(Key) + sizeof(Entry) + detail::tree_node_bytes);
+            for (std::map<Key, Entry>::const_iterator it = entries_.begin(); it != entries_.end();
+                 ++it)
+            {
+                bytes += detail::heap_bytes(it->first.first) + detail::heap_bytes(it->first.second)
+                    + detail::heap_bytes(it->second.value);
+            }
+
+            for (std::map<std::string, std::vector<std::string>>::const_iterator it
+                 = listings_.begin();
+                 it != listings_.end();
+                 ++it)
+            {
+                bytes += sizeof(*it) + detail::tree_node_bytes + detail::heap_bytes(it->first)
+                    + it->second.capacity() * sizeof(std::string);
+                for (size_t i = 0; i < it->second.size(); ++i)
+                {
+                    bytes += detail::heap_bytes(it->second[i]);
+                }
+            }
+            return bytes;
+        }
+    private:
+        std::string path_of(const std::string& service, const std::string& account) const
+        {
+            return account.empty() ? root_ + "/" + service : root_ + "/" + service + "/" + account;
+        }
+
+        /**
+         * Makes sure the service's directory is watched. A missing directory
+         * counts as watched: the root watch reports its creation. Must be
+         * called with the mutex held.
+         */
+        bool watch_service(const std::string& service)
+        {
+            if (root_wd_ < 0)
+            {
+                return false;
+            }
+
+            if (service_watches_.count(service) != 0)
+            {
+                return true;
+            }
+
+            std::string dir = root_ + "/" + service;
+            int wd = watcher_.add_watch(dir, watch_mask | IN_ONLYDIR);
+            if (wd < 0)
+            {
+                return errno == ENOENT || errno == ENOTDIR;
+            }
+
+            service_watches_[service] = wd;
+            watched_services_[wd] = service;
+            return true;
+        }
+
+        void drop_service(const std::string& service)
+        {
+            for (std::map<Key, Entry>::iterator it = entries_.lower_bound(Key(service, ""));
+                 it != entries_.end() && it->first.first == service;)
+            {
+                entries_.erase(it++);
+            }
+            listings_.erase(service);
+
+            std::map<std::string, int>::iterator watch = service_watches_.find(service);
+            if (watch != service_watches_.end())
+            {
+                watched_services_.erase(watch->second);
+                watcher_.remove_watch(watch->second);
+                service_watches_.erase(watch);
+            }
+        }
+
+        void drop_all()
+        {
+            entries_.clear();
+            listings_.clear();
+
+            for (std::map<int, std::string>::const_iterator it = watched_services_.begin();
+                 it != watched_services_.end();
+                 ++it)
+            {
+                watcher_.remove_watch(it->first);
+            }
+            watched_services_.clear();
+            service_watches_.clear();
+        }
+
+        void handle_event(int wd, uint32_t mask, const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if ((mask & IN_Q_OVERFLOW) != 0)
+            {
+                drop_all();
+                return;
+            }
+
+            if (wd == root_wd_)
+            {
+                if (name.empty() || name[0] == '.')
+                {
+                    drop_all();
+                }
+                else
+                {
+                    // The entry may be a new or replaced service directory;
+                    // it gets watched again on next access.
+                    drop_service(name);
+                }
+                return;
+            }
+
+            std::map<int, std::string>::const_iterator it = watched_services_.find(wd);
+            if (it == watched_services_.end())
+            {
+                return;
+            }
+
+            std::string service = it->second;
+            if (name.empty() || (mask & IN_IGNORED) != 0)
+            {
+                drop_service(service);
+                return;
+            }
+
+            entries_.erase(Key(service, name));
+            listings_.erase(service);
+        }
+
+        std::string root_;
+        bool strip_newline_;
+
+        std::mutex mutex_;
+        std::map<Key, Entry> entries_;
+        std::map<std::string, std::vector<std::string>> listings_;
+        int root_wd_;
+        std::map<std::string, int> service_watches_;
+        std::map<int, std::string> watched_services_;
+
+        // Declared last so its thread stops before the state it touches goes.
+        detail::InotifyWatcher watcher_;
+    };
+
+    DirectoryBackend::DirectoryBackend(const std::string& root, bool strip_newline)
+        : impl_(new Impl(root, strip_newline))
+    {
+    }
+
+    DirectoryBackend::~DirectoryBackend()
+    {
+    }
+
+    std::string DirectoryBackend::default_root()
+    {
+        const char* credentials_directory = getenv("CREDENTIALS_DIRECTORY");
+        if (credentials_directory != NULL && credentials_directory[0] != '\0')
+        {
+            return credentials_directory;
+        }
+
+        return "/run/secrets";
+    }
+
+    LIBCRED_RESULT DirectoryBackend::set_password(const std::string& service,
+                                                  const std::string& account,
+                                                  const std::string& password,
+                                                  std::string* error)
+    {
+        *error = "The directory backend is read-only";
+        return FAIL_ERROR;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::get_password(const std::string& service,
+                                                  const std::string& account,
+                                                  std::string* password,
+                                                  std::string* error)
+    {
+        return impl_->read(service, account, password, error);
+    }
+
+    LIBCRED_RESULT DirectoryBackend::delete_password(const std::string& service,
+                                                     const std::string& account,
+                                                     std::string* error)
+    {
+        *error = "The directory backend is read-only";
+        return FAIL_ERROR;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::find_password(const std::string& service,
+                                                   std::string* password,
+                                                   std::string* error)
+    {
+        return find_password(service, FIND_FIRST_ACCOUNT, NULL, password, error);
+    }
+
+    LIBCRED_RESULT DirectoryBackend::find_credentials(const std::string& service,
+                                                      std::vector<Credentials>* credentials,
+                                                      std::string* error)
+    {
+        std::string next_cursor;
+        return find_credentials(service, 0, std::string(), credentials, &next_cursor, error);
+    }
+
+    LIBCRED_RESULT DirectoryBackend::find_password(const std::string& service,
+                                                   LIBCRED_FIND_POLICY policy,
+                                                   std::string* account,
+                                                   std::string* password,
+                                                   std::string* error)
+    {
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->list(service, &accounts, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        // Accounts are sorted, so FIND_ANY and FIND_FIRST_ACCOUNT agree.
+        size_t chosen = 0;
+        if (policy == FIND_MOST_RECENT)
+        {
+            time_t chosen_mtime = 0;
+            for (size_t i = 0; i < accounts.size(); ++i)
+            {
+                time_t mtime;
+                if (impl_->modified_time(service, accounts[i], &mtime) && mtime > chosen_mtime)
+                {
+                    chosen = i;
+                    chosen_mtime = mtime;
+                }
+            }
+        }
+
+        result = impl_->read(service, accounts[chosen], password, error);
+        if (result == SUCCESS && account != NULL)
+        {
+            *account = accounts[chosen];
+        }
+        return result;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::find_credentials(const std::string& service,
+                                                      size_t limit,
+                                                      const std::string& cursor,
+                                                      std::vector<Credentials>* credentials,
+                                                      std::string* next_cursor,
+                                                      std::string* error)
+    {
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->list(service, &accounts, error);
+        if (result == FAIL_ERROR)
+        {
+            return result;
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        size_t found = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            std::string password;
+            result = impl_->read(service, accounts[i], &password, error);
+            if (result == FAIL_ERROR)
+            {
+                return result;
+            }
+
+            if (result == SUCCESS)
+            {
+                credentials->push_back(Credentials(accounts[i], password));
+                ++found;
+            }
+        }
+
+        return found != 0 || !next_cursor->empty() ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::count_credentials(const std::string& service,
+                                                       size_t* count,
+                                                       std::string* error)
+    {
+        std::vector<std::string> accounts;
+        if (impl_->list(service, &accounts, error) == FAIL_ERROR)
+        {
+            return FAIL_ERROR;
+        }
+
+        *count = accounts.size();
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::delete_credentials(const std::string& service,
+                                                        size_t* deleted,
+                                                        std::string* error)
+    {
+        *deleted = 0;
+        *error = "The directory backend is read-only";
+        return FAIL_ERROR;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::rename_service(const std::string& from,
+                                                    const std::string& to,
+                                                    std::vector<std::string>* accounts,
+                                                    std::string* error)
+    {
+        *error = "The directory backend is read-only";
+        return FAIL_ERROR;
+    }
+
+    LIBCRED_RESULT DirectoryBackend::get_modified(const std::string& service,
+                                                  const std::string& account,
+                                                  time_t* modified,
+                                                  std::string* error)
+    {
+        if (impl_->modified_time(service, account, modified))
+        {
+            return SUCCESS;
+        }
+        if (errno == ENOENT || errno == ENOTDIR)
+        {
+            return FAIL_NONFATAL;
+        }
+        *error = strerror(errno);
+        return FAIL_ERROR;
+    }
+
+    size_t DirectoryBackend::memory_usage() const
+    {
+        return impl_->memory_usage();
+    }
+
+}  // namespace libcred
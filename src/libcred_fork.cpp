@@ -0,0 +1,91 @@
+#include "libcred_fork.hpp"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        namespace
+        {
+
+            // Both deliberately leaked, so handlers of objects destroyed during
+            // static destruction can still unregister.
+            std::mutex& handlers_mutex()
+            {
+                static std::mutex* mutex = new std::mutex();
+                return *mutex;
+            }
+
+            std::vector<ForkHandler*>& handlers()
+            {
+                static std::vector<ForkHandler*>* handlers = new std::vector<ForkHandler*>();
+                return *handlers;
+            }
+
+#ifndef _WIN32
+            void prepare()
+            {
+                handlers_mutex().lock();
+                for (std::vector<ForkHandler*>::const_iterator it = handlers().begin();
+                     it != handlers().end();
+                     ++it)
+                {
+                    (*it)->prepare_fork();
+                }
+            }
+
+            void parent()
+            {
+                for (std::vector<ForkHandler*>::const_reverse_iterator it = handlers().rbegin();
+                     it != handlers().rend();
+                     ++it)
+                {
+                    (*it)->parent_after_fork();
+                }
+                handlers_mutex().unlock();
+            }
+
+            void child()
+            {
+                for (std::vector<ForkHandler*>::const_reverse_iterator it = handlers().rbegin();
+                     it != handlers().rend();
+                     ++it)
+                {
+                    (*it)->child_after_fork();
+                }
+                handlers_mutex().unlock();
+            }
+#endif
+
+        }  // namespace
+
+        void register_fork_handler(ForkHandler* handler)
+        {
+#ifndef _WIN32
+            static std::once_flag installed;
+            std::call_once(installed, [] { pthread_atfork(prepare, parent, child); });
+
+            std::lock_guard<std::mutex> lock(handlers_mutex());
+            handlers().push_back(handler);
+#endif
+        }
+
+        void unregister_fork_handler(ForkHandler* handler)
+        {
+#ifndef _WIN32
+            std::lock_guard<std::mutex> lock(handlers_mutex());
+            handlers().erase(std::remove(handlers().begin(), handlers().end(), handler),
+                             handlers().end());
+#endif
+        }
+
+    }  // namespace detail
+}  // namespace libcred
@@ -0,0 +1,46 @@
+#ifndef SRC_LIBCRED_FORK_H_
+#define SRC_LIBCRED_FORK_H_
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        /**
+         * State that needs care across fork(). Registered handlers run from
+         * pthread_atfork hooks: prepare_fork() in the parent just before the
+         * fork takes the locks guarding the state, so that no other thread is
+         * halfway through changing it, then parent_after_fork() or
+         * child_after_fork() releases them. Only the forking thread exists in
+         * the child, so child_after_fork() must also forget the object's
+         * threads and connections instead of joining or closing them.
+         *
+         * Handlers are prepared in registration order and released in reverse.
+         */
+        class ForkHandler
+        {
+        public:
+            virtual ~ForkHandler()
+            {
+            }
+
+            virtual void prepare_fork() = 0;
+            virtual void parent_after_fork() = 0;
+            virtual void child_after_fork() = 0;
+        };
+
+        /**
+         * Adds a handler, installing the atfork hooks on first use. Does
+         * nothing on Windows, which has no fork().
+         */
+        void register_fork_handler(ForkHandler* handler);
+
+        /**
+         * Removes a handler; call it before tearing down what it guards.
+         */
+        void unregister_fork_handler(ForkHandler* handler);
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_FORK_H_
@@ -0,0 +1,915 @@
+#include "libcred_http.hpp"
+#include "libcred_internal.hpp"
+#include "libcred_json.hpp"
+
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <set>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        typedef std::chrono::steady_clock Clock;
+        typedef std::pair<std::string, std::string> Key;
+
+        std::once_flag curl_initialized;
+
+        size_t append_body(char* data, size_t size, size_t count, void* userdata)
+        {
+            static_cast<std::string*>(userdata)->append(data, size * count);
+            return size * count;
+        }
+
+        /**
+         * Percent-encodes everything but RFC 3986 unreserved characters, so a
+         * service or account name always stays a single path segment.
+         */
+        std::string escape_segment(const std::string& segment)
+        {
+            static const char hex_digits[] = "0123456789ABCDEF";
+
+            std::string escaped;
+            for (size_t i = 0; i < segment.size(); ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(segment[i]);
+                if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+                    || c == '-' || c == '_' || c == '.' || c == '~')
+                {
+                    escaped += static_cast<char>(c);
+                }
+                else
+                {
+                    escaped += '%';
+                    escaped += hex_digits[c >> 4];
+                    escaped += hex_digits[c & 0xf];
+                }
+            }
+            return escaped;
+        }
+
+        /**
+         * One HTTP exchange. Requests are prepared on pooled easy handles and
+         * run either alone or side by side on a multi handle.
+         */
+        struct Request
+        {
+            Request()
+                : status(0)
+                , code(CURLE_OK)
+                , handle(NULL)
+            {
+                error[0] = '\0';
+            }
+
+            std::string method;
+            std::string url;
+            std::string body;
+
+            long status;
+            std::string response;
+            CURLcode code;
+            char error[CURL_ERROR_SIZE];
+            CURL* handle;
+        };
+
+        /**
+         * Maps a finished request to a result. 404 is "not found"; anything
+         * else outside 2xx is an error carrying the server's message.
+         */
+        LIBCRED_RESULT request_result(const Request& request, std::string* errStr)
+        {
+            if (request.code != CURLE_OK)
+            {
+                *errStr = request.error[0] != '\0' ? request.error
+                                                   : curl_easy_strerror(request.code);
+                return FAIL_ERROR;
+            }
+
+            if (request.status == 404)
+            {
+                return FAIL_NONFATAL;
+            }
+
+            if (request.status < 200 || request.status >= 300)
+            {
+                char status[32];
+                snprintf(status, sizeof(status), "HTTP status %ld", request.status);
+                *errStr = status;
+
+                detail::JsonValue body;
+                const detail::JsonValue* errors;
+                if (detail::json_parse(request.response, &body)
+                    && (errors = body.get("errors")) != NULL && !errors->array.empty()
+                    && errors->array[0].type == detail::JsonValue::JSON_STRING)
+                {
+                    *errStr += ": " + errors->array[0].string;
+                }
+                return FAIL_ERROR;
+            }
+
+            return SUCCESS;
+        }
+
+        struct CacheEntry
+        {
+            std::string value;
+            Clock::time_point expires;
+        };
+
+    }  // namespace
+
+    HttpOptions::HttpOptions()
+        : address("http://127.0.0.1:8200")
+        , mount("secret")
+        , timeout_ms(5000)
+        , max_connections(8)
+        , cache_ttl_ms(0)
+    {
+    }
+
+    HttpOptions HttpOptions::from_environment()
+    {
+        HttpOptions options;
+
+        const char* address = getenv("VAULT_ADDR");
+        if (address != NULL && address[0] != '\0')
+        {
+            options.address = address;
+        }
+
+        const char* token = getenv("VAULT_TOKEN");
+        if (token != NULL)
+        {
+            options.token = token;
+        }
+
+        return options;
+    }
+
+    class HttpBackend::Impl
+    {
+    public:
+        explicit Impl(const HttpOptions& options)
+            : options_(options)
+            , headers_(NULL)
+        {
+            std::call_once(curl_initialized, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+            if (options_.max_connections == 0)
+            {
+                options_.max_connections = 1;
+            }
+
+            // All handles share one connection and DNS cache, so a keep-alive
+            // connection opened by any call is reused by the next one.
+            share_ = curl_share_init();
+            curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &Impl::lock_share);
+            curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &Impl::unlock_share);
+            curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+            curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+            headers_ = curl_slist_append(headers_, ("X-Vault-Token: " + options_.token).c_str());
+            headers_ = curl_slist_append(headers_, "Content-Type: application/json");
+        }
+
+        ~Impl()
+        {
+            for (size_t i = 0; i < pool_.size(); ++i)
+            {
+                curl_easy_cleanup(pool_[i]);
+            }
+            curl_share_cleanup(share_);
+            curl_slist_free_all(headers_);
+        }
+
+        std::string secret_url(const char* kind,
+                               const std::string& service,
+                               const std::string& account) const
+        {
+            std::string url = options_.address + "/v1/" + options_.mount + "/" + kind + "/";
+            if (!options_.prefix.empty())
+            {
+                url += options_.prefix + "/";
+            }
+            url += escape_segment(service);
+            if (!account.empty())
+            {
+                url += "/" + escape_segment(account);
+            }
+            return url;
+        }
+
+        void perform(Request* request)
+        {
+            request->handle = acquire();
+            prepare(request);
+            request->code = curl_easy_perform(request->handle);
+            finish(request);
+        }
+
+        /**
+         * Runs requests in parallel, at most max_connections at a time.
+         */
+        void perform_all(std::vector<Request>* requests)
+        {
+            if (requests->size() == 1)
+            {
+                perform(&(*requests)[0]);
+                return;
+            }
+
+            CURLM* multi = curl_multi_init();
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            curl_multi_setopt(
+                multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(options_.max_connections));
+
+            size_t next = 0;
+            size_t running = 0;
+            while (next < requests->size() || running != 0)
+            {
+                while (next < requests->size() && running < options_.max_connections)
+                {
+                    Request* request = &(*requests)[next++];
+                    request->handle = acquire();
+                    prepare(request);
+                    curl_easy_setopt(request->handle, CURLOPT_PRIVATE, request);
+                    curl_multi_add_handle(multi, request->handle);
+                    ++running;
+                }
+
+                int still_running;
+                curl_multi_perform(multi, &still_running);
+
+                CURLMsg* message;
+                int queued;
+                while ((message = curl_multi_info_read(multi, &queued)) != NULL)
+                {
+                    if (message->msg != CURLMSG_DONE)
+                    {
+                        continue;
+                    }
+
+                    Request* request;
+                    curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &request);
+                    request->code = message->data.result;
+                    curl_multi_remove_handle(multi, message->easy_handle);
+                    finish(request);
+                    --running;
+                }
+
+                if (still_running != 0)
+                {
+                    curl_multi_poll(multi, NULL, 0, 1000, NULL);
+                }
+            }
+
+            curl_multi_cleanup(multi);
+        }
+
+        bool cache_lookup(const Key& key, std::string* value)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+
+            std::map<Key, CacheEntry>::iterator it = cache_.find(key);
+            if (it == cache_.end())
+            {
+                return false;
+            }
+
+            if (it->second.expires <= Clock::now())
+            {
+                cache_.erase(it);
+                return false;
+            }
+
+            *value = it->second.value;
+            return true;
+        }
+
+        /**
+         * Caches a value for the lease the server granted, or for the
+         * configured default when it granted none.
+         */
+        void cache_store(const Key& key, const std::string& value, long lease_seconds)
+        {
+            long ttl_ms = lease_seconds > 0 ? lease_seconds * 1000 : options_.cache_ttl_ms;
+            if (ttl_ms <= 0)
+            {
+                return;
+            }
+
+            CacheEntry entry;
+            entry.value = value;
+            entry.expires = Clock::now() + std::chrono::milliseconds(ttl_ms);
+
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            cache_[key] = entry;
+        }
+
+        void cache_erase(const Key& key)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            cache_.erase(key);
+        }
+
+        Request read_request(const std::string& service, const std::string& account) const
+        {
+            Request request;
+            request.method = "GET";
+            request.url = secret_url("data", service, account);
+            return request;
+        }
+
+        Request list_request(const std::string& service) const
+        {
+            Request request;
+            request.method = "GET";
+            request.url = secret_url("metadata", service, std::string()) + "?list=true";
+            return request;
+        }
+
+        /**
+         * Extracts the password of a KV v2 read response and caches it.
+         */
+        LIBCRED_RESULT parse_read(const Key& key,
+                                  const Request& request,
+                                  std::string* password,
+                                  std::string* errStr)
+        {
+            LIBCRED_RESULT result = request_result(request, errStr);
+            if (result != SUCCESS)
+            {
+                return result;
+            }
+
+            detail::JsonValue body;
+            if (!detail::json_parse(request.response, &body))
+            {
+                *errStr = "Malformed response from " + request.url;
+                return FAIL_ERROR;
+            }
+
+            const detail::JsonValue* data = body.get("data");
+            const detail::JsonValue* secret = data != NULL ? data->get("data") : NULL;
+            const detail::JsonValue* value = secret != NULL ? secret->get("password") : NULL;
+            if (value == NULL || value->type != detail::JsonValue::JSON_STRING)
+            {
+                return FAIL_NONFATAL;
+            }
+
+            const detail::JsonValue* lease = body.get("lease_duration");
+            cache_store(key,
+                        value->string,
+                        lease != NULL && lease->type == detail::JsonValue::JSON_NUMBER
+                            ? static_cast<long>(lease->number)
+                            : 0);
+
+            *password = value->string;
+            return SUCCESS;
+        }
+
+        /**
+         * Extracts the sorted account names of a KV v2 list response,
+         * skipping nested folders.
+         */
+        LIBCRED_RESULT parse_list(const Request& request,
+                                  std::vector<std::string>* accounts,
+                                  std::string* errStr)
+        {
+            LIBCRED_RESULT result = request_result(request, errStr);
+            if (result != SUCCESS)
+            {
+                return result;
+            }
+
+            detail::JsonValue body;
+            if (!detail::json_parse(request.response, &body))
+            {
+                *errStr = "Malformed response from " + request.url;
+                return FAIL_ERROR;
+            }
+
+            const detail::JsonValue* data = body.get("data");
+            const detail::JsonValue* keys = data != NULL ? data->get("keys") : NULL;
+            if (keys != NULL)
+            {
+                for (size_t i = 0; i < keys->array.size(); ++i)
+                {
+                    const std::string& key = keys->array[i].string;
+                    if (!key.empty() && key[key.size() - 1] != '/')
+                    {
+                        accounts->push_back(key);
+                    }
+                }
+            }
+
+            std::sort(accounts->begin(), accounts->end());
+            return accounts->empty() ? FAIL_NONFATAL : SUCCESS;
+        }
+
+        /**
+         * Fetches the passwords of many accounts, serving what it can from the
+         * cache and reading the rest in parallel.
+         */
+        LIBCRED_RESULT read_all(const std::vector<Key>& keys,
+                                std::vector<std::string>* passwords,
+                                std::vector<bool>* found,
+                                std::string* errStr)
+        {
+            passwords->assign(keys.size(), std::string());
+            found->assign(keys.size(), false);
+
+            std::vector<size_t> misses;
+            std::vector<Request> requests;
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                if (cache_lookup(keys[i], &(*passwords)[i]))
+                {
+                    (*found)[i] = true;
+                }
+                else
+                {
+                    misses.push_back(i);
+                    requests.push_back(read_request(keys[i].first, keys[i].second));
+                }
+            }
+
+            if (requests.empty())
+            {
+                return SUCCESS;
+            }
+
+            perform_all(&requests);
+
+            for (size_t i = 0; i < misses.size(); ++i)
+            {
+                size_t index = misses[i];
+                LIBCRED_RESULT result
+                    = parse_read(keys[index], requests[i], &(*passwords)[index], errStr);
+                if (result == FAIL_ERROR)
+                {
+                    return result;
+                }
+                (*found)[index] = result == SUCCESS;
+            }
+
+            return SUCCESS;
+        }
+
+        void invalidate(const Key& key)
+        {
+            cache_erase(key);
+        }
+
+
+        size_t memory_usage()
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+
+            size_t bytes = 0;
+            for (std::map<Key, CacheEntry>::const_iterator it = cache_.begin(); it != cache_.end();
+                 ++it)
+            {
+                bytes += sizeof(*it) + detail::tree_node_bytes + detail::heap_bytes(it->first.first)
+                    + detail::heap_bytes(it->first.second) + detail::heap_bytes(it->second.value);
+            }
+            return bytes;
+        }
+    private:
+        static void lock_share(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+        {
+            static_cast<Impl*>(userptr)->share_locks_[data].lock();
+        }
+
+        static void unlock_share(CURL*, curl_lock_data data, void* userptr)
+        {
+            static_cast<Impl*>(userptr)->share_locks_[data].unlock();
+        }
+
+        CURL* acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex_);
+                if (!pool_.empty())
+                {
+                    CURL* handle = pool_.back();
+                    pool_.pop_back();
+                    return handle;
+                }
+            }
+
+            return curl_easy_init();
+        }
+
+        void release(CURL* handle)
+        {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex_);
+                if (pool_.size() < options_.max_connections)
+                {
+                    pool_.push_back(handle);
+                    return;
+                }
+            }
+
+            curl_easy_cleanup(handle);
+        }
+
+        void prepare(Request* request)
+        {
+            CURL* handle = request->handle;
+
+            // Resetting keeps the handle's live connections and the share.
+            curl_easy_reset(handle);
+            curl_easy_setopt(handle, CURLOPT_SHARE, share_);
+            curl_easy_setopt(handle, CURLOPT_URL, request->url.c_str());
+            curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers_);
+            curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &append_body);
+            curl_easy_setopt(handle, CURLOPT_WRITEDATA, &request->response);
+            curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, request->error);
+            curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, options_.timeout_ms);
+            curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+
+            if (request->method == "POST")
+            {
+                curl_easy_setopt(handle, CURLOPT_POSTFIELDS, request->body.c_str());
+                curl_easy_setopt(
+                    handle, CURLOPT_POSTFIELDSIZE, static_cast<long>(request->body.size()));
+            }
+            else if (request->method != "GET")
+            {
+                curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, request->method.c_str());
+            }
+        }
+
+        void finish(Request* request)
+        {
+            curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &request->status);
+            release(request->handle);
+            request->handle = NULL;
+        }
+
+        HttpOptions options_;
+        CURLSH* share_;
+        std::mutex share_locks_[CURL_LOCK_DATA_LAST];
+        struct curl_slist* headers_;
+
+        std::mutex pool_mutex_;
+        std::vector<CURL*> pool_;
+
+        std::mutex cache_mutex_;
+        std::map<Key, CacheEntry> cache_;
+    };
+
+    HttpBackend::HttpBackend(const HttpOptions& options)
+        : impl_(new Impl(options))
+    {
+    }
+
+    HttpBackend::~HttpBackend()
+    {
+    }
+
+    LIBCRED_RESULT HttpBackend::set_password(const std::string& service,
+                                             const std::string& account,
+                                             const std::string& password,
+                                             std::string* error)
+    {
+        Key key(service, account);
+
+        Request request;
+        request.method = "POST";
+        request.url = impl_->secret_url("data", service, account);
+        request.body = "{\"data\":{\"password\":" + detail::json_quote(password) + "}}";
+
+        // Dropped again once the write is done: a read racing it may have
+        // cached the old value meanwhile.
+        impl_->invalidate(key);
+        impl_->perform(&request);
+        impl_->invalidate(key);
+
+        LIBCRED_RESULT result = request_result(request, error);
+        if (result == FAIL_NONFATAL)
+        {
+            *error = "Secret engine not found at " + request.url;
+            return FAIL_ERROR;
+        }
+
+        return result;
+    }
+
+    LIBCRED_RESULT HttpBackend::get_password(const std::string& service,
+                                             const std::string& account,
+                                             std::string* password,
+                                             std::string* error)
+    {
+        Key key(service, account);
+        if (impl_->cache_lookup(key, password))
+        {
+            return SUCCESS;
+        }
+
+        Request request = impl_->read_request(service, account);
+        impl_->perform(&request);
+        return impl_->parse_read(key, request, password, error);
+    }
+
+    LIBCRED_RESULT HttpBackend::delete_password(const std::string& service,
+                                                const std::string& account,
+                                                std::string* error)
+    {
+        impl_->invalidate(Key(service, account));
+
+        // Deleting metadata succeeds whether or not the secret exists, so look
+        // it up first to report missing credentials like the other backends.
+        Request lookup;
+        lookup.method = "GET";
+        lookup.url = impl_->secret_url("metadata", service, account);
+        impl_->perform(&lookup);
+
+        LIBCRED_RESULT result = request_result(lookup, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        Request request;
+        request.method = "DELETE";
+        request.url = lookup.url;
+        impl_->perform(&request);
+        impl_->invalidate(Key(service, account));
+        return request_result(request, error);
+    }
+
+    LIBCRED_RESULT HttpBackend::find_password(const std::string& service,
+                                              std::string* password,
+                                              std::string* error)
+    {
+        return find_password(service, FIND_FIRST_ACCOUNT, NULL, password, error);
+    }
+
+    LIBCRED_RESULT HttpBackend::find_password(const std::string& service,
+                                              LIBCRED_FIND_POLICY policy,
+                                              std::string* account,
+                                              std::string* password,
+                                              std::string* error)
+    {
+        if (policy == FIND_MOST_RECENT)
+        {
+            return Backend::find_password(service, policy, account, password, error);
+        }
+
+        // Listing is sorted, so FIND_ANY and FIND_FIRST_ACCOUNT agree and only
+        // one secret is read.
+        Request list = impl_->list_request(service);
+        impl_->perform(&list);
+
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->parse_list(list, &accounts, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        result = get_password(service, accounts[0], password, error);
+        if (result == SUCCESS && account != NULL)
+        {
+            *account = accounts[0];
+        }
+        return result;
+    }
+
+    LIBCRED_RESULT HttpBackend::find_credentials(const std::string& service,
+                                                 std::vector<Credentials>* credentials,
+                                                 std::string* error)
+    {
+        std::string next_cursor;
+        return find_credentials(service, 0, std::string(), credentials, &next_cursor, error);
+    }
+
+    LIBCRED_RESULT HttpBackend::find_credentials(const std::string& service,
+                                                 size_t limit,
+                                                 const std::string& cursor,
+                                                 std::vector<Credentials>* credentials,
+                                                 std::string* next_cursor,
+                                                 std::string* error)
+    {
+        Request list = impl_->list_request(service);
+        impl_->perform(&list);
+
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->parse_list(list, &accounts, error);
+        if (result != SUCCESS)
+        {
+            next_cursor->clear();
+            return result;
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        std::vector<Key> keys;
+        for (size_t i = begin; i < end; ++i)
+        {
+            keys.push_back(Key(service, accounts[i]));
+        }
+
+        std::vector<std::string> passwords;
+        std::vector<bool> found;
+        result = impl_->read_all(keys, &passwords, &found, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (found[i])
+            {
+                credentials->push_back(Credentials(keys[i].second, passwords[i]));
+            }
+        }
+
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT HttpBackend::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* error)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        std::vector<std::string> names(wanted.begin(), wanted.end());
+
+        // List every service in parallel, then read every secret in parallel.
+        std::vector<Request> lists;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            (*credentials)[names[i]];
+            lists.push_back(impl_->list_request(names[i]));
+        }
+
+        if (lists.empty())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        impl_->perform_all(&lists);
+
+        std::vector<Key> keys;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            std::vector<std::string> accounts;
+            if (impl_->parse_list(lists[i], &accounts, error) == FAIL_ERROR)
+            {
+                return FAIL_ERROR;
+            }
+
+            for (size_t j = 0; j < accounts.size(); ++j)
+            {
+                keys.push_back(Key(names[i], accounts[j]));
+            }
+        }
+
+        std::vector<std::string> passwords;
+        std::vector<bool> found;
+        LIBCRED_RESULT result = impl_->read_all(keys, &passwords, &found, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (found[i])
+            {
+                (*credentials)[keys[i].first].push_back(Credentials(keys[i].second, passwords[i]));
+                ++count;
+            }
+        }
+
+        return count != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT HttpBackend::delete_credentials(const std::string& service,
+                                                   size_t* deleted,
+                                                   std::string* error)
+    {
+        *deleted = 0;
+
+        // Listed accounts exist, so unlike delete_password no lookup precedes
+        // each delete, and the deletes run in parallel.
+        Request list = impl_->list_request(service);
+        impl_->perform(&list);
+
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->parse_list(list, &accounts, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        std::vector<Request> requests(accounts.size());
+        for (size_t i = 0; i < accounts.size(); ++i)
+        {
+            requests[i].method = "DELETE";
+            requests[i].url = impl_->secret_url("metadata", service, accounts[i]);
+        }
+        impl_->perform_all(&requests);
+
+        // Only once the deletes are done, so that no racing read caches a
+        // value they removed.
+        for (size_t i = 0; i < accounts.size(); ++i)
+        {
+            impl_->invalidate(Key(service, accounts[i]));
+        }
+
+        // Every delete has run, so those that succeeded are counted even
+        // when another failed.
+        result = SUCCESS;
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            std::string request_error;
+            LIBCRED_RESULT request = request_result(requests[i], &request_error);
+            if (request == SUCCESS)
+            {
+                ++*deleted;
+            }
+            else if (request == FAIL_ERROR && result != FAIL_ERROR)
+            {
+                result = FAIL_ERROR;
+                *error = request_error;
+            }
+        }
+
+        if (result == FAIL_ERROR)
+        {
+            return result;
+        }
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT HttpBackend::count_credentials(const std::string& service,
+                                                  size_t* count,
+                                                  std::string* error)
+    {
+        // A metadata listing: no secret is read.
+        Request list = impl_->list_request(service);
+        impl_->perform(&list);
+
+        std::vector<std::string> accounts;
+        if (impl_->parse_list(list, &accounts, error) == FAIL_ERROR)
+        {
+            return FAIL_ERROR;
+        }
+
+        *count = accounts.size();
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT HttpBackend::count_credentials(const std::vector<std::string>& services,
+                                                  std::map<std::string, size_t>* counts,
+                                                  std::string* error)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        std::vector<std::string> names(wanted.begin(), wanted.end());
+
+        std::vector<Request> lists;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            lists.push_back(impl_->list_request(names[i]));
+        }
+        impl_->perform_all(&lists);
+
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            std::vector<std::string> accounts;
+            if (impl_->parse_list(lists[i], &accounts, error) == FAIL_ERROR)
+            {
+                return FAIL_ERROR;
+            }
+            (*counts)[names[i]] = accounts.size();
+        }
+        return SUCCESS;
+    }
+
+    size_t HttpBackend::memory_usage() const
+    {
+        return impl_->memory_usage();
+    }
+
+}  // namespace libcred
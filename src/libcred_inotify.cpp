@@ -0,0 +1,117 @@
+#include "libcred_inotify.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        InotifyWatcher::InotifyWatcher(const Handler& handler)
+            : handler_(handler)
+            , inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+            , wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+            if (inotify_fd_ >= 0 && wake_fd_ >= 0)
+            {
+                thread_ = std::thread(&InotifyWatcher::run, this);
+            }
+        }
+
+        InotifyWatcher::~InotifyWatcher()
+        {
+            if (thread_.joinable())
+            {
+                uint64_t one = 1;
+                ssize_t written = write(wake_fd_, &one, sizeof(one));
+                (void) written;
+                thread_.join();
+            }
+
+            if (inotify_fd_ >= 0)
+            {
+                close(inotify_fd_);
+            }
+
+            if (wake_fd_ >= 0)
+            {
+                close(wake_fd_);
+            }
+        }
+
+        bool InotifyWatcher::ok() const
+        {
+            return thread_.joinable();
+        }
+
+        int InotifyWatcher::add_watch(const std::string& path, uint32_t mask)
+        {
+            if (!ok())
+            {
+                return -1;
+            }
+
+            return inotify_add_watch(inotify_fd_, path.c_str(), mask);
+        }
+
+        void InotifyWatcher::remove_watch(int wd)
+        {
+            if (ok() && wd >= 0)
+            {
+                inotify_rm_watch(inotify_fd_, wd);
+            }
+        }
+
+        void InotifyWatcher::run()
+        {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+            for (;;)
+            {
+                struct pollfd fds[2];
+                fds[0].fd = inotify_fd_;
+                fds[0].events = POLLIN;
+                fds[1].fd = wake_fd_;
+                fds[1].events = POLLIN;
+
+                if (poll(fds, 2, -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return;
+                }
+
+                if (fds[1].revents != 0)
+                {
+                    return;
+                }
+
+                for (;;)
+                {
+                    ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+                    if (length <= 0)
+                    {
+                        break;
+                    }
+
+                    for (char* ptr = buffer; ptr < buffer + length;)
+                    {
+                        const struct inotify_event* event
+                            = reinterpret_cast<const struct inotify_event*>(ptr);
+                        handler_(event->wd,
+                                 event->mask,
+                                 event->len != 0 ? std::string(event->name) : std::string());
+                        ptr += sizeof(struct inotify_event) + event->len;
+                    }
+                }
+            }
+        }
+
+    }  // namespace detail
+}  // namespace libcred
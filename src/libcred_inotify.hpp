@@ -0,0 +1,57 @@
+#ifndef SRC_LIBCRED_INOTIFY_H_
+#define SRC_LIBCRED_INOTIFY_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        /**
+         * Owns an inotify instance and a thread that delivers its events.
+         *
+         * The handler runs on the watcher thread with the watch descriptor,
+         * event mask and entry name (empty for events on the watched directory
+         * itself). A wd of -1 with IN_Q_OVERFLOW means events were lost.
+         */
+        class InotifyWatcher
+        {
+        public:
+            typedef std::function<void(int wd, uint32_t mask, const std::string& name)> Handler;
+
+            explicit InotifyWatcher(const Handler& handler);
+            ~InotifyWatcher();
+
+            /**
+             * False if inotify is unavailable; callers must then not cache.
+             */
+            bool ok() const;
+
+            /**
+             * Returns the watch descriptor, or -1 on failure.
+             */
+            int add_watch(const std::string& path, uint32_t mask);
+
+            void remove_watch(int wd);
+
+        private:
+            InotifyWatcher(const InotifyWatcher&);
+            InotifyWatcher& operator=(const InotifyWatcher&);
+
+            void run();
+
+            Handler handler_;
+            int inotify_fd_;
+            int wake_fd_;
+            std::thread thread_;
+        };
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_INOTIFY_H_
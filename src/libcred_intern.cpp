@@ -0,0 +1,239 @@
+#include "libcred_fork.hpp"
+#include "libcred_internal.hpp"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        /**
+         * Append-only string table. Names live in a deque so references handed
+         * out stay valid while new names are interned concurrently.
+         */
+        class Interner
+        {
+        public:
+            uint32_t intern(const std::string& name)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                std::unordered_map<std::string, uint32_t>::const_iterator it = ids_.find(name);
+                if (it != ids_.end())
+                {
+                    return it->second;
+                }
+
+                uint32_t id = static_cast<uint32_t>(names_.size());
+                names_.push_back(name);
+                ids_.insert(std::make_pair(name, id));
+                return id;
+            }
+
+            const std::string* name(uint32_t id)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if (id >= names_.size())
+                {
+                    return NULL;
+                }
+
+                return &names_[id];
+            }
+
+            size_t memory_usage()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                // Every name is held twice, as a key of ids_ and in names_.
+                size_t bytes = names_.size()
+                    * (sizeof(std::string) * 2 + sizeof(uint32_t) + detail::hash_node_bytes);
+                for (std::deque<std::string>::const_iterator it = names_.begin();
+                     it != names_.end();
+                     ++it)
+                {
+                    bytes += 2 * detail::heap_bytes(*it);
+                }
+                return bytes;
+            }
+
+            void lock()
+            {
+                mutex_.lock();
+            }
+
+            void unlock()
+            {
+                mutex_.unlock();
+            }
+
+        private:
+            std::mutex mutex_;
+            std::unordered_map<std::string, uint32_t> ids_;
+            std::deque<std::string> names_;
+        };
+
+        Interner& services()
+        {
+            static Interner interner;
+            return interner;
+        }
+
+        Interner& accounts()
+        {
+            static Interner interner;
+            return interner;
+        }
+
+        std::mutex labels_mutex;
+        std::unordered_map<uint64_t, std::string> labels;
+
+        /**
+         * Holds the name table locks across fork(), in the order key_label
+         * takes them. Nothing else is locked while one is held, so they can
+         * be prepared before or after any other handler.
+         */
+        class InternForkHandler : public detail::ForkHandler
+        {
+        public:
+            InternForkHandler()
+            {
+                detail::register_fork_handler(this);
+            }
+
+            ~InternForkHandler()
+            {
+                detail::unregister_fork_handler(this);
+            }
+
+            void prepare_fork()
+            {
+                labels_mutex.lock();
+                services().lock();
+                accounts().lock();
+            }
+
+            void parent_after_fork()
+            {
+                accounts().unlock();
+                services().unlock();
+                labels_mutex.unlock();
+            }
+
+            void child_after_fork()
+            {
+                parent_after_fork();
+            }
+        };
+
+        InternForkHandler intern_fork_handler;
+
+    }  // namespace
+
+    ServiceId intern_service(const std::string& service)
+    {
+        return services().intern(service);
+    }
+
+    AccountId intern_account(const std::string& account)
+    {
+        return accounts().intern(account);
+    }
+
+    namespace detail
+    {
+
+        const std::string* service_name(ServiceId service)
+        {
+            return services().name(service);
+        }
+
+        const std::string* account_name(AccountId account)
+        {
+            return accounts().name(account);
+        }
+
+        const std::string* key_label(ServiceId service, AccountId account)
+        {
+            uint64_t key = key_of(service, account);
+
+            std::lock_guard<std::mutex> lock(labels_mutex);
+
+            // Elements of an unordered_map are never moved by a rehash, so the
+            // pointer returned here stays valid.
+            std::unordered_map<uint64_t, std::string>::const_iterator it = labels.find(key);
+            if (it != labels.end())
+            {
+                return &it->second;
+            }
+
+            const std::string* service_str = service_name(service);
+            const std::string* account_str = account_name(account);
+            if (service_str == NULL || account_str == NULL)
+            {
+                return NULL;
+            }
+
+            return &labels.insert(std::make_pair(key, *service_str + "/" + *account_str))
+                        .first->second;
+        }
+
+        size_t intern_memory_usage()
+        {
+            size_t bytes = services().memory_usage() + accounts().memory_usage();
+
+            std::lock_guard<std::mutex> lock(labels_mutex);
+            bytes += labels.size()
+                * (sizeof(uint64_t) + sizeof(std::string) + detail::hash_node_bytes);
+            for (std::unordered_map<uint64_t, std::string>::const_iterator it = labels.begin();
+                 it != labels.end();
+                 ++it)
+            {
+                bytes += detail::heap_bytes(it->second);
+            }
+            return bytes;
+        }
+
+        bool resolve_service(ServiceId service,
+                             const std::string** service_str,
+                             std::string* errStr)
+        {
+            *service_str = service_name(service);
+            if (*service_str == NULL)
+            {
+                *errStr = "Unknown service id";
+                return false;
+            }
+
+            return true;
+        }
+
+        bool resolve_key(ServiceId service,
+                         AccountId account,
+                         const std::string** service_str,
+                         const std::string** account_str,
+                         std::string* errStr)
+        {
+            if (!resolve_service(service, service_str, errStr))
+            {
+                return false;
+            }
+
+            *account_str = account_name(account);
+            if (*account_str == NULL)
+            {
+                *errStr = "Unknown account id";
+                return false;
+            }
+
+            return true;
+        }
+
+    }  // namespace detail
+
+}  // namespace libcred
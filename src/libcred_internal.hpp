@@ -0,0 +1,113 @@
+#ifndef SRC_LIBCRED_INTERNAL_H_
+#define SRC_LIBCRED_INTERNAL_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libcred.hpp"
+
+namespace libcred
+{
+    class Backend;
+    struct StoreOptions;
+
+    namespace detail
+    {
+        /**
+         * Creates a backend over the platform keyring with its own connection;
+         * defined by each platform's implementation file.
+         */
+        std::unique_ptr<Backend> make_keyring_backend(const StoreOptions& options);
+
+        /**
+         * Packs a (service, account) pair of interned IDs into a single integer
+         * so that per-key tables can be keyed and compared as plain integers.
+         */
+        inline uint64_t key_of(ServiceId service, AccountId account)
+        {
+            return (static_cast<uint64_t>(service) << 32) | account;
+        }
+
+        /**
+         * Resolve interned IDs back to their names. The returned pointers stay
+         * valid for the lifetime of the process; NULL means the ID is unknown.
+         */
+        const std::string* service_name(ServiceId service);
+        const std::string* account_name(AccountId account);
+
+        /**
+         * Returns the "service/account" label for an interned key, building it
+         * on first use only. NULL if either ID is unknown.
+         */
+        const std::string* key_label(ServiceId service, AccountId account);
+
+        /**
+         * Resolves both IDs, setting *errStr and returning false if either is
+         * unknown.
+         */
+        bool resolve_key(ServiceId service,
+                         AccountId account,
+                         const std::string** service_str,
+                         const std::string** account_str,
+                         std::string* errStr);
+
+        bool resolve_service(ServiceId service,
+                             const std::string** service_str,
+                             std::string* errStr);
+
+        /**
+         * Selects the page following `cursor` from accounts sorted in ascending
+         * order, as the index range [*begin, *end). *next_cursor is set to
+         * resume after the page, or cleared if nothing follows it. A limit of
+         * zero selects all remaining accounts. Returns false for a malformed
+         * cursor.
+         */
+        bool select_page(const std::vector<std::string>& sorted_accounts,
+                         size_t limit,
+                         const std::string& cursor,
+                         size_t* begin,
+                         size_t* end,
+                         std::string* next_cursor,
+                         std::string* errStr);
+
+        /**
+         * Appends to *found the credentials of each collection, collections
+         * listed in order of precedence, keeping one per account as policy
+         * says. modified[i][j] is when credentials[i][j] last changed; only
+         * MERGE_MOST_RECENT reads it, ties going to the earlier collection.
+         * Unless origins is NULL, it is set to the (i, j) of each credential
+         * appended, in the same order.
+         */
+        void merge_collections(const std::vector<std::string>& collections,
+                               const std::vector<std::vector<Credentials>>& credentials,
+                               const std::vector<std::vector<time_t>>& modified,
+                               LIBCRED_MERGE_POLICY policy,
+                               std::vector<CollectionCredentials>* found,
+                               std::vector<std::pair<size_t, size_t>>* origins);
+
+        /**
+         * Heap bytes behind a string, 0 while it fits the inline buffer.
+         */
+        inline size_t heap_bytes(const std::string& value)
+        {
+            static const size_t inline_capacity = std::string().capacity();
+            return value.capacity() > inline_capacity ? value.capacity() + 1 : 0;
+        }
+
+        // Per-node bookkeeping of the standard containers, for estimates: the
+        // links and color of a tree node, the link and cached hash of a hash
+        // node (plus a bucket pointer per element at load factor 1).
+        const size_t tree_node_bytes = 4 * sizeof(void*);
+        const size_t hash_node_bytes = 3 * sizeof(void*);
+
+        /**
+         * Estimated heap bytes of the interned names and labels.
+         */
+        size_t intern_memory_usage();
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_INTERNAL_H_
@@ -0,0 +1,352 @@
+#include "libcred_json.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        namespace
+        {
+
+            class Parser
+            {
+            public:
+                explicit Parser(const std::string& text)
+                    : text_(text)
+                    , pos_(0)
+                {
+                }
+
+                bool parse(JsonValue* value)
+                {
+                    if (!parse_value(value, 0))
+                    {
+                        return false;
+                    }
+
+                    skip_space();
+                    return pos_ == text_.size();
+                }
+
+            private:
+                void skip_space()
+                {
+                    while (pos_ < text_.size()
+                           && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n'
+                               || text_[pos_] == '\r'))
+                    {
+                        ++pos_;
+                    }
+                }
+
+                bool consume(const char* literal)
+                {
+                    size_t i = 0;
+                    for (; literal[i] != '\0'; ++i)
+                    {
+                        if (pos_ + i >= text_.size() || text_[pos_ + i] != literal[i])
+                        {
+                            return false;
+                        }
+                    }
+                    pos_ += i;
+                    return true;
+                }
+
+                static void append_utf8(unsigned long code, std::string* out)
+                {
+                    if (code < 0x80)
+                    {
+                        *out += static_cast<char>(code);
+                    }
+                    else if (code < 0x800)
+                    {
+                        *out += static_cast<char>(0xc0 | (code >> 6));
+                        *out += static_cast<char>(0x80 | (code & 0x3f));
+                    }
+                    else if (code < 0x10000)
+                    {
+                        *out += static_cast<char>(0xe0 | (code >> 12));
+                        *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                        *out += static_cast<char>(0x80 | (code & 0x3f));
+                    }
+                    else
+                    {
+                        *out += static_cast<char>(0xf0 | (code >> 18));
+                        *out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+                        *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                        *out += static_cast<char>(0x80 | (code & 0x3f));
+                    }
+                }
+
+                bool parse_hex4(unsigned long* code)
+                {
+                    if (pos_ + 4 > text_.size())
+                    {
+                        return false;
+                    }
+
+                    std::string digits = text_.substr(pos_, 4);
+                    char* end;
+                    *code = strtoul(digits.c_str(), &end, 16);
+                    if (end != digits.c_str() + 4)
+                    {
+                        return false;
+                    }
+                    pos_ += 4;
+                    return true;
+                }
+
+                bool parse_string(std::string* out)
+                {
+                    if (!consume("\""))
+                    {
+                        return false;
+                    }
+
+                    while (pos_ < text_.size())
+                    {
+                        char c = text_[pos_++];
+                        if (c == '"')
+                        {
+                            return true;
+                        }
+
+                        if (c != '\\')
+                        {
+                            *out += c;
+                            continue;
+                        }
+
+                        if (pos_ >= text_.size())
+                        {
+                            return false;
+                        }
+
+                        char escape = text_[pos_++];
+                        switch (escape)
+                        {
+                            case '"':
+                            case '\\':
+                            case '/':
+                                *out += escape;
+                                break;
+                            case 'b':
+                                *out += '\b';
+                                break;
+                            case 'f':
+                                *out += '\f';
+                                break;
+                            case 'n':
+                                *out += '\n';
+                                break;
+                            case 'r':
+                                *out += '\r';
+                                break;
+                            case 't':
+                                *out += '\t';
+                                break;
+                            case 'u':
+                            {
+                                unsigned long code;
+                                if (!parse_hex4(&code))
+                                {
+                                    return false;
+                                }
+
+                                // Combine a UTF-16 surrogate pair.
+                                if (code >= 0xd800 && code < 0xdc00 && consume("\\u"))
+                                {
+                                    unsigned long low;
+                                    if (!parse_hex4(&low))
+                                    {
+                                        return false;
+                                    }
+                                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                                }
+                                append_utf8(code, out);
+                                break;
+                            }
+                            default:
+                                return false;
+                        }
+                    }
+
+                    return false;
+                }
+
+                bool parse_value(JsonValue* value, int depth)
+                {
+                    if (depth > 64)
+                    {
+                        return false;
+                    }
+
+                    skip_space();
+                    if (pos_ >= text_.size())
+                    {
+                        return false;
+                    }
+
+                    char c = text_[pos_];
+                    if (c == '{')
+                    {
+                        ++pos_;
+                        value->type = JsonValue::JSON_OBJECT;
+                        skip_space();
+                        if (consume("}"))
+                        {
+                            return true;
+                        }
+
+                        for (;;)
+                        {
+                            skip_space();
+                            std::string key;
+                            if (!parse_string(&key))
+                            {
+                                return false;
+                            }
+
+                            skip_space();
+                            if (!consume(":") || !parse_value(&value->object[key], depth + 1))
+                            {
+                                return false;
+                            }
+
+                            skip_space();
+                            if (consume("}"))
+                            {
+                                return true;
+                            }
+                            if (!consume(","))
+                            {
+                                return false;
+                            }
+                        }
+                    }
+                    else if (c == '[')
+                    {
+                        ++pos_;
+                        value->type = JsonValue::JSON_ARRAY;
+                        skip_space();
+                        if (consume("]"))
+                        {
+                            return true;
+                        }
+
+                        for (;;)
+                        {
+                            value->array.push_back(JsonValue());
+                            if (!parse_value(&value->array.back(), depth + 1))
+                            {
+                                return false;
+                            }
+
+                            skip_space();
+                            if (consume("]"))
+                            {
+                                return true;
+                            }
+                            if (!consume(","))
+                            {
+                                return false;
+                            }
+                        }
+                    }
+                    else if (c == '"')
+                    {
+                        value->type = JsonValue::JSON_STRING;
+                        return parse_string(&value->string);
+                    }
+                    else if (consume("true") || consume("false"))
+                    {
+                        value->type = JsonValue::JSON_BOOL;
+                        value->boolean = c == 't';
+                        return true;
+                    }
+                    else if (consume("null"))
+                    {
+                        value->type = JsonValue::JSON_NULL;
+                        return true;
+                    }
+
+                    const char* start = text_.c_str() + pos_;
+                    char* end;
+                    value->type = JsonValue::JSON_NUMBER;
+                    value->number = strtod(start, &end);
+                    if (end == start)
+                    {
+                        return false;
+                    }
+                    pos_ += end - start;
+                    return true;
+                }
+
+                const std::string& text_;
+                size_t pos_;
+            };
+
+        }  // namespace
+
+        const JsonValue* JsonValue::get(const std::string& key) const
+        {
+            if (type != JSON_OBJECT)
+            {
+                return NULL;
+            }
+
+            std::map<std::string, JsonValue>::const_iterator it = object.find(key);
+            return it != object.end() ? &it->second : NULL;
+        }
+
+        bool json_parse(const std::string& text, JsonValue* value)
+        {
+            return Parser(text).parse(value);
+        }
+
+        std::string json_quote(const std::string& text)
+        {
+            std::string out("\"");
+            for (size_t i = 0; i < text.size(); ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(text[i]);
+                switch (c)
+                {
+                    case '"':
+                        out += "\\\"";
+                        break;
+                    case '\\':
+                        out += "\\\\";
+                        break;
+                    case '\n':
+                        out += "\\n";
+                        break;
+                    case '\r':
+                        out += "\\r";
+                        break;
+                    case '\t':
+                        out += "\\t";
+                        break;
+                    default:
+                        if (c < 0x20)
+                        {
+                            char escaped[8];
+                            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                            out += escaped;
+                        }
+                        else
+                        {
+                            out += static_cast<char>(c);
+                        }
+                }
+            }
+            out += '"';
+            return out;
+        }
+
+    }  // namespace detail
+}  // namespace libcred
@@ -0,0 +1,59 @@
+#ifndef SRC_LIBCRED_JSON_H_
+#define SRC_LIBCRED_JSON_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        /**
+         * Just enough JSON to read secret-manager responses: a parsed value
+         * tree without any attempt at speed or full number fidelity.
+         */
+        struct JsonValue
+        {
+            enum Type
+            {
+                JSON_NULL,
+                JSON_BOOL,
+                JSON_NUMBER,
+                JSON_STRING,
+                JSON_ARRAY,
+                JSON_OBJECT
+            };
+
+            JsonValue()
+                : type(JSON_NULL)
+                , boolean(false)
+                , number(0)
+            {
+            }
+
+            /**
+             * Returns the member `key` of an object, or NULL.
+             */
+            const JsonValue* get(const std::string& key) const;
+
+            Type type;
+            bool boolean;
+            double number;
+            std::string string;
+            std::vector<JsonValue> array;
+            std::map<std::string, JsonValue> object;
+        };
+
+        bool json_parse(const std::string& text, JsonValue* value);
+
+        /**
+         * Returns `text` as a quoted JSON string literal.
+         */
+        std::string json_quote(const std::string& text);
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_JSON_H_
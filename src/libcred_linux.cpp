@@ -1,4 +1,7 @@
-#include "libcred.hpp"
+#include "libcred_fork.hpp"
+#include "libcred_internal.hpp"
+#include "libcred_probes.hpp"
+#include "libcred_store.hpp"
 
 // This is needed to make the builds on Ubuntu 14.04 / libsecret v0.16 work.
 // The API we use has already stabilized.
@@ -7,37 +10,652 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
 namespace libcred
 {
 
     namespace
     {
 
-        static const SecretSchema schema = { "org.freedesktop.Secret.Generic",
-                                             SECRET_SCHEMA_NONE,
-                                             { { "service", SECRET_SCHEMA_ATTRIBUTE_STRING },
-                                               { "account", SECRET_SCHEMA_ATTRIBUTE_STRING } } };
+        // GDBus runs every connection on one worker thread, created on first
+        // use and never replaced, so a child forked after that cannot use
+        // D-Bus at all.
+        std::atomic<bool> dbus_used(false);
+        std::atomic<bool> dbus_lost(false);
+
+        bool item_attribute(SecretItem* item, const char* name, std::string* value)
+        {
+            GHashTable* attributes = secret_item_get_attributes(item);
+            const char* raw_value
+                = reinterpret_cast<const char*>(g_hash_table_lookup(attributes, name));
+
+            bool found = raw_value != NULL;
+            if (found)
+            {
+                *value = raw_value;
+            }
+
+            g_hash_table_unref(attributes);
+            return found;
+        }
+
+        /**
+         * The (already loaded) secret of an item as text; false if it has
+         * none.
+         */
+        bool item_password(SecretItem* item, std::string* password)
+        {
+            SecretValue* secret = secret_item_get_secret(item);
+            if (secret == NULL)
+            {
+                return false;
+            }
+
+            const char* text = secret_value_get_text(secret);
+            if (text != NULL)
+            {
+                *password = text;
+            }
+
+            secret_value_unref(secret);
+            return text != NULL;
+        }
+
+        /**
+         * Appends the account and (already loaded) secret of an item. Items
+         * lacking either are skipped.
+         */
+        bool append_credentials(SecretItem* item, std::vector<Credentials>* credentials)
+        {
+            std::string account;
+            std::string password;
+            if (!item_attribute(item, "account", &account) || !item_password(item, &password))
+            {
+                return false;
+            }
+
+            credentials->push_back(Credentials(account, password));
+            return true;
+        }
+
+        // Item calls a bulk operation keeps on the bus at once.
+        const size_t max_pending_calls = 64;
+
+        /**
+         * The item calls of one bulk operation. Rather than one round trip
+         * per item, up to max_pending_calls are in flight, their replies
+         * collected on a main context of our own, pushed for the lifetime of
+         * the batch so that no other source is dispatched meanwhile.
+         */
+        class ItemBatch
+        {
+        public:
+            ItemBatch()
+                : context_(g_main_context_new())
+                , pending_(0)
+                , error_(NULL)
+            {
+                g_main_context_push_thread_default(context_);
+            }
+
+            ~ItemBatch()
+            {
+                drain();
+                g_main_context_pop_thread_default(context_);
+                g_main_context_unref(context_);
+                if (error_ != NULL)
+                {
+                    g_error_free(error_);
+                }
+            }
+
+            /**
+             * Waits for room for one more call, which the caller then starts
+             * with one of the callbacks below and the batch as user data.
+             * False once a call has failed.
+             */
+            bool reserve()
+            {
+                while (pending_ >= max_pending_calls)
+                {
+                    g_main_context_iteration(context_, TRUE);
+                }
+                if (error_ != NULL)
+                {
+                    return false;
+                }
+                ++pending_;
+                return true;
+            }
+
+            /**
+             * Waits for every call; FAIL_ERROR with the first failure, if any.
+             */
+            LIBCRED_RESULT wait(std::string* errStr)
+            {
+                drain();
+                if (error_ != NULL)
+                {
+                    *errStr = std::string(error_->message);
+                    return FAIL_ERROR;
+                }
+                return SUCCESS;
+            }
+
+            /**
+             * The items of the deletions and attribute changes that succeeded.
+             */
+            const std::vector<SecretItem*>& done() const
+            {
+                return done_;
+            }
+
+            static void on_deleted(GObject* source, GAsyncResult* result, gpointer data)
+            {
+                SecretItem* item = reinterpret_cast<SecretItem*>(source);
+                GError* error = NULL;
+                bool ok = secret_item_delete_finish(item, result, &error);
+                reinterpret_cast<ItemBatch*>(data)->finish(ok ? item : NULL, error);
+            }
+
+            static void on_attributes_set(GObject* source, GAsyncResult* result, gpointer data)
+            {
+                SecretItem* item = reinterpret_cast<SecretItem*>(source);
+                GError* error = NULL;
+                bool ok = secret_item_set_attributes_finish(item, result, &error);
+                reinterpret_cast<ItemBatch*>(data)->finish(ok ? item : NULL, error);
+            }
+
+            // Labels are not counted as done: they only follow the attributes.
+            static void on_label_set(GObject* source, GAsyncResult* result, gpointer data)
+            {
+                GError* error = NULL;
+                secret_item_set_label_finish(reinterpret_cast<SecretItem*>(source), result, &error);
+                reinterpret_cast<ItemBatch*>(data)->finish(NULL, error);
+            }
+
+        private:
+            ItemBatch(const ItemBatch&);
+            ItemBatch& operator=(const ItemBatch&);
+
+            void drain()
+            {
+                while (pending_ > 0)
+                {
+                    g_main_context_iteration(context_, TRUE);
+                }
+            }
+
+            void finish(SecretItem* done, GError* error)
+            {
+                if (done != NULL)
+                {
+                    done_.push_back(done);
+                }
+                if (error != NULL && error_ == NULL)
+                {
+                    error_ = error;
+                }
+                else if (error != NULL)
+                {
+                    g_error_free(error);
+                }
+                --pending_;
+            }
+
+            GMainContext* context_;
+            size_t pending_;
+            GError* error_;  // The first failure.
+            std::vector<SecretItem*> done_;
+        };
+
+        /**
+         * One search per collection, all in flight at once on a main context
+         * of our own, so that several collections take about as long as the
+         * slowest of them. Each collection is looked up by alias, or by
+         * object path if it starts with a slash, and searched as soon as it
+         * is found; a collection that does not exist holds nothing, whether
+         * named by alias or by path. schema and attributes must outlive the
+         * search.
+         */
+        class CollectionSearch
+        {
+        public:
+            CollectionSearch(SecretService* service,
+                             const SecretSchema* schema,
+                             GHashTable* attributes,
+                             SecretSearchFlags flags,
+                             const std::vector<std::string>& collections)
+                : context_(g_main_context_new())
+                , schema_(schema)
+                , attributes_(attributes)
+                , flags_(flags)
+                , searches_(collections.size())
+                , pending_(collections.size())
+                , error_(NULL)
+            {
+                g_main_context_push_thread_default(context_);
+                for (size_t i = 0; i < collections.size(); ++i)
+                {
+                    Search& search = searches_[i];
+                    search.owner = this;
+                    search.name = collections[i].c_str();
+
+                    LIBCRED_PROBE1(collection_search__start, search.name);
+                    if (search.name[0] == '/')
+                    {
+                        secret_collection_new_for_dbus_path(
+                            service, search.name, SECRET_COLLECTION_NONE, NULL, on_found, &search);
+                    }
+                    else
+                    {
+                        secret_collection_for_alias(
+                            service, search.name, SECRET_COLLECTION_NONE, NULL, on_found, &search);
+                    }
+                }
+            }
+
+            ~CollectionSearch()
+            {
+                drain();
+                for (size_t i = 0; i < searches_.size(); ++i)
+                {
+                    if (searches_[i].collection != NULL)
+                    {
+                        g_object_unref(searches_[i].collection);
+                    }
+                    g_list_free_full(searches_[i].items, g_object_unref);
+                }
+                g_main_context_pop_thread_default(context_);
+                g_main_context_unref(context_);
+                if (error_ != NULL)
+                {
+                    g_error_free(error_);
+                }
+            }
+
+            /**
+             * Waits for every search; FAIL_ERROR with the first failure, if
+             * any.
+             */
+            LIBCRED_RESULT wait(std::string* errStr)
+            {
+                drain();
+                if (error_ != NULL)
+                {
+                    *errStr = std::string(error_->message);
+                    return FAIL_ERROR;
+                }
+                return SUCCESS;
+            }
+
+            /**
+             * The items found in the i-th collection, owned by the search.
+             */
+            GList* items(size_t i) const
+            {
+                return searches_[i].items;
+            }
+
+        private:
+            CollectionSearch(const CollectionSearch&);
+            CollectionSearch& operator=(const CollectionSearch&);
+
+            struct Search
+            {
+                Search()
+                    : owner(NULL)
+                    , name(NULL)
+                    , collection(NULL)
+                    , items(NULL)
+                {
+                }
+
+                CollectionSearch* owner;
+                const char* name;
+                SecretCollection* collection;
+                GList* items;
+            };
+
+            static void on_found(GObject* source, GAsyncResult* result, gpointer data)
+            {
+                Search* search = reinterpret_cast<Search*>(data);
+                CollectionSearch* owner = search->owner;
+
+                GError* error = NULL;
+                if (search->name[0] == '/')
+                {
+                    search->collection = secret_collection_new_for_dbus_path_finish(result, &error);
+                }
+                else
+                {
+                    search->collection = secret_collection_for_alias_finish(result, &error);
+                }
+                // An unknown alias resolves to no collection, but an unknown
+                // path fails to load its properties; both hold nothing.
+                if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)
+                    || g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT))
+                {
+                    g_error_free(error);
+                    error = NULL;
+                }
+                if (search->collection == NULL)
+                {
+                    owner->finish(search, error);
+                    return;
+                }
+
+                secret_collection_search(search->collection,
+                                         owner->schema_,
+                                         owner->attributes_,
+                                         owner->flags_,
+                                         NULL,
+                                         on_searched,
+                                         search);
+            }
+
+            static void on_searched(GObject* source, GAsyncResult* result, gpointer data)
+            {
+                Search* search = reinterpret_cast<Search*>(data);
+                GError* error = NULL;
+                search->items = secret_collection_search_finish(
+                    reinterpret_cast<SecretCollection*>(source), result, &error);
+                search->owner->finish(search, error);
+            }
+
+            void drain()
+            {
+                while (pending_ > 0)
+                {
+                    g_main_context_iteration(context_, TRUE);
+                }
+            }
+
+            void finish(Search* search, GError* error)
+            {
+                LIBCRED_PROBE3(collection_search__done,
+                               search->name,
+                               error != NULL ? FAIL_ERROR : SUCCESS,
+                               g_list_length(search->items));
+
+                if (error != NULL && error_ == NULL)
+                {
+                    error_ = error;
+                }
+                else if (error != NULL)
+                {
+                    g_error_free(error);
+                }
+                --pending_;
+            }
+
+            GMainContext* context_;
+            const SecretSchema* schema_;
+            GHashTable* attributes_;
+            SecretSearchFlags flags_;
+            std::vector<Search> searches_;  // Never resized: the calls point into it.
+            size_t pending_;
+            GError* error_;  // The first failure.
+        };
+
+        /**
+         * Backend over the Secret Service. Each instance opens its own service
+         * proxy and session on first use, and stores its items under its own
+         * schema name and collection.
+         *
+         * In a forked child the proxy is dropped, and a new one is opened on
+         * next use if D-Bus is still usable (see dbus_used); otherwise calls
+         * fail with an error instead of hanging.
+         */
+        class SecretServiceBackend : public Backend, public detail::ForkHandler
+        {
+        public:
+            explicit SecretServiceBackend(const StoreOptions& options);
+            ~SecretServiceBackend();
+
+            using Backend::count_credentials;
+            using Backend::delete_password;
+            using Backend::find_credentials;
+            using Backend::find_password;
+            using Backend::get_password;
+            using Backend::set_password;
+
+            LIBCRED_RESULT set_password(const std::string& service,
+                                        const std::string& account,
+                                        const std::string& password,
+                                        std::string* error);
+
+            LIBCRED_RESULT get_password(const std::string& service,
+                                        const std::string& account,
+                                        std::string* password,
+                                        std::string* error);
+
+            LIBCRED_RESULT delete_password(const std::string& service,
+                                           const std::string& account,
+                                           std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         LIBCRED_FIND_POLICY policy,
+                                         std::string* account,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            size_t limit,
+                                            const std::string& cursor,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* next_cursor,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_credentials(
+                const std::vector<std::string>& services,
+                std::map<std::string, std::vector<Credentials>>* credentials,
+                std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            const std::vector<std::string>& collections,
+                                            LIBCRED_MERGE_POLICY policy,
+                                            std::vector<CollectionCredentials>* found,
+                                            std::string* error);
+
+            LIBCRED_RESULT count_credentials(const std::string& service,
+                                             size_t* count,
+                                             std::string* error);
+
+            LIBCRED_RESULT count_credentials(const std::vector<std::string>& services,
+                                             std::map<std::string, size_t>* counts,
+                                             std::string* error);
+
+            LIBCRED_RESULT delete_credentials(const std::string& service,
+                                              size_t* deleted,
+                                              std::string* error);
+
+            LIBCRED_RESULT rename_service(const std::string& from,
+                                          const std::string& to,
+                                          std::vector<std::string>* accounts,
+                                          std::string* error);
+
+            LIBCRED_RESULT set_password(ServiceId service,
+                                        AccountId account,
+                                        const std::string& password,
+                                        std::string* error);
+
+            LIBCRED_RESULT get_modified(const std::string& service,
+                                        const std::string& account,
+                                        time_t* modified,
+                                        std::string* error);
+
+            void prepare_fork();
+            void parent_after_fork();
+            void child_after_fork();
+
+        private:
+            SecretServiceBackend(const SecretServiceBackend&);
+            SecretServiceBackend& operator=(const SecretServiceBackend&);
+
+            SecretService* connect(std::string* errStr);
+
+            LIBCRED_RESULT store_password(const std::string& service,
+                                          const std::string& account,
+                                          const char* label,
+                                          const std::string& password,
+                                          std::string* errStr);
+
+            LIBCRED_RESULT lookup_password(GHashTable* attributes,
+                                           std::string* password,
+                                           std::string* errStr);
+
+            LIBCRED_RESULT search_items(const char* service,
+                                        SecretSearchFlags flags,
+                                        GList** items,
+                                        std::string* errStr);
+
+            std::string schema_name_;
+            std::string collection_;
+            int timeout_ms_;
+            SecretSchema schema_;
+
+            std::mutex mutex_;
+            SecretService* service_;
+        };
 
     }  // namespace
 
-    LIBCRED_RESULT set_password(const std::string& service,
-                                const std::string& account,
-                                const std::string& password,
-                                std::string* errStr)
+    SecretServiceBackend::SecretServiceBackend(const StoreOptions& options)
+        : schema_name_(options.schema_name)
+        , collection_(options.collection)
+        , timeout_ms_(options.timeout_ms)
+        , service_(NULL)
+    {
+        memset(&schema_, 0, sizeof(schema_));
+        schema_.name = schema_name_.c_str();
+        schema_.flags = SECRET_SCHEMA_NONE;
+        schema_.attributes[0].name = "service";
+        schema_.attributes[0].type = SECRET_SCHEMA_ATTRIBUTE_STRING;
+        schema_.attributes[1].name = "account";
+        schema_.attributes[1].type = SECRET_SCHEMA_ATTRIBUTE_STRING;
+
+        detail::register_fork_handler(this);
+    }
+
+    SecretServiceBackend::~SecretServiceBackend()
+    {
+        detail::unregister_fork_handler(this);
+        if (service_ != NULL)
+        {
+            g_object_unref(service_);
+        }
+    }
+
+    /**
+     * Opens this backend's own (unshared) service proxy on first use, so its
+     * session and call timeout are independent of other backends.
+     */
+    SecretService* SecretServiceBackend::connect(std::string* errStr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (service_ != NULL)
+        {
+            return service_;
+        }
+
+        if (dbus_lost)
+        {
+            *errStr = "The Secret Service is unreachable from a process forked after libcred "
+                      "used D-Bus; passwords cached before the fork are still served";
+            return NULL;
+        }
+
+        LIBCRED_PROBE0(connect__start);
+
+        GError* error = NULL;
+        SecretService* service = secret_service_open_sync(
+            SECRET_TYPE_SERVICE, NULL, SECRET_SERVICE_OPEN_SESSION, NULL, &error);
+
+        LIBCRED_PROBE1(connect__done, error == NULL);
+
+        if (error != NULL)
+        {
+            *errStr = std::string(error->message);
+            g_error_free(error);
+            return NULL;
+        }
+
+        if (timeout_ms_ >= 0)
+        {
+            g_dbus_proxy_set_default_timeout(G_DBUS_PROXY(service), timeout_ms_);
+        }
+
+        service_ = service;
+        dbus_used = true;
+        return service_;
+    }
+
+    /**
+     * Waits for a connect() in progress, so the child sees service_ either
+     * set or not.
+     */
+    void SecretServiceBackend::prepare_fork()
+    {
+        mutex_.lock();
+    }
+
+    void SecretServiceBackend::parent_after_fork()
+    {
+        mutex_.unlock();
+    }
+
+    void SecretServiceBackend::child_after_fork()
+    {
+        // Leaked: unreferencing it would talk to the GDBus worker, which the
+        // child does not have.
+        service_ = NULL;
+        dbus_lost = dbus_used.load();
+        mutex_.unlock();
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::store_password(const std::string& service,
+                                                        const std::string& account,
+                                                        const char* label,
+                                                        const std::string& password,
+                                                        std::string* errStr)
     {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
         GError* error = NULL;
 
-        secret_password_store_sync(&schema,                            // The schema.
-                                   SECRET_COLLECTION_DEFAULT,          // Default collection.
-                                   (service + "/" + account).c_str(),  // The label.
-                                   password.c_str(),                   // The password.
-                                   NULL,                               // Cancellable. (unneeded)
-                                   &error,                             // Reference to the error.
-                                   "service",
-                                   service.c_str(),
-                                   "account",
-                                   account.c_str(),
-                                   NULL);  // End of arguments.
+        GHashTable* attributes = secret_attributes_build(
+            &schema_, "service", service.c_str(), "account", account.c_str(), NULL);
+        SecretValue* value = secret_value_new(password.c_str(), -1, "text/plain");
+
+        secret_service_store_sync(secret_service,
+                                  &schema_,  // The schema.
+                                  attributes,
+                                  collection_.empty() ? NULL : collection_.c_str(),
+                                  label,     // The label.
+                                  value,     // The password.
+                                  NULL,      // Cancellable. (unneeded)
+                                  &error);   // Reference to the error.
+
+        secret_value_unref(value);
+        g_hash_table_unref(attributes);
 
         if (error != NULL)
         {
@@ -49,21 +667,28 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT get_password(const std::string& service,
-                                const std::string& account,
-                                std::string* password,
-                                std::string* errStr)
+    LIBCRED_RESULT SecretServiceBackend::lookup_password(GHashTable* attributes,
+                                                         std::string* password,
+                                                         std::string* errStr)
     {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
         GError* error = NULL;
 
-        gchar* raw_password = secret_password_lookup_sync(&schema,  // The schema.
-                                                          NULL,     // Cancellable. (unneeded)
-                                                          &error,   // Reference to the error.
-                                                          "service",
-                                                          service.c_str(),
-                                                          "account",
-                                                          account.c_str(),
-                                                          NULL);  // End of arguments.
+        LIBCRED_PROBE0(lookup__start);
+
+        SecretValue* value = secret_service_lookup_sync(secret_service,
+                                                        &schema_,  // The schema.
+                                                        attributes,
+                                                        NULL,      // Cancellable. (unneeded)
+                                                        &error);   // Reference to the error.
+
+        LIBCRED_PROBE1(lookup__done,
+                       error != NULL ? FAIL_ERROR : value != NULL ? SUCCESS : FAIL_NONFATAL);
 
         if (error != NULL)
         {
@@ -72,28 +697,110 @@ namespace libcred
             return FAIL_ERROR;
         }
 
-        if (raw_password == NULL)
+        if (value == NULL)
             return FAIL_NONFATAL;
 
-        *password = raw_password;
-        secret_password_free(raw_password);
+        const char* text = secret_value_get_text(value);
+        if (text != NULL)
+        {
+            *password = text;
+        }
+        secret_value_unref(value);
+        return text != NULL ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    /**
+     * Searches items of our schema, restricted to a service unless it is
+     * NULL. On success *items holds a list the caller must free.
+     */
+    LIBCRED_RESULT SecretServiceBackend::search_items(const char* service,
+                                                      SecretSearchFlags flags,
+                                                      GList** items,
+                                                      std::string* errStr)
+    {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
+        GError* error = NULL;
+
+        GHashTable* attributes = g_hash_table_new(NULL, NULL);
+        if (service != NULL)
+        {
+            g_hash_table_replace(attributes, (gpointer) "service", (gpointer) service);
+        }
+
+        LIBCRED_PROBE1(search__start, service);
+
+        *items = secret_service_search_sync(secret_service,
+                                            &schema_,  // The schema.
+                                            attributes,
+                                            flags,
+                                            NULL,      // Cancellable. (unneeded)
+                                            &error);   // Reference to the error.
+
+        LIBCRED_PROBE3(search__done,
+                       service,
+                       error != NULL ? FAIL_ERROR : SUCCESS,
+                       error != NULL ? 0 : g_list_length(*items));
+
+        g_hash_table_destroy(attributes);
+
+        if (error != NULL)
+        {
+            *errStr = std::string(error->message);
+            g_error_free(error);
+            return FAIL_ERROR;
+        }
+
         return SUCCESS;
     }
 
-    LIBCRED_RESULT delete_password(const std::string& service,
-                                   const std::string& account,
-                                   std::string* errStr)
+    LIBCRED_RESULT SecretServiceBackend::set_password(const std::string& service,
+                                                      const std::string& account,
+                                                      const std::string& password,
+                                                      std::string* errStr)
     {
+        return store_password(
+            service, account, (service + "/" + account).c_str(), password, errStr);
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::get_password(const std::string& service,
+                                                      const std::string& account,
+                                                      std::string* password,
+                                                      std::string* errStr)
+    {
+        GHashTable* attributes = secret_attributes_build(
+            &schema_, "service", service.c_str(), "account", account.c_str(), NULL);
+        LIBCRED_RESULT result = lookup_password(attributes, password, errStr);
+        g_hash_table_unref(attributes);
+        return result;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::delete_password(const std::string& service,
+                                                         const std::string& account,
+                                                         std::string* errStr)
+    {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
         GError* error = NULL;
 
-        gboolean result = secret_password_clear_sync(&schema,  // The schema.
-                                                     NULL,     // Cancellable. (unneeded)
-                                                     &error,   // Reference to the error.
-                                                     "service",
-                                                     service.c_str(),
-                                                     "account",
-                                                     account.c_str(),
-                                                     NULL);  // End of arguments.
+        GHashTable* attributes = secret_attributes_build(
+            &schema_, "service", service.c_str(), "account", account.c_str(), NULL);
+
+        gboolean result = secret_service_clear_sync(secret_service,
+                                                    &schema_,  // The schema.
+                                                    attributes,
+                                                    NULL,      // Cancellable. (unneeded)
+                                                    &error);   // Reference to the error.
+
+        g_hash_table_unref(attributes);
 
         if (error != NULL)
         {
@@ -108,51 +815,377 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT find_password(const std::string& service,
-                                 std::string* password,
-                                 std::string* errStr)
+    LIBCRED_RESULT SecretServiceBackend::find_password(const std::string& service,
+                                                       std::string* password,
+                                                       std::string* errStr)
     {
-        GError* error = NULL;
+        GHashTable* attributes
+            = secret_attributes_build(&schema_, "service", service.c_str(), NULL);
+        LIBCRED_RESULT result = lookup_password(attributes, password, errStr);
+        g_hash_table_unref(attributes);
+        return result;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::find_password(const std::string& service,
+                                                       LIBCRED_FIND_POLICY policy,
+                                                       std::string* account,
+                                                       std::string* password,
+                                                       std::string* errStr)
+    {
+        if (policy == FIND_ANY && account == NULL)
+        {
+            return find_password(service, password, errStr);
+        }
 
-        gchar* raw_password = secret_password_lookup_sync(&schema,  // The schema.
-                                                          NULL,     // Cancellable. (unneeded)
-                                                          &error,   // Reference to the error.
-                                                          "service",
-                                                          service.c_str(),
-                                                          NULL);  // End of arguments.
+        GList* items;
+        LIBCRED_RESULT result = search_items(
+            service.c_str(),
+            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK),
+            &items,
+            errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        // Pick the item from its attributes and modification time alone.
+        SecretItem* chosen = NULL;
+        std::string chosen_account;
+        guint64 chosen_modified = 0;
+        for (GList* current = items; current != NULL; current = current->next)
+        {
+            SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+
+            std::string item_account;
+            if (!item_attribute(item, "account", &item_account))
+            {
+                continue;
+            }
+
+            guint64 modified = secret_item_get_modified(item);
+            bool better = chosen == NULL;
+            if (!better && policy == FIND_MOST_RECENT)
+            {
+                better = modified > chosen_modified
+                         || (modified == chosen_modified && item_account < chosen_account);
+            }
+            else if (!better && policy == FIND_FIRST_ACCOUNT)
+            {
+                better = item_account < chosen_account;
+            }
 
+            if (better)
+            {
+                chosen = item;
+                chosen_account = item_account;
+                chosen_modified = modified;
+            }
+        }
+
+        if (chosen == NULL)
+        {
+            g_list_free_full(items, g_object_unref);
+            return FAIL_NONFATAL;
+        }
+
+        GError* error = NULL;
+        secret_item_load_secret_sync(chosen, NULL, &error);
         if (error != NULL)
         {
             *errStr = std::string(error->message);
             g_error_free(error);
+            g_list_free_full(items, g_object_unref);
             return FAIL_ERROR;
         }
 
-        if (raw_password == NULL)
+        std::vector<Credentials> credentials;
+        append_credentials(chosen, &credentials);
+        g_list_free_full(items, g_object_unref);
+
+        if (credentials.empty())
+        {
             return FAIL_NONFATAL;
+        }
 
-        *password = raw_password;
-        secret_password_free(raw_password);
+        if (account != NULL)
+        {
+            *account = credentials[0].first;
+        }
+        *password = credentials[0].second;
         return SUCCESS;
     }
 
-    LIBCRED_RESULT find_credentials(const std::string& service,
-                                    std::vector<Credentials>* credentials,
-                                    std::string* errStr)
+    LIBCRED_RESULT SecretServiceBackend::find_credentials(const std::string& service,
+                                                          std::vector<Credentials>* credentials,
+                                                          std::string* errStr)
     {
+        GList* items;
+        LIBCRED_RESULT result = search_items(
+            service.c_str(),
+            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK
+                                           | SECRET_SEARCH_LOAD_SECRETS),
+            &items,
+            errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        for (GList* current = items; current != NULL; current = current->next)
+        {
+            append_credentials(reinterpret_cast<SecretItem*>(current->data), credentials);
+        }
+
+        g_list_free_full(items, g_object_unref);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::find_credentials(const std::string& service,
+                                                          size_t limit,
+                                                          const std::string& cursor,
+                                                          std::vector<Credentials>* credentials,
+                                                          std::string* next_cursor,
+                                                          std::string* errStr)
+    {
+        // Search without secrets, order the items by account and only load
+        // the secrets of the requested page.
+        GList* items;
+        LIBCRED_RESULT result = search_items(
+            service.c_str(),
+            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK),
+            &items,
+            errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        std::vector<std::pair<std::string, SecretItem*>> sorted;
+        for (GList* current = items; current != NULL; current = current->next)
+        {
+            SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+
+            std::string account;
+            if (item_attribute(item, "account", &account))
+            {
+                sorted.push_back(std::make_pair(account, item));
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<std::string> accounts;
+        accounts.reserve(sorted.size());
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            accounts.push_back(sorted[i].first);
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, errStr))
+        {
+            g_list_free_full(items, g_object_unref);
+            return FAIL_ERROR;
+        }
+
+        GList* page = NULL;
+        for (size_t i = end; i > begin; --i)
+        {
+            page = g_list_prepend(page, sorted[i - 1].second);
+        }
+
         GError* error = NULL;
+        if (page != NULL)
+        {
+            LIBCRED_PROBE1(load_secrets__start, end - begin);
+            secret_item_load_secrets_sync(page, NULL, &error);
+            LIBCRED_PROBE2(load_secrets__done, end - begin, error != NULL ? FAIL_ERROR : SUCCESS);
+        }
+
+        if (error == NULL)
+        {
+            for (GList* current = page; current != NULL; current = current->next)
+            {
+                append_credentials(reinterpret_cast<SecretItem*>(current->data), credentials);
+            }
+        }
+
+        g_list_free(page);
+        g_list_free_full(items, g_object_unref);
+
+        if (error != NULL)
+        {
+            *errStr = std::string(error->message);
+            g_error_free(error);
+            return FAIL_ERROR;
+        }
+
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* errStr)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            (*credentials)[*it];
+        }
+
+        if (wanted.empty())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        // A single service can be matched by the search itself. For several we
+        // search the whole schema once and pick the matching items locally, so
+        // the number of D-Bus round trips doesn't grow with the service count.
+        GList* items;
+        LIBCRED_RESULT result = search_items(
+            wanted.size() == 1 ? wanted.begin()->c_str() : NULL,
+            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK),
+            &items,
+            errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        GList* matched = NULL;
+        for (GList* current = items; current != NULL; current = current->next)
+        {
+            std::string item_service;
+            if (item_attribute(reinterpret_cast<SecretItem*>(current->data),
+                               "service",
+                               &item_service)
+                && wanted.count(item_service) != 0)
+            {
+                matched = g_list_prepend(matched, current->data);
+            }
+        }
+        matched = g_list_reverse(matched);
+
+        // Fetch the secrets of every matched item in one GetSecrets call.
+        GError* error = NULL;
+        if (matched != NULL)
+        {
+            LIBCRED_PROBE1(load_secrets__start, g_list_length(matched));
+            secret_item_load_secrets_sync(matched, NULL, &error);
+            LIBCRED_PROBE2(load_secrets__done,
+                           g_list_length(matched),
+                           error != NULL ? FAIL_ERROR : SUCCESS);
+        }
+
+        if (error != NULL)
+        {
+            *errStr = std::string(error->message);
+            g_error_free(error);
+            g_list_free(matched);
+            g_list_free_full(items, g_object_unref);
+            return FAIL_ERROR;
+        }
+
+        size_t found = 0;
+        for (GList* current = matched; current != NULL; current = current->next)
+        {
+            SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+
+            std::string item_service;
+            item_attribute(item, "service", &item_service);
+            if (append_credentials(item, &(*credentials)[item_service]))
+            {
+                ++found;
+            }
+        }
+
+        g_list_free(matched);
+        g_list_free_full(items, g_object_unref);
+        return found != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::find_credentials(
+        const std::string& service,
+        const std::vector<std::string>& collections,
+        LIBCRED_MERGE_POLICY policy,
+        std::vector<CollectionCredentials>* found,
+        std::string* errStr)
+    {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
 
         GHashTable* attributes = g_hash_table_new(NULL, NULL);
         g_hash_table_replace(attributes, (gpointer) "service", (gpointer) service.c_str());
 
-        GList* items = secret_service_search_sync(
-            NULL,
-            &schema,  // The schema.
-            attributes,
-            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK
-                                           | SECRET_SEARCH_LOAD_SECRETS),
-            NULL,     // Cancellable. (unneeded)
-            &error);  // Reference to the error.
+        // Accounts and times come with the search; secrets are loaded only
+        // for the credentials the merge keeps.
+        std::vector<std::vector<Credentials>> credentials(collections.size());
+        std::vector<std::vector<time_t>> modified(collections.size());
+        std::vector<std::vector<SecretItem*>> sources(collections.size());
+        std::vector<CollectionCredentials> merged;
+        size_t before = found->size();
+        GError* error = NULL;
+        LIBCRED_RESULT result;
+        {
+            CollectionSearch search(
+                secret_service,
+                &schema_,
+                attributes,
+                static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK),
+                collections);
+            result = search.wait(errStr);
+
+            for (size_t i = 0; result == SUCCESS && i < collections.size(); ++i)
+            {
+                for (GList* current = search.items(i); current != NULL; current = current->next)
+                {
+                    SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+                    std::string account;
+                    if (item_attribute(item, "account", &account))
+                    {
+                        credentials[i].push_back(Credentials(account, std::string()));
+                        modified[i].push_back(static_cast<time_t>(secret_item_get_modified(item)));
+                        sources[i].push_back(item);
+                    }
+                }
+            }
+
+            std::vector<std::pair<size_t, size_t>> origins;
+            if (result == SUCCESS)
+            {
+                detail::merge_collections(
+                    collections, credentials, modified, policy, &merged, &origins);
+            }
+
+            GList* kept = NULL;
+            for (size_t k = origins.size(); k > 0; --k)
+            {
+                kept = g_list_prepend(kept, sources[origins[k - 1].first][origins[k - 1].second]);
+            }
+
+            if (kept != NULL)
+            {
+                LIBCRED_PROBE1(load_secrets__start, origins.size());
+                secret_item_load_secrets_sync(kept, NULL, &error);
+                LIBCRED_PROBE2(
+                    load_secrets__done, origins.size(), error != NULL ? FAIL_ERROR : SUCCESS);
+            }
+
+            size_t k = 0;
+            for (GList* current = kept; error == NULL && current != NULL; current = current->next)
+            {
+                SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+                if (item_password(item, &merged[k].credentials.second))
+                {
+                    found->push_back(merged[k]);
+                }
+                ++k;
+            }
+            g_list_free(kept);
+        }
 
         g_hash_table_destroy(attributes);
 
@@ -162,36 +1195,300 @@ namespace libcred
             g_error_free(error);
             return FAIL_ERROR;
         }
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+        return found->size() != before ? SUCCESS : FAIL_NONFATAL;
+    }
 
-        GList* current = items;
-        for (current = items; current != NULL; current = current->next)
+    LIBCRED_RESULT SecretServiceBackend::count_credentials(const std::string& service,
+                                                           size_t* count,
+                                                           std::string* errStr)
+    {
+        std::vector<std::string> services(1, service);
+        std::map<std::string, size_t> counts;
+        LIBCRED_RESULT result = count_credentials(services, &counts, errStr);
+        *count = counts[service];
+        return result;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::count_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, size_t>* counts,
+        std::string* errStr)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            (*counts)[*it] = 0;
+        }
+
+        if (wanted.empty())
+        {
+            return SUCCESS;
+        }
+
+        // Item attributes are readable while their collection is locked, so
+        // counting neither unlocks nor loads anything: one search, whatever
+        // the number of services (see find_credentials).
+        GList* items;
+        LIBCRED_RESULT result = search_items(wanted.size() == 1 ? wanted.begin()->c_str() : NULL,
+                                             SECRET_SEARCH_ALL,
+                                             &items,
+                                             errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        for (GList* current = items; current != NULL; current = current->next)
         {
             SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
 
-            GHashTable* itemAttrs = secret_item_get_attributes(item);
-            char* account
-                = strdup(reinterpret_cast<char*>(g_hash_table_lookup(itemAttrs, "account")));
+            std::string item_service, account;
+            if (item_attribute(item, "service", &item_service) && wanted.count(item_service) != 0
+                && item_attribute(item, "account", &account))
+            {
+                ++(*counts)[item_service];
+            }
+        }
 
-            SecretValue* secret = secret_item_get_secret(item);
-            char* password = strdup(secret_value_get_text(secret));
+        g_list_free_full(items, g_object_unref);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::delete_credentials(const std::string& service,
+                                                            size_t* deleted,
+                                                            std::string* errStr)
+    {
+        *deleted = 0;
+
+        // The search matches attributes only; no secret is transferred.
+        GList* items;
+        LIBCRED_RESULT result = search_items(
+            service.c_str(),
+            static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK),
+            &items,
+            errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        LIBCRED_PROBE1(delete_items__start, g_list_length(items));
 
-            if (account == NULL || password == NULL)
+        {
+            ItemBatch batch;
+            for (GList* current = items; current != NULL && batch.reserve();
+                 current = current->next)
             {
-                if (account)
-                    free(account);
+                secret_item_delete(reinterpret_cast<SecretItem*>(current->data),
+                                   NULL,
+                                   ItemBatch::on_deleted,
+                                   &batch);
+            }
+            result = batch.wait(errStr);
+            *deleted = batch.done().size();
+        }
+        g_list_free_full(items, g_object_unref);
 
-                if (password)
-                    free(password);
+        LIBCRED_PROBE2(delete_items__done, *deleted, result);
 
-                continue;
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::rename_service(const std::string& from,
+                                                        const std::string& to,
+                                                        std::vector<std::string>* accounts,
+                                                        std::string* errStr)
+    {
+        if (from == to)
+        {
+            *errStr = "A service cannot be renamed to itself";
+            return FAIL_ERROR;
+        }
+
+        // Both searches match attributes only; no secret is transferred.
+        SecretSearchFlags flags
+            = static_cast<SecretSearchFlags>(SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK);
+        GList* items;
+        LIBCRED_RESULT result = search_items(from.c_str(), flags, &items, errStr);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        GList* existing;
+        result = search_items(to.c_str(), flags, &existing, errStr);
+        if (result != SUCCESS)
+        {
+            g_list_free_full(items, g_object_unref);
+            return result;
+        }
+
+        std::map<SecretItem*, std::string> renaming;
+        std::set<std::string> renamed_accounts;
+        for (GList* current = items; current != NULL; current = current->next)
+        {
+            SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+            std::string account;
+            if (item_attribute(item, "account", &account))
+            {
+                renaming[item] = account;
+                renamed_accounts.insert(account);
             }
+        }
 
-            credentials->push_back(Credentials(account, password));
-            free(account);
-            free(password);
+        LIBCRED_PROBE1(rename_items__start, renaming.size());
+
+        // Credentials of the new service under a renamed account are
+        // replaced, as set_password would, rather than left as duplicates.
+        {
+            ItemBatch batch;
+            for (GList* current = existing; current != NULL; current = current->next)
+            {
+                SecretItem* item = reinterpret_cast<SecretItem*>(current->data);
+                std::string account;
+                if (item_attribute(item, "account", &account)
+                    && renamed_accounts.count(account) != 0)
+                {
+                    if (!batch.reserve())
+                    {
+                        break;
+                    }
+                    secret_item_delete(item, NULL, ItemBatch::on_deleted, &batch);
+                }
+            }
+            result = batch.wait(errStr);
+        }
+
+        // Then rewrite the attributes and labels in place.
+        size_t renamed = 0;
+        if (result == SUCCESS)
+        {
+            ItemBatch batch;
+            for (std::map<SecretItem*, std::string>::const_iterator it = renaming.begin();
+                 it != renaming.end() && batch.reserve();
+                 ++it)
+            {
+                GHashTable* attributes = secret_attributes_build(
+                    &schema_, "service", to.c_str(), "account", it->second.c_str(), NULL);
+                secret_item_set_attributes(
+                    it->first, &schema_, attributes, NULL, ItemBatch::on_attributes_set, &batch);
+                g_hash_table_unref(attributes);
+
+                if (!batch.reserve())
+                {
+                    break;
+                }
+                secret_item_set_label(it->first,
+                                      (to + "/" + it->second).c_str(),
+                                      NULL,
+                                      ItemBatch::on_label_set,
+                                      &batch);
+            }
+            result = batch.wait(errStr);
+
+            for (std::vector<SecretItem*>::const_iterator it = batch.done().begin();
+                 it != batch.done().end();
+                 ++it)
+            {
+                accounts->push_back(renaming[*it]);
+            }
+            renamed = batch.done().size();
+        }
+
+        g_list_free_full(existing, g_object_unref);
+        g_list_free_full(items, g_object_unref);
+
+        LIBCRED_PROBE2(rename_items__done, renamed, result);
+
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+        return renamed != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::set_password(ServiceId service,
+                                                      AccountId account,
+                                                      const std::string& password,
+                                                      std::string* errStr)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, errStr))
+        {
+            return FAIL_ERROR;
         }
 
+        return store_password(*service_str,
+                              *account_str,
+                              detail::key_label(service, account)->c_str(),
+                              password,
+                              errStr);
+    }
+
+    LIBCRED_RESULT SecretServiceBackend::get_modified(const std::string& service,
+                                                      const std::string& account,
+                                                      time_t* modified,
+                                                      std::string* errStr)
+    {
+        SecretService* secret_service = connect(errStr);
+        if (secret_service == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
+        GError* error = NULL;
+
+        GHashTable* attributes = secret_attributes_build(
+            &schema_, "service", service.c_str(), "account", account.c_str(), NULL);
+
+        LIBCRED_PROBE1(search__start, service.c_str());
+
+        // Neither unlocks nor loads the secret: item properties are readable
+        // while the collection is locked.
+        GList* items = secret_service_search_sync(secret_service,
+                                                  &schema_,  // The schema.
+                                                  attributes,
+                                                  SECRET_SEARCH_NONE,
+                                                  NULL,      // Cancellable. (unneeded)
+                                                  &error);   // Reference to the error.
+
+        LIBCRED_PROBE3(search__done,
+                       service.c_str(),
+                       error != NULL ? FAIL_ERROR : SUCCESS,
+                       error != NULL ? 0 : g_list_length(items));
+
+        g_hash_table_unref(attributes);
+
+        if (error != NULL)
+        {
+            *errStr = std::string(error->message);
+            g_error_free(error);
+            return FAIL_ERROR;
+        }
+
+        if (items == NULL)
+        {
+            return FAIL_NONFATAL;
+        }
+
+        *modified = static_cast<time_t>(
+            secret_item_get_modified(reinterpret_cast<SecretItem*>(items->data)));
+        g_list_free_full(items, g_object_unref);
         return SUCCESS;
     }
 
+    std::unique_ptr<Backend> detail::make_keyring_backend(const StoreOptions& options)
+    {
+        return std::unique_ptr<Backend>(new SecretServiceBackend(options));
+    }
+
 }  // namespace keytar
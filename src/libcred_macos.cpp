@@ -1,5 +1,9 @@
 #include <Security/Security.h>
-#include "libcred.hpp"
+#include "libcred_internal.hpp"
+#include "libcred_store.hpp"
+
+#include <algorithm>
+#include <set>
 
 
 namespace libcred
@@ -58,6 +62,79 @@ namespace libcred
         return errorStr;
     }
 
+    namespace
+    {
+
+        /**
+         * Backend over the user's default keychain search list. Store options
+         * for the Secret Service do not apply.
+         */
+        class KeychainBackend : public Backend
+        {
+        public:
+            using Backend::count_credentials;
+            using Backend::delete_password;
+            using Backend::find_credentials;
+            using Backend::find_password;
+            using Backend::get_password;
+            using Backend::set_password;
+
+            LIBCRED_RESULT set_password(const std::string& service,
+                                        const std::string& account,
+                                        const std::string& password,
+                                        std::string* error);
+
+            LIBCRED_RESULT get_password(const std::string& service,
+                                        const std::string& account,
+                                        std::string* password,
+                                        std::string* error);
+
+            LIBCRED_RESULT delete_password(const std::string& service,
+                                           const std::string& account,
+                                           std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         LIBCRED_FIND_POLICY policy,
+                                         std::string* account,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            size_t limit,
+                                            const std::string& cursor,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* next_cursor,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_credentials(
+                const std::vector<std::string>& services,
+                std::map<std::string, std::vector<Credentials>>* credentials,
+                std::string* error);
+
+            LIBCRED_RESULT count_credentials(const std::string& service,
+                                             size_t* count,
+                                             std::string* error);
+
+            LIBCRED_RESULT delete_credentials(const std::string& service,
+                                              size_t* deleted,
+                                              std::string* error);
+
+            LIBCRED_RESULT rename_service(const std::string& from,
+                                          const std::string& to,
+                                          std::vector<std::string>* accounts,
+                                          std::string* error);
+        };
+
+    }  // namespace
+
     LIBCRED_RESULT AddPassword(const std::string& service,
                                const std::string& account,
                                const std::string& password,
@@ -81,10 +158,10 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT set_password(const std::string& service,
-                                const std::string& account,
-                                const std::string& password,
-                                std::string* error)
+    LIBCRED_RESULT KeychainBackend::set_password(const std::string& service,
+                                                 const std::string& account,
+                                                 const std::string& password,
+                                                 std::string* error)
     {
         SecKeychainItemRef item;
         OSStatus result = SecKeychainFindGenericPassword(NULL,
@@ -118,10 +195,10 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT get_password(const std::string& service,
-                                const std::string& account,
-                                std::string* password,
-                                std::string* error)
+    LIBCRED_RESULT KeychainBackend::get_password(const std::string& service,
+                                                 const std::string& account,
+                                                 std::string* password,
+                                                 std::string* error)
     {
         void* data;
         UInt32 length;
@@ -149,9 +226,9 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT delete_password(const std::string& service,
-                                   const std::string& account,
-                                   std::string* error)
+    LIBCRED_RESULT KeychainBackend::delete_password(const std::string& service,
+                                                    const std::string& account,
+                                                    std::string* error)
     {
         SecKeychainItemRef item;
         OSStatus status = SecKeychainFindGenericPassword(NULL,
@@ -184,9 +261,9 @@ namespace libcred
         return SUCCESS;
     }
 
-    LIBCRED_RESULT find_password(const std::string& service,
-                                 std::string* password,
-                                 std::string* error)
+    LIBCRED_RESULT KeychainBackend::find_password(const std::string& service,
+                                                  std::string* password,
+                                                  std::string* error)
     {
         SecKeychainItemRef item;
         void* data;
@@ -251,9 +328,107 @@ namespace libcred
         return cred;
     }
 
-    LIBCRED_RESULT find_credentials(const std::string& service,
-                                    std::vector<Credentials>* credentials,
-                                    std::string* error)
+    LIBCRED_RESULT KeychainBackend::find_password(const std::string& service,
+                                                  LIBCRED_FIND_POLICY policy,
+                                                  std::string* account,
+                                                  std::string* password,
+                                                  std::string* error)
+    {
+        if (policy == FIND_ANY && account == NULL)
+        {
+            return find_password(service, password, error);
+        }
+
+        CFStringRef serviceStr
+            = CFStringCreateWithCString(NULL, service.c_str(), kCFStringEncodingUTF8);
+
+        // Attributes only; the data of the chosen item is fetched below.
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecAttrService, serviceStr);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnAttributes, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        CFRelease(serviceStr);
+        CFRelease(query);
+
+        if (status == errSecItemNotFound)
+        {
+            return FAIL_NONFATAL;
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        CFArrayRef resultArray = (CFArrayRef) result;
+        CFIndex resultCount = CFArrayGetCount(resultArray);
+
+        CFDictionaryRef chosen = NULL;
+        std::string chosenAccount;
+        CFAbsoluteTime chosenModified = 0;
+        for (CFIndex idx = 0; idx < resultCount; idx++)
+        {
+            CFDictionaryRef item = (CFDictionaryRef) CFArrayGetValueAtIndex(resultArray, idx);
+            CFStringRef accountStr = (CFStringRef) CFDictionaryGetValue(item, kSecAttrAccount);
+            if (accountStr == NULL)
+            {
+                continue;
+            }
+
+            std::string itemAccount = CFStringToStdString(accountStr);
+            CFDateRef modifiedDate
+                = (CFDateRef) CFDictionaryGetValue(item, kSecAttrModificationDate);
+            CFAbsoluteTime modified
+                = modifiedDate != NULL ? CFDateGetAbsoluteTime(modifiedDate) : 0;
+
+            bool better = chosen == NULL;
+            if (!better && policy == FIND_MOST_RECENT)
+            {
+                better = modified > chosenModified
+                         || (modified == chosenModified && itemAccount < chosenAccount);
+            }
+            else if (!better && policy == FIND_FIRST_ACCOUNT)
+            {
+                better = itemAccount < chosenAccount;
+            }
+
+            if (better)
+            {
+                chosen = item;
+                chosenAccount = itemAccount;
+                chosenModified = modified;
+            }
+        }
+
+        LIBCRED_RESULT found = FAIL_NONFATAL;
+        if (chosen != NULL)
+        {
+            Credentials cred = getCredentialsForItem(chosen);
+            if (!cred.first.empty())
+            {
+                if (account != NULL)
+                {
+                    *account = cred.first;
+                }
+                *password = cred.second;
+                found = SUCCESS;
+            }
+        }
+
+        CFRelease(result);
+
+        return found;
+    }
+
+    LIBCRED_RESULT KeychainBackend::find_credentials(const std::string& service,
+                                                     std::vector<Credentials>* credentials,
+                                                     std::string* error)
     {
         CFStringRef serviceStr
             = CFStringCreateWithCString(NULL, service.c_str(), kCFStringEncodingUTF8);
@@ -303,4 +478,318 @@ namespace libcred
         return SUCCESS;
     }
 
+    LIBCRED_RESULT KeychainBackend::find_credentials(const std::string& service,
+                                                     size_t limit,
+                                                     const std::string& cursor,
+                                                     std::vector<Credentials>* credentials,
+                                                     std::string* next_cursor,
+                                                     std::string* error)
+    {
+        CFStringRef serviceStr
+            = CFStringCreateWithCString(NULL, service.c_str(), kCFStringEncodingUTF8);
+
+        // Attributes only; password data is fetched for the page's items below.
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecAttrService, serviceStr);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnAttributes, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        CFRelease(serviceStr);
+        CFRelease(query);
+
+        if (status == errSecItemNotFound)
+        {
+            next_cursor->clear();
+            return FAIL_NONFATAL;
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        CFArrayRef resultArray = (CFArrayRef) result;
+        CFIndex resultCount = CFArrayGetCount(resultArray);
+
+        std::vector<std::pair<std::string, CFIndex>> sorted;
+        for (CFIndex idx = 0; idx < resultCount; idx++)
+        {
+            CFDictionaryRef item = (CFDictionaryRef) CFArrayGetValueAtIndex(resultArray, idx);
+            CFStringRef account = (CFStringRef) CFDictionaryGetValue(item, kSecAttrAccount);
+            if (account != NULL)
+            {
+                sorted.push_back(std::make_pair(CFStringToStdString(account), idx));
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<std::string> accounts;
+        accounts.reserve(sorted.size());
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            accounts.push_back(sorted[i].first);
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, error))
+        {
+            CFRelease(result);
+            return FAIL_ERROR;
+        }
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            CFDictionaryRef item
+                = (CFDictionaryRef) CFArrayGetValueAtIndex(resultArray, sorted[i].second);
+            credentials->push_back(getCredentialsForItem(item));
+        }
+
+        CFRelease(result);
+
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT KeychainBackend::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* error)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            (*credentials)[*it];
+        }
+
+        if (wanted.empty())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        // Enumerate the attributes of all generic passwords once and only fetch
+        // the data of items belonging to one of the requested services.
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnAttributes, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        CFRelease(query);
+
+        if (status == errSecItemNotFound)
+        {
+            return FAIL_NONFATAL;
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        size_t found = 0;
+        CFArrayRef resultArray = (CFArrayRef) result;
+        CFIndex resultCount = CFArrayGetCount(resultArray);
+
+        for (CFIndex idx = 0; idx < resultCount; idx++)
+        {
+            CFDictionaryRef item = (CFDictionaryRef) CFArrayGetValueAtIndex(resultArray, idx);
+            CFStringRef service = (CFStringRef) CFDictionaryGetValue(item, kSecAttrService);
+            if (service == NULL)
+            {
+                continue;
+            }
+
+            std::string serviceStr = CFStringToStdString(service);
+            if (wanted.count(serviceStr) == 0)
+            {
+                continue;
+            }
+
+            (*credentials)[serviceStr].push_back(getCredentialsForItem(item));
+            ++found;
+        }
+
+        CFRelease(result);
+
+        return found != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT KeychainBackend::count_credentials(const std::string& service,
+                                                      size_t* count,
+                                                      std::string* error)
+    {
+        *count = 0;
+
+        CFStringRef serviceStr
+            = CFStringCreateWithCString(NULL, service.c_str(), kCFStringEncodingUTF8);
+
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecAttrService, serviceStr);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnRef, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        CFRelease(serviceStr);
+        CFRelease(query);
+
+        if (status == errSecItemNotFound)
+        {
+            return SUCCESS;
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        *count = CFArrayGetCount((CFArrayRef) result);
+        CFRelease(result);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT KeychainBackend::delete_credentials(const std::string& service,
+                                                       size_t* deleted,
+                                                       std::string* error)
+    {
+        *deleted = 0;
+
+        CFStringRef serviceStr
+            = CFStringCreateWithCString(NULL, service.c_str(), kCFStringEncodingUTF8);
+
+        // References only: neither attributes nor password data are copied.
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecAttrService, serviceStr);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnRef, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        CFRelease(serviceStr);
+        CFRelease(query);
+
+        if (status == errSecItemNotFound)
+        {
+            return FAIL_NONFATAL;
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        CFArrayRef resultArray = (CFArrayRef) result;
+        CFIndex resultCount = CFArrayGetCount(resultArray);
+        for (CFIndex idx = 0; idx < resultCount && status == errSecSuccess; idx++)
+        {
+            SecKeychainItemRef item
+                = (SecKeychainItemRef) CFArrayGetValueAtIndex(resultArray, idx);
+            status = SecKeychainItemDelete(item);
+            if (status == errSecSuccess)
+            {
+                ++*deleted;
+            }
+        }
+
+        CFRelease(result);
+
+        if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT KeychainBackend::rename_service(const std::string& from,
+                                                   const std::string& to,
+                                                   std::vector<std::string>* accounts,
+                                                   std::string* error)
+    {
+        if (from == to)
+        {
+            *error = "A service cannot be renamed to itself";
+            return FAIL_ERROR;
+        }
+
+        CFStringRef fromStr = CFStringCreateWithCString(NULL, from.c_str(), kCFStringEncodingUTF8);
+        CFStringRef toStr = CFStringCreateWithCString(NULL, to.c_str(), kCFStringEncodingUTF8);
+
+        // The accounts first, attributes only, to report them.
+        CFMutableDictionaryRef query = CFDictionaryCreateMutable(
+            NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(query, kSecClass, kSecClassGenericPassword);
+        CFDictionaryAddValue(query, kSecAttrService, fromStr);
+        CFDictionaryAddValue(query, kSecMatchLimit, kSecMatchLimitAll);
+        CFDictionaryAddValue(query, kSecReturnAttributes, kCFBooleanTrue);
+
+        CFTypeRef result = NULL;
+        OSStatus status = SecItemCopyMatching((CFDictionaryRef) query, &result);
+
+        std::vector<std::string> renamed;
+        if (status == errSecSuccess)
+        {
+            CFArrayRef resultArray = (CFArrayRef) result;
+            for (CFIndex idx = 0; idx < CFArrayGetCount(resultArray); idx++)
+            {
+                CFDictionaryRef item = (CFDictionaryRef) CFArrayGetValueAtIndex(resultArray, idx);
+                CFStringRef account = (CFStringRef) CFDictionaryGetValue(item, kSecAttrAccount);
+                renamed.push_back(account != NULL ? CFStringToStdString(account) : std::string());
+            }
+            CFRelease(result);
+
+            // Then every item in one update, which never touches the data.
+            CFDictionaryRemoveValue(query, kSecMatchLimit);
+            CFDictionaryRemoveValue(query, kSecReturnAttributes);
+            CFMutableDictionaryRef changes = CFDictionaryCreateMutable(
+                NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+            CFDictionaryAddValue(changes, kSecAttrService, toStr);
+            CFDictionaryAddValue(changes, kSecAttrLabel, toStr);
+            status = SecItemUpdate((CFDictionaryRef) query, (CFDictionaryRef) changes);
+            CFRelease(changes);
+        }
+
+        CFRelease(query);
+        CFRelease(fromStr);
+        CFRelease(toStr);
+
+        if (status == errSecItemNotFound)
+        {
+            return FAIL_NONFATAL;
+        }
+        else if (status == errSecDuplicateItem)
+        {
+            // The new service already has some of the accounts: copying
+            // replaces them.
+            return Backend::rename_service(from, to, accounts, error);
+        }
+        else if (status != errSecSuccess)
+        {
+            *error = errorStatusToString(status);
+            return FAIL_ERROR;
+        }
+
+        accounts->insert(accounts->end(), renamed.begin(), renamed.end());
+        return SUCCESS;
+    }
+
+    std::unique_ptr<Backend> detail::make_keyring_backend(const StoreOptions& options)
+    {
+        return std::unique_ptr<Backend>(new KeychainBackend());
+    }
+
 }  // namespace keytar
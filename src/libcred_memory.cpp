@@ -0,0 +1,259 @@
+#include "libcred_memory.hpp"
+#include "libcred_internal.hpp"
+
+#include <time.h>
+
+#include <map>
+#include <mutex>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        struct Entry
+        {
+            std::string password;
+            unsigned long long modified;  // Value of the write counter when set.
+            time_t changed;               // Wall clock time when set.
+        };
+
+        typedef std::map<std::string, Entry> Accounts;
+
+    }  // namespace
+
+    class MemoryBackend::Impl
+    {
+    public:
+        Impl()
+            : writes_(0)
+        {
+        }
+
+        std::mutex mutex_;
+        std::map<std::string, Accounts> services_;
+        unsigned long long writes_;
+    };
+
+    MemoryBackend::MemoryBackend()
+        : impl_(new Impl())
+    {
+    }
+
+    MemoryBackend::~MemoryBackend()
+    {
+    }
+
+    LIBCRED_RESULT MemoryBackend::set_password(const std::string& service,
+                                               const std::string& account,
+                                               const std::string& password,
+                                               std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        Entry& entry = impl_->services_[service][account];
+        entry.password = password;
+        entry.modified = ++impl_->writes_;
+        entry.changed = time(NULL);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::get_password(const std::string& service,
+                                               const std::string& account,
+                                               std::string* password,
+                                               std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::const_iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        Accounts::const_iterator it = accounts->second.find(account);
+        if (it == accounts->second.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        *password = it->second.password;
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::delete_password(const std::string& service,
+                                                  const std::string& account,
+                                                  std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end() || accounts->second.erase(account) == 0)
+        {
+            return FAIL_NONFATAL;
+        }
+
+        if (accounts->second.empty())
+        {
+            impl_->services_.erase(accounts);
+        }
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::find_password(const std::string& service,
+                                                std::string* password,
+                                                std::string* error)
+    {
+        return find_password(service, FIND_FIRST_ACCOUNT, NULL, password, error);
+    }
+
+    LIBCRED_RESULT MemoryBackend::find_credentials(const std::string& service,
+                                                   std::vector<Credentials>* credentials,
+                                                   std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::const_iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        for (Accounts::const_iterator it = accounts->second.begin(); it != accounts->second.end();
+             ++it)
+        {
+            credentials->push_back(Credentials(it->first, it->second.password));
+        }
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::find_password(const std::string& service,
+                                                LIBCRED_FIND_POLICY policy,
+                                                std::string* account,
+                                                std::string* password,
+                                                std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::const_iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        // Accounts are sorted, so the first one serves FIND_ANY and FIND_FIRST_ACCOUNT.
+        Accounts::const_iterator chosen = accounts->second.begin();
+        if (policy == FIND_MOST_RECENT)
+        {
+            for (Accounts::const_iterator it = chosen; it != accounts->second.end(); ++it)
+            {
+                if (it->second.modified > chosen->second.modified)
+                {
+                    chosen = it;
+                }
+            }
+        }
+
+        if (account != NULL)
+        {
+            *account = chosen->first;
+        }
+        *password = chosen->second.password;
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::count_credentials(const std::string& service,
+                                                    size_t* count,
+                                                    std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::const_iterator accounts = impl_->services_.find(service);
+        *count = accounts != impl_->services_.end() ? accounts->second.size() : 0;
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::delete_credentials(const std::string& service,
+                                                     size_t* deleted,
+                                                     std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end())
+        {
+            *deleted = 0;
+            return FAIL_NONFATAL;
+        }
+
+        *deleted = accounts->second.size();
+        impl_->services_.erase(accounts);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::rename_service(const std::string& from,
+                                                 const std::string& to,
+                                                 std::vector<std::string>* accounts,
+                                                 std::string* error)
+    {
+        if (from == to)
+        {
+            *error = "A service cannot be renamed to itself";
+            return FAIL_ERROR;
+        }
+
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::iterator moving = impl_->services_.find(from);
+        if (moving == impl_->services_.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        Accounts& target = impl_->services_[to];
+        for (Accounts::iterator it = moving->second.begin(); it != moving->second.end(); ++it)
+        {
+            target[it->first] = it->second;
+            accounts->push_back(it->first);
+        }
+        impl_->services_.erase(moving);
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT MemoryBackend::get_modified(const std::string& service,
+                                               const std::string& account,
+                                               time_t* modified,
+                                               std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+        std::map<std::string, Accounts>::const_iterator accounts = impl_->services_.find(service);
+        if (accounts == impl_->services_.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        Accounts::const_iterator it = accounts->second.find(account);
+        if (it == accounts->second.end())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        *modified = it->second.changed;
+        return SUCCESS;
+    }
+
+    size_t MemoryBackend::memory_usage() const
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex_);
+
+        size_t bytes = 0;
+        for (std::map<std::string, Accounts>::const_iterator service = impl_->services_.begin();
+             service != impl_->services_.end();
+             ++service)
+        {
+            bytes
+                += sizeof(*service) + detail::tree_node_bytes + detail::heap_bytes(service->first);
+            for (Accounts::const_iterator it = service->second.begin(); it != service->second.end();
+                 ++it)
+            {
+                bytes += sizeof(*it) + detail::tree_node_bytes + detail::heap_bytes(it->first)
+                    + detail::heap_bytes(it->second.password);
+            }
+        }
+        return bytes;
+    }
+
+}  // namespace libcred
@@ -0,0 +1,116 @@
+#include "libcred_internal.hpp"
+
+#include <algorithm>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        const char hex_digits[] = "0123456789abcdef";
+
+        int hex_value(char c)
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            return -1;
+        }
+
+        /**
+         * Cursors are the hex encoding of the last account of a page. Callers
+         * must treat them as opaque; hex keeps them safe to pass through URLs
+         * and UI state whatever bytes the account name contains.
+         */
+        std::string encode_cursor(const std::string& account)
+        {
+            std::string cursor;
+            cursor.reserve(account.size() * 2);
+            for (size_t i = 0; i < account.size(); ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(account[i]);
+                cursor += hex_digits[c >> 4];
+                cursor += hex_digits[c & 0xf];
+            }
+            return cursor;
+        }
+
+        bool decode_cursor(const std::string& cursor, std::string* account)
+        {
+            if (cursor.size() % 2 != 0)
+            {
+                return false;
+            }
+
+            account->clear();
+            account->reserve(cursor.size() / 2);
+            for (size_t i = 0; i < cursor.size(); i += 2)
+            {
+                int high = hex_value(cursor[i]);
+                int low = hex_value(cursor[i + 1]);
+                if (high < 0 || low < 0)
+                {
+                    return false;
+                }
+                *account += static_cast<char>((high << 4) | low);
+            }
+            return true;
+        }
+
+    }  // namespace
+
+    namespace detail
+    {
+
+        bool select_page(const std::vector<std::string>& sorted_accounts,
+                         size_t limit,
+                         const std::string& cursor,
+                         size_t* begin,
+                         size_t* end,
+                         std::string* next_cursor,
+                         std::string* errStr)
+        {
+            *begin = 0;
+            if (!cursor.empty())
+            {
+                std::string last_account;
+                if (!decode_cursor(cursor, &last_account))
+                {
+                    *errStr = "Invalid page cursor";
+                    return false;
+                }
+
+                // Resume strictly after the last account already returned, so
+                // items added or removed in between don't shift later pages.
+                *begin = std::upper_bound(
+                             sorted_accounts.begin(), sorted_accounts.end(), last_account)
+                         - sorted_accounts.begin();
+            }
+
+            *end = sorted_accounts.size();
+            if (limit != 0 && *end - *begin > limit)
+            {
+                *end = *begin + limit;
+            }
+
+            if (*end < sorted_accounts.size())
+            {
+                *next_cursor = encode_cursor(sorted_accounts[*end - 1]);
+            }
+            else
+            {
+                next_cursor->clear();
+            }
+
+            return true;
+        }
+
+    }  // namespace detail
+
+}  // namespace libcred
@@ -0,0 +1,1174 @@
+#include "libcred_pass.hpp"
+#include "libcred_inotify.hpp"
+#include "libcred_internal.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+extern char** environ;
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        const uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE
+                                    | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF
+                                    | IN_MOVE_SELF | IN_ONLYDIR;
+
+        const std::string extension(".gpg");
+
+        typedef std::pair<std::string, std::string> Key;
+
+        bool valid_component(const std::string& name)
+        {
+            return !name.empty() && name[0] != '.' && name.find('/') == std::string::npos;
+        }
+
+        /**
+         * Services may be nested ("work/email"), but every component must be
+         * a plain name so paths cannot escape the root or reach .git.
+         */
+        bool valid_service(const std::string& service)
+        {
+            size_t begin = 0;
+            for (;;)
+            {
+                size_t end = service.find('/', begin);
+                if (!valid_component(service.substr(begin, end - begin)))
+                {
+                    return false;
+                }
+                if (end == std::string::npos)
+                {
+                    return true;
+                }
+                begin = end + 1;
+            }
+        }
+
+        bool valid_key(const std::string& service, const std::string& account)
+        {
+            return valid_service(service) && (account.empty() || valid_component(account));
+        }
+
+        /**
+         * Maps a file <dir>/<stem>.gpg of the store to its credential: an entry
+         * directly under the root is a service with an empty account.
+         */
+        Key key_of_file(const std::string& dir, const std::string& stem)
+        {
+            return dir.empty() ? Key(stem, std::string()) : Key(dir, stem);
+        }
+
+        /**
+         * The key a credential is indexed and cached under: ("work/github", "")
+         * names the same entry as ("work", "github").
+         */
+        Key canonical(const std::string& service, const std::string& account)
+        {
+            size_t slash = service.rfind('/');
+            if (!account.empty() || slash == std::string::npos)
+            {
+                return Key(service, account);
+            }
+            return Key(service.substr(0, slash), service.substr(slash + 1));
+        }
+
+        /**
+         * Starts `command` with the given stdin and stdout, leaving stderr to
+         * the caller's so gpg can still report problems. Returns the pid or -1.
+         */
+        pid_t spawn_filter(const std::vector<std::string>& command, int in_fd, int out_fd)
+        {
+            if (command.empty())
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            std::vector<char*> argv;
+            for (size_t i = 0; i < command.size(); ++i)
+            {
+                argv.push_back(const_cast<char*>(command[i].c_str()));
+            }
+            argv.push_back(NULL);
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+            posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+            pid_t pid;
+            int spawn_error = posix_spawnp(&pid, argv[0], &actions, NULL, &argv[0], environ);
+            posix_spawn_file_actions_destroy(&actions);
+
+            if (spawn_error != 0)
+            {
+                errno = spawn_error;
+                return -1;
+            }
+            return pid;
+        }
+
+        bool wait_filter(pid_t pid, const std::string& name, std::string* errStr)
+        {
+            int status;
+            while (waitpid(pid, &status, 0) < 0)
+            {
+                if (errno != EINTR)
+                {
+                    *errStr = "Unable to wait for " + name;
+                    return false;
+                }
+            }
+
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                *errStr = name + " failed";
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Decrypts the file at `path` and returns its first line. Returns
+         * FAIL_NONFATAL if the file does not exist.
+         */
+        LIBCRED_RESULT decrypt_file(const std::vector<std::string>& command,
+                                    const std::string& path,
+                                    std::string* password,
+                                    std::string* errStr)
+        {
+            int in_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in_fd < 0)
+            {
+                if (errno == ENOENT || errno == ENOTDIR)
+                {
+                    return FAIL_NONFATAL;
+                }
+
+                *errStr = "Unable to open " + path;
+                return FAIL_ERROR;
+            }
+
+            int out_pipe[2];
+            if (pipe2(out_pipe, O_CLOEXEC) != 0)
+            {
+                close(in_fd);
+                *errStr = "Unable to create a pipe";
+                return FAIL_ERROR;
+            }
+
+            pid_t pid = spawn_filter(command, in_fd, out_pipe[1]);
+            close(in_fd);
+            close(out_pipe[1]);
+            if (pid < 0)
+            {
+                close(out_pipe[0]);
+                *errStr = "Unable to run the decrypt command";
+                return FAIL_ERROR;
+            }
+
+            std::string plaintext;
+            char buffer[4096];
+            for (;;)
+            {
+                ssize_t length = read(out_pipe[0], buffer, sizeof(buffer));
+                if (length < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (length <= 0)
+                {
+                    break;
+                }
+                plaintext.append(buffer, length);
+            }
+            close(out_pipe[0]);
+
+            if (!wait_filter(pid, "Decrypting " + path, errStr))
+            {
+                return FAIL_ERROR;
+            }
+
+            *password = plaintext.substr(0, plaintext.find('\n'));
+            return SUCCESS;
+        }
+
+        /**
+         * Encrypts `plaintext` into the new file `out_fd`.
+         */
+        bool encrypt_to(const std::vector<std::string>& command,
+                        const std::string& plaintext,
+                        int out_fd,
+                        std::string* errStr)
+        {
+            int in_pipe[2];
+            if (pipe2(in_pipe, O_CLOEXEC) != 0)
+            {
+                *errStr = "Unable to create a pipe";
+                return false;
+            }
+
+            pid_t pid = spawn_filter(command, in_pipe[0], out_fd);
+            close(in_pipe[0]);
+            if (pid < 0)
+            {
+                close(in_pipe[1]);
+                *errStr = "Unable to run the encrypt command";
+                return false;
+            }
+
+            // A filter that exits early must not kill us with SIGPIPE: block
+            // it on this thread and discard the one the write raised.
+            sigset_t pipe_set, old_set;
+            sigemptyset(&pipe_set);
+            sigaddset(&pipe_set, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+            bool broken = false;
+            for (size_t written = 0; written < plaintext.size();)
+            {
+                ssize_t length
+                    = write(in_pipe[1], plaintext.data() + written, plaintext.size() - written);
+                if (length < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    broken = errno == EPIPE;
+                    break;
+                }
+                written += length;
+            }
+            close(in_pipe[1]);
+
+            if (broken)
+            {
+                struct timespec no_wait = { 0, 0 };
+                sigtimedwait(&pipe_set, NULL, &no_wait);
+            }
+            pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+            return wait_filter(pid, "Encrypting", errStr);
+        }
+
+    }  // namespace
+
+    PassOptions::PassOptions()
+        : max_processes(4)
+        , cache_plaintext(true)
+    {
+        const char* common[] = { "--quiet", "--yes", "--compress-algo=none", "--no-encrypt-to",
+                                 "--batch", "--use-agent" };
+
+        decrypt_command.push_back("gpg");
+        decrypt_command.push_back("-d");
+        encrypt_command.push_back("gpg");
+        encrypt_command.push_back("-e");
+        for (size_t i = 0; i < sizeof(common) / sizeof(common[0]); ++i)
+        {
+            decrypt_command.push_back(common[i]);
+            encrypt_command.push_back(common[i]);
+        }
+    }
+
+    PassOptions PassOptions::from_environment()
+    {
+        PassOptions options;
+
+        const char* store_dir = getenv("PASSWORD_STORE_DIR");
+        const char* home = getenv("HOME");
+        if (store_dir != NULL && store_dir[0] != '\0')
+        {
+            options.root = store_dir;
+        }
+        else if (home != NULL)
+        {
+            options.root = std::string(home) + "/.password-store";
+        }
+
+        return options;
+    }
+
+    class PassBackend::Impl
+    {
+    public:
+        explicit Impl(const PassOptions& options)
+            : options_(options)
+            , indexed_(false)
+            , generation_(0)
+            , watcher_(std::bind(&Impl::handle_event,
+                                 this,
+                                 std::placeholders::_1,
+                                 std::placeholders::_2,
+                                 std::placeholders::_3))
+        {
+            if (options_.max_processes == 0)
+            {
+                options_.max_processes = 1;
+            }
+        }
+
+        std::string path_of(const std::string& service, const std::string& account) const
+        {
+            return options_.root + "/" + service + (account.empty() ? "" : "/" + account)
+                   + extension;
+        }
+
+        LIBCRED_RESULT read(const std::string& service,
+                            const std::string& account,
+                            std::string* password,
+                            std::string* errStr)
+        {
+            std::vector<std::string> accounts(1, account);
+            std::vector<std::string> passwords;
+            std::vector<bool> found;
+            LIBCRED_RESULT result = read_many(service, accounts, &passwords, &found, errStr);
+            if (result != SUCCESS)
+            {
+                return result;
+            }
+
+            if (!found[0])
+            {
+                return FAIL_NONFATAL;
+            }
+
+            *password = passwords[0];
+            return SUCCESS;
+        }
+
+        /**
+         * Reads the passwords of several accounts of a service, serving cached
+         * ones directly and decrypting the rest over up to max_processes
+         * filters at once.
+         */
+        LIBCRED_RESULT read_many(const std::string& service,
+                                 const std::vector<std::string>& accounts,
+                                 std::vector<std::string>* passwords,
+                                 std::vector<bool>* found,
+                                 std::string* errStr)
+        {
+            passwords->assign(accounts.size(), std::string());
+            found->assign(accounts.size(), false);
+
+            std::vector<size_t> misses;
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ensure_index();
+
+                for (size_t i = 0; i < accounts.size(); ++i)
+                {
+                    if (!valid_key(service, accounts[i]))
+                    {
+                        continue;
+                    }
+
+                    Key key = canonical(service, accounts[i]);
+                    std::map<Key, std::string>::const_iterator it = plaintext_.find(key);
+                    if (it != plaintext_.end())
+                    {
+                        (*passwords)[i] = it->second;
+                        (*found)[i] = true;
+                    }
+                    else if (!indexed_ || listed(key))
+                    {
+                        misses.push_back(i);
+                    }
+                }
+                generation = generation_;
+            }
+
+            if (misses.empty())
+            {
+                return SUCCESS;
+            }
+
+            // gpg-agent serializes the private key operations, but running a
+            // few filters at once hides the process startup cost.
+            std::vector<LIBCRED_RESULT> results(misses.size(), FAIL_NONFATAL);
+            std::vector<std::string> errors(misses.size());
+            std::atomic<size_t> next(0);
+            std::function<void()> work = [&]() {
+                for (size_t i = next++; i < misses.size(); i = next++)
+                {
+                    size_t index = misses[i];
+                    results[i] = decrypt_file(options_.decrypt_command,
+                                              path_of(service, accounts[index]),
+                                              &(*passwords)[index],
+                                              &errors[i]);
+                }
+            };
+
+            std::vector<std::thread> workers;
+            size_t helpers = std::min(options_.max_processes, misses.size()) - 1;
+            for (size_t i = 0; i < helpers; ++i)
+            {
+                workers.push_back(std::thread(work));
+            }
+            work();
+            for (size_t i = 0; i < workers.size(); ++i)
+            {
+                workers[i].join();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < misses.size(); ++i)
+            {
+                if (results[i] == FAIL_ERROR)
+                {
+                    *errStr = errors[i];
+                    return FAIL_ERROR;
+                }
+
+                size_t index = misses[i];
+                (*found)[index] = results[i] == SUCCESS;
+
+                // Only cache what no change raced with, and only while watched.
+                if ((*found)[index] && options_.cache_plaintext && indexed_
+                    && generation == generation_)
+                {
+                    plaintext_[canonical(service, accounts[index])] = (*passwords)[index];
+                }
+            }
+
+            return SUCCESS;
+        }
+
+        /**
+         * Lists the accounts of a service in ascending order.
+         */
+        LIBCRED_RESULT list(const std::string& service,
+                            std::vector<std::string>* accounts,
+                            std::string* errStr)
+        {
+            if (!valid_service(service))
+            {
+                return FAIL_NONFATAL;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ensure_index();
+
+            std::map<std::string, std::set<std::string>>::const_iterator it = index_.find(service);
+            if (it == index_.end())
+            {
+                return FAIL_NONFATAL;
+            }
+
+            accounts->assign(it->second.begin(), it->second.end());
+            return SUCCESS;
+        }
+
+        LIBCRED_RESULT write(const std::string& service,
+                             const std::string& account,
+                             const std::string& password,
+                             std::string* errStr)
+        {
+            if (!valid_key(service, account))
+            {
+                *errStr = "Invalid service or account name for a password store";
+                return FAIL_ERROR;
+            }
+
+            std::string path = path_of(service, account);
+            std::string dir = path.substr(0, path.rfind('/'));
+
+            std::vector<std::string> command = options_.encrypt_command;
+            if (!append_recipients(dir, &command))
+            {
+                *errStr = "No .gpg-id found for " + path;
+                return FAIL_ERROR;
+            }
+
+            if (!make_directories(dir))
+            {
+                *errStr = "Unable to create " + dir;
+                return FAIL_ERROR;
+            }
+
+            // Encrypt next to the entry and rename over it, so readers never
+            // see a partial file. The dot keeps the temporary out of the index.
+            std::string base = path.substr(dir.size() + 1);
+            std::string temp_template = dir + "/." + base + ".XXXXXX";
+            std::vector<char> temp_path(temp_template.begin(), temp_template.end());
+            temp_path.push_back('\0');
+            int out_fd = mkostemp(&temp_path[0], O_CLOEXEC);
+            if (out_fd < 0)
+            {
+                *errStr = "Unable to create a file in " + dir;
+                return FAIL_ERROR;
+            }
+
+            bool encrypted = encrypt_to(command, password + "\n", out_fd, errStr);
+            close(out_fd);
+            if (!encrypted || rename(&temp_path[0], path.c_str()) != 0)
+            {
+                unlink(&temp_path[0]);
+                if (encrypted)
+                {
+                    *errStr = "Unable to write " + path;
+                }
+                return FAIL_ERROR;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            Key key = canonical(service, account);
+            forget(key);
+            if (indexed_)
+            {
+                index_[key.first].insert(key.second);
+            }
+            return SUCCESS;
+        }
+
+        LIBCRED_RESULT remove(const std::string& service,
+                              const std::string& account,
+                              std::string* errStr)
+        {
+            if (!valid_key(service, account))
+            {
+                return FAIL_NONFATAL;
+            }
+
+            std::string path = path_of(service, account);
+            if (unlink(path.c_str()) != 0)
+            {
+                if (errno == ENOENT || errno == ENOTDIR)
+                {
+                    return FAIL_NONFATAL;
+                }
+
+                *errStr = "Unable to remove " + path;
+                return FAIL_ERROR;
+            }
+
+            remove_empty_directories(path);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            Key key = canonical(service, account);
+            forget(key);
+            unlist(key);
+            return SUCCESS;
+        }
+
+        /**
+         * Whether an entry would be encrypted to the same ids under either
+         * service, so that its file can move as it is. False if either name
+         * is not valid here.
+         */
+        bool same_recipients(const std::string& from,
+                             const std::string& to,
+                             const std::string& account) const
+        {
+            if (!valid_key(from, account) || !valid_key(to, account))
+            {
+                return false;
+            }
+
+            std::string from_path = path_of(from, account);
+            std::string to_path = path_of(to, account);
+            std::vector<std::string> from_ids;
+            std::vector<std::string> to_ids;
+            return append_recipients(from_path.substr(0, from_path.rfind('/')), &from_ids)
+                   && append_recipients(to_path.substr(0, to_path.rfind('/')), &to_ids)
+                   && from_ids == to_ids;
+        }
+
+        /**
+         * Moves an entry to another service by renaming its file, replacing
+         * any entry there, so nothing is decrypted or encrypted again.
+         */
+        LIBCRED_RESULT move(const std::string& from,
+                            const std::string& to,
+                            const std::string& account,
+                            std::string* errStr)
+        {
+            if (!valid_key(from, account) || !valid_key(to, account))
+            {
+                *errStr = "Invalid service or account name for a password store";
+                return FAIL_ERROR;
+            }
+
+            std::string from_path = path_of(from, account);
+            std::string to_path = path_of(to, account);
+            std::string dir = to_path.substr(0, to_path.rfind('/'));
+            if (!make_directories(dir))
+            {
+                *errStr = "Unable to create " + dir;
+                return FAIL_ERROR;
+            }
+
+            if (rename(from_path.c_str(), to_path.c_str()) != 0)
+            {
+                if (errno == ENOENT)
+                {
+                    return FAIL_NONFATAL;
+                }
+
+                *errStr = "Unable to move " + from_path + " to " + to_path;
+                return FAIL_ERROR;
+            }
+
+            remove_empty_directories(from_path);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            Key from_key = canonical(from, account);
+            Key to_key = canonical(to, account);
+            forget(from_key);
+            forget(to_key);
+            unlist(from_key);
+            if (indexed_)
+            {
+                index_[to_key.first].insert(to_key.second);
+            }
+            return SUCCESS;
+        }
+
+        bool modified_time(const std::string& service, const std::string& account, time_t* mtime)
+        {
+            struct stat st;
+            if (stat(path_of(service, account).c_str(), &st) != 0)
+            {
+                return false;
+            }
+
+            *mtime = st.st_mtime;
+            return true;
+        }
+
+
+        size_t memory_usage()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            size_t bytes = 0;
+            for (std::map<std::string, std::set<std::string>>::const_iterator it = index_.begin();
+                 it != index_.end();
+                 ++it)
+            {
+                bytes += sizeof(*it) + detail::tree_node_bytes + detail::heap_bytes(it->first);
+                for (std::set<std::string>::const_iterator account = it->second.begin();
+                     account != it->second.end();
+                     ++account)
+                {
+                    bytes += sizeof(std::string) + detail::tree_node_bytes
+                        + detail::heap_bytes(*account);
+                }
+            }
+
+            for (std::map<Key, std::string>::const_iterator it = plaintext_.begin();
+                 it != plaintext_.end();
+                 ++it)
+            {
+                bytes += sizeof(*it) + detail::tree_node_bytes + detail::heap_bytes(it->first.first)
+                    + detail::heap_bytes(it->first.second) + detail::heap_bytes(it->second);
+            }
+            return bytes;
+        }
+    private:
+        /**
+         * Appends "--recipient <id>" for each id in the .gpg-id nearest to
+         * `dir`, looking upwards to the root like pass does.
+         */
+        bool append_recipients(const std::string& dir, std::vector<std::string>* command) const
+        {
+            for (std::string current = dir;; current.erase(current.rfind('/')))
+            {
+                std::ifstream ids((current + "/.gpg-id").c_str());
+                if (ids)
+                {
+                    bool any = false;
+                    std::string line;
+                    while (std::getline(ids, line))
+                    {
+                        line.erase(0, line.find_first_not_of(" \t"));
+                        line.erase(line.find_last_not_of(" \t\r") + 1);
+                        if (!line.empty() && line[0] != '#')
+                        {
+                            command->push_back("--recipient");
+                            command->push_back(line);
+                            any = true;
+                        }
+                    }
+                    return any;
+                }
+
+                if (current.size() <= options_.root.size())
+                {
+                    return false;
+                }
+            }
+        }
+
+        bool make_directories(const std::string& dir) const
+        {
+            for (size_t slash = options_.root.size(); slash != std::string::npos;)
+            {
+                slash = dir.find('/', slash + 1);
+                if (mkdir(dir.substr(0, slash).c_str(), 0700) != 0 && errno != EEXIST)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Like `pass rm`, drops the directories an entry's removal left empty.
+         */
+        void remove_empty_directories(const std::string& path) const
+        {
+            for (std::string dir = path.substr(0, path.rfind('/'));
+                 dir.size() > options_.root.size() && rmdir(dir.c_str()) == 0;
+                 dir.erase(dir.rfind('/')))
+            {
+            }
+        }
+
+        bool listed(const Key& key) const
+        {
+            std::map<std::string, std::set<std::string>>::const_iterator it
+                = index_.find(key.first);
+            return it != index_.end() && it->second.count(key.second) != 0;
+        }
+
+        void unlist(const Key& key)
+        {
+            std::map<std::string, std::set<std::string>>::iterator it = index_.find(key.first);
+            if (it != index_.end())
+            {
+                it->second.erase(key.second);
+                if (it->second.empty())
+                {
+                    index_.erase(it);
+                }
+            }
+        }
+
+        /**
+         * Drops a cached password. Bumping the generation also stops reads
+         * already in flight from caching what they decrypted.
+         */
+        void forget(const Key& key)
+        {
+            plaintext_.erase(key);
+            ++generation_;
+        }
+
+        void forget_all()
+        {
+            plaintext_.clear();
+            ++generation_;
+        }
+
+        /**
+         * Builds the index if it is not current, watching every directory of
+         * the store. Without inotify the index is rebuilt on every call. Must
+         * be called with the mutex held.
+         */
+        void ensure_index()
+        {
+            if (indexed_)
+            {
+                return;
+            }
+
+            for (std::map<int, std::string>::const_iterator it = watched_dirs_.begin();
+                 it != watched_dirs_.end();
+                 ++it)
+            {
+                watcher_.remove_watch(it->first);
+            }
+            watched_dirs_.clear();
+            index_.clear();
+
+            indexed_ = watcher_.ok();
+            scan(std::string());
+        }
+
+        void scan(const std::string& relative)
+        {
+            std::string dir = relative.empty() ? options_.root : options_.root + "/" + relative;
+
+            // Watch before listing so entries created meanwhile are reported.
+            if (indexed_)
+            {
+                int wd = watcher_.add_watch(dir, watch_mask);
+                if (wd >= 0)
+                {
+                    watched_dirs_[wd] = relative;
+                }
+                else
+                {
+                    // Unwatched (or a store not created yet): rescan next time.
+                    indexed_ = false;
+                }
+            }
+
+            DIR* handle = opendir(dir.c_str());
+            if (handle == NULL)
+            {
+                return;
+            }
+
+            struct dirent* entry;
+            while ((entry = readdir(handle)) != NULL)
+            {
+                std::string name = entry->d_name;
+                struct stat st;
+                if (!valid_component(name) || fstatat(dirfd(handle), entry->d_name, &st, 0) != 0)
+                {
+                    continue;
+                }
+
+                if (S_ISDIR(st.st_mode))
+                {
+                    scan(relative.empty() ? name : relative + "/" + name);
+                }
+                else if (S_ISREG(st.st_mode) && name.size() > extension.size()
+                         && name.compare(name.size() - extension.size(), std::string::npos,
+                                         extension)
+                                == 0)
+                {
+                    Key key = key_of_file(relative, name.substr(0, name.size() - extension.size()));
+                    index_[key.first].insert(key.second);
+                }
+            }
+            closedir(handle);
+        }
+
+        void handle_event(int wd, uint32_t mask, const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if ((mask & IN_Q_OVERFLOW) != 0)
+            {
+                indexed_ = false;
+                forget_all();
+                return;
+            }
+
+            std::map<int, std::string>::const_iterator it = watched_dirs_.find(wd);
+            if (it == watched_dirs_.end())
+            {
+                return;
+            }
+
+            // The directory itself went away or moved.
+            if (name.empty() || (mask & IN_IGNORED) != 0)
+            {
+                indexed_ = false;
+                forget_all();
+                return;
+            }
+
+            // Temporaries, .gpg-id and .git never hold entries.
+            if (name[0] == '.')
+            {
+                return;
+            }
+
+            if ((mask & IN_ISDIR) != 0)
+            {
+                indexed_ = false;
+                if ((mask & IN_CREATE) == 0)
+                {
+                    forget_all();
+                }
+                return;
+            }
+
+            if (name.size() <= extension.size()
+                || name.compare(name.size() - extension.size(), std::string::npos, extension) != 0)
+            {
+                return;
+            }
+
+            Key key = key_of_file(it->second, name.substr(0, name.size() - extension.size()));
+            forget(key);
+            if ((mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+            {
+                index_[key.first].insert(key.second);
+            }
+            else if ((mask & (IN_DELETE | IN_MOVED_FROM)) != 0)
+            {
+                unlist(key);
+            }
+        }
+
+        PassOptions options_;
+
+        std::mutex mutex_;
+        bool indexed_;
+        std::map<std::string, std::set<std::string>> index_;
+        std::map<int, std::string> watched_dirs_;
+        std::map<Key, std::string> plaintext_;
+        uint64_t generation_;
+
+        // Declared last so its thread stops before the state it touches goes.
+        detail::InotifyWatcher watcher_;
+    };
+
+    PassBackend::PassBackend(const PassOptions& options)
+        : impl_(new Impl(options))
+    {
+    }
+
+    PassBackend::~PassBackend()
+    {
+    }
+
+    LIBCRED_RESULT PassBackend::set_password(const std::string& service,
+                                             const std::string& account,
+                                             const std::string& password,
+                                             std::string* error)
+    {
+        return impl_->write(service, account, password, error);
+    }
+
+    LIBCRED_RESULT PassBackend::get_password(const std::string& service,
+                                             const std::string& account,
+                                             std::string* password,
+                                             std::string* error)
+    {
+        return impl_->read(service, account, password, error);
+    }
+
+    LIBCRED_RESULT PassBackend::delete_password(const std::string& service,
+                                                const std::string& account,
+                                                std::string* error)
+    {
+        return impl_->remove(service, account, error);
+    }
+
+    LIBCRED_RESULT PassBackend::find_password(const std::string& service,
+                                              std::string* password,
+                                              std::string* error)
+    {
+        return find_password(service, FIND_FIRST_ACCOUNT, NULL, password, error);
+    }
+
+    LIBCRED_RESULT PassBackend::find_credentials(const std::string& service,
+                                                 std::vector<Credentials>* credentials,
+                                                 std::string* error)
+    {
+        std::string next_cursor;
+        return find_credentials(service, 0, std::string(), credentials, &next_cursor, error);
+    }
+
+    LIBCRED_RESULT PassBackend::find_password(const std::string& service,
+                                              LIBCRED_FIND_POLICY policy,
+                                              std::string* account,
+                                              std::string* password,
+                                              std::string* error)
+    {
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->list(service, &accounts, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        // Accounts are sorted, so FIND_ANY and FIND_FIRST_ACCOUNT agree.
+        size_t chosen = 0;
+        if (policy == FIND_MOST_RECENT)
+        {
+            time_t chosen_mtime = 0;
+            for (size_t i = 0; i < accounts.size(); ++i)
+            {
+                time_t mtime;
+                if (impl_->modified_time(service, accounts[i], &mtime) && mtime > chosen_mtime)
+                {
+                    chosen = i;
+                    chosen_mtime = mtime;
+                }
+            }
+        }
+
+        result = impl_->read(service, accounts[chosen], password, error);
+        if (result == SUCCESS && account != NULL)
+        {
+            *account = accounts[chosen];
+        }
+        return result;
+    }
+
+    LIBCRED_RESULT PassBackend::find_credentials(const std::string& service,
+                                                 size_t limit,
+                                                 const std::string& cursor,
+                                                 std::vector<Credentials>* credentials,
+                                                 std::string* next_cursor,
+                                                 std::string* error)
+    {
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->list(service, &accounts, error);
+        if (result == FAIL_ERROR)
+        {
+            return result;
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        std::vector<std::string> page(accounts.begin() + begin, accounts.begin() + end);
+        std::vector<std::string> passwords;
+        std::vector<bool> found;
+        result = impl_->read_many(service, page, &passwords, &found, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < page.size(); ++i)
+        {
+            if (found[i])
+            {
+                credentials->push_back(Credentials(page[i], passwords[i]));
+                ++count;
+            }
+        }
+
+        return count != 0 || !next_cursor->empty() ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT PassBackend::count_credentials(const std::string& service,
+                                                  size_t* count,
+                                                  std::string* error)
+    {
+        std::vector<std::string> accounts;
+        if (impl_->list(service, &accounts, error) == FAIL_ERROR)
+        {
+            return FAIL_ERROR;
+        }
+
+        *count = accounts.size();
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT PassBackend::delete_credentials(const std::string& service,
+                                                   size_t* deleted,
+                                                   std::string* error)
+    {
+        *deleted = 0;
+
+        // The index lists the entries, so nothing is decrypted.
+        std::vector<std::string> accounts;
+        LIBCRED_RESULT result = impl_->list(service, &accounts, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        for (size_t i = 0; i < accounts.size(); ++i)
+        {
+            result = impl_->remove(service, accounts[i], error);
+            if (result == FAIL_ERROR)
+            {
+                return result;
+            }
+            if (result == SUCCESS)
+            {
+                ++*deleted;
+            }
+        }
+
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT PassBackend::rename_service(const std::string& from,
+                                               const std::string& to,
+                                               std::vector<std::string>* accounts,
+                                               std::string* error)
+    {
+        if (from == to)
+        {
+            *error = "A service cannot be renamed to itself";
+            return FAIL_ERROR;
+        }
+
+        std::vector<std::string> listed;
+        LIBCRED_RESULT result = impl_->list(from, &listed, error);
+        if (result != SUCCESS)
+        {
+            return result;
+        }
+
+        // Entries whose new place has other recipients are encrypted again,
+        // which the generic version does through get and set.
+        for (size_t i = 0; i < listed.size(); ++i)
+        {
+            if (!impl_->same_recipients(from, to, listed[i]))
+            {
+                return Backend::rename_service(from, to, accounts, error);
+            }
+        }
+
+        size_t moved = 0;
+        for (size_t i = 0; i < listed.size(); ++i)
+        {
+            result = impl_->move(from, to, listed[i], error);
+            if (result == FAIL_ERROR)
+            {
+                return result;
+            }
+            if (result == SUCCESS)
+            {
+                accounts->push_back(listed[i]);
+                ++moved;
+            }
+        }
+
+        return moved != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT PassBackend::get_modified(const std::string& service,
+                                             const std::string& account,
+                                             time_t* modified,
+                                             std::string* error)
+    {
+        if (impl_->modified_time(service, account, modified))
+        {
+            return SUCCESS;
+        }
+        if (errno == ENOENT || errno == ENOTDIR)
+        {
+            return FAIL_NONFATAL;
+        }
+        *error = strerror(errno);
+        return FAIL_ERROR;
+    }
+
+    size_t PassBackend::memory_usage() const
+    {
+        return impl_->memory_usage();
+    }
+
+}  // namespace libcred
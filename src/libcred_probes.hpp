@@ -0,0 +1,70 @@
+#ifndef SRC_LIBCRED_PROBES_H_
+#define SRC_LIBCRED_PROBES_H_
+
+// USDT probes of the "libcred" provider, for bpftrace, perf and SystemTap:
+//
+//   bpftrace -e 'usdt:/usr/lib/libcred.so:libcred:get_password__return
+//                { @[arg2] = count(); }'
+//
+// With the meson option usdt enabled each probe is a single nop plus a note
+// in the ELF file; tracers patch the nop while attached. Arguments are still
+// evaluated, so they are limited to values at hand: C strings, sizes and
+// LIBCRED_RESULT codes. Without the option the macros compile to nothing;
+// their arguments go only through sizeof, so they are never evaluated.
+//
+// Operations (every backend, through Store):
+//   <op>__entry(service, account)        set_password, get_password,
+//   <op>__return(service, account, result)   delete_password
+//   find_password__entry(service, policy)
+//   find_password__return(service, result)
+//   find_credentials__entry(service, limit)       limit 0 for all
+//   find_credentials__return(service, result, count)
+//   find_credentials_multi__entry(service_count)
+//   find_credentials_multi__return(result, count)
+//   find_credentials_collections__entry(service, collection_count)
+//   find_credentials_collections__return(service, result, count)
+//   rename_service__entry(from, to)
+//   rename_service__return(from, result, count)
+//   count_credentials__entry(service)
+//   count_credentials__return(service, result, count)
+//   count_credentials_multi__entry(service_count)
+//   count_credentials_multi__return(result, service_count)
+//   count_index__hit(service, count)       count kept by count_ttl_ms
+//   delete_credentials__entry(service)
+//   delete_credentials__return(service, result, count)
+//   cache__hit(service, account), cache__miss(service, account)
+//   thread_cache__hit(service, account)
+//   cache__stale(service, account)         served stale, refresh queued
+//   cache__refresh(service, account, result)
+//   expiry__expired(service, account)      get_password of an expired credential
+//   expiry__reap(service, account, result)
+//   snapshot__load(result, count), snapshot__save(result, count)
+//
+// Secret Service phases (Linux keyring):
+//   connect__start(), connect__done(ok)
+//   search__start(service), search__done(service, result, count)   service may be NULL
+//   lookup__start(), lookup__done(result)
+//   load_secrets__start(count), load_secrets__done(count, result)
+//   delete_items__start(count), delete_items__done(count, result)   count deleted
+//   rename_items__start(count), rename_items__done(count, result)   count renamed
+//   collection_search__start(collection), collection_search__done(collection, result, count)
+
+#ifdef LIBCRED_USDT
+
+#include <sys/sdt.h>
+
+#define LIBCRED_PROBE0(name) DTRACE_PROBE(libcred, name)
+#define LIBCRED_PROBE1(name, a1) DTRACE_PROBE1(libcred, name, a1)
+#define LIBCRED_PROBE2(name, a1, a2) DTRACE_PROBE2(libcred, name, a1, a2)
+#define LIBCRED_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(libcred, name, a1, a2, a3)
+
+#else
+
+#define LIBCRED_PROBE0(name) ((void)0)
+#define LIBCRED_PROBE1(name, a1) ((void)sizeof(a1))
+#define LIBCRED_PROBE2(name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#define LIBCRED_PROBE3(name, a1, a2, a3) ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+
+#endif
+
+#endif  // SRC_LIBCRED_PROBES_H_
@@ -0,0 +1,373 @@
+#include "libcred_snapshot.hpp"
+
+#ifdef LIBCRED_SNAPSHOT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/keyctl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        namespace
+        {
+
+            // File layout: magic, IV, ciphertext, GCM tag. The magic is also
+            // authenticated, as additional data.
+            const char magic[8] = {'L', 'C', 'S', 'N', 'A', 'P', '0', '1'};
+            const size_t key_size = 32;
+            const size_t iv_size = 12;
+            const size_t tag_size = 16;
+
+            /**
+             * Reads the key for the snapshot at path from the session keyring,
+             * first adding a random one if there is none and create is set.
+             */
+            bool session_key(const std::string& path,
+                             bool create,
+                             unsigned char* key,
+                             std::string* error)
+            {
+                std::string description = "libcred:snapshot:" + path;
+                long id = syscall(SYS_keyctl,
+                                  KEYCTL_SEARCH,
+                                  KEY_SPEC_SESSION_KEYRING,
+                                  "user",
+                                  description.c_str(),
+                                  0);
+                if (id < 0 && create)
+                {
+                    unsigned char fresh[key_size];
+                    if (RAND_bytes(fresh, key_size) != 1)
+                    {
+                        *error = "Unable to generate a snapshot key";
+                        return false;
+                    }
+                    id = syscall(SYS_add_key,
+                                 "user",
+                                 description.c_str(),
+                                 fresh,
+                                 key_size,
+                                 KEY_SPEC_SESSION_KEYRING);
+                    OPENSSL_cleanse(fresh, key_size);
+                }
+                if (id < 0)
+                {
+                    *error = std::string("No snapshot key in the session keyring: ")
+                             + strerror(errno);
+                    return false;
+                }
+
+                if (syscall(SYS_keyctl, KEYCTL_READ, id, key, key_size)
+                    != static_cast<long>(key_size))
+                {
+                    *error = "Unable to read the snapshot key";
+                    return false;
+                }
+                return true;
+            }
+
+            void put_string(const std::string& value, std::string* out)
+            {
+                uint32_t size = static_cast<uint32_t>(value.size());
+                out->append(reinterpret_cast<const char*>(&size), sizeof(size));
+                out->append(value);
+            }
+
+            void put_time(time_t value, std::string* out)
+            {
+                int64_t wide = value;
+                out->append(reinterpret_cast<const char*>(&wide), sizeof(wide));
+            }
+
+            bool get_string(const std::string& in, size_t* offset, std::string* value)
+            {
+                uint32_t size;
+                if (in.size() - *offset < sizeof(size))
+                {
+                    return false;
+                }
+                memcpy(&size, in.data() + *offset, sizeof(size));
+                *offset += sizeof(size);
+
+                if (in.size() - *offset < size)
+                {
+                    return false;
+                }
+                value->assign(in, *offset, size);
+                *offset += size;
+                return true;
+            }
+
+            bool get_time(const std::string& in, size_t* offset, time_t* value)
+            {
+                int64_t wide;
+                if (in.size() - *offset < sizeof(wide))
+                {
+                    return false;
+                }
+                memcpy(&wide, in.data() + *offset, sizeof(wide));
+                *offset += sizeof(wide);
+                *value = static_cast<time_t>(wide);
+                return true;
+            }
+
+            /**
+             * Encrypts plain into a complete snapshot file image.
+             */
+            bool seal(const unsigned char* key, const std::string& plain, std::string* sealed)
+            {
+                unsigned char iv[iv_size];
+                if (RAND_bytes(iv, iv_size) != 1)
+                {
+                    return false;
+                }
+
+                std::string cipher(plain.size(), '\0');
+                unsigned char* out = reinterpret_cast<unsigned char*>(&cipher[0]);
+                const unsigned char* in = reinterpret_cast<const unsigned char*>(plain.data());
+                const unsigned char* aad = reinterpret_cast<const unsigned char*>(magic);
+                unsigned char tag[tag_size];
+                int length = 0;
+                int final_length = 0;
+
+                EVP_CIPHER_CTX* context = EVP_CIPHER_CTX_new();
+                bool ok = context != NULL
+                          && EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, key, iv) == 1
+                          && EVP_EncryptUpdate(context, NULL, &length, aad, sizeof(magic)) == 1
+                          && EVP_EncryptUpdate(
+                                 context, out, &length, in, static_cast<int>(plain.size()))
+                                 == 1
+                          && EVP_EncryptFinal_ex(context, out + length, &final_length) == 1
+                          && EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, tag_size, tag)
+                                 == 1;
+                EVP_CIPHER_CTX_free(context);
+                if (!ok)
+                {
+                    return false;
+                }
+
+                sealed->assign(magic, sizeof(magic));
+                sealed->append(reinterpret_cast<const char*>(iv), iv_size);
+                sealed->append(cipher);
+                sealed->append(reinterpret_cast<const char*>(tag), tag_size);
+                return true;
+            }
+
+            /**
+             * Decrypts and authenticates a snapshot file image.
+             */
+            bool open_sealed(const unsigned char* key,
+                             const std::string& sealed,
+                             std::string* plain)
+            {
+                const size_t overhead = sizeof(magic) + iv_size + tag_size;
+                if (sealed.size() < overhead
+                    || sealed.compare(0, sizeof(magic), magic, sizeof(magic)) != 0)
+                {
+                    return false;
+                }
+
+                const unsigned char* iv
+                    = reinterpret_cast<const unsigned char*>(sealed.data()) + sizeof(magic);
+                const unsigned char* cipher = iv + iv_size;
+                size_t cipher_size = sealed.size() - overhead;
+                unsigned char tag[tag_size];
+                memcpy(tag, cipher + cipher_size, tag_size);
+
+                plain->assign(cipher_size, '\0');
+                unsigned char* out = reinterpret_cast<unsigned char*>(&(*plain)[0]);
+                const unsigned char* aad = reinterpret_cast<const unsigned char*>(magic);
+                int length = 0;
+                int final_length = 0;
+
+                EVP_CIPHER_CTX* context = EVP_CIPHER_CTX_new();
+                bool ok = context != NULL
+                          && EVP_DecryptInit_ex(context, EVP_aes_256_gcm(), NULL, key, iv) == 1
+                          && EVP_DecryptUpdate(context, NULL, &length, aad, sizeof(magic)) == 1
+                          && EVP_DecryptUpdate(
+                                 context, out, &length, cipher, static_cast<int>(cipher_size))
+                                 == 1
+                          && EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, tag_size, tag) == 1
+                          && EVP_DecryptFinal_ex(context, out + length, &final_length) == 1;
+                EVP_CIPHER_CTX_free(context);
+                return ok;
+            }
+
+            void cleanse(std::string* value)
+            {
+                if (!value->empty())
+                {
+                    OPENSSL_cleanse(&(*value)[0], value->size());
+                }
+            }
+
+        }  // namespace
+
+        bool save_snapshot(const std::string& path,
+                           const std::vector<SnapshotEntry>& entries,
+                           std::string* error)
+        {
+            unsigned char key[key_size];
+            if (!session_key(path, true, key, error))
+            {
+                return false;
+            }
+
+            std::string plain;
+            for (std::vector<SnapshotEntry>::const_iterator it = entries.begin();
+                 it != entries.end();
+                 ++it)
+            {
+                put_string(it->service, &plain);
+                put_string(it->account, &plain);
+                put_string(it->password, &plain);
+                put_time(it->modified, &plain);
+                put_time(it->loaded, &plain);
+            }
+
+            std::string sealed;
+            bool sealed_ok = seal(key, plain, &sealed);
+            OPENSSL_cleanse(key, key_size);
+            cleanse(&plain);
+            if (!sealed_ok)
+            {
+                *error = "Unable to encrypt the snapshot";
+                return false;
+            }
+
+            // Written aside and renamed over, so a crash never leaves half a snapshot.
+            std::string temporary = path + ".tmp";
+            int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0)
+            {
+                *error = "Unable to write " + temporary + ": " + strerror(errno);
+                return false;
+            }
+
+            size_t written = 0;
+            while (written < sealed.size())
+            {
+                ssize_t count = write(fd, sealed.data() + written, sealed.size() - written);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    *error = "Unable to write " + temporary + ": " + strerror(errno);
+                    close(fd);
+                    unlink(temporary.c_str());
+                    return false;
+                }
+                written += static_cast<size_t>(count);
+            }
+            close(fd);
+
+            if (rename(temporary.c_str(), path.c_str()) != 0)
+            {
+                *error = "Unable to replace " + path + ": " + strerror(errno);
+                unlink(temporary.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        bool load_snapshot(const std::string& path,
+                           std::vector<SnapshotEntry>* entries,
+                           std::string* error)
+        {
+            FILE* file = fopen(path.c_str(), "rbe");
+            if (file == NULL)
+            {
+                *error = "Unable to read " + path + ": " + strerror(errno);
+                return false;
+            }
+
+            std::string sealed;
+            char buffer[4096];
+            size_t count;
+            while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            {
+                sealed.append(buffer, count);
+            }
+            fclose(file);
+
+            unsigned char key[key_size];
+            if (!session_key(path, false, key, error))
+            {
+                return false;
+            }
+
+            std::string plain;
+            bool opened = open_sealed(key, sealed, &plain);
+            OPENSSL_cleanse(key, key_size);
+            if (!opened)
+            {
+                cleanse(&plain);
+                *error = "The snapshot at " + path
+                         + " is invalid or was written by another session";
+                return false;
+            }
+
+            size_t offset = 0;
+            while (offset < plain.size())
+            {
+                SnapshotEntry entry;
+                if (!get_string(plain, &offset, &entry.service)
+                    || !get_string(plain, &offset, &entry.account)
+                    || !get_string(plain, &offset, &entry.password)
+                    || !get_time(plain, &offset, &entry.modified)
+                    || !get_time(plain, &offset, &entry.loaded))
+                {
+                    cleanse(&plain);
+                    *error = "The snapshot at " + path + " is truncated";
+                    return false;
+                }
+                entries->push_back(entry);
+            }
+            cleanse(&plain);
+            return true;
+        }
+
+    }  // namespace detail
+}  // namespace libcred
+
+#else
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        bool save_snapshot(const std::string& path,
+                           const std::vector<SnapshotEntry>& entries,
+                           std::string* error)
+        {
+            *error = "Cache snapshots need Linux and OpenSSL";
+            return false;
+        }
+
+        bool load_snapshot(const std::string& path,
+                           std::vector<SnapshotEntry>* entries,
+                           std::string* error)
+        {
+            *error = "Cache snapshots need Linux and OpenSSL";
+            return false;
+        }
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // LIBCRED_SNAPSHOT
@@ -0,0 +1,45 @@
+#ifndef SRC_LIBCRED_SNAPSHOT_H_
+#define SRC_LIBCRED_SNAPSHOT_H_
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        struct SnapshotEntry
+        {
+            std::string service;
+            std::string account;
+            std::string password;
+            time_t modified;  // When the credential last changed, 0 if unknown.
+            time_t loaded;    // When the password was read from the backend.
+        };
+
+        /**
+         * Writes a cache snapshot to path, replacing any earlier one. It is
+         * encrypted with AES-256-GCM under a random key kept in the kernel
+         * session keyring, so only processes of the same login session can
+         * read it back, and a snapshot from a previous boot or session is
+         * useless. Needs Linux and OpenSSL; false otherwise.
+         */
+        bool save_snapshot(const std::string& path,
+                           const std::vector<SnapshotEntry>& entries,
+                           std::string* error);
+
+        /**
+         * Reads back a snapshot written by save_snapshot. False if it is
+         * missing, was tampered with, or its key is gone.
+         */
+        bool load_snapshot(const std::string& path,
+                           std::vector<SnapshotEntry>* entries,
+                           std::string* error);
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_SNAPSHOT_H_
@@ -0,0 +1,1993 @@
+#include "libcred_store.hpp"
+#include "libcred_audit.hpp"
+#include "libcred_trace.hpp"
+#include "libcred_fork.hpp"
+#include "libcred_internal.hpp"
+#include "libcred_probes.hpp"
+#include "libcred_snapshot.hpp"
+#include "libcred_timer_wheel.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        typedef std::chrono::steady_clock Clock;
+
+        struct CacheEntry
+        {
+            std::string password;
+            Clock::time_point expires;
+            uint64_t generation;  // Changes whenever the password is stored.
+            bool refreshing;      // A background refresh is queued or running.
+            bool accessed;        // Read since it was stored, so worth refreshing ahead.
+            time_t loaded;        // Wall clock time the password was read from the backend.
+            time_t modified;      // When the credential changed, if known; else 0.
+        };
+
+        struct CountEntry
+        {
+            size_t count;
+            Clock::time_point expires;
+        };
+
+        enum RefreshReason
+        {
+            REFRESH_STALE,     // Served past its TTL.
+            REFRESH_AHEAD,     // Due for refresh-ahead, if it was read.
+            REFRESH_SNAPSHOT,  // Loaded from a snapshot, to revalidate.
+        };
+
+        struct Refresh
+        {
+            Refresh(const std::string& key, uint64_t generation, RefreshReason reason)
+                : key(key)
+                , generation(generation)
+                , reason(reason)
+            {
+            }
+
+            std::string key;
+            uint64_t generation;  // Of the entry when queued; it is skipped if that changed.
+            RefreshReason reason;
+        };
+
+        /**
+         * When a credential stored with an expiry expires. generation tells
+         * the timers of earlier expiries of the key apart.
+         */
+        struct Expiry
+        {
+            Clock::time_point deadline;
+            uint64_t generation;
+        };
+
+        struct ExpiryTimer
+        {
+            std::string key;
+            uint64_t generation;
+        };
+
+        struct CacheShard;
+
+        /**
+         * Where the cached password of an interned key is. Elements of an
+         * unordered_map are never moved by a rehash, so entry stays valid
+         * while its shard's removals are unchanged.
+         */
+        struct IdEntry
+        {
+            CacheShard* shard;
+            CacheEntry* entry;
+            uint64_t removals;
+        };
+
+        /**
+         * One lock per shard, so lookups of different keys rarely contend.
+         * ids indexes the cache by key_of(), so that the ID overloads can
+         * find a cached password without resolving names or building a key;
+         * an ID's shard is usually not its entry's.
+         */
+        struct CacheShard
+        {
+            CacheShard()
+                : generation(0)
+                , removals(0)
+            {
+            }
+
+            std::mutex mutex;
+            std::unordered_map<std::string, CacheEntry> entries;
+            uint64_t generation;  // Bumped by every insertion or removal.
+            uint64_t removals;    // Bumped by every removal, which may free an entry.
+            std::unordered_map<uint64_t, IdEntry> ids;
+        };
+
+        const size_t shard_count = 16;
+
+        /**
+         * A per-thread copy of a shared cache entry. It is valid while its
+         * store's epoch is unchanged, as every change to the shared cache
+         * bumps the epoch, and until the shared entry would expire.
+         */
+        struct ThreadCacheEntry
+        {
+            ThreadCacheEntry()
+                : store(0)
+                , epoch(0)
+            {
+            }
+
+            uint64_t store;  // Store::Impl::id_ of the owner, 0 when unused.
+            uint64_t epoch;
+            std::string key;
+            std::string password;
+            Clock::time_point expires;
+        };
+
+        // Direct-mapped and shared by every store on the thread; a hot key
+        // evicts another only when they hash to the same slot.
+        const size_t thread_cache_slots = 64;
+        thread_local ThreadCacheEntry thread_cache[thread_cache_slots];
+
+        std::atomic<uint64_t> store_ids(0);
+
+        // Expiries further ahead are reaped then instead: a steady_clock
+        // time_point only reaches about 292 years past the clock's origin.
+        const long long max_expiry_seconds = 100LL * 365 * 24 * 60 * 60;
+
+        /**
+         * Where the account starts in a cache_key, which is "service\0account".
+         */
+        const char* account_of_key(const std::string& key)
+        {
+            return key.c_str() + std::strlen(key.c_str()) + 1;
+        }
+
+        std::string cache_key(const std::string& service, const std::string& account)
+        {
+            std::string key;
+            key.reserve(service.size() + account.size() + 1);
+            key.append(service).push_back('\0');
+            key.append(account);
+            return key;
+        }
+
+        const std::string no_name;
+
+        const std::string& record_name(ServiceId service)
+        {
+            const std::string* name = detail::service_name(service);
+            return name != NULL ? *name : no_name;
+        }
+
+        inline const char* probe_name(ServiceId service)
+        {
+            const std::string* name = detail::service_name(service);
+            return name != NULL ? name->c_str() : NULL;
+        }
+
+        const std::string& record_account(AccountId account)
+        {
+            const std::string* name = detail::account_name(account);
+            return name != NULL ? *name : no_name;
+        }
+
+        inline const char* probe_account(AccountId account)
+        {
+            const std::string* name = detail::account_name(account);
+            return name != NULL ? name->c_str() : NULL;
+        }
+
+    }  // namespace
+
+    StoreOptions::StoreOptions()
+        : collection("default")
+        , schema_name("org.freedesktop.Secret.Generic")
+        , timeout_ms(-1)
+        , cache_ttl_ms(0)
+        , stale_ttl_ms(0)
+        , refresh_ahead_percent(0)
+        , thread_cache(false)
+        , reap_interval_ms(1000)
+        , count_ttl_ms(0)
+    {
+    }
+
+    MemoryUsage::MemoryUsage()
+        : cache_entries(0)
+        , cache_bytes(0)
+        , backend_bytes(0)
+        , intern_bytes(0)
+    {
+    }
+
+    size_t MemoryUsage::total() const
+    {
+        return cache_bytes + backend_bytes + intern_bytes;
+    }
+
+    /**
+     * Forking keeps the cache: a parent can warm it for its children.
+     */
+    class Store::Impl : public detail::ForkHandler
+    {
+    public:
+        Impl(std::unique_ptr<Backend> backend, const StoreOptions& options)
+            : backend_(std::move(backend))
+            , options_(options)
+            , generations_(0)
+            , id_(++store_ids)
+            , epoch_(0)
+            , stopping_(false)
+            , tick_(std::max(options.cache_ttl_ms / 256, 1L))
+            , jitter_(std::random_device()())
+            , expiring_(false)
+            , reaper_stopping_(false)
+            , reap_interval_(std::max(options.reap_interval_ms, 1L))
+            , count_generation_(0)
+        {
+            if (!options_.snapshot_path.empty() && options_.cache_ttl_ms > 0)
+            {
+                load_snapshot();
+            }
+            detail::register_fork_handler(this);
+        }
+
+        ~Impl()
+        {
+            detail::unregister_fork_handler(this);
+            {
+                std::lock_guard<std::mutex> lock(refresh_mutex_);
+                stopping_ = true;
+            }
+            refresh_wake_.notify_one();
+            if (refresh_thread_)
+            {
+                refresh_thread_->join();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(expiry_mutex_);
+                reaper_stopping_ = true;
+            }
+            reap_wake_.notify_one();
+            if (reap_thread_)
+            {
+                reap_thread_->join();
+            }
+
+            if (!options_.snapshot_path.empty() && options_.cache_ttl_ms > 0)
+            {
+                std::string error;
+                save_snapshot(&error);
+            }
+        }
+
+        Backend& backend()
+        {
+            return *backend_;
+        }
+
+        /**
+         * get_password through the cache; key is cache_key(service, account).
+         */
+        template <typename ServiceT, typename AccountT>
+        LIBCRED_RESULT get_password(const std::string& key,
+                                    ServiceT service,
+                                    AccountT account,
+                                    std::string* password,
+                                    std::string* error)
+        {
+            if (expired(key))
+            {
+                return FAIL_NONFATAL;
+            }
+
+            if (cache_lookup(key, password))
+            {
+                return SUCCESS;
+            }
+
+            uint64_t generation = cache_generation(key);
+            LIBCRED_RESULT result = backend_->get_password(service, account, password, error);
+            if (result == SUCCESS)
+            {
+                cache_fill(key, *password, generation);
+            }
+            return result;
+        }
+
+        /**
+         * When an operation began, for the trace; the clock is only read
+         * while tracing.
+         */
+        Clock::time_point start() const
+        {
+            return options_.trace ? Clock::now() : Clock::time_point();
+        }
+
+        /**
+         * Whether record() reports anywhere, so that callers holding IDs
+         * need only resolve names when it does.
+         */
+        bool recording() const
+        {
+            return options_.audit || options_.trace;
+        }
+
+        /**
+         * Reports a finished operation to the audit log and the trace.
+         * size is the password length or the number of credentials found.
+         */
+        void record(const char* operation,
+                    const std::string& service,
+                    const std::string& account,
+                    size_t size,
+                    Clock::time_point started,
+                    LIBCRED_RESULT result)
+        {
+            if (options_.audit)
+            {
+                options_.audit->record(operation, service, account, result);
+            }
+            if (options_.trace)
+            {
+                options_.trace->record(operation, service, account, size, started, result);
+            }
+        }
+
+        bool cache_lookup(const std::string& key, std::string* password)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return false;
+            }
+
+            size_t hash = std::hash<std::string>()(key);
+            const char* service = key.c_str();
+            const char* account = account_of_key(key);
+
+            // The thread's own copy only needs reads of shared memory. The
+            // epoch is read before the shared entry, so a change made in
+            // between invalidates the copy taken below.
+            ThreadCacheEntry* local = NULL;
+            uint64_t epoch = 0;
+            if (options_.thread_cache)
+            {
+                local = &thread_cache[hash % thread_cache_slots];
+                epoch = epoch_.load(std::memory_order_acquire);
+                if (local->store == id_ && local->epoch == epoch && local->key == key
+                    && local->expires > Clock::now())
+                {
+                    *password = local->password;
+                    LIBCRED_PROBE2(thread_cache__hit, service, account);
+                    return true;
+                }
+            }
+
+            CacheShard& shard = shards_[hash % shard_count];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            std::unordered_map<std::string, CacheEntry>::iterator it = shard.entries.find(key);
+            if (it == shard.entries.end())
+            {
+                LIBCRED_PROBE2(cache__miss, service, account);
+                return false;
+            }
+
+            CacheEntry& entry = it->second;
+            Clock::time_point now = Clock::now();
+            if (entry.expires > now)
+            {
+                entry.accessed = true;
+                *password = entry.password;
+                if (local != NULL)
+                {
+                    local->store = id_;
+                    local->epoch = epoch;
+                    local->key = key;
+                    local->password = entry.password;
+                    local->expires = entry.expires;
+                }
+                LIBCRED_PROBE2(cache__hit, service, account);
+                return true;
+            }
+
+            // Past its TTL but within the staleness limit: serve it, and have
+            // the first caller to see it so start a refresh.
+            if (entry.expires + std::chrono::milliseconds(options_.stale_ttl_ms) > now)
+            {
+                if (!entry.refreshing)
+                {
+                    entry.refreshing = true;
+                    schedule_refresh(Refresh(key, entry.generation, REFRESH_STALE));
+                }
+                *password = entry.password;
+                LIBCRED_PROBE2(cache__stale, service, account);
+                return true;
+            }
+
+            shard.entries.erase(it);
+            ++shard.generation;
+            ++shard.removals;
+            LIBCRED_PROBE2(cache__miss, service, account);
+            return false;
+        }
+
+        /**
+         * cache_lookup for an interned key through the ID index, without
+         * resolving names. Serves only entries within their TTL, which never
+         * outlives an expiry (see cache_expiry()); anything else is left to
+         * get_password. The ID's shard and the entry's are never locked
+         * together.
+         */
+        bool id_lookup(ServiceId service, AccountId account, std::string* password)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return false;
+            }
+
+            uint64_t id = detail::key_of(service, account);
+            IdEntry found;
+            {
+                CacheShard& shard = shards_[id % shard_count];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::unordered_map<uint64_t, IdEntry>::const_iterator it = shard.ids.find(id);
+                if (it == shard.ids.end())
+                {
+                    return false;
+                }
+                found = it->second;
+            }
+
+            std::lock_guard<std::mutex> lock(found.shard->mutex);
+            if (found.shard->removals != found.removals || found.entry->expires <= Clock::now())
+            {
+                return false;
+            }
+            found.entry->accessed = true;
+            *password = found.entry->password;
+            LIBCRED_PROBE2(cache__hit, probe_name(service), probe_account(account));
+            return true;
+        }
+
+        /**
+         * Indexes the cached entry of key, if any, for id_lookup(); called
+         * after a get_password by ID that id_lookup() could not answer.
+         */
+        void id_index(ServiceId service, AccountId account, const std::string& key)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            IdEntry indexed;
+            {
+                CacheShard& shard = shard_of(key);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::unordered_map<std::string, CacheEntry>::iterator it = shard.entries.find(key);
+                if (it == shard.entries.end())
+                {
+                    return;
+                }
+                indexed.shard = &shard;
+                indexed.entry = &it->second;
+                indexed.removals = shard.removals;
+            }
+
+            // Removed meanwhile, it fails the removals check on lookup.
+            uint64_t id = detail::key_of(service, account);
+            CacheShard& shard = shards_[id % shard_count];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.ids[id] = indexed;
+        }
+
+        /**
+         * Caches a password just written to the backend.
+         */
+        void cache_store(const std::string& key, const std::string& password)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            CacheShard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            insert(shard, key, password);
+        }
+
+        /**
+         * The generation of the key's shard, taken before reading a password
+         * from the backend and passed to cache_fill().
+         */
+        uint64_t cache_generation(const std::string& key)
+        {
+            CacheShard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.generation;
+        }
+
+        /**
+         * Caches a password read from the backend, unless the shard changed
+         * since the read began: a write or delete may have come in between,
+         * leaving the password read older than the backend's.
+         */
+        void cache_fill(const std::string& key, const std::string& password, uint64_t generation)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            CacheShard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.generation == generation)
+            {
+                insert(shard, key, password);
+            }
+        }
+
+        void cache_erase(const std::string& key)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            CacheShard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.entries.erase(key);
+            ++shard.generation;
+            ++shard.removals;
+            invalidate_thread_caches();
+        }
+
+        /**
+         * Drops the cached passwords of every account of a service.
+         */
+        void cache_erase_service(const std::string& service)
+        {
+            if (options_.cache_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            std::string prefix = cache_key(service, std::string());
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                std::lock_guard<std::mutex> lock(shards_[i].mutex);
+                std::unordered_map<std::string, CacheEntry>& entries = shards_[i].entries;
+                for (std::unordered_map<std::string, CacheEntry>::iterator it = entries.begin();
+                     it != entries.end();)
+                {
+                    if (it->first.compare(0, prefix.size(), prefix) == 0)
+                    {
+                        it = entries.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+                ++shards_[i].generation;
+                ++shards_[i].removals;
+            }
+            invalidate_thread_caches();
+        }
+
+        void cache_usage(MemoryUsage* usage)
+        {
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                std::lock_guard<std::mutex> lock(shards_[i].mutex);
+                const std::unordered_map<std::string, CacheEntry>& entries = shards_[i].entries;
+
+                usage->cache_entries += entries.size();
+                usage->cache_bytes += entries.size()
+                    * (sizeof(std::string) + sizeof(CacheEntry) + detail::hash_node_bytes);
+                for (std::unordered_map<std::string, CacheEntry>::const_iterator it
+                     = entries.begin();
+                     it != entries.end();
+                     ++it)
+                {
+                    usage->cache_bytes
+                        += detail::heap_bytes(it->first) + detail::heap_bytes(it->second.password);
+                }
+                usage->cache_bytes += shards_[i].ids.size()
+                    * (sizeof(uint64_t) + sizeof(IdEntry) + detail::hash_node_bytes);
+            }
+
+            std::lock_guard<std::mutex> lock(count_mutex_);
+            usage->cache_bytes += counts_.size()
+                * (sizeof(std::string) + sizeof(CountEntry) + detail::hash_node_bytes);
+            for (std::unordered_map<std::string, CountEntry>::const_iterator it = counts_.begin();
+                 it != counts_.end();
+                 ++it)
+            {
+                usage->cache_bytes += detail::heap_bytes(it->first);
+            }
+        }
+
+        void cache_clear()
+        {
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                std::lock_guard<std::mutex> lock(shards_[i].mutex);
+                shards_[i].entries.clear();
+                shards_[i].ids.clear();
+                ++shards_[i].generation;
+                ++shards_[i].removals;
+            }
+            invalidate_thread_caches();
+        }
+
+        bool count_lookup(const std::string& service, size_t* count)
+        {
+            if (options_.count_ttl_ms <= 0)
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(count_mutex_);
+            std::unordered_map<std::string, CountEntry>::iterator it = counts_.find(service);
+            if (it == counts_.end())
+            {
+                return false;
+            }
+            if (it->second.expires <= Clock::now())
+            {
+                counts_.erase(it);
+                return false;
+            }
+
+            *count = it->second.count;
+            LIBCRED_PROBE2(count_index__hit, service.c_str(), *count);
+            return true;
+        }
+
+        /**
+         * Taken before counting in the backend and passed to count_store(),
+         * which drops the count if a write came in between.
+         */
+        uint64_t count_generation()
+        {
+            std::lock_guard<std::mutex> lock(count_mutex_);
+            return count_generation_;
+        }
+
+        void count_store(const std::string& service, size_t count, uint64_t generation)
+        {
+            if (options_.count_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(count_mutex_);
+            if (generation == count_generation_)
+            {
+                CountEntry entry
+                    = {count, Clock::now() + std::chrono::milliseconds(options_.count_ttl_ms)};
+                counts_[service] = entry;
+            }
+        }
+
+        /**
+         * Called after each write or delete, which may have changed the
+         * count of the service. Counts fetched meanwhile may or may not
+         * include the change, so they are not kept either.
+         */
+        void count_forget(const std::string& service)
+        {
+            if (options_.count_ttl_ms <= 0)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(count_mutex_);
+            counts_.erase(service);
+            ++count_generation_;
+        }
+
+        /**
+         * True if the credential was stored with an expiry that has passed.
+         * Costs one atomic load until some credential has an expiry.
+         */
+        bool expired(const std::string& key)
+        {
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            std::unordered_map<std::string, Expiry>::const_iterator it = expiries_.find(key);
+            if (it == expiries_.end() || it->second.deadline > Clock::now())
+            {
+                return false;
+            }
+            LIBCRED_PROBE2(expiry__expired, key.c_str(), account_of_key(key));
+            return true;
+        }
+
+        /**
+         * Held around writes while credentials with an expiry exist, or
+         * always if expiring, so that the reaper never deletes a password
+         * stored after it chose to delete the previous one.
+         */
+        std::unique_lock<std::mutex> lock_writes(bool expiring)
+        {
+            std::unique_lock<std::mutex> lock(reap_mutex_, std::defer_lock);
+            if (expiring || expiring_.load(std::memory_order_acquire))
+            {
+                lock.lock();
+            }
+            return lock;
+        }
+
+        /**
+         * Records that a credential just stored expires at the given wall
+         * clock time, at most max_expiry_seconds ahead, and sets a timer for
+         * the reaper to delete it then.
+         */
+        void set_expiry(const std::string& key, time_t expires)
+        {
+            time_t now = time(NULL);
+            long long delay_s
+                = expires > now ? std::min<long long>(expires - now, max_expiry_seconds) : 0;
+            Clock::time_point deadline = Clock::now() + std::chrono::seconds(delay_s);
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            schedule_expiry(key, deadline);
+        }
+
+        /**
+         * Moves the expiries of the given accounts from one service to
+         * another, after a rename. A credential replaced by one without an
+         * expiry loses its own.
+         */
+        void move_expiries(const std::string& from,
+                           const std::string& to,
+                           const std::vector<std::string>& accounts)
+        {
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            for (std::vector<std::string>::const_iterator it = accounts.begin();
+                 it != accounts.end();
+                 ++it)
+            {
+                std::string key = cache_key(to, *it);
+                std::unordered_map<std::string, Expiry>::iterator expiry
+                    = expiries_.find(cache_key(from, *it));
+                if (expiry == expiries_.end())
+                {
+                    expiries_.erase(key);
+                    continue;
+                }
+
+                Clock::time_point deadline = expiry->second.deadline;
+                expiries_.erase(expiry);
+                schedule_expiry(key, deadline);
+            }
+        }
+
+        /**
+         * Records an expiry and sets a timer for the reaper to delete the
+         * credential then. Called with expiry_mutex_ held.
+         */
+        void schedule_expiry(const std::string& key, Clock::time_point deadline)
+        {
+            Expiry expiry = {deadline, ++generations_};
+            expiries_[key] = expiry;
+            expiring_.store(true, std::memory_order_release);
+            if (reaper_stopping_)
+            {
+                return;
+            }
+
+            // An empty wheel has the reaper asleep until woken.
+            bool wake = expiry_timers_.empty();
+            if (wake)
+            {
+                expiry_time_ = Clock::now();
+            }
+
+            // Rounded up, so that nothing is reaped before it expires.
+            long long delay_ms = std::max(
+                0LL,
+                static_cast<long long>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - expiry_time_)
+                        .count()));
+            ExpiryTimer timer = {key, expiry.generation};
+            expiry_timers_.add((delay_ms + reap_interval_ - 1) / reap_interval_, timer);
+
+            if (!reap_thread_)
+            {
+                reap_thread_.reset(new std::thread(&Impl::run_reaper, this));
+            }
+            if (wake)
+            {
+                reap_wake_.notify_one();
+            }
+        }
+
+        /**
+         * Forgets the expiry of a credential stored again without one, or
+         * deleted.
+         */
+        void clear_expiry(const std::string& key)
+        {
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            expiries_.erase(key);
+        }
+
+        /**
+         * clear_expiry for every account of a service.
+         */
+        void clear_service_expiries(const std::string& service)
+        {
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            std::string prefix = cache_key(service, std::string());
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            for (std::unordered_map<std::string, Expiry>::iterator it = expiries_.begin();
+                 it != expiries_.end();)
+            {
+                if (it->first.compare(0, prefix.size(), prefix) == 0)
+                {
+                    it = expiries_.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        void prepare_fork()
+        {
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                shards_[i].mutex.lock();
+            }
+            refresh_mutex_.lock();
+            expiry_mutex_.lock();
+            count_mutex_.lock();
+        }
+
+        void parent_after_fork()
+        {
+            count_mutex_.unlock();
+            expiry_mutex_.unlock();
+            refresh_mutex_.unlock();
+            for (size_t i = shard_count; i > 0; --i)
+            {
+                shards_[i - 1].mutex.unlock();
+            }
+        }
+
+        /**
+         * The refresh thread is gone; the next refresh starts another. What
+         * it had queued or was running is dropped and the entries unmarked,
+         * so that they get refreshed again when next served stale. Expired
+         * credentials are still not served, but the parent reaps them.
+         */
+        void child_after_fork()
+        {
+            // Neither joinable nor detachable in the child, so leaked.
+            refresh_thread_.release();
+            reap_thread_.release();
+            // They may still count the lost threads as waiters, and the lost
+            // reaper may have held reap_mutex_.
+            new (&refresh_wake_) std::condition_variable();
+            new (&reap_wake_) std::condition_variable();
+            new (&reap_mutex_) std::mutex();
+            expiry_timers_ = detail::HierarchicalTimerWheel<ExpiryTimer>();
+            refresh_queue_.clear();
+            timers_ = detail::TimerWheel<Refresh>();
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                for (std::unordered_map<std::string, CacheEntry>::iterator it
+                     = shards_[i].entries.begin();
+                     it != shards_[i].entries.end();
+                     ++it)
+                {
+                    it->second.refreshing = false;
+                }
+            }
+            parent_after_fork();
+        }
+
+        /**
+         * Writes the servable cache entries to snapshot_path. Each goes with
+         * the credential's modification time when the backend can tell that
+         * it has not changed since the password was read, so that a later
+         * load can revalidate it without reading the secret. Credentials
+         * stored with an expiry are left out, as the snapshot cannot carry it.
+         */
+        LIBCRED_RESULT save_snapshot(std::string* error)
+        {
+            if (options_.snapshot_path.empty())
+            {
+                *error = "No snapshot_path is set";
+                return FAIL_ERROR;
+            }
+
+            std::vector<detail::SnapshotEntry> entries;
+            Clock::time_point now = Clock::now();
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                std::lock_guard<std::mutex> lock(shards_[i].mutex);
+                for (std::unordered_map<std::string, CacheEntry>::const_iterator it
+                     = shards_[i].entries.begin();
+                     it != shards_[i].entries.end();
+                     ++it)
+                {
+                    if (it->second.expires + std::chrono::milliseconds(options_.stale_ttl_ms)
+                            <= now
+                        || has_expiry(it->first))
+                    {
+                        continue;
+                    }
+
+                    detail::SnapshotEntry entry;
+                    entry.service = it->first.c_str();
+                    entry.account = account_of_key(it->first);
+                    entry.password = it->second.password;
+                    entry.modified = it->second.modified;
+                    entry.loaded = it->second.loaded;
+                    entries.push_back(entry);
+                }
+            }
+
+            for (std::vector<detail::SnapshotEntry>::iterator it = entries.begin();
+                 it != entries.end();
+                 ++it)
+            {
+                // A change in the same second as the read may have come after it.
+                time_t modified;
+                std::string ignored;
+                if (it->modified == 0
+                    && backend_->get_modified(it->service, it->account, &modified, &ignored)
+                           == SUCCESS
+                    && modified < it->loaded)
+                {
+                    it->modified = modified;
+                }
+            }
+
+            bool saved = detail::save_snapshot(options_.snapshot_path, entries, error);
+            LIBCRED_PROBE2(snapshot__save, saved ? SUCCESS : FAIL_ERROR, entries.size());
+            return saved ? SUCCESS : FAIL_ERROR;
+        }
+
+    private:
+        CacheShard& shard_of(const std::string& key)
+        {
+            return shards_[std::hash<std::string>()(key) % shard_count];
+        }
+
+        /**
+         * When a password cached now stops being served: after cache_ttl_ms,
+         * or when the credential expires if that is sooner.
+         */
+        Clock::time_point cache_expiry(const std::string& key)
+        {
+            Clock::time_point expires
+                = Clock::now() + std::chrono::milliseconds(options_.cache_ttl_ms);
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return expires;
+            }
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            std::unordered_map<std::string, Expiry>::const_iterator it = expiries_.find(key);
+            return it != expiries_.end() ? std::min(expires, it->second.deadline) : expires;
+        }
+
+        /**
+         * True if the credential was stored with an expiry, passed or not.
+         */
+        bool has_expiry(const std::string& key)
+        {
+            if (!expiring_.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(expiry_mutex_);
+            return expiries_.count(key) != 0;
+        }
+
+        /**
+         * Stores an entry for a password just written or read. Called with
+         * the shard's mutex held.
+         */
+        void insert(CacheShard& shard, const std::string& key, const std::string& password)
+        {
+            CacheEntry entry;
+            entry.password = password;
+            entry.expires = cache_expiry(key);
+            entry.generation = ++generations_;
+            entry.refreshing = false;
+            entry.accessed = false;
+            entry.loaded = time(NULL);
+            entry.modified = 0;
+
+            shard.entries[key] = entry;
+            ++shard.generation;
+            invalidate_thread_caches();
+            schedule_refresh_ahead(key, entry.generation);
+        }
+
+        /**
+         * Called after every change to the shared cache, as the entries
+         * threads copied may no longer match it.
+         */
+        void invalidate_thread_caches()
+        {
+            if (options_.thread_cache)
+            {
+                epoch_.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        /**
+         * Fills the cache from the snapshot, if there is a usable one, and
+         * queues every entry to be revalidated.
+         */
+        void load_snapshot()
+        {
+            std::vector<detail::SnapshotEntry> entries;
+            std::string error;
+            bool loaded = detail::load_snapshot(options_.snapshot_path, &entries, &error);
+            LIBCRED_PROBE2(snapshot__load, loaded ? SUCCESS : FAIL_ERROR, entries.size());
+
+            Clock::time_point expires
+                = Clock::now() + std::chrono::milliseconds(options_.cache_ttl_ms);
+            for (std::vector<detail::SnapshotEntry>::const_iterator it = entries.begin();
+                 it != entries.end();
+                 ++it)
+            {
+                CacheEntry entry;
+                entry.password = it->password;
+                entry.expires = expires;
+                entry.generation = ++generations_;
+                entry.refreshing = true;
+                entry.accessed = false;
+                entry.loaded = it->loaded;
+                entry.modified = it->modified;
+
+                std::string key = cache_key(it->service, it->account);
+                {
+                    CacheShard& shard = shard_of(key);
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    shard.entries[key] = entry;
+                    ++shard.generation;
+                }
+                schedule_refresh(Refresh(key, entry.generation, REFRESH_SNAPSHOT));
+            }
+        }
+
+        /**
+         * Queues a refresh of an entry; the refresh thread starts on first use.
+         */
+        void schedule_refresh(const Refresh& refresh)
+        {
+            std::lock_guard<std::mutex> lock(refresh_mutex_);
+            if (stopping_)
+            {
+                return;
+            }
+
+            refresh_queue_.push_back(refresh);
+            start_refresh_thread();
+            refresh_wake_.notify_one();
+        }
+
+        /**
+         * With refresh_ahead_percent, sets a timer to refresh a newly stored
+         * entry before it expires. The point is jittered down by up to a fifth
+         * so that entries loaded together are not all refreshed together.
+         */
+        void schedule_refresh_ahead(const std::string& key, uint64_t generation)
+        {
+            if (options_.refresh_ahead_percent <= 0 || options_.refresh_ahead_percent >= 100)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(refresh_mutex_);
+            if (stopping_)
+            {
+                return;
+            }
+
+            // An empty wheel has the refresh thread asleep until woken.
+            Clock::time_point now = Clock::now();
+            bool wake = timers_.empty();
+            if (wake)
+            {
+                timers_time_ = now;
+            }
+
+            double ahead = options_.cache_ttl_ms * options_.refresh_ahead_percent / 100.0;
+            double delay_ms = ahead * std::uniform_real_distribution<double>(0.8, 1.0)(jitter_);
+            // Ticks count from timers_time_, which may be up to a tick behind now.
+            long long since_ms
+                = std::chrono::duration_cast<std::chrono::milliseconds>(now - timers_time_).count();
+            timers_.add(static_cast<uint64_t>((since_ms + delay_ms) / tick_),
+                        Refresh(key, generation, REFRESH_AHEAD));
+
+            start_refresh_thread();
+            if (wake)
+            {
+                refresh_wake_.notify_one();
+            }
+        }
+
+        void start_refresh_thread()
+        {
+            if (!refresh_thread_)
+            {
+                refresh_thread_.reset(new std::thread(&Impl::run_refreshes, this));
+            }
+        }
+
+        /**
+         * Runs queued refreshes, and while timers are pending wakes every
+         * tick to run those that fell due.
+         */
+        void run_refreshes()
+        {
+            std::unique_lock<std::mutex> lock(refresh_mutex_);
+            for (;;)
+            {
+                if (refresh_queue_.empty() && !stopping_)
+                {
+                    if (timers_.empty())
+                    {
+                        refresh_wake_.wait(lock);
+                    }
+                    else
+                    {
+                        refresh_wake_.wait_for(lock, std::chrono::milliseconds(tick_));
+                    }
+                }
+                if (stopping_)
+                {
+                    return;
+                }
+
+                std::deque<Refresh> queued;
+                queued.swap(refresh_queue_);
+
+                std::vector<Refresh> due;
+                if (!timers_.empty())
+                {
+                    long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                               Clock::now() - timers_time_)
+                                               .count();
+                    long long ticks = elapsed_ms / tick_;
+                    timers_.advance(static_cast<uint64_t>(ticks), &due);
+                    timers_time_ += std::chrono::milliseconds(ticks * tick_);
+                }
+
+                lock.unlock();
+                for (std::deque<Refresh>::const_iterator it = queued.begin(); it != queued.end();
+                     ++it)
+                {
+                    refresh(*it);
+                }
+                for (std::vector<Refresh>::const_iterator it = due.begin(); it != due.end(); ++it)
+                {
+                    refresh(*it);
+                }
+                lock.lock();
+            }
+        }
+
+        /**
+         * Reloads an entry from the backend. The result is dropped if the
+         * entry was stored or removed in the meantime, as that is newer. A
+         * refresh ahead is skipped unless the entry was read since it was
+         * stored; idle entries are left to expire. An entry from a snapshot
+         * is kept without reading the secret if its modification time still
+         * matches.
+         */
+        void refresh(const Refresh& task)
+        {
+            const std::string& key = task.key;
+            uint64_t generation = task.generation;
+            std::string service(key.c_str());
+            std::string account(account_of_key(key));
+
+            CacheShard& shard = shard_of(key);
+            time_t expected_modified = 0;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::unordered_map<std::string, CacheEntry>::iterator it = shard.entries.find(key);
+                if (it == shard.entries.end() || it->second.generation != generation)
+                {
+                    return;
+                }
+                if (task.reason == REFRESH_AHEAD)
+                {
+                    if (!it->second.accessed || it->second.refreshing)
+                    {
+                        return;
+                    }
+                    it->second.refreshing = true;
+                }
+                expected_modified = it->second.modified;
+            }
+
+            if (task.reason == REFRESH_SNAPSHOT && expected_modified != 0)
+            {
+                time_t modified;
+                std::string ignored;
+                if (backend_->get_modified(service, account, &modified, &ignored) == SUCCESS
+                    && modified == expected_modified)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    std::unordered_map<std::string, CacheEntry>::iterator it
+                        = shard.entries.find(key);
+                    if (it != shard.entries.end() && it->second.generation == generation)
+                    {
+                        it->second.refreshing = false;
+                        schedule_refresh_ahead(key, generation);
+                    }
+                    return;
+                }
+            }
+
+            std::string password, error;
+            LIBCRED_RESULT result = backend_->get_password(service, account, &password, &error);
+            LIBCRED_PROBE3(cache__refresh, service.c_str(), account.c_str(), result);
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            std::unordered_map<std::string, CacheEntry>::iterator it = shard.entries.find(key);
+            if (it == shard.entries.end() || it->second.generation != generation)
+            {
+                return;
+            }
+
+            if (result == SUCCESS)
+            {
+                it->second.password = password;
+                it->second.expires = cache_expiry(key);
+                it->second.generation = ++generations_;
+                it->second.refreshing = false;
+                it->second.accessed = false;
+                it->second.loaded = time(NULL);
+                it->second.modified = 0;
+                invalidate_thread_caches();
+                schedule_refresh_ahead(key, it->second.generation);
+            }
+            else if (result == FAIL_NONFATAL)
+            {
+                shard.entries.erase(it);
+                ++shard.generation;
+                ++shard.removals;
+                invalidate_thread_caches();
+            }
+            else
+            {
+                // Keep serving it; the next caller within the limit retries.
+                it->second.refreshing = false;
+            }
+        }
+
+        /**
+         * Deletes expired credentials from the backend. Wakes every interval
+         * while timers are pending and deletes all that fell due as one
+         * batch, holding reap_mutex_ so no write of those keys interleaves.
+         */
+        void run_reaper()
+        {
+            std::unique_lock<std::mutex> lock(expiry_mutex_);
+            for (;;)
+            {
+                if (!reaper_stopping_)
+                {
+                    if (expiry_timers_.empty())
+                    {
+                        reap_wake_.wait(lock);
+                    }
+                    else
+                    {
+                        reap_wake_.wait_for(lock, std::chrono::milliseconds(reap_interval_));
+                    }
+                }
+                if (reaper_stopping_)
+                {
+                    return;
+                }
+
+                std::vector<ExpiryTimer> due;
+                long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                           Clock::now() - expiry_time_)
+                                           .count();
+                long long ticks = elapsed_ms / reap_interval_;
+                expiry_timers_.advance(static_cast<uint64_t>(ticks), &due);
+                expiry_time_ += std::chrono::milliseconds(ticks * reap_interval_);
+                if (due.empty())
+                {
+                    continue;
+                }
+
+                lock.unlock();
+                std::lock_guard<std::mutex> writes(reap_mutex_);
+                lock.lock();
+
+                // Only timers of expiries still current: the others were
+                // replaced by a later store or a delete. The expiries stay
+                // until the deletes are done, so that get_password keeps
+                // treating the credentials as not found rather than reading
+                // them from the backend meanwhile. The wheel parks timers
+                // beyond its span and places them again each revolution, so
+                // none should come up before its deadline; one that does is
+                // set again rather than reaped early.
+                std::vector<ExpiryTimer> reaped;
+                Clock::time_point now = Clock::now();
+                for (std::vector<ExpiryTimer>::const_iterator it = due.begin(); it != due.end();
+                     ++it)
+                {
+                    std::unordered_map<std::string, Expiry>::iterator expiry
+                        = expiries_.find(it->key);
+                    if (expiry == expiries_.end() || expiry->second.generation != it->generation)
+                    {
+                        continue;
+                    }
+                    if (expiry->second.deadline > now)
+                    {
+                        schedule_expiry(it->key, expiry->second.deadline);
+                    }
+                    else
+                    {
+                        reaped.push_back(*it);
+                    }
+                }
+
+                lock.unlock();
+                std::vector<LIBCRED_RESULT> results;
+                for (std::vector<ExpiryTimer>::const_iterator it = reaped.begin();
+                     it != reaped.end();
+                     ++it)
+                {
+                    std::string service(it->key.c_str());
+                    std::string account(account_of_key(it->key));
+                    std::string error;
+                    Clock::time_point started = start();
+                    LIBCRED_RESULT result = backend_->delete_password(service, account, &error);
+                    cache_erase(it->key);
+                    count_forget(service);
+                    results.push_back(result);
+                    LIBCRED_PROBE3(expiry__reap, service.c_str(), account.c_str(), result);
+                    record("delete_password", service, account, 0, started, result);
+                }
+                lock.lock();
+
+                // A failed delete keeps its expiry, so the credential is
+                // still not served, and is retried an interval later.
+                for (size_t i = 0; i < reaped.size(); ++i)
+                {
+                    std::unordered_map<std::string, Expiry>::iterator expiry
+                        = expiries_.find(reaped[i].key);
+                    if (expiry == expiries_.end()
+                        || expiry->second.generation != reaped[i].generation)
+                    {
+                        continue;
+                    }
+                    if (results[i] == FAIL_ERROR)
+                    {
+                        schedule_expiry(reaped[i].key, expiry->second.deadline);
+                    }
+                    else
+                    {
+                        expiries_.erase(expiry);
+                    }
+                }
+            }
+        }
+
+        std::unique_ptr<Backend> backend_;
+        StoreOptions options_;
+        CacheShard shards_[shard_count];
+        std::atomic<uint64_t> generations_;
+        const uint64_t id_;             // Tells this store's thread cache entries apart.
+        std::atomic<uint64_t> epoch_;  // Bumped by every change to the shared cache.
+
+        std::mutex refresh_mutex_;
+        std::condition_variable refresh_wake_;
+        std::deque<Refresh> refresh_queue_;
+        bool stopping_;
+        const long tick_;  // Milliseconds per tick of timers_.
+        detail::TimerWheel<Refresh> timers_;
+        Clock::time_point timers_time_;  // When timers_ was last advanced to.
+        std::minstd_rand jitter_;
+        std::unique_ptr<std::thread> refresh_thread_;
+
+        std::mutex reap_mutex_;  // Taken before expiry_mutex_, see lock_writes().
+        std::mutex expiry_mutex_;
+        std::condition_variable reap_wake_;
+        std::unordered_map<std::string, Expiry> expiries_;
+        std::atomic<bool> expiring_;  // Set once any credential is stored with an expiry.
+        bool reaper_stopping_;
+        const long reap_interval_;  // Milliseconds per tick of expiry_timers_.
+        detail::HierarchicalTimerWheel<ExpiryTimer> expiry_timers_;
+        Clock::time_point expiry_time_;  // When expiry_timers_ was last advanced to.
+        std::unique_ptr<std::thread> reap_thread_;
+
+        std::mutex count_mutex_;
+        std::unordered_map<std::string, CountEntry> counts_;
+        uint64_t count_generation_;  // Bumped by every count_forget().
+    };
+
+    Store::Store(const StoreOptions& options)
+        : impl_(new Impl(detail::make_keyring_backend(options), options))
+    {
+    }
+
+    Store::Store(std::unique_ptr<Backend> backend, const StoreOptions& options)
+        : impl_(new Impl(std::move(backend), options))
+    {
+    }
+
+    Store::~Store()
+    {
+    }
+
+    Store& Store::default_store()
+    {
+        // Deliberately leaked: callers may still use it during static destruction.
+        static Store* store = new Store();
+        return *store;
+    }
+
+    LIBCRED_RESULT Store::set_password(const std::string& service,
+                                       const std::string& account,
+                                       const std::string& password,
+                                       std::string* error)
+    {
+        LIBCRED_PROBE2(set_password__entry, service.c_str(), account.c_str());
+        Clock::time_point started = impl_->start();
+
+        std::string key = cache_key(service, account);
+        std::unique_lock<std::mutex> writes = impl_->lock_writes(false);
+        impl_->cache_erase(key);
+
+        LIBCRED_RESULT result = impl_->backend().set_password(service, account, password, error);
+        impl_->count_forget(service);
+        if (result == SUCCESS)
+        {
+            impl_->clear_expiry(key);
+            impl_->cache_store(key, password);
+        }
+
+        LIBCRED_PROBE3(set_password__return, service.c_str(), account.c_str(), result);
+        impl_->record("set_password", service, account, password.size(), started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::set_password(const std::string& service,
+                                       const std::string& account,
+                                       const std::string& password,
+                                       time_t expires,
+                                       std::string* error)
+    {
+        LIBCRED_PROBE2(set_password__entry, service.c_str(), account.c_str());
+        Clock::time_point started = impl_->start();
+
+        std::string key = cache_key(service, account);
+        std::unique_lock<std::mutex> writes = impl_->lock_writes(true);
+        impl_->cache_erase(key);
+
+        LIBCRED_RESULT result = impl_->backend().set_password(service, account, password, error);
+        impl_->count_forget(service);
+        if (result == SUCCESS)
+        {
+            impl_->set_expiry(key, expires);
+            impl_->cache_store(key, password);
+        }
+
+        LIBCRED_PROBE3(set_password__return, service.c_str(), account.c_str(), result);
+        impl_->record("set_password", service, account, password.size(), started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::get_password(const std::string& service,
+                                       const std::string& account,
+                                       std::string* password,
+                                       std::string* error)
+    {
+        LIBCRED_PROBE2(get_password__entry, service.c_str(), account.c_str());
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->get_password(
+            cache_key(service, account), service, account, password, error);
+
+        LIBCRED_PROBE3(get_password__return, service.c_str(), account.c_str(), result);
+        impl_->record("get_password",
+                      service,
+                      account,
+                      result == SUCCESS ? password->size() : 0,
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::delete_password(const std::string& service,
+                                          const std::string& account,
+                                          std::string* error)
+    {
+        LIBCRED_PROBE2(delete_password__entry, service.c_str(), account.c_str());
+        Clock::time_point started = impl_->start();
+
+        // Dropped once the backend is done, so that a read racing the delete
+        // cannot leave the password cached.
+        std::string key = cache_key(service, account);
+        LIBCRED_RESULT result = impl_->backend().delete_password(service, account, error);
+        impl_->cache_erase(key);
+        impl_->count_forget(service);
+        impl_->clear_expiry(key);
+
+        LIBCRED_PROBE3(delete_password__return, service.c_str(), account.c_str(), result);
+        impl_->record("delete_password", service, account, 0, started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_password(const std::string& service,
+                                        std::string* password,
+                                        std::string* error)
+    {
+        LIBCRED_PROBE2(find_password__entry, service.c_str(), FIND_ANY);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_password(service, password, error);
+
+        LIBCRED_PROBE2(find_password__return, service.c_str(), result);
+        impl_->record("find_password",
+                      service,
+                      std::string(),
+                      result == SUCCESS ? password->size() : 0,
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_credentials(const std::string& service,
+                                           std::vector<Credentials>* credentials,
+                                           std::string* error)
+    {
+        LIBCRED_PROBE2(find_credentials__entry, service.c_str(), 0);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_credentials(service, credentials, error);
+
+        LIBCRED_PROBE3(find_credentials__return, service.c_str(), result, credentials->size());
+        impl_->record("find_credentials",
+                      service,
+                      std::string(),
+                      credentials->size(),
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_password(const std::string& service,
+                                        LIBCRED_FIND_POLICY policy,
+                                        std::string* account,
+                                        std::string* password,
+                                        std::string* error)
+    {
+        LIBCRED_PROBE2(find_password__entry, service.c_str(), policy);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result =
+            impl_->backend().find_password(service, policy, account, password, error);
+
+        LIBCRED_PROBE2(find_password__return, service.c_str(), result);
+        impl_->record("find_password",
+                      service,
+                      result == SUCCESS && account != NULL ? *account : std::string(),
+                      result == SUCCESS ? password->size() : 0,
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_credentials(const std::string& service,
+                                           size_t limit,
+                                           const std::string& cursor,
+                                           std::vector<Credentials>* credentials,
+                                           std::string* next_cursor,
+                                           std::string* error)
+    {
+        LIBCRED_PROBE2(find_credentials__entry, service.c_str(), limit);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_credentials(
+            service, limit, cursor, credentials, next_cursor, error);
+
+        LIBCRED_PROBE3(find_credentials__return, service.c_str(), result, credentials->size());
+        impl_->record("find_credentials",
+                      service,
+                      std::string(),
+                      credentials->size(),
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* error)
+    {
+        LIBCRED_PROBE1(find_credentials_multi__entry, services.size());
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_credentials(services, credentials, error);
+
+        LIBCRED_PROBE2(find_credentials_multi__return, result, credentials->size());
+        for (std::vector<std::string>::const_iterator it = services.begin(); it != services.end();
+             ++it)
+        {
+            std::map<std::string, std::vector<Credentials>>::const_iterator found
+                = credentials->find(*it);
+            impl_->record("find_credentials",
+                          *it,
+                          std::string(),
+                          found != credentials->end() ? found->second.size() : 0,
+                          started,
+                          result);
+        }
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_credentials(const std::string& service,
+                                           const std::vector<std::string>& collections,
+                                           LIBCRED_MERGE_POLICY policy,
+                                           std::vector<CollectionCredentials>* found,
+                                           std::string* error)
+    {
+        LIBCRED_PROBE2(find_credentials_collections__entry, service.c_str(), collections.size());
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result
+            = impl_->backend().find_credentials(service, collections, policy, found, error);
+
+        LIBCRED_PROBE3(find_credentials_collections__return,
+                       service.c_str(),
+                       result,
+                       found->size());
+        impl_->record("find_credentials", service, std::string(), found->size(), started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::count_credentials(const std::string& service,
+                                            size_t* count,
+                                            std::string* error)
+    {
+        LIBCRED_PROBE1(count_credentials__entry, service.c_str());
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = SUCCESS;
+        if (!impl_->count_lookup(service, count))
+        {
+            uint64_t generation = impl_->count_generation();
+            *count = 0;
+            result = impl_->backend().count_credentials(service, count, error);
+            if (result == SUCCESS)
+            {
+                impl_->count_store(service, *count, generation);
+            }
+        }
+
+        LIBCRED_PROBE3(count_credentials__return, service.c_str(), result, *count);
+        impl_->record("count_credentials", service, std::string(), *count, started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::count_credentials(const std::vector<std::string>& services,
+                                            std::map<std::string, size_t>* counts,
+                                            std::string* error)
+    {
+        LIBCRED_PROBE1(count_credentials_multi__entry, services.size());
+        Clock::time_point started = impl_->start();
+
+        // Only the services without a kept count go to the backend.
+        std::vector<std::string> missing;
+        for (std::vector<std::string>::const_iterator it = services.begin(); it != services.end();
+             ++it)
+        {
+            size_t& count = (*counts)[*it];
+            if (!impl_->count_lookup(*it, &count))
+            {
+                count = 0;
+                missing.push_back(*it);
+            }
+        }
+
+        LIBCRED_RESULT result = SUCCESS;
+        if (!missing.empty())
+        {
+            uint64_t generation = impl_->count_generation();
+            result = impl_->backend().count_credentials(missing, counts, error);
+            for (std::vector<std::string>::const_iterator it = missing.begin();
+                 result == SUCCESS && it != missing.end();
+                 ++it)
+            {
+                impl_->count_store(*it, (*counts)[*it], generation);
+            }
+        }
+
+        LIBCRED_PROBE2(count_credentials_multi__return, result, counts->size());
+        for (std::vector<std::string>::const_iterator it = services.begin(); it != services.end();
+             ++it)
+        {
+            impl_->record(
+                "count_credentials", *it, std::string(), (*counts)[*it], started, result);
+        }
+        return result;
+    }
+
+    LIBCRED_RESULT Store::delete_credentials(const std::string& service,
+                                             size_t* deleted,
+                                             std::string* error)
+    {
+        LIBCRED_PROBE1(delete_credentials__entry, service.c_str());
+        Clock::time_point started = impl_->start();
+
+        *deleted = 0;
+        LIBCRED_RESULT result = impl_->backend().delete_credentials(service, deleted, error);
+        impl_->cache_erase_service(service);
+        impl_->count_forget(service);
+        impl_->clear_service_expiries(service);
+
+        LIBCRED_PROBE3(delete_credentials__return, service.c_str(), result, *deleted);
+        impl_->record("delete_credentials", service, std::string(), *deleted, started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::rename_service(const std::string& from,
+                                         const std::string& to,
+                                         std::vector<std::string>* accounts,
+                                         std::string* error)
+    {
+        LIBCRED_PROBE2(rename_service__entry, from.c_str(), to.c_str());
+        Clock::time_point started = impl_->start();
+
+        // Keeps the reaper from deleting a credential whose expiry is moving.
+        std::unique_lock<std::mutex> writes = impl_->lock_writes(false);
+        size_t before = accounts->size();
+        LIBCRED_RESULT result = impl_->backend().rename_service(from, to, accounts, error);
+        impl_->cache_erase_service(from);
+        impl_->cache_erase_service(to);
+        impl_->count_forget(from);
+        impl_->count_forget(to);
+        impl_->move_expiries(
+            from, to, std::vector<std::string>(accounts->begin() + before, accounts->end()));
+        size_t renamed = accounts->size() - before;
+
+        // The new name goes where other operations record the account, so
+        // that a trace can be replayed.
+        LIBCRED_PROBE3(rename_service__return, from.c_str(), result, renamed);
+        impl_->record("rename_service", from, to, renamed, started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::set_password(ServiceId service,
+                                       AccountId account,
+                                       const std::string& password,
+                                       std::string* error)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        LIBCRED_PROBE2(set_password__entry, service_str->c_str(), account_str->c_str());
+        Clock::time_point started = impl_->start();
+
+        std::string key = cache_key(*service_str, *account_str);
+        std::unique_lock<std::mutex> writes = impl_->lock_writes(false);
+        impl_->cache_erase(key);
+
+        LIBCRED_RESULT result = impl_->backend().set_password(service, account, password, error);
+        impl_->count_forget(*service_str);
+        if (result == SUCCESS)
+        {
+            impl_->clear_expiry(key);
+            impl_->cache_store(key, password);
+        }
+
+        LIBCRED_PROBE3(set_password__return, service_str->c_str(), account_str->c_str(), result);
+        impl_->record("set_password", *service_str, *account_str, password.size(), started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::get_password(ServiceId service,
+                                       AccountId account,
+                                       std::string* password,
+                                       std::string* error)
+    {
+        LIBCRED_PROBE2(get_password__entry, probe_name(service), probe_account(account));
+        Clock::time_point started = impl_->start();
+
+        // Names are resolved on a miss only, or for the audit log and trace.
+        if (impl_->id_lookup(service, account, password))
+        {
+            LIBCRED_PROBE3(
+                get_password__return, probe_name(service), probe_account(account), SUCCESS);
+            if (impl_->recording())
+            {
+                impl_->record("get_password",
+                              record_name(service),
+                              record_account(account),
+                              password->size(),
+                              started,
+                              SUCCESS);
+            }
+            return SUCCESS;
+        }
+
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            LIBCRED_PROBE3(
+                get_password__return, probe_name(service), probe_account(account), FAIL_ERROR);
+            return FAIL_ERROR;
+        }
+
+        std::string key = cache_key(*service_str, *account_str);
+        LIBCRED_RESULT result = impl_->get_password(key, service, account, password, error);
+        if (result == SUCCESS)
+        {
+            impl_->id_index(service, account, key);
+        }
+
+        LIBCRED_PROBE3(get_password__return, service_str->c_str(), account_str->c_str(), result);
+        impl_->record("get_password",
+                      *service_str,
+                      *account_str,
+                      result == SUCCESS ? password->size() : 0,
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::delete_password(ServiceId service, AccountId account, std::string* error)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, error))
+        {
+            return FAIL_ERROR;
+        }
+
+        LIBCRED_PROBE2(delete_password__entry, service_str->c_str(), account_str->c_str());
+        Clock::time_point started = impl_->start();
+
+        std::string key = cache_key(*service_str, *account_str);
+        LIBCRED_RESULT result = impl_->backend().delete_password(service, account, error);
+        impl_->cache_erase(key);
+        impl_->count_forget(*service_str);
+        impl_->clear_expiry(key);
+
+        LIBCRED_PROBE3(delete_password__return, service_str->c_str(), account_str->c_str(), result);
+        impl_->record("delete_password", *service_str, *account_str, 0, started, result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_password(ServiceId service,
+                                        std::string* password,
+                                        std::string* error)
+    {
+        LIBCRED_PROBE2(find_password__entry, probe_name(service), FIND_ANY);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_password(service, password, error);
+
+        LIBCRED_PROBE2(find_password__return, probe_name(service), result);
+        impl_->record("find_password",
+                      record_name(service),
+                      std::string(),
+                      result == SUCCESS ? password->size() : 0,
+                      started,
+                      result);
+        return result;
+    }
+
+    LIBCRED_RESULT Store::find_credentials(ServiceId service,
+                                           std::vector<Credentials>* credentials,
+                                           std::string* error)
+    {
+        LIBCRED_PROBE2(find_credentials__entry, probe_name(service), 0);
+        Clock::time_point started = impl_->start();
+
+        LIBCRED_RESULT result = impl_->backend().find_credentials(service, credentials, error);
+
+        LIBCRED_PROBE3(find_credentials__return, probe_name(service), result, credentials->size());
+        impl_->record("find_credentials",
+                      record_name(service),
+                      std::string(),
+                      credentials->size(),
+                      started,
+                      result);
+        return result;
+    }
+
+    bool Store::get_cached_password(const std::string& service,
+                                    const std::string& account,
+                                    std::string* password)
+    {
+        Clock::time_point started = impl_->start();
+        std::string key = cache_key(service, account);
+        if (impl_->expired(key) || !impl_->cache_lookup(key, password))
+        {
+            return false;
+        }
+
+        impl_->record("get_password", service, account, password->size(), started, SUCCESS);
+        return true;
+    }
+
+    void Store::clear_cache()
+    {
+        impl_->cache_clear();
+    }
+
+    LIBCRED_RESULT Store::save_snapshot(std::string* error)
+    {
+        return impl_->save_snapshot(error);
+    }
+
+    MemoryUsage Store::memory_usage() const
+    {
+        MemoryUsage usage;
+        impl_->cache_usage(&usage);
+        usage.backend_bytes = impl_->backend().memory_usage();
+        usage.intern_bytes = detail::intern_memory_usage();
+        return usage;
+    }
+
+}  // namespace libcred
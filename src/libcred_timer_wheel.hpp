@@ -0,0 +1,246 @@
+#ifndef SRC_LIBCRED_TIMER_WHEEL_H_
+#define SRC_LIBCRED_TIMER_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace libcred
+{
+    namespace detail
+    {
+
+        /**
+         * A hashed timer wheel: a timer goes in the slot of the tick it is due
+         * in, so adding one is constant time and advancing a tick only looks
+         * at one slot, however many timers are pending. Timers due more than
+         * a revolution ahead share a slot with nearer ones and wait out the
+         * extra laps there.
+         *
+         * Time is counted in ticks; the owner decides how long a tick is and
+         * calls advance() as they pass. Not thread safe.
+         */
+        template <typename T>
+        class TimerWheel
+        {
+        public:
+            explicit TimerWheel(size_t slots = 256)
+                : slots_(slots)
+                , now_(0)
+                , size_(0)
+            {
+            }
+
+            /**
+             * Adds a timer due after the given number of ticks, at least one.
+             */
+            void add(uint64_t ticks, const T& value)
+            {
+                Timer timer = {now_ + (ticks > 0 ? ticks : 1), value};
+                slots_[timer.due % slots_.size()].push_back(timer);
+                ++size_;
+            }
+
+            /**
+             * Moves time forward, appending the values of the timers that
+             * fall due to expired.
+             */
+            void advance(uint64_t ticks, std::vector<T>* expired)
+            {
+                uint64_t target = now_ + ticks;
+                if (size_ == 0)
+                {
+                    now_ = target;
+                    return;
+                }
+
+                if (ticks >= slots_.size())
+                {
+                    // A revolution or more: every slot comes up anyway.
+                    for (size_t i = 0; i < slots_.size(); ++i)
+                    {
+                        expire(&slots_[i], target, expired);
+                    }
+                    now_ = target;
+                    return;
+                }
+
+                while (now_ < target)
+                {
+                    ++now_;
+                    expire(&slots_[now_ % slots_.size()], now_, expired);
+                }
+            }
+
+            bool empty() const
+            {
+                return size_ == 0;
+            }
+
+            size_t size() const
+            {
+                return size_;
+            }
+
+        private:
+            struct Timer
+            {
+                uint64_t due;
+                T value;
+            };
+
+            void expire(std::vector<Timer>* slot, uint64_t now, std::vector<T>* expired)
+            {
+                size_t i = 0;
+                while (i < slot->size())
+                {
+                    if ((*slot)[i].due <= now)
+                    {
+                        expired->push_back((*slot)[i].value);
+                        (*slot)[i] = slot->back();
+                        slot->pop_back();
+                        --size_;
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+
+            std::vector<std::vector<Timer>> slots_;
+            uint64_t now_;
+            size_t size_;
+        };
+
+        /**
+         * A hierarchical timer wheel, for timers far ahead: level 0 has a slot
+         * per tick, and each level above a slot per revolution of the one
+         * below. A timer goes in the level its distance calls for and moves
+         * down a level each time the slot it is in comes up, so every timer
+         * is touched once per level rather than once per lap. Timers beyond
+         * the top level wait there for whole revolutions.
+         *
+         * Same interface as TimerWheel. Not thread safe.
+         */
+        template <typename T>
+        class HierarchicalTimerWheel
+        {
+        public:
+            HierarchicalTimerWheel()
+                : now_(0)
+                , size_(0)
+            {
+            }
+
+            /**
+             * Adds a timer due after the given number of ticks, at least one.
+             */
+            void add(uint64_t ticks, const T& value)
+            {
+                Timer timer = {now_ + (ticks > 0 ? ticks : 1), value};
+                place(timer);
+                ++size_;
+            }
+
+            /**
+             * Moves time forward, appending the values of the timers that
+             * fall due to expired.
+             */
+            void advance(uint64_t ticks, std::vector<T>* expired)
+            {
+                uint64_t target = now_ + ticks;
+                while (now_ < target)
+                {
+                    if (size_ == 0)
+                    {
+                        now_ = target;
+                        return;
+                    }
+
+                    ++now_;
+                    // Higher levels first, as what they hand down may be due
+                    // in the level 0 slot coming up now.
+                    for (int level = levels - 1; level > 0; --level)
+                    {
+                        if ((now_ & ((uint64_t(1) << (level * slot_bits)) - 1)) == 0)
+                        {
+                            cascade(level);
+                        }
+                    }
+
+                    std::vector<Timer>& slot = slots_[0][now_ & slot_mask];
+                    for (size_t i = 0; i < slot.size(); ++i)
+                    {
+                        expired->push_back(slot[i].value);
+                    }
+                    size_ -= slot.size();
+                    slot.clear();
+                }
+            }
+
+            bool empty() const
+            {
+                return size_ == 0;
+            }
+
+            size_t size() const
+            {
+                return size_;
+            }
+
+        private:
+            static const int levels = 4;
+            static const int slot_bits = 6;
+            static const uint64_t slot_mask = (uint64_t(1) << slot_bits) - 1;
+
+            struct Timer
+            {
+                uint64_t due;
+                T value;
+            };
+
+            /**
+             * Files a timer due after now_ in the lowest level whose range
+             * reaches it.
+             */
+            void place(const Timer& timer)
+            {
+                uint64_t distance = timer.due - now_;
+                int level = 0;
+                while (level < levels - 1 && distance >> ((level + 1) * slot_bits) != 0)
+                {
+                    ++level;
+                }
+
+                // The top level's slot for a timer out of its range comes up a
+                // revolution early; the timer is placed again from there.
+                uint64_t due = timer.due;
+                uint64_t range = uint64_t(1) << (levels * slot_bits);
+                if (distance >= range)
+                {
+                    due = now_ + range - 1;
+                }
+                slots_[level][(due >> (level * slot_bits)) & slot_mask].push_back(timer);
+            }
+
+            void cascade(int level)
+            {
+                std::vector<Timer> slot;
+                slot.swap(slots_[level][(now_ >> (level * slot_bits)) & slot_mask]);
+                for (size_t i = 0; i < slot.size(); ++i)
+                {
+                    place(slot[i]);
+                }
+            }
+
+            std::vector<Timer> slots_[levels][slot_mask + 1];
+            uint64_t now_;
+            size_t size_;
+        };
+
+    }  // namespace detail
+}  // namespace libcred
+
+#endif  // SRC_LIBCRED_TIMER_WHEEL_H_
@@ -0,0 +1,186 @@
+#include "libcred_trace.hpp"
+#include "libcred_fork.hpp"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace libcred
+{
+
+    namespace
+    {
+
+        typedef std::chrono::steady_clock Clock;
+
+        uint64_t fnv1a(const std::string& salt, const std::string& name)
+        {
+            uint64_t hash = 14695981039346656037ULL;
+            for (std::string::const_iterator it = salt.begin(); it != salt.end(); ++it)
+            {
+                hash = (hash ^ static_cast<unsigned char>(*it)) * 1099511628211ULL;
+            }
+            for (std::string::const_iterator it = name.begin(); it != name.end(); ++it)
+            {
+                hash = (hash ^ static_cast<unsigned char>(*it)) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+    }  // namespace
+
+    TraceOptions::TraceOptions()
+    {
+    }
+
+    /**
+     * Records go through stdio's buffer under one lock: tracing is a
+     * diagnostic mode, and a trace is only useful if nothing is dropped.
+     * The lock is held across fork() and the buffer flushed before it, so
+     * a child neither inherits a half written buffer nor writes the
+     * parent's records again.
+     */
+    class TraceRecorder::Impl : public detail::ForkHandler
+    {
+    public:
+        explicit Impl(const TraceOptions& options)
+            : salt_(options.salt)
+            , file_(fopen(options.path.c_str(), "w"))
+            , started_(false)
+        {
+            if (file_ != NULL)
+            {
+                fputs("# libcred trace 1\n", file_);
+            }
+            detail::register_fork_handler(this);
+        }
+
+        ~Impl()
+        {
+            detail::unregister_fork_handler(this);
+            if (file_ != NULL)
+            {
+                fclose(file_);
+            }
+        }
+
+        bool ok() const
+        {
+            return file_ != NULL;
+        }
+
+        void record(const char* operation,
+                    const std::string& service,
+                    const std::string& account,
+                    size_t size,
+                    Clock::time_point started,
+                    LIBCRED_RESULT result)
+        {
+            if (file_ == NULL)
+            {
+                return;
+            }
+
+            Clock::time_point finished = Clock::now();
+            uint64_t service_hash = fnv1a(salt_, service);
+            uint64_t account_hash = fnv1a(salt_, account);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Small thread numbers show the concurrency without system thread ids.
+            std::map<std::thread::id, int>::iterator thread
+                = threads_.insert(std::make_pair(std::this_thread::get_id(), threads_.size()))
+                      .first;
+            if (!started_)
+            {
+                origin_ = started;
+                started_ = true;
+            }
+
+            // A call may have started before the one recorded first.
+            long long start_us
+                = std::chrono::duration_cast<std::chrono::microseconds>(started - origin_).count();
+            long long latency_us
+                = std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count();
+            fprintf(file_,
+                    "%lld %d %s %016" PRIx64 " %016" PRIx64 " %zu %d %lld\n",
+                    start_us > 0 ? start_us : 0,
+                    thread->second,
+                    operation,
+                    service_hash,
+                    account_hash,
+                    size,
+                    static_cast<int>(result),
+                    latency_us);
+        }
+
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_ != NULL)
+            {
+                fflush(file_);
+            }
+        }
+
+        void prepare_fork()
+        {
+            mutex_.lock();
+            if (file_ != NULL)
+            {
+                fflush(file_);
+            }
+        }
+
+        void parent_after_fork()
+        {
+            mutex_.unlock();
+        }
+
+        void child_after_fork()
+        {
+            mutex_.unlock();
+        }
+
+    private:
+        std::string salt_;
+        FILE* file_;
+
+        std::mutex mutex_;
+        bool started_;
+        Clock::time_point origin_;
+        std::map<std::thread::id, int> threads_;
+    };
+
+    TraceRecorder::TraceRecorder(const TraceOptions& options)
+        : impl_(new Impl(options))
+    {
+    }
+
+    TraceRecorder::~TraceRecorder()
+    {
+    }
+
+    bool TraceRecorder::ok() const
+    {
+        return impl_->ok();
+    }
+
+    void TraceRecorder::record(const char* operation,
+                               const std::string& service,
+                               const std::string& account,
+                               size_t size,
+                               std::chrono::steady_clock::time_point started,
+                               LIBCRED_RESULT result)
+    {
+        impl_->record(operation, service, account, size, started, result);
+    }
+
+    void TraceRecorder::flush()
+    {
+        impl_->flush();
+    }
+
+}  // namespace libcred
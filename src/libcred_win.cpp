@@ -1,10 +1,16 @@
-#include "libcred.hpp"
+#include "libcred_internal.hpp"
+#include "libcred_store.hpp"
 
 #define UNICODE
 
 #include <windows.h>
 #include <wincred.h>
 
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
 namespace libcred
 {
 
@@ -91,48 +97,237 @@ namespace libcred
         return errMsg;
     }
 
-    LIBCRED_PUBLIC_API LIBCRED_RESULT set_password(const std::string& service,
-                                                   const std::string& account,
-                                                   const std::string& password,
-                                                   std::string* errStr)
+    namespace
     {
-        LPWSTR target_name = utf8ToWideChar(service + '/' + account);
-        if (target_name == NULL)
+
+        LIBCRED_RESULT write_credential(LPCWSTR target_name,
+                                        const std::string& account,
+                                        const std::string& password,
+                                        std::string* errStr)
         {
-            return FAIL_ERROR;
+            LPWSTR user_name = utf8ToWideChar(account);
+            if (user_name == NULL)
+            {
+                return FAIL_ERROR;
+            }
+
+            CREDENTIAL cred = { 0 };
+            cred.Type = CRED_TYPE_GENERIC;
+            cred.TargetName = const_cast<LPWSTR>(target_name);
+            cred.UserName = user_name;
+            cred.CredentialBlobSize = password.size();
+            cred.CredentialBlob = (LPBYTE) (password.data());
+            cred.Persist = CRED_PERSIST_ENTERPRISE;
+
+            bool result = ::CredWrite(&cred, 0);
+            delete[] user_name;
+            if (!result)
+            {
+                *errStr = getErrorMessage(::GetLastError());
+                return FAIL_ERROR;
+            }
+            else
+            {
+                return SUCCESS;
+            }
         }
 
-        LPWSTR user_name = utf8ToWideChar(account);
-        if (user_name == NULL)
+        LIBCRED_RESULT read_credential(LPCWSTR target_name,
+                                       std::string* password,
+                                       std::string* errStr)
         {
-            return FAIL_ERROR;
+            CREDENTIAL* cred;
+            bool result = ::CredRead(target_name, CRED_TYPE_GENERIC, 0, &cred);
+            if (!result)
+            {
+                DWORD code = ::GetLastError();
+                if (code == ERROR_NOT_FOUND)
+                {
+                    return FAIL_NONFATAL;
+                }
+                else
+                {
+                    *errStr = getErrorMessage(code);
+                    return FAIL_ERROR;
+                }
+            }
+
+            *password = std::string(reinterpret_cast<char*>(cred->CredentialBlob),
+                                    cred->CredentialBlobSize);
+            ::CredFree(cred);
+            return SUCCESS;
         }
 
-        CREDENTIAL cred = { 0 };
-        cred.Type = CRED_TYPE_GENERIC;
-        cred.TargetName = target_name;
-        cred.UserName = user_name;
-        cred.CredentialBlobSize = password.size();
-        cred.CredentialBlob = (LPBYTE) (password.data());
-        cred.Persist = CRED_PERSIST_ENTERPRISE;
+        LIBCRED_RESULT delete_credential(LPCWSTR target_name, std::string* errStr)
+        {
+            bool result = ::CredDelete(target_name, CRED_TYPE_GENERIC, 0);
+            if (!result)
+            {
+                DWORD code = ::GetLastError();
+                if (code == ERROR_NOT_FOUND)
+                {
+                    return FAIL_NONFATAL;
+                }
+                else
+                {
+                    *errStr = getErrorMessage(code);
+                    return FAIL_ERROR;
+                }
+            }
 
-        bool result = ::CredWrite(&cred, 0);
-        delete[] target_name;
-        if (!result)
+            return SUCCESS;
+        }
+
+        std::mutex targets_mutex;
+        std::unordered_map<uint64_t, std::wstring> targets;
+
+        /**
+         * Returns the wide target name of an interned key, converting it from
+         * UTF-8 on first use only. NULL if the key is unknown or not convertible.
+         */
+        LPCWSTR key_target(ServiceId service, AccountId account)
+        {
+            uint64_t key = detail::key_of(service, account);
+
+            std::lock_guard<std::mutex> lock(targets_mutex);
+
+            std::unordered_map<uint64_t, std::wstring>::const_iterator it = targets.find(key);
+            if (it != targets.end())
+            {
+                return it->second.c_str();
+            }
+
+            const std::string* label = detail::key_label(service, account);
+            if (label == NULL)
+            {
+                return NULL;
+            }
+
+            LPWSTR target_name = utf8ToWideChar(*label);
+            if (target_name == NULL)
+            {
+                return NULL;
+            }
+
+            std::wstring target(target_name);
+            delete[] target_name;
+            return targets.insert(std::make_pair(key, target)).first->second.c_str();
+        }
+
+        /**
+         * Backend over the Windows Credential Manager, with "service/account"
+         * as target names. Store options for the Secret Service do not apply.
+         */
+        class CredentialManagerBackend : public Backend
+        {
+        public:
+            using Backend::count_credentials;
+            using Backend::delete_password;
+            using Backend::find_credentials;
+            using Backend::find_password;
+            using Backend::get_password;
+            using Backend::set_password;
+
+            LIBCRED_RESULT set_password(const std::string& service,
+                                        const std::string& account,
+                                        const std::string& password,
+                                        std::string* error);
+
+            LIBCRED_RESULT get_password(const std::string& service,
+                                        const std::string& account,
+                                        std::string* password,
+                                        std::string* error);
+
+            LIBCRED_RESULT delete_password(const std::string& service,
+                                           const std::string& account,
+                                           std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_password(const std::string& service,
+                                         LIBCRED_FIND_POLICY policy,
+                                         std::string* account,
+                                         std::string* password,
+                                         std::string* error);
+
+            LIBCRED_RESULT find_credentials(const std::string& service,
+                                            size_t limit,
+                                            const std::string& cursor,
+                                            std::vector<Credentials>* credentials,
+                                            std::string* next_cursor,
+                                            std::string* error);
+
+            LIBCRED_RESULT find_credentials(
+                const std::vector<std::string>& services,
+                std::map<std::string, std::vector<Credentials>>* credentials,
+                std::string* error);
+
+            LIBCRED_RESULT count_credentials(const std::string& service,
+                                             size_t* count,
+                                             std::string* error);
+
+            LIBCRED_RESULT delete_credentials(const std::string& service,
+                                              size_t* deleted,
+                                              std::string* error);
+
+            LIBCRED_RESULT set_password(ServiceId service,
+                                        AccountId account,
+                                        const std::string& password,
+                                        std::string* error);
+
+            LIBCRED_RESULT get_password(ServiceId service,
+                                        AccountId account,
+                                        std::string* password,
+                                        std::string* error);
+
+            LIBCRED_RESULT delete_password(ServiceId service,
+                                           AccountId account,
+                                           std::string* error);
+        };
+
+    }  // namespace
+
+    LIBCRED_RESULT CredentialManagerBackend::set_password(const std::string& service,
+                                                          const std::string& account,
+                                                          const std::string& password,
+                                                          std::string* errStr)
+    {
+        LPWSTR target_name = utf8ToWideChar(service + '/' + account);
+        if (target_name == NULL)
         {
-            *errStr = getErrorMessage(::GetLastError());
             return FAIL_ERROR;
         }
-        else
+
+        LIBCRED_RESULT result = write_credential(target_name, account, password, errStr);
+        delete[] target_name;
+        return result;
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::get_password(const std::string& service,
+                                                          const std::string& account,
+                                                          std::string* password,
+                                                          std::string* errStr)
+    {
+        LPWSTR target_name = utf8ToWideChar(service + '/' + account);
+        if (target_name == NULL)
         {
-            return SUCCESS;
+            return FAIL_ERROR;
         }
+
+        LIBCRED_RESULT result = read_credential(target_name, password, errStr);
+        delete[] target_name;
+        return result;
     }
 
-    LIBCRED_PUBLIC_API LIBCRED_RESULT get_password(const std::string& service,
-                                                   const std::string& account,
-                                                   std::string* password,
-                                                   std::string* errStr)
+    LIBCRED_RESULT CredentialManagerBackend::delete_password(const std::string& service,
+                                                             const std::string& account,
+                                                             std::string* errStr)
     {
         LPWSTR target_name = utf8ToWideChar(service + '/' + account);
         if (target_name == NULL)
@@ -140,9 +335,25 @@ namespace libcred
             return FAIL_ERROR;
         }
 
-        CREDENTIAL* cred;
-        bool result = ::CredRead(target_name, CRED_TYPE_GENERIC, 0, &cred);
+        LIBCRED_RESULT result = delete_credential(target_name, errStr);
         delete[] target_name;
+        return result;
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::find_password(const std::string& service,
+                                                           std::string* password,
+                                                           std::string* errStr)
+    {
+        LPWSTR filter = utf8ToWideChar(service + "*");
+        if (filter == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
+        DWORD count;
+        CREDENTIAL** creds;
+        bool result = ::CredEnumerate(filter, 0, &count, &creds);
+        delete[] filter;
         if (!result)
         {
             DWORD code = ::GetLastError();
@@ -157,24 +368,30 @@ namespace libcred
             }
         }
 
-        *password
-            = std::string(reinterpret_cast<char*>(cred->CredentialBlob), cred->CredentialBlobSize);
-        ::CredFree(cred);
+        *password = std::string(reinterpret_cast<char*>(creds[0]->CredentialBlob),
+                                creds[0]->CredentialBlobSize);
+        ::CredFree(creds);
         return SUCCESS;
     }
 
-    LIBCRED_PUBLIC_API LIBCRED_RESULT delete_password(const std::string& service,
-                                                      const std::string& account,
-                                                      std::string* errStr)
+    LIBCRED_RESULT CredentialManagerBackend::find_password(const std::string& service,
+                                                           LIBCRED_FIND_POLICY policy,
+                                                           std::string* account,
+                                                           std::string* password,
+                                                           std::string* errStr)
     {
-        LPWSTR target_name = utf8ToWideChar(service + '/' + account);
-        if (target_name == NULL)
+        LPWSTR filter = utf8ToWideChar(service + "/*");
+        if (filter == NULL)
         {
             return FAIL_ERROR;
         }
 
-        bool result = ::CredDelete(target_name, CRED_TYPE_GENERIC, 0);
-        delete[] target_name;
+        // CredEnumerate always returns the credential blobs along with the
+        // metadata, so the policy only decides which one is copied out.
+        DWORD count;
+        CREDENTIAL** creds;
+        bool result = ::CredEnumerate(filter, 0, &count, &creds);
+        delete[] filter;
         if (!result)
         {
             DWORD code = ::GetLastError();
@@ -189,23 +406,71 @@ namespace libcred
             }
         }
 
+        CREDENTIAL* chosen = NULL;
+        std::string chosen_account;
+        ULONGLONG chosen_modified = 0;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            CREDENTIAL* cred = creds[i];
+            if (cred->UserName == NULL)
+            {
+                continue;
+            }
+
+            std::string login = wideCharToUtf8(cred->UserName);
+            ULONGLONG modified = (static_cast<ULONGLONG>(cred->LastWritten.dwHighDateTime) << 32)
+                                 | cred->LastWritten.dwLowDateTime;
+
+            bool better = chosen == NULL;
+            if (!better && policy == FIND_MOST_RECENT)
+            {
+                better = modified > chosen_modified
+                         || (modified == chosen_modified && login < chosen_account);
+            }
+            else if (!better && policy == FIND_FIRST_ACCOUNT)
+            {
+                better = login < chosen_account;
+            }
+
+            if (better)
+            {
+                chosen = cred;
+                chosen_account = login;
+                chosen_modified = modified;
+            }
+        }
+
+        if (chosen == NULL)
+        {
+            ::CredFree(creds);
+            return FAIL_NONFATAL;
+        }
+
+        if (account != NULL)
+        {
+            *account = chosen_account;
+        }
+        *password = std::string(reinterpret_cast<char*>(chosen->CredentialBlob),
+                                chosen->CredentialBlobSize);
+        ::CredFree(creds);
         return SUCCESS;
     }
 
-    LIBCRED_PUBLIC_API LIBCRED_RESULT find_password(const std::string& service,
-                                                    std::string* password,
-                                                    std::string* errStr)
+    LIBCRED_RESULT CredentialManagerBackend::find_credentials(const std::string& service,
+                                                              std::vector<Credentials>* credentials,
+                                                              std::string* errStr)
     {
         LPWSTR filter = utf8ToWideChar(service + "*");
         if (filter == NULL)
         {
+            *errStr = "Error generating credential filter";
             return FAIL_ERROR;
         }
 
         DWORD count;
         CREDENTIAL** creds;
+
         bool result = ::CredEnumerate(filter, 0, &count, &creds);
-        delete[] filter;
         if (!result)
         {
             DWORD code = ::GetLastError();
@@ -220,17 +485,35 @@ namespace libcred
             }
         }
 
-        *password = std::string(reinterpret_cast<char*>(creds[0]->CredentialBlob),
-                                creds[0]->CredentialBlobSize);
-        ::CredFree(creds);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            CREDENTIAL* cred = creds[i];
+
+            if (cred->UserName == NULL || cred->CredentialBlobSize == NULL)
+            {
+                continue;
+            }
+
+            std::string login = wideCharToUtf8(cred->UserName);
+            std::string password(reinterpret_cast<char*>(cred->CredentialBlob),
+                                 cred->CredentialBlobSize);
+
+            credentials->push_back(Credentials(login, password));
+        }
+
+        CredFree(creds);
+
         return SUCCESS;
     }
 
-    LIBCRED_PUBLIC_API LIBCRED_RESULT find_credentials(const std::string& service,
-                                                       std::vector<Credentials>* credentials,
-                                                       std::string* errStr)
+    LIBCRED_RESULT CredentialManagerBackend::find_credentials(const std::string& service,
+                                                              size_t limit,
+                                                              const std::string& cursor,
+                                                              std::vector<Credentials>* credentials,
+                                                              std::string* next_cursor,
+                                                              std::string* errStr)
     {
-        LPWSTR filter = utf8ToWideChar(service + "*");
+        LPWSTR filter = utf8ToWideChar(service + "/*");
         if (filter == NULL)
         {
             *errStr = "Error generating credential filter";
@@ -240,12 +523,16 @@ namespace libcred
         DWORD count;
         CREDENTIAL** creds;
 
+        // CredEnumerate always returns the credential blobs, so on Windows the
+        // page only limits what is copied out, not what is read.
         bool result = ::CredEnumerate(filter, 0, &count, &creds);
+        delete[] filter;
         if (!result)
         {
             DWORD code = ::GetLastError();
             if (code == ERROR_NOT_FOUND)
             {
+                next_cursor->clear();
                 return FAIL_NONFATAL;
             }
             else
@@ -255,24 +542,269 @@ namespace libcred
             }
         }
 
+        std::vector<std::pair<std::string, unsigned int>> sorted;
         for (unsigned int i = 0; i < count; ++i)
         {
             CREDENTIAL* cred = creds[i];
 
-            if (cred->UserName == NULL || cred->CredentialBlobSize == NULL)
+            if (cred->UserName == NULL || cred->CredentialBlobSize == 0)
+            {
+                continue;
+            }
+
+            sorted.push_back(std::make_pair(wideCharToUtf8(cred->UserName), i));
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<std::string> accounts;
+        accounts.reserve(sorted.size());
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            accounts.push_back(sorted[i].first);
+        }
+
+        size_t begin, end;
+        if (!detail::select_page(accounts, limit, cursor, &begin, &end, next_cursor, errStr))
+        {
+            CredFree(creds);
+            return FAIL_ERROR;
+        }
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            CREDENTIAL* cred = creds[sorted[i].second];
+            std::string password(reinterpret_cast<char*>(cred->CredentialBlob),
+                                 cred->CredentialBlobSize);
+            credentials->push_back(Credentials(sorted[i].first, password));
+        }
+
+        CredFree(creds);
+
+        return SUCCESS;
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::find_credentials(
+        const std::vector<std::string>& services,
+        std::map<std::string, std::vector<Credentials>>* credentials,
+        std::string* errStr)
+    {
+        std::set<std::string> wanted(services.begin(), services.end());
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            (*credentials)[*it];
+        }
+
+        if (wanted.empty())
+        {
+            return FAIL_NONFATAL;
+        }
+
+        // Enumerate once and split "service/account" target names locally
+        // instead of running one filtered enumeration per service.
+        DWORD count;
+        CREDENTIAL** creds;
+
+        bool result = ::CredEnumerate(NULL, 0, &count, &creds);
+        if (!result)
+        {
+            DWORD code = ::GetLastError();
+            if (code == ERROR_NOT_FOUND)
+            {
+                return FAIL_NONFATAL;
+            }
+            else
+            {
+                *errStr = getErrorMessage(code);
+                return FAIL_ERROR;
+            }
+        }
+
+        size_t found = 0;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            CREDENTIAL* cred = creds[i];
+
+            if (cred->UserName == NULL || cred->CredentialBlobSize == 0)
             {
                 continue;
             }
 
+            std::string target = wideCharToUtf8(cred->TargetName);
             std::string login = wideCharToUtf8(cred->UserName);
+            if (target.size() <= login.size()
+                || target.compare(target.size() - login.size() - 1, std::string::npos, "/" + login)
+                       != 0)
+            {
+                continue;
+            }
+
+            std::string service = target.substr(0, target.size() - login.size() - 1);
+            if (wanted.count(service) == 0)
+            {
+                continue;
+            }
+
             std::string password(reinterpret_cast<char*>(cred->CredentialBlob),
                                  cred->CredentialBlobSize);
+            (*credentials)[service].push_back(Credentials(login, password));
+            ++found;
+        }
 
-            credentials->push_back(Credentials(login, password));
+        CredFree(creds);
+
+        return found != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::count_credentials(const std::string& service,
+                                                               size_t* count,
+                                                               std::string* errStr)
+    {
+        *count = 0;
+
+        LPWSTR filter = utf8ToWideChar(service + "/*");
+        if (filter == NULL)
+        {
+            *errStr = "Error generating credential filter";
+            return FAIL_ERROR;
+        }
+
+        DWORD found;
+        CREDENTIAL** creds;
+
+        bool result = ::CredEnumerate(filter, 0, &found, &creds);
+        delete[] filter;
+        if (!result)
+        {
+            DWORD code = ::GetLastError();
+            if (code == ERROR_NOT_FOUND)
+            {
+                return SUCCESS;
+            }
+            else
+            {
+                *errStr = getErrorMessage(code);
+                return FAIL_ERROR;
+            }
+        }
+
+        for (unsigned int i = 0; i < found; ++i)
+        {
+            if (creds[i]->UserName != NULL)
+            {
+                ++*count;
+            }
         }
 
         CredFree(creds);
 
         return SUCCESS;
     }
+
+    LIBCRED_RESULT CredentialManagerBackend::delete_credentials(const std::string& service,
+                                                                size_t* deleted,
+                                                                std::string* errStr)
+    {
+        *deleted = 0;
+
+        // The separator keeps other services sharing the prefix out. The
+        // blobs come along with the enumeration but are never decoded.
+        LPWSTR filter = utf8ToWideChar(service + "/*");
+        if (filter == NULL)
+        {
+            *errStr = "Error generating credential filter";
+            return FAIL_ERROR;
+        }
+
+        DWORD count;
+        CREDENTIAL** creds;
+
+        bool result = ::CredEnumerate(filter, 0, &count, &creds);
+        delete[] filter;
+        if (!result)
+        {
+            DWORD code = ::GetLastError();
+            if (code == ERROR_NOT_FOUND)
+            {
+                return FAIL_NONFATAL;
+            }
+            else
+            {
+                *errStr = getErrorMessage(code);
+                return FAIL_ERROR;
+            }
+        }
+
+        LIBCRED_RESULT deleted_result = SUCCESS;
+        for (unsigned int i = 0; i < count && deleted_result != FAIL_ERROR; ++i)
+        {
+            deleted_result = delete_credential(creds[i]->TargetName, errStr);
+            if (deleted_result == SUCCESS)
+            {
+                ++*deleted;
+            }
+        }
+
+        CredFree(creds);
+
+        if (deleted_result == FAIL_ERROR)
+        {
+            return FAIL_ERROR;
+        }
+        return *deleted != 0 ? SUCCESS : FAIL_NONFATAL;
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::set_password(ServiceId service,
+                                                          AccountId account,
+                                                          const std::string& password,
+                                                          std::string* errStr)
+    {
+        const std::string* service_str;
+        const std::string* account_str;
+        if (!detail::resolve_key(service, account, &service_str, &account_str, errStr))
+        {
+            return FAIL_ERROR;
+        }
+
+        LPCWSTR target_name = key_target(service, account);
+        if (target_name == NULL)
+        {
+            return FAIL_ERROR;
+        }
+
+        return write_credential(target_name, *account_str, password, errStr);
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::get_password(ServiceId service,
+                                                          AccountId account,
+                                                          std::string* password,
+                                                          std::string* errStr)
+    {
+        LPCWSTR target_name = key_target(service, account);
+        if (target_name == NULL)
+        {
+            *errStr = "Unknown service or account id";
+            return FAIL_ERROR;
+        }
+
+        return read_credential(target_name, password, errStr);
+    }
+
+    LIBCRED_RESULT CredentialManagerBackend::delete_password(ServiceId service,
+                                                             AccountId account,
+                                                             std::string* errStr)
+    {
+        LPCWSTR target_name = key_target(service, account);
+        if (target_name == NULL)
+        {
+            *errStr = "Unknown service or account id";
+            return FAIL_ERROR;
+        }
+
+        return delete_credential(target_name, errStr);
+    }
+
+    std::unique_ptr<Backend> detail::make_keyring_backend(const StoreOptions& options)
+    {
+        return std::unique_ptr<Backend>(new CredentialManagerBackend());
+    }
 }  // namespace keytar
@@ -0,0 +1,376 @@
+#ifndef TEST_KV_STUB_SERVER_H_
+#define TEST_KV_STUB_SERVER_H_
+
+// A tiny in-memory stand-in for a Vault KV version 2 engine mounted at
+// "secret", speaking keep-alive HTTP/1.1 on a loopback port. It implements
+// just the endpoints HttpBackend uses and counts connections and requests so
+// tests can check pooling and caching.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class KvStubServer
+{
+public:
+    explicit KvStubServer(const std::string& token)
+        : token_(token)
+        , lease_seconds_(0)
+        , connections_(0)
+        , requests_(0)
+    {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+        listen(listen_fd_, 64);
+
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        acceptor_ = std::thread(&KvStubServer::accept_loop, this);
+    }
+
+    ~KvStubServer()
+    {
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        acceptor_.join();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::set<int>::const_iterator it = clients_.begin(); it != clients_.end(); ++it)
+            {
+                shutdown(*it, SHUT_RDWR);
+            }
+        }
+
+        for (size_t i = 0; i < workers_.size(); ++i)
+        {
+            workers_[i].join();
+        }
+    }
+
+    std::string address() const
+    {
+        char address[64];
+        snprintf(address, sizeof(address), "http://127.0.0.1:%d", port_);
+        return address;
+    }
+
+    // Lease granted on reads; zero like a real KV v2 engine.
+    void set_lease(int seconds)
+    {
+        lease_seconds_ = seconds;
+    }
+
+    // Called once, on the server's thread, just before the next POST or
+    // DELETE changes anything; other requests are served meanwhile.
+    void before_next_write(const std::function<void()>& hook)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        before_write_ = hook;
+    }
+
+    size_t connections() const
+    {
+        return connections_;
+    }
+
+    size_t requests() const
+    {
+        return requests_;
+    }
+
+private:
+    void accept_loop()
+    {
+        for (;;)
+        {
+            int fd = accept(listen_fd_, NULL, NULL);
+            if (fd < 0)
+            {
+                return;
+            }
+
+            ++connections_;
+            std::lock_guard<std::mutex> lock(mutex_);
+            clients_.insert(fd);
+            workers_.push_back(std::thread(&KvStubServer::serve, this, fd));
+        }
+    }
+
+    static std::string header_value(const std::string& head, const std::string& name)
+    {
+        std::string lower_head(head);
+        for (size_t i = 0; i < lower_head.size(); ++i)
+        {
+            lower_head[i] = tolower(lower_head[i]);
+        }
+
+        size_t pos = lower_head.find("\r\n" + name + ":");
+        if (pos == std::string::npos)
+        {
+            return std::string();
+        }
+
+        pos += name.size() + 3;
+        while (pos < head.size() && head[pos] == ' ')
+        {
+            ++pos;
+        }
+        return head.substr(pos, head.find("\r\n", pos) - pos);
+    }
+
+    static std::string unescape(const std::string& text)
+    {
+        std::string out;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '%' && i + 2 < text.size())
+            {
+                out += static_cast<char>(strtol(text.substr(i + 1, 2).c_str(), NULL, 16));
+                i += 2;
+            }
+            else
+            {
+                out += text[i];
+            }
+        }
+        return out;
+    }
+
+    static std::string quote(const std::string& text)
+    {
+        std::string out("\"");
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '"' || text[i] == '\\')
+            {
+                out += '\\';
+            }
+            out += text[i];
+        }
+        return out + "\"";
+    }
+
+    // Reads the "password" string out of {"data":{"password":"..."}}.
+    static std::string password_of(const std::string& body)
+    {
+        std::string password;
+        size_t pos = body.find("\"password\"");
+        pos = body.find('"', body.find(':', pos) + 1) + 1;
+        for (; pos < body.size() && body[pos] != '"'; ++pos)
+        {
+            if (body[pos] == '\\')
+            {
+                ++pos;
+            }
+            password += body[pos];
+        }
+        return password;
+    }
+
+    std::string handle(const std::string& method,
+                       const std::string& target,
+                       const std::string& token,
+                       const std::string& body,
+                       int* status)
+    {
+        ++requests_;
+
+        if (token != token_)
+        {
+            *status = 403;
+            return "{\"errors\":[\"permission denied\"]}";
+        }
+
+        std::string path = target;
+        bool list = false;
+        size_t query = path.find('?');
+        if (query != std::string::npos)
+        {
+            list = path.substr(query) == "?list=true";
+            path.erase(query);
+        }
+
+        const std::string data_prefix("/v1/secret/data/");
+        const std::string metadata_prefix("/v1/secret/metadata/");
+
+        if (method == "POST" || method == "DELETE")
+        {
+            std::function<void()> hook;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                hook.swap(before_write_);
+            }
+            if (hook)
+            {
+                hook();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (path.compare(0, data_prefix.size(), data_prefix) == 0)
+        {
+            std::string key = unescape(path.substr(data_prefix.size()));
+            if (method == "POST")
+            {
+                secrets_[key] = password_of(body);
+                *status = 200;
+                return "{\"data\":{\"version\":1}}";
+            }
+
+            std::map<std::string, std::string>::const_iterator it = secrets_.find(key);
+            if (method != "GET" || it == secrets_.end())
+            {
+                *status = 404;
+                return "{\"errors\":[]}";
+            }
+
+            char lease[32];
+            snprintf(lease, sizeof(lease), "%d", static_cast<int>(lease_seconds_));
+            *status = 200;
+            return "{\"data\":{\"data\":{\"password\":" + quote(it->second)
+                   + "},\"metadata\":{\"version\":1}},\"lease_duration\":" + lease + "}";
+        }
+
+        if (path.compare(0, metadata_prefix.size(), metadata_prefix) == 0)
+        {
+            std::string key = unescape(path.substr(metadata_prefix.size()));
+            if (list)
+            {
+                std::string keys;
+                std::string folder = key + "/";
+                for (std::map<std::string, std::string>::const_iterator it
+                     = secrets_.lower_bound(folder);
+                     it != secrets_.end() && it->first.compare(0, folder.size(), folder) == 0;
+                     ++it)
+                {
+                    keys += (keys.empty() ? "" : ",") + quote(it->first.substr(folder.size()));
+                }
+
+                *status = keys.empty() ? 404 : 200;
+                return keys.empty() ? "{\"errors\":[]}" : "{\"data\":{\"keys\":[" + keys + "]}}";
+            }
+
+            if (method == "DELETE")
+            {
+                secrets_.erase(key);
+                *status = 204;
+                return std::string();
+            }
+
+            *status = secrets_.count(key) != 0 ? 200 : 404;
+            return *status == 200 ? "{\"data\":{\"current_version\":1}}" : "{\"errors\":[]}";
+        }
+
+        *status = 404;
+        return "{\"errors\":[]}";
+    }
+
+    void disconnect(int fd)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        clients_.erase(fd);
+        close(fd);
+    }
+
+    void serve(int fd)
+    {
+        std::string buffer;
+        char chunk[4096];
+
+        for (;;)
+        {
+            size_t head_end;
+            while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received <= 0)
+                {
+                    disconnect(fd);
+                    return;
+                }
+                buffer.append(chunk, received);
+            }
+
+            std::string head = buffer.substr(0, head_end + 2);
+            size_t length = strtoul(header_value(head, "content-length").c_str(), NULL, 10);
+            while (buffer.size() < head_end + 4 + length)
+            {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received <= 0)
+                {
+                    disconnect(fd);
+                    return;
+                }
+                buffer.append(chunk, received);
+            }
+
+            std::string body = buffer.substr(head_end + 4, length);
+            buffer.erase(0, head_end + 4 + length);
+
+            size_t method_end = head.find(' ');
+            size_t target_end = head.find(' ', method_end + 1);
+            std::string method = head.substr(0, method_end);
+            std::string target = head.substr(method_end + 1, target_end - method_end - 1);
+
+            int status;
+            std::string response_body
+                = handle(method, target, header_value(head, "x-vault-token"), body, &status);
+
+            char response_head[128];
+            snprintf(response_head,
+                     sizeof(response_head),
+                     "HTTP/1.1 %d Stub\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n\r\n",
+                     status,
+                     response_body.size());
+            std::string response = response_head + response_body;
+            if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) < 0)
+            {
+                disconnect(fd);
+                return;
+            }
+        }
+    }
+
+    std::string token_;
+    int listen_fd_;
+    int port_;
+    std::atomic<int> lease_seconds_;
+    std::atomic<size_t> connections_;
+    std::atomic<size_t> requests_;
+
+    std::thread acceptor_;
+    std::mutex mutex_;
+    std::set<int> clients_;
+    std::vector<std::thread> workers_;
+    std::map<std::string, std::string> secrets_;
+    std::function<void()> before_write_;
+};
+
+#endif  // TEST_KV_STUB_SERVER_H_
@@ -1,10 +1,36 @@
 // Standard includes
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 // libcred includes
 #include <libcred.hpp>
+#ifndef _WIN32
+#include <libcred_async.hpp>
+#endif
+#include <libcred_audit.hpp>
+#include <libcred_memory.hpp>
+#include <libcred_store.hpp>
+#include <libcred_trace.hpp>
 
 // Required MinUnit definitions
 int tests_run = 0;
@@ -92,6 +118,1376 @@ test_password_lifecycle()
                 libcred::delete_password(service, account, &errStr) == libcred::SUCCESS);
 }
 
+// Make sure the interned-ID overloads behave like the string-based API
+void
+test_interned_lifecycle()
+{
+    const std::string password("$uP3RseCr1t!");
+    std::string password_retrieved;
+    std::string errStr;
+
+    libcred::ServiceId service = libcred::intern_service("libcred-test-interned-service");
+    libcred::AccountId account = libcred::intern_account("libcred@example.org");
+
+    TEST_ASSERT("error: interning the same service twice yields different ids",
+                libcred::intern_service("libcred-test-interned-service") == service);
+    TEST_ASSERT("error: interning the same account twice yields different ids",
+                libcred::intern_account("libcred@example.org") == account);
+
+    TEST_ASSERT("error: set_password by id didnt succeed",
+                libcred::set_password(service, account, password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: unable to get password stored by id by name",
+                libcred::get_password("libcred-test-interned-service",
+                                      "libcred@example.org",
+                                      &password_retrieved,
+                                      &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: retrieved password doesn't match password stored by id",
+                password_retrieved == password);
+
+    password_retrieved.clear();
+    TEST_ASSERT("error: unable to get password by id",
+                libcred::get_password(service, account, &password_retrieved, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: retrieved password by id doesn't match password stored",
+                password_retrieved == password);
+
+    TEST_ASSERT("error: unable to delete password by id",
+                libcred::delete_password(service, account, &errStr) == libcred::SUCCESS);
+
+    TEST_ASSERT("error: unknown service id should fail",
+                libcred::get_password(static_cast<libcred::ServiceId>(-1),
+                                      account,
+                                      &password_retrieved,
+                                      &errStr)
+                    == libcred::FAIL_ERROR);
+}
+
+// Make sure a multi-service find returns credentials grouped by service
+void
+test_find_credentials_multi()
+{
+    const std::string service_a("libcred-test-multi-a");
+    const std::string service_b("libcred-test-multi-b");
+    const std::string service_empty("libcred-test-multi-empty");
+    std::string errStr;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                libcred::set_password(service_a, "alice", "pw-a", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: set_password didnt succeed",
+                libcred::set_password(service_b, "bob", "pw-b", &errStr) == libcred::SUCCESS);
+
+    std::vector<std::string> services;
+    services.push_back(service_a);
+    services.push_back(service_b);
+    services.push_back(service_empty);
+
+    std::map<std::string, std::vector<libcred::Credentials>> found;
+    TEST_ASSERT("error: unable to find credentials of several services",
+                libcred::find_credentials(services, &found, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected one group per requested service", found.size() == 3);
+    TEST_ASSERT("error: wrong credentials for first service",
+                found[service_a].size() == 1 && found[service_a][0].first == "alice"
+                    && found[service_a][0].second == "pw-a");
+    TEST_ASSERT("error: wrong credentials for second service",
+                found[service_b].size() == 1 && found[service_b][0].first == "bob"
+                    && found[service_b][0].second == "pw-b");
+    TEST_ASSERT("error: expected no credentials for empty service", found[service_empty].empty());
+
+    libcred::delete_password(service_a, "alice", &errStr);
+    libcred::delete_password(service_b, "bob", &errStr);
+}
+
+// A backend whose bulk delete fails before it counts anything
+class UnreachableBackend : public libcred::MemoryBackend
+{
+public:
+    libcred::LIBCRED_RESULT delete_credentials(const std::string& service,
+                                               size_t* deleted,
+                                               std::string* error)
+    {
+        *error = "Backend unreachable";
+        return libcred::FAIL_ERROR;
+    }
+};
+
+// Make sure a bulk delete removes every credential of the service and no other,
+// including cached copies
+void
+test_delete_credentials()
+{
+    const std::string service("libcred-test-bulk-delete");
+    const std::string other("libcred-test-bulk-delete-other");
+    const char* accounts[] = {"alice", "bob", "carol"};
+    std::string password, errStr;
+    size_t deleted;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        libcred::set_password(service, accounts[i], "pw", &errStr);
+    }
+    libcred::set_password(other, "alice", "pw-other", &errStr);
+
+    TEST_ASSERT("error: unable to delete the credentials of a service",
+                libcred::delete_credentials(service, &deleted, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected every credential of the service counted", deleted == 3);
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: expected no credentials left after a bulk delete",
+                libcred::find_credentials(service, &credentials, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: expected a service sharing the prefix kept",
+                libcred::get_password(other, "alice", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected a bulk delete of an empty service to find nothing",
+                libcred::delete_credentials(service, &deleted, &errStr) == libcred::FAIL_NONFATAL
+                    && deleted == 0);
+    libcred::delete_password(other, "alice", &errStr);
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend()), options);
+    store.set_password(service, "alice", "pw", &errStr);
+    store.set_password(other, "alice", "pw-other", &errStr);
+    store.get_password(service, "alice", &password, &errStr);
+
+    TEST_ASSERT("error: unable to delete the credentials of a service",
+                store.delete_credentials(service, &deleted, &errStr) == libcred::SUCCESS
+                    && deleted == 1);
+    TEST_ASSERT("error: expected the cached password dropped by a bulk delete",
+                store.get_password(service, "alice", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: expected the cached password of another service kept",
+                store.get_password(other, "alice", &password, &errStr) == libcred::SUCCESS
+                    && password == "pw-other");
+}
+
+// Make sure a failed bulk delete through a store reports nothing deleted
+void
+test_delete_credentials_failed()
+{
+    std::string errStr;
+    size_t deleted = 42;
+
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new UnreachableBackend()));
+    TEST_ASSERT("error: expected fatal fail from an unreachable backend",
+                store.delete_credentials("libcred-test-bulk-delete", &deleted, &errStr)
+                    == libcred::FAIL_ERROR);
+    TEST_ASSERT("error: expected nothing counted as deleted", deleted == 0);
+}
+
+// Make sure paging through credentials returns each account exactly once, in order
+void
+test_find_credentials_paged()
+{
+    const std::string service("libcred-test-paged-service");
+    const char* accounts[] = { "carol", "alice", "erin", "bob", "dave" };
+    std::string errStr;
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        TEST_ASSERT("error: set_password didnt succeed",
+                    libcred::set_password(service, accounts[i], "pw", &errStr)
+                        == libcred::SUCCESS);
+    }
+
+    std::vector<std::string> seen;
+    std::string cursor;
+    size_t pages = 0;
+    do
+    {
+        std::vector<libcred::Credentials> page;
+        std::string next_cursor;
+        TEST_ASSERT("error: unable to find a page of credentials",
+                    libcred::find_credentials(service, 2, cursor, &page, &next_cursor, &errStr)
+                        == libcred::SUCCESS);
+        TEST_ASSERT("error: page larger than requested", page.size() <= 2);
+        for (size_t i = 0; i < page.size(); ++i)
+        {
+            seen.push_back(page[i].first);
+        }
+        cursor = next_cursor;
+        ++pages;
+    } while (!cursor.empty() && pages < 10);
+
+    TEST_ASSERT("error: expected three pages", pages == 3);
+    TEST_ASSERT("error: paging returned wrong accounts",
+                seen.size() == 5 && seen[0] == "alice" && seen[1] == "bob" && seen[2] == "carol"
+                    && seen[3] == "dave" && seen[4] == "erin");
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        libcred::delete_password(service, accounts[i], &errStr);
+    }
+}
+
+// Make sure find_password selection policies pick the expected credential
+void
+test_find_password_policy()
+{
+    const std::string service("libcred-test-policy-service");
+    std::string account, password, errStr;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                libcred::set_password(service, "zed", "pw-zed", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: set_password didnt succeed",
+                libcred::set_password(service, "amy", "pw-amy", &errStr) == libcred::SUCCESS);
+
+    TEST_ASSERT("error: unable to find first account",
+                libcred::find_password(
+                    service, libcred::FIND_FIRST_ACCOUNT, &account, &password, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: first account policy picked the wrong credential",
+                account == "amy" && password == "pw-amy");
+
+    TEST_ASSERT("error: unable to find most recent credential",
+                libcred::find_password(
+                    service, libcred::FIND_MOST_RECENT, &account, &password, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: most recent policy returned a mismatched credential",
+                (account == "amy" && password == "pw-amy")
+                    || (account == "zed" && password == "pw-zed"));
+
+    TEST_ASSERT("error: policy find should not succeed for a nonexistent service",
+                libcred::find_password("libcred-test-bad-service",
+                                       libcred::FIND_FIRST_ACCOUNT,
+                                       &account,
+                                       &password,
+                                       &errStr)
+                    == libcred::FAIL_NONFATAL);
+
+    libcred::delete_password(service, "zed", &errStr);
+    libcred::delete_password(service, "amy", &errStr);
+}
+
+// Make sure a Store keeps its own cache apart from the default store
+void
+test_store_cache()
+{
+    const std::string service("libcred-test-store-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    libcred::Store store(options);
+
+    TEST_ASSERT("error: set_password through a store didnt succeed",
+                store.set_password(service, account, "st0re", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: password stored through a store not visible to the free functions",
+                libcred::get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "st0re");
+
+    // Deleting through the default store leaves this store's cached copy.
+    TEST_ASSERT("error: unable to delete password",
+                libcred::delete_password(service, account, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the cached password",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "st0re");
+
+    store.clear_cache();
+    TEST_ASSERT("error: expected non fatal fail after clearing the cache",
+                store.get_password(service, account, &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// Make sure the ID overloads are served from the cache, and see writes and
+// deletes by either key
+void
+test_store_interned_cache()
+{
+    const std::string service("libcred-test-interned-cache-service");
+    const std::string account("libcred@example.org");
+    libcred::ServiceId service_id = libcred::intern_service(service);
+    libcred::AccountId account_id = libcred::intern_account(account);
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    libcred::MemoryBackend* backend = new libcred::MemoryBackend();
+    libcred::Store store(std::unique_ptr<libcred::Backend>(backend), options);
+
+    TEST_ASSERT("error: set_password by id didnt succeed",
+                store.set_password(service_id, account_id, "1d", &errStr) == libcred::SUCCESS);
+    backend->set_password(service, account, "b4ckend", &errStr);
+    for (int i = 0; i < 2; ++i)
+    {
+        TEST_ASSERT("error: expected the cached password by id",
+                    store.get_password(service_id, account_id, &password, &errStr)
+                            == libcred::SUCCESS
+                        && password == "1d");
+    }
+
+    TEST_ASSERT("error: set_password by name didnt succeed",
+                store.set_password(service, account, "n4me", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the password stored by name",
+                store.get_password(service_id, account_id, &password, &errStr)
+                        == libcred::SUCCESS
+                    && password == "n4me");
+
+    store.clear_cache();
+    backend->set_password(service, account, "b4ckend", &errStr);
+    TEST_ASSERT("error: expected the backend's password after clearing the cache",
+                store.get_password(service_id, account_id, &password, &errStr)
+                        == libcred::SUCCESS
+                    && password == "b4ckend");
+
+    TEST_ASSERT("error: unable to delete password by name",
+                store.delete_password(service, account, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected non fatal fail after the delete",
+                store.get_password(service_id, account_id, &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// Make sure an expired entry is served while it is refreshed, and not past
+// the staleness limit
+void
+test_store_stale()
+{
+    const std::string service("libcred-test-stale-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 20;
+    options.stale_ttl_ms = 60000;
+    libcred::MemoryBackend* backend = new libcred::MemoryBackend();
+    libcred::Store store(std::unique_ptr<libcred::Backend>(backend), options);
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                store.set_password(service, account, "0ld", &errStr) == libcred::SUCCESS);
+    backend->set_password(service, account, "n3w", &errStr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+
+    TEST_ASSERT("error: expected the stale password",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "0ld");
+    for (int i = 0; i < 200 && password != "n3w"; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        store.get_password(service, account, &password, &errStr);
+    }
+    TEST_ASSERT("error: expected the refreshed password", password == "n3w");
+
+    // A refresh that finds the credential gone drops the entry.
+    backend->delete_password(service, account, &errStr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    store.get_password(service, account, &password, &errStr);
+    libcred::LIBCRED_RESULT result = libcred::SUCCESS;
+    for (int i = 0; i < 200 && result == libcred::SUCCESS; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        result = store.get_password(service, account, &password, &errStr);
+    }
+    TEST_ASSERT("error: expected non fatal fail once the refresh saw the delete",
+                result == libcred::FAIL_NONFATAL);
+
+    // Past cache_ttl_ms + stale_ttl_ms, callers wait for the backend.
+    options.stale_ttl_ms = 20;
+    libcred::MemoryBackend* limited = new libcred::MemoryBackend();
+    libcred::Store limited_store(std::unique_ptr<libcred::Backend>(limited), options);
+    limited_store.set_password(service, account, "0ld", &errStr);
+    limited->set_password(service, account, "n3w", &errStr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    TEST_ASSERT("error: expected the backend password past the staleness limit",
+                limited_store.get_password(service, account, &password, &errStr)
+                        == libcred::SUCCESS
+                    && password == "n3w");
+}
+
+// Make sure entries read since they were loaded are refreshed before they
+// expire, and idle ones are not
+void
+test_store_refresh_ahead()
+{
+    const std::string service("libcred-test-ahead-service");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 1000;
+    options.refresh_ahead_percent = 50;
+    libcred::MemoryBackend* backend = new libcred::MemoryBackend();
+    libcred::Store store(std::unique_ptr<libcred::Backend>(backend), options);
+
+    store.set_password(service, "hot", "0ld", &errStr);
+    store.set_password(service, "idle", "0ld", &errStr);
+    store.get_password(service, "hot", &password, &errStr);
+    backend->set_password(service, "hot", "n3w", &errStr);
+    backend->set_password(service, "idle", "n3w", &errStr);
+
+    // Both are refreshed, if at all, between 400 and 500 ms, and expire at 1 s.
+    std::this_thread::sleep_for(std::chrono::milliseconds(700));
+    TEST_ASSERT("error: expected the hot entry refreshed ahead of its expiry",
+                store.get_password(service, "hot", &password, &errStr) == libcred::SUCCESS
+                    && password == "n3w");
+    TEST_ASSERT("error: expected the idle entry left as cached",
+                store.get_password(service, "idle", &password, &errStr) == libcred::SUCCESS
+                    && password == "0ld");
+}
+
+// Make sure per-thread copies follow changes made by any thread
+void
+test_store_thread_cache()
+{
+    const std::string service("libcred-test-thread-cache-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    options.thread_cache = true;
+    libcred::MemoryBackend* backend = new libcred::MemoryBackend();
+    libcred::Store store(std::unique_ptr<libcred::Backend>(backend), options);
+
+    store.set_password(service, account, "0ne", &errStr);
+    store.get_password(service, account, &password, &errStr);
+    TEST_ASSERT("error: expected the cached password",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "0ne");
+
+    std::thread writer([&store, &service, &account] {
+        std::string error;
+        store.set_password(service, account, "tw0", &error);
+    });
+    writer.join();
+    TEST_ASSERT("error: expected the password set by another thread",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "tw0");
+
+    backend->set_password(service, account, "thr33", &errStr);
+    store.clear_cache();
+    TEST_ASSERT("error: expected the backend password after clearing the cache",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "thr33");
+
+    store.delete_password(service, account, &errStr);
+    TEST_ASSERT("error: expected non fatal fail after deleting",
+                store.get_password(service, account, &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// A backend over a MemoryBackend that outlives it, counting secret reads
+class SharedBackend : public libcred::Backend
+{
+public:
+    explicit SharedBackend(libcred::MemoryBackend* backend)
+        : backend_(backend)
+        , reads(0)
+    {
+    }
+
+    using libcred::Backend::delete_password;
+    using libcred::Backend::find_credentials;
+    using libcred::Backend::find_password;
+    using libcred::Backend::get_password;
+    using libcred::Backend::set_password;
+
+    libcred::LIBCRED_RESULT set_password(const std::string& service,
+                                         const std::string& account,
+                                         const std::string& password,
+                                         std::string* error)
+    {
+        return backend_->set_password(service, account, password, error);
+    }
+
+    libcred::LIBCRED_RESULT get_password(const std::string& service,
+                                         const std::string& account,
+                                         std::string* password,
+                                         std::string* error)
+    {
+        ++reads;
+        libcred::LIBCRED_RESULT result = backend_->get_password(service, account, password, error);
+        if (after_read)
+        {
+            after_read();
+        }
+        return result;
+    }
+
+    libcred::LIBCRED_RESULT delete_password(const std::string& service,
+                                            const std::string& account,
+                                            std::string* error)
+    {
+        if (before_delete)
+        {
+            before_delete();
+        }
+        return backend_->delete_password(service, account, error);
+    }
+
+    libcred::LIBCRED_RESULT find_password(const std::string& service,
+                                          std::string* password,
+                                          std::string* error)
+    {
+        return backend_->find_password(service, password, error);
+    }
+
+    libcred::LIBCRED_RESULT find_credentials(const std::string& service,
+                                             std::vector<libcred::Credentials>* credentials,
+                                             std::string* error)
+    {
+        return backend_->find_credentials(service, credentials, error);
+    }
+
+    libcred::LIBCRED_RESULT get_modified(const std::string& service,
+                                         const std::string& account,
+                                         time_t* modified,
+                                         std::string* error)
+    {
+        return backend_->get_modified(service, account, modified, error);
+    }
+
+    libcred::MemoryBackend* backend_;
+    std::atomic<int> reads;
+    std::function<void()> after_read;     // Runs between a read and its return.
+    std::function<void()> before_delete;  // Runs before each delete.
+};
+
+// Make sure a read racing a write or delete through the store does not leave
+// the replaced password cached
+void
+test_store_read_race()
+{
+    const std::string service("libcred-test-race-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr, writeErr;
+
+    libcred::MemoryBackend backend;
+    backend.set_password(service, account, "0ld", &errStr);
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    SharedBackend* shared = new SharedBackend(&backend);
+    libcred::Store store(std::unique_ptr<libcred::Backend>(shared), options);
+
+    shared->after_read = [&] { store.set_password(service, account, "n3w", &writeErr); };
+    store.get_password(service, account, &password, &errStr);
+    shared->after_read = nullptr;
+    TEST_ASSERT("error: expected the password written during a read to be served",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+                    && password == "n3w");
+
+    store.clear_cache();
+    shared->after_read = [&] { store.delete_password(service, account, &writeErr); };
+    store.get_password(service, account, &password, &errStr);
+    shared->after_read = nullptr;
+    TEST_ASSERT("error: expected a password deleted during a read not to be served",
+                store.get_password(service, account, &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// Make sure a snapshot warms the next store's cache, is revalidated by
+// modification time without reading secrets, and reloads what changed
+void
+test_store_snapshot()
+{
+    const std::string service("libcred-test-snapshot-service");
+    const std::string account("libcred@example.org");
+    const std::string path("libcred-test-snapshot");
+    std::string password, errStr;
+    std::remove(path.c_str());
+
+    libcred::MemoryBackend backend;
+    backend.set_password(service, account, "0ne", &errStr);
+    // Modification times have whole seconds; read the secret in a later one.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    options.snapshot_path = path;
+    {
+        libcred::Store store(std::unique_ptr<libcred::Backend>(new SharedBackend(&backend)),
+                             options);
+        store.get_password(service, account, &password, &errStr);
+        store.set_password(service, "expiring", "3xp1r1ng", time(NULL) + 3600, &errStr);
+        if (store.save_snapshot(&errStr) != libcred::SUCCESS)
+        {
+            // Not supported on this platform or build.
+            return;
+        }
+    }
+
+    {
+        SharedBackend* shared = new SharedBackend(&backend);
+        libcred::Store store(std::unique_ptr<libcred::Backend>(shared), options);
+        TEST_ASSERT("error: expected the password from the snapshot",
+                    store.get_password(service, account, &password, &errStr)
+                            == libcred::SUCCESS
+                        && password == "0ne");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        TEST_ASSERT("error: expected revalidation without reading the secret",
+                    shared->reads == 0);
+        TEST_ASSERT("error: expected no credential with an expiry in the snapshot",
+                    !store.get_cached_password(service, "expiring", &password));
+
+        backend.set_password(service, account, "tw0", &errStr);
+    }
+
+    {
+        libcred::Store store(std::unique_ptr<libcred::Backend>(new SharedBackend(&backend)),
+                             options);
+        for (int i = 0; i < 200 && password != "tw0"; ++i)
+        {
+            store.get_password(service, account, &password, &errStr);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        TEST_ASSERT("error: expected the changed password reloaded", password == "tw0");
+    }
+
+    std::remove(path.c_str());
+}
+
+// Count the lines of a file containing a string
+size_t
+count_lines(const std::string& path, const std::string& needle)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    size_t count = 0;
+    while (std::getline(file, line))
+    {
+        if (line.find(needle) != std::string::npos)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Split the last record of an operation in a trace into its fields
+std::vector<std::string>
+trace_fields(const std::string& path, const std::string& operation)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    std::vector<std::string> fields;
+    while (std::getline(file, line))
+    {
+        if (line.find(" " + operation + " ") != std::string::npos)
+        {
+            std::istringstream stream(line);
+            std::string field;
+            fields.clear();
+            while (stream >> field)
+            {
+                fields.push_back(field);
+            }
+        }
+    }
+    return fields;
+}
+
+// Make sure expired credentials are not served, then reaped, unless stored again
+void
+test_store_expiry()
+{
+    const std::string service("libcred-test-expiry-service");
+    std::string password, errStr;
+
+    libcred::MemoryBackend backend;
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    options.reap_interval_ms = 10;
+    SharedBackend* shared = new SharedBackend(&backend);
+    libcred::Store store(std::unique_ptr<libcred::Backend>(shared), options);
+
+    store.set_password(service, "long", "l0ng", time(NULL) + 3600, &errStr);
+    store.set_password(
+        service, "forever", "f0r3ver", std::numeric_limits<time_t>::max(), &errStr);
+    store.set_password(service, "renewed", "0ld", time(NULL) - 1, &errStr);
+    store.set_password(service, "renewed", "n3w", &errStr);
+    TEST_ASSERT("error: set_password with an expiry didnt succeed",
+                store.set_password(service, "expired", "g0ne", time(NULL) - 1, &errStr)
+                    == libcred::SUCCESS);
+
+    int reads = shared->reads;
+    TEST_ASSERT("error: expected the expired credential not found, without a backend read",
+                store.get_password(service, "expired", &password, &errStr)
+                        == libcred::FAIL_NONFATAL
+                    && shared->reads == reads);
+
+    bool reaped = false;
+    for (int i = 0; i < 200 && !reaped; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reaped = backend.get_password(service, "expired", &password, &errStr)
+                 == libcred::FAIL_NONFATAL;
+    }
+    TEST_ASSERT("error: expected the expired credential deleted from the backend", reaped);
+    TEST_ASSERT("error: expected the credential stored again without expiry kept",
+                backend.get_password(service, "renewed", &password, &errStr) == libcred::SUCCESS
+                    && password == "n3w");
+    TEST_ASSERT("error: expected the credential expiring later still served",
+                store.get_password(service, "long", &password, &errStr) == libcred::SUCCESS
+                    && password == "l0ng");
+    TEST_ASSERT("error: expected the credential expiring in the far future kept",
+                backend.get_password(service, "forever", &password, &errStr) == libcred::SUCCESS
+                    && store.get_password(service, "forever", &password, &errStr)
+                           == libcred::SUCCESS);
+
+    // Without the reaper, the cache alone must stop serving it, stale or not.
+    options.reap_interval_ms = 600000;
+    options.stale_ttl_ms = 60000;
+    libcred::Store unreaped(std::unique_ptr<libcred::Backend>(new SharedBackend(&backend)),
+                            options);
+    unreaped.set_password(service, "soon", "s00n", time(NULL) + 1, &errStr);
+    TEST_ASSERT("error: expected the credential cached until it expires",
+                unreaped.get_cached_password(service, "soon", &password));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    TEST_ASSERT("error: expected the expired credential not served from the cache",
+                !unreaped.get_cached_password(service, "soon", &password));
+
+    // A read while the reaper deletes must not bring the credential back.
+    options.reap_interval_ms = 10;
+    SharedBackend* racing = new SharedBackend(&backend);
+    libcred::Store reaping(std::unique_ptr<libcred::Backend>(racing), options);
+    std::string raced, racedErr;
+    racing->before_delete
+        = [&] { reaping.get_password(service, "raced", &raced, &racedErr); };
+    reaping.set_password(service, "raced", "r4ced", time(NULL) - 1, &errStr);
+    reaped = false;
+    for (int i = 0; i < 200 && !reaped; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reaped = backend.get_password(service, "raced", &password, &errStr)
+                 == libcred::FAIL_NONFATAL;
+    }
+    TEST_ASSERT("error: expected a credential read while being reaped to stay deleted",
+                reaped
+                    && reaping.get_password(service, "raced", &password, &errStr)
+                           == libcred::FAIL_NONFATAL);
+}
+
+// Make sure counts match the credentials stored, and that a store keeping counts
+// serves them until a write through it
+void
+test_count_credentials()
+{
+    const std::string service("libcred-test-count");
+    const std::string other("libcred-test-count-other");
+    const std::string empty("libcred-test-count-empty");
+    std::string errStr;
+    size_t count;
+
+    libcred::set_password(service, "alice", "pw", &errStr);
+    libcred::set_password(service, "bob", "pw", &errStr);
+    libcred::set_password(other, "alice", "pw", &errStr);
+
+    TEST_ASSERT("error: unable to count the credentials of a service",
+                libcred::count_credentials(service, &count, &errStr) == libcred::SUCCESS
+                    && count == 2);
+    TEST_ASSERT("error: expected a service without credentials to count 0",
+                libcred::count_credentials(empty, &count, &errStr) == libcred::SUCCESS
+                    && count == 0);
+
+    std::vector<std::string> services;
+    services.push_back(service);
+    services.push_back(other);
+    services.push_back(empty);
+    std::map<std::string, size_t> counts;
+    TEST_ASSERT("error: unable to count the credentials of several services",
+                libcred::count_credentials(services, &counts, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong counts for several services",
+                counts.size() == 3 && counts[service] == 2 && counts[other] == 1
+                    && counts[empty] == 0);
+
+    libcred::delete_password(service, "alice", &errStr);
+    libcred::delete_password(service, "bob", &errStr);
+    libcred::delete_password(other, "alice", &errStr);
+
+    libcred::MemoryBackend backend;
+    libcred::StoreOptions options;
+    options.count_ttl_ms = 60000;
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new SharedBackend(&backend)), options);
+
+    store.set_password(service, "alice", "pw", &errStr);
+    store.count_credentials(service, &count, &errStr);
+    backend.set_password(service, "bob", "pw", &errStr);
+    TEST_ASSERT("error: expected the count kept by the store",
+                store.count_credentials(service, &count, &errStr) == libcred::SUCCESS
+                    && count == 1);
+    counts.clear();
+    TEST_ASSERT("error: expected the kept count served to a multi-service count",
+                store.count_credentials(services, &counts, &errStr) == libcred::SUCCESS
+                    && counts[service] == 1 && counts[other] == 0);
+
+    store.set_password(service, "carol", "pw", &errStr);
+    TEST_ASSERT("error: expected a write through the store to drop the kept count",
+                store.count_credentials(service, &count, &errStr) == libcred::SUCCESS
+                    && count == 3);
+    size_t deleted;
+    store.delete_credentials(service, &deleted, &errStr);
+    TEST_ASSERT("error: expected a bulk delete to drop the kept count",
+                store.count_credentials(service, &count, &errStr) == libcred::SUCCESS
+                    && count == 0);
+}
+
+// Make sure a search of several collections tells where each credential was
+// found, and keeps one per account unless asked for all
+void
+test_find_credentials_collections()
+{
+    const std::string service("libcred-test-collections");
+    const std::string missing("libcred-test-no-such-collection");
+    std::string errStr;
+
+    libcred::set_password(service, "alice", "a1ice", &errStr);
+    libcred::set_password(service, "bob", "b0b", &errStr);
+
+    std::vector<std::string> collections;
+    collections.push_back(missing);
+    collections.push_back("default");
+    std::vector<libcred::CollectionCredentials> found;
+    TEST_ASSERT("error: unable to search several collections",
+                libcred::find_credentials(
+                    service, collections, libcred::MERGE_FIRST_COLLECTION, &found, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the credentials reported from the collection holding them",
+                found.size() == 2 && found[0].collection == "default"
+                    && found[1].collection == "default");
+
+    collections[0] = "default";
+    found.clear();
+    libcred::find_credentials(service, collections, libcred::MERGE_ALL, &found, &errStr);
+    TEST_ASSERT("error: expected every copy kept when merging all", found.size() == 4);
+    found.clear();
+    libcred::find_credentials(service, collections, libcred::MERGE_MOST_RECENT, &found, &errStr);
+    TEST_ASSERT("error: expected one credential kept per account", found.size() == 2);
+
+    collections.assign(1, missing);
+    found.clear();
+    TEST_ASSERT("error: expected nothing found in a collection that does not exist",
+                libcred::find_credentials(
+                    service, collections, libcred::MERGE_FIRST_COLLECTION, &found, &errStr)
+                        == libcred::FAIL_NONFATAL
+                    && found.empty());
+
+    libcred::delete_password(service, "alice", &errStr);
+    libcred::delete_password(service, "bob", &errStr);
+}
+
+// Make sure a renamed service keeps its credentials, replacing those of the new
+// name, and that a store drops what it cached and moves expiries along
+void
+test_rename_service()
+{
+    const std::string from("libcred-test-rename-from");
+    const std::string to("libcred-test-rename-to");
+    std::string password, errStr;
+
+    libcred::set_password(from, "alice", "a1ice", &errStr);
+    libcred::set_password(from, "bob", "b0b", &errStr);
+    libcred::set_password(to, "alice", "0ld", &errStr);
+    libcred::set_password(to, "carol", "car0l", &errStr);
+
+    std::vector<std::string> accounts;
+    TEST_ASSERT("error: unable to rename a service",
+                libcred::rename_service(from, to, &accounts, &errStr) == libcred::SUCCESS);
+    std::sort(accounts.begin(), accounts.end());
+    TEST_ASSERT("error: wrong accounts reported renamed",
+                accounts.size() == 2 && accounts[0] == "alice" && accounts[1] == "bob");
+    size_t count;
+    TEST_ASSERT("error: expected nothing left under the old name",
+                libcred::count_credentials(from, &count, &errStr) == libcred::SUCCESS
+                    && count == 0);
+    TEST_ASSERT("error: expected the renamed credential to replace the existing one",
+                libcred::get_password(to, "alice", &password, &errStr) == libcred::SUCCESS
+                    && password == "a1ice");
+    TEST_ASSERT("error: expected other credentials of the new name kept",
+                libcred::get_password(to, "carol", &password, &errStr) == libcred::SUCCESS
+                    && password == "car0l");
+
+    accounts.clear();
+    TEST_ASSERT("error: expected renaming a service without credentials to find nothing",
+                libcred::rename_service(from, to, &accounts, &errStr) == libcred::FAIL_NONFATAL
+                    && accounts.empty());
+    TEST_ASSERT("error: expected renaming a service to itself to fail",
+                libcred::rename_service(to, to, &accounts, &errStr) == libcred::FAIL_ERROR);
+
+    size_t deleted;
+    libcred::delete_credentials(to, &deleted, &errStr);
+
+    libcred::MemoryBackend backend;
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    options.reap_interval_ms = 600000;
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new SharedBackend(&backend)), options);
+
+    store.set_password(from, "kept", "k3pt", &errStr);
+    store.set_password(from, "expired", "g0ne", time(NULL) - 1, &errStr);
+    store.get_password(from, "kept", &password, &errStr);
+    store.rename_service(from, to, &accounts, &errStr);
+    TEST_ASSERT("error: expected the old name no longer served from the cache",
+                store.get_password(from, "kept", &password, &errStr) == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: expected the credential served under the new name",
+                store.get_password(to, "kept", &password, &errStr) == libcred::SUCCESS
+                    && password == "k3pt");
+    TEST_ASSERT("error: expected the expiry moved with its credential",
+                backend.get_password(to, "expired", &password, &errStr) == libcred::SUCCESS
+                    && store.get_password(to, "expired", &password, &errStr)
+                           == libcred::FAIL_NONFATAL);
+}
+
+// Make sure store operations reach the audit log, and that a full buffer
+// drops records instead of losing count of them
+void
+test_store_audit()
+{
+    const std::string service("libcred-test-audit-service");
+    const std::string account("libcred@example.org");
+    const std::string path("libcred-test-audit.log");
+    std::string password, errStr;
+    std::remove(path.c_str());
+    std::remove((path + ".1").c_str());
+
+    libcred::AuditOptions audit_options;
+    audit_options.path = path;
+    audit_options.capacity = 8;
+
+    libcred::StoreOptions options;
+    options.audit = std::make_shared<libcred::AuditLog>(audit_options);
+    libcred::Store store(options);
+
+    TEST_ASSERT("error: set_password through an audited store didnt succeed",
+                store.set_password(service, account, "aud1t", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: get_password through an audited store didnt succeed",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: unable to delete password",
+                store.delete_password(service, account, &errStr) == libcred::SUCCESS);
+    options.audit->flush();
+
+    TEST_ASSERT("error: expected one audit record per operation",
+                count_lines(path, "op=set_password result=success service=\""
+                                      + service + "\" account=\"" + account + "\"")
+                        == 1
+                    && count_lines(path, "op=get_password result=success") == 1
+                    && count_lines(path, "op=delete_password result=success") == 1);
+
+    const int threads = 4;
+    const int records = 1000;
+    std::vector<std::thread> writers;
+    for (int i = 0; i < threads; ++i)
+    {
+        writers.push_back(std::thread([&options, &service, &account, records] {
+            for (int j = 0; j < records; ++j)
+            {
+                options.audit->record("concurrent", service, account, libcred::SUCCESS);
+            }
+        }));
+    }
+    for (size_t i = 0; i < writers.size(); ++i)
+    {
+        writers[i].join();
+    }
+    options.audit->flush();
+
+    TEST_ASSERT("error: expected every audit record written or counted as dropped",
+                count_lines(path, "op=concurrent") + options.audit->dropped()
+                    == static_cast<size_t>(threads * records));
+
+    // A file over max_file_bytes is moved aside on the next write.
+    audit_options.max_file_bytes = 1;
+    libcred::AuditLog rotating(audit_options);
+    rotating.record("rotated", service, account, libcred::SUCCESS);
+    rotating.flush();
+    TEST_ASSERT("error: expected the audit log rotated",
+                count_lines(path, "op=rotated") == 1
+                    && count_lines(path + ".1", "op=set_password") == 1);
+
+    options.audit.reset();
+    std::remove(path.c_str());
+    std::remove((path + ".1").c_str());
+}
+
+// Make sure a trace records every operation without names or secrets
+void
+test_store_trace()
+{
+    const std::string service("libcred-test-trace-service");
+    const std::string account("libcred@example.org");
+    const std::string path("libcred-test.trace");
+    std::string password, errStr;
+
+    libcred::TraceOptions trace_options;
+    trace_options.path = path;
+
+    libcred::StoreOptions options;
+    options.trace = std::make_shared<libcred::TraceRecorder>(trace_options);
+    TEST_ASSERT("error: unable to create the trace", options.trace->ok());
+
+    std::unique_ptr<libcred::Backend> backend(new libcred::MemoryBackend());
+    libcred::Store store(std::move(backend), options);
+
+    TEST_ASSERT("error: set_password through a traced store didnt succeed",
+                store.set_password(service, account, "tr4ce", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: get_password through a traced store didnt succeed",
+                store.get_password(service, account, &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected non fatal fail for a missing password",
+                store.get_password(service, "nobody", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    options.trace->flush();
+
+    TEST_ASSERT("error: expected one trace record per operation",
+                count_lines(path, " set_password ") == 1
+                    && count_lines(path, " get_password ") == 2
+                    && count_lines(path, " 5 0 ") == 2);
+    TEST_ASSERT("error: names or secrets in the trace",
+                count_lines(path, service) == 0 && count_lines(path, account) == 0
+                    && count_lines(path, "tr4ce") == 0);
+
+    // A rename records the new name in place of the account, for replay.
+    const std::string renamed("libcred-test-trace-renamed");
+    std::vector<std::string> accounts;
+    TEST_ASSERT("error: rename_service through a traced store didnt succeed",
+                store.rename_service(service, renamed, &accounts, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: get_password of the renamed service didnt succeed",
+                store.get_password(renamed, account, &password, &errStr) == libcred::SUCCESS);
+    options.trace->flush();
+    std::vector<std::string> rename = trace_fields(path, "rename_service");
+    std::vector<std::string> get = trace_fields(path, "get_password");
+    TEST_ASSERT("error: expected the new name's hash in the rename record",
+                rename.size() == 8 && get.size() == 8 && rename[4] == get[3]
+                    && rename[3] != get[3]);
+
+    options.trace.reset();
+    std::remove(path.c_str());
+}
+
+// Make sure memory_usage accounts for the cache and the backend
+void
+test_memory_usage()
+{
+    const std::string service("libcred-test-memory-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    std::unique_ptr<libcred::Backend> backend(new libcred::MemoryBackend());
+    libcred::Store store(std::move(backend), options);
+
+    TEST_ASSERT("error: expected an empty store",
+                store.memory_usage().cache_entries == 0
+                    && store.memory_usage().backend_bytes == 0);
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                store.set_password(service, account, "m3m0ry", &errStr) == libcred::SUCCESS);
+    libcred::MemoryUsage usage = store.memory_usage();
+    TEST_ASSERT("error: expected the cached password and the backend copy counted",
+                usage.cache_entries == 1 && usage.cache_bytes > 0 && usage.backend_bytes > 0
+                    && usage.total() >= usage.cache_bytes + usage.backend_bytes);
+
+    store.clear_cache();
+    TEST_ASSERT("error: expected an empty cache after clearing it",
+                store.memory_usage().cache_entries == 0 && store.memory_usage().cache_bytes == 0);
+}
+
+#ifndef _WIN32
+// Make sure a forked child keeps the cache and restarts the background threads
+void
+test_store_fork()
+{
+    const std::string service("libcred-test-fork-service");
+    const std::string account("libcred@example.org");
+    const std::string path("libcred-test-fork.log");
+    std::string password, errStr;
+    remove(path.c_str());
+
+    libcred::AuditOptions audit_options;
+    audit_options.path = path;
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 50;
+    options.stale_ttl_ms = 60000;
+    options.audit = std::make_shared<libcred::AuditLog>(audit_options);
+    libcred::MemoryBackend* backend = new libcred::MemoryBackend();
+    libcred::Store store(std::unique_ptr<libcred::Backend>(backend), options);
+
+    // Serve the entry stale once, so the refresh thread is running at the fork.
+    store.set_password(service, account, "0ld", &errStr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    store.get_password(service, account, &password, &errStr);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // Still cached, so the change is not seen yet.
+        backend->set_password(service, account, "n3w", &errStr);
+        bool cached = store.get_password(service, account, &password, &errStr)
+                      == libcred::SUCCESS
+                      && password == "0ld";
+
+        // The stale entry is refreshed by a new refresh thread.
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        store.get_password(service, account, &password, &errStr);
+        bool refreshed = false;
+        for (int i = 0; i < 100 && !refreshed; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            refreshed = store.get_password(service, account, &password, &errStr)
+                            == libcred::SUCCESS
+                        && password == "n3w";
+        }
+
+        options.audit->record("child", service, account, libcred::SUCCESS);
+        options.audit->flush();
+        _exit(cached && refreshed ? 0 : 1);
+    }
+
+    int status = 0;
+    TEST_ASSERT("error: fork didnt succeed", child > 0 && waitpid(child, &status, 0) == child);
+    TEST_ASSERT("error: expected the child served from the cache, then refreshed",
+                WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    TEST_ASSERT("error: expected the child to write its audit record",
+                count_lines(path, "op=child") == 1);
+    TEST_ASSERT("error: expected the parent store unaffected",
+                store.set_password(service, account, "p4r3nt", &errStr) == libcred::SUCCESS
+                    && store.get_password(service, account, &password, &errStr)
+                           == libcred::SUCCESS
+                    && password == "p4r3nt");
+    remove(path.c_str());
+}
+
+// Make sure async calls complete through the descriptor, cache hits at once
+void
+test_async_store()
+{
+    const std::string service("libcred-test-async-service");
+    const std::string account("libcred@example.org");
+    std::string password, errStr;
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = 60000;
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend()), options);
+    libcred::AsyncStore async(store);
+    TEST_ASSERT("error: expected a descriptor to poll", async.fd() >= 0);
+
+    struct pollfd fds;
+    fds.fd = async.fd();
+    fds.events = POLLIN;
+    TEST_ASSERT("error: expected nothing to process yet",
+                poll(&fds, 1, 0) == 0 && async.process_events() == 0);
+
+    int done = 0;
+    libcred::LIBCRED_RESULT set_result = libcred::FAIL_ERROR;
+    async.set_password(service, account, "4sync", [&](libcred::LIBCRED_RESULT result,
+                                                      const std::string& error) {
+        set_result = result;
+        ++done;
+        // Callbacks may chain calls; this one is a cache hit.
+        async.get_password(service, account, [&](libcred::LIBCRED_RESULT result,
+                                                 const std::string& value,
+                                                 const std::string& error) {
+            password = value;
+            ++done;
+        });
+    });
+
+    while (done < 1)
+    {
+        TEST_ASSERT("error: expected the descriptor readable", poll(&fds, 1, 5000) == 1);
+        async.process_events();
+    }
+    TEST_ASSERT("error: async set_password didnt succeed", set_result == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the cache hit completed without waiting",
+                poll(&fds, 1, 0) == 1 && async.process_events() == 1 && done == 2
+                    && password == "4sync");
+    TEST_ASSERT("error: expected the descriptor cleared", poll(&fds, 1, 0) == 0);
+
+    libcred::LIBCRED_RESULT delete_result = libcred::FAIL_ERROR;
+    size_t found = 1;
+    async.delete_password(
+        service, account, [&](libcred::LIBCRED_RESULT result, const std::string& error) {
+            delete_result = result;
+            ++done;
+        });
+    async.find_credentials(service, [&](libcred::LIBCRED_RESULT result,
+                                        const std::vector<libcred::Credentials>& credentials,
+                                        const std::string& error) {
+        found = credentials.size();
+        ++done;
+    });
+    while (done < 4)
+    {
+        TEST_ASSERT("error: expected the descriptor readable", poll(&fds, 1, 5000) == 1);
+        async.process_events();
+    }
+    TEST_ASSERT("error: expected the credential deleted, then not found",
+                delete_result == libcred::SUCCESS && found == 0);
+}
+
+// A MemoryBackend whose get_password waits while the gate is locked
+class GatedBackend : public libcred::MemoryBackend
+{
+public:
+    using libcred::MemoryBackend::get_password;
+
+    libcred::LIBCRED_RESULT get_password(const std::string& service,
+                                         const std::string& account,
+                                         std::string* password,
+                                         std::string* error)
+    {
+        std::lock_guard<std::mutex> lock(gate);
+        return libcred::MemoryBackend::get_password(service, account, password, error);
+    }
+
+    std::mutex gate;
+};
+
+// Make sure full queues refuse calls, and that higher priorities go first
+void
+test_async_backpressure()
+{
+    const std::string service("libcred-test-async-backpressure-service");
+    std::string errStr;
+    std::vector<std::string> order;
+    bool capacity = false;
+
+    GatedBackend* backend = new GatedBackend();
+    libcred::Store store((std::unique_ptr<libcred::Backend>(backend)));
+    libcred::AsyncOptions options;
+    options.queue_capacity = 2;
+    libcred::AsyncStore async(store, options);
+
+    std::unique_lock<std::mutex> gate(backend->gate);
+    const char* accounts[] = {"running", "low1", "low2", "refused"};
+    bool submitted[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        std::string account(accounts[i]);
+        submitted[i] = async.get_password(
+            service,
+            account,
+            [&order, account](libcred::LIBCRED_RESULT result,
+                              const std::string& password,
+                              const std::string& error) { order.push_back(account); },
+            libcred::PRIORITY_LOW);
+        // The first call leaves the queue for the worker, which waits at the gate.
+        while (i == 0 && async.stats().running == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+    TEST_ASSERT("error: expected calls queued up to the capacity, then refused",
+                submitted[0] && submitted[1] && submitted[2] && !submitted[3]);
+
+    TEST_ASSERT("error: expected a high priority call queued despite the full low queue",
+                async.get_password(service,
+                                   "high",
+                                   [&order](libcred::LIBCRED_RESULT result,
+                                            const std::string& password,
+                                            const std::string& error) { order.push_back("high"); },
+                                   libcred::PRIORITY_HIGH));
+    async.on_capacity(libcred::PRIORITY_LOW, [&capacity] { capacity = true; });
+
+    libcred::AsyncStats stats = async.stats();
+    TEST_ASSERT("error: expected the queue depths and refusals counted",
+                stats.queued[libcred::PRIORITY_LOW] == 2
+                    && stats.queued[libcred::PRIORITY_HIGH] == 1
+                    && stats.max_queued[libcred::PRIORITY_LOW] == 2
+                    && stats.rejected[libcred::PRIORITY_LOW] == 1 && stats.running == 1);
+    TEST_ASSERT("error: expected no capacity while the queue is full",
+                async.process_events() == 0 && !capacity);
+
+    gate.unlock();
+    struct pollfd fds;
+    fds.fd = async.fd();
+    fds.events = POLLIN;
+    while (order.size() < 4)
+    {
+        TEST_ASSERT("error: expected the descriptor readable", poll(&fds, 1, 5000) == 1);
+        async.process_events();
+    }
+    TEST_ASSERT("error: expected the high priority call run before the queued low ones",
+                order[0] == "running" && order[1] == "high" && order[2] == "low1"
+                    && order[3] == "low2");
+    TEST_ASSERT("error: expected capacity signalled once a low priority call left its queue",
+                capacity);
+}
+
+// Make sure a child forked after the worker started gets a worker and a
+// descriptor of its own, and leaves the parent's completions to the parent
+void
+test_async_fork()
+{
+    const std::string service("libcred-test-async-fork-service");
+    const std::string account("libcred@example.org");
+    std::string errStr;
+
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend()));
+    libcred::AsyncStore async(store);
+    struct pollfd fds;
+    fds.fd = async.fd();
+    fds.events = POLLIN;
+
+    int parent_done = 0;
+    async.set_password(
+        service, account, "p4r3nt", [&](libcred::LIBCRED_RESULT result, const std::string& error) {
+            ++parent_done;
+        });
+    TEST_ASSERT("error: expected the descriptor readable", poll(&fds, 1, 5000) == 1);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        alarm(10);  // A lock left held by the parent's worker would hang it.
+        bool cleared = poll(&fds, 1, 0) == 0;
+        std::string password;
+        async.get_password(service,
+                           account,
+                           [&](libcred::LIBCRED_RESULT result,
+                               const std::string& value,
+                               const std::string& error) { password = value; });
+        bool completed = poll(&fds, 1, 5000) == 1 && async.process_events() == 1;
+        _exit(cleared && completed && password == "p4r3nt" && parent_done == 0 ? 0 : 1);
+    }
+
+    int status = 0;
+    TEST_ASSERT("error: fork didnt succeed", child > 0 && waitpid(child, &status, 0) == child);
+    TEST_ASSERT("error: expected the child to complete its own call only",
+                WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    TEST_ASSERT("error: expected the parent's completion left for the parent",
+                poll(&fds, 1, 0) == 1 && async.process_events() == 1 && parent_done == 1);
+}
+
+// Make sure a forked child writes its own trace records but not the parent's
+void
+test_trace_fork()
+{
+    const std::string service("libcred-test-trace-fork-service");
+    const std::string path("libcred-test-fork.trace");
+    std::string password, errStr;
+
+    libcred::TraceOptions trace_options;
+    trace_options.path = path;
+
+    libcred::StoreOptions options;
+    options.trace = std::make_shared<libcred::TraceRecorder>(trace_options);
+    libcred::Store store(std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend()),
+                         options);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        store.set_password(service, "parent", "p4r3nt", &errStr);
+    }
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        store.set_password(service, "child", "ch1ld", &errStr);
+        options.trace->flush();
+        _exit(0);
+    }
+
+    int status = 0;
+    TEST_ASSERT("error: fork didnt succeed", child > 0 && waitpid(child, &status, 0) == child);
+    store.set_password(service, "parent", "p4r3nt", &errStr);
+    options.trace->flush();
+    TEST_ASSERT("error: expected each record written once",
+                count_lines(path, " set_password ") == 5);
+
+    options.trace.reset();
+    std::remove(path.c_str());
+}
+#endif
+
 // Test registry
 void
 all_tests()
@@ -99,6 +1495,33 @@ all_tests()
     test_non_existent_get();
     test_non_existent_find();
     test_password_lifecycle();
+    test_interned_lifecycle();
+    test_find_credentials_multi();
+    test_delete_credentials();
+    test_delete_credentials_failed();
+    test_find_credentials_paged();
+    test_find_password_policy();
+    test_store_cache();
+    test_store_interned_cache();
+    test_store_stale();
+    test_store_refresh_ahead();
+    test_store_read_race();
+    test_store_snapshot();
+    test_store_thread_cache();
+    test_store_expiry();
+    test_count_credentials();
+    test_find_credentials_collections();
+    test_rename_service();
+#ifndef _WIN32
+    test_store_fork();
+    test_trace_fork();
+    test_async_store();
+    test_async_backpressure();
+    test_async_fork();
+#endif
+    test_store_audit();
+    test_store_trace();
+    test_memory_usage();
 }
 
 // Main entry point
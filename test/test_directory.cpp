@@ -0,0 +1,184 @@
+// Standard includes
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// libcred includes
+#include <libcred_directory.hpp>
+
+
+#define TEST_ASSERT(msg, test)                                                                     \
+    if (!(test))                                                                                   \
+    {                                                                                              \
+        std::cout << msg << ": " << errStr << std::endl;                                           \
+        exit(1);                                                                                   \
+    }
+
+
+std::string root;
+
+void
+write_file(const std::string& path, const std::string& contents)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out << contents;
+}
+
+// Poll until the backend sees `expected`, giving the inotify thread time to run
+bool
+eventually_equals(libcred::DirectoryBackend& backend,
+                  const std::string& service,
+                  const std::string& account,
+                  const std::string& expected)
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string password, errStr;
+        if (backend.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+            && password == expected)
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+// Make sure nested and top-level files map to (service, account) pairs
+void
+test_layout()
+{
+    libcred::DirectoryBackend backend(root);
+    std::string password, errStr;
+
+    TEST_ASSERT("error: unable to get nested credential",
+                backend.get_password("db", "admin", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: trailing newline not stripped", password == "hunter2");
+
+    TEST_ASSERT("error: unable to get top-level credential",
+                backend.get_password("api-token", "", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong top-level credential", password == "t0ken");
+
+    TEST_ASSERT("error: expected non fatal fail for missing credential",
+                backend.get_password("db", "nobody", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: paths escaping the root must not resolve",
+                backend.get_password("..", "db", &password, &errStr) == libcred::FAIL_NONFATAL);
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: unable to find credentials",
+                backend.find_credentials("db", &credentials, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong credentials found",
+                credentials.size() == 2 && credentials[0].first == "admin"
+                    && credentials[1].first == "reader" && credentials[1].second == "r3ad");
+
+    TEST_ASSERT("error: unable to find password",
+                backend.find_password("db", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: find_password should pick the first account", password == "hunter2");
+
+    TEST_ASSERT("error: directory backend must be read-only",
+                backend.set_password("db", "admin", "x", &errStr) == libcred::FAIL_ERROR);
+    TEST_ASSERT("error: directory backend must be read-only",
+                backend.delete_password("db", "admin", &errStr) == libcred::FAIL_ERROR);
+}
+
+// Make sure changed, created and removed files are picked up after caching
+void
+test_hot_reload()
+{
+    libcred::DirectoryBackend backend(root);
+    std::string password, errStr;
+
+    TEST_ASSERT("error: unable to get credential",
+                backend.get_password("db", "reader", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected missing credential",
+                backend.get_password("db", "writer", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+
+    write_file(root + "/db/reader", "changed\n");
+    TEST_ASSERT("error: modified file not reloaded",
+                eventually_equals(backend, "db", "reader", "changed"));
+
+    write_file(root + "/db/writer", "wr1te");
+    TEST_ASSERT("error: created file not picked up",
+                eventually_equals(backend, "db", "writer", "wr1te"));
+
+    mkdir((root + "/cache").c_str(), 0700);
+    write_file(root + "/cache/redis", "r3dis");
+    TEST_ASSERT("error: created service directory not picked up",
+                eventually_equals(backend, "cache", "redis", "r3dis"));
+
+    unlink((root + "/db/writer").c_str());
+    bool removed = false;
+    for (int i = 0; i < 200 && !removed; ++i)
+    {
+        removed = backend.get_password("db", "writer", &password, &errStr)
+                  == libcred::FAIL_NONFATAL;
+        usleep(10000);
+    }
+    TEST_ASSERT("error: removed file still served", removed);
+}
+
+// Make sure the Kubernetes-style atomic "..data" symlink swap reloads everything
+void
+test_atomic_swap()
+{
+    std::string errStr;
+    std::string volume = root + "/volume";
+    mkdir(volume.c_str(), 0700);
+    mkdir((volume + "/..v1").c_str(), 0700);
+    mkdir((volume + "/..v1/db").c_str(), 0700);
+    write_file(volume + "/..v1/db/admin", "old");
+    TEST_ASSERT("error: unable to set up volume",
+                symlink("..v1", (volume + "/..data").c_str()) == 0
+                    && symlink("..data/db", (volume + "/db").c_str()) == 0);
+
+    libcred::DirectoryBackend backend(volume);
+    TEST_ASSERT("error: unable to get credential through symlinks",
+                eventually_equals(backend, "db", "admin", "old"));
+
+    mkdir((volume + "/..v2").c_str(), 0700);
+    mkdir((volume + "/..v2/db").c_str(), 0700);
+    write_file(volume + "/..v2/db/admin", "new");
+    TEST_ASSERT("error: unable to swap volume",
+                symlink("..v2", (volume + "/..data_tmp").c_str()) == 0
+                    && rename((volume + "/..data_tmp").c_str(), (volume + "/..data").c_str())
+                           == 0);
+
+    TEST_ASSERT("error: swapped volume not reloaded",
+                eventually_equals(backend, "db", "admin", "new"));
+}
+
+// Test registry
+void
+all_tests()
+{
+    test_layout();
+    test_hot_reload();
+    test_atomic_swap();
+}
+
+// Main entry point
+int
+main(int argc, char** argv)
+{
+    char root_template[] = "/tmp/libcred-test-XXXXXX";
+    root = mkdtemp(root_template);
+
+    mkdir((root + "/db").c_str(), 0700);
+    write_file(root + "/db/admin", "hunter2\n");
+    write_file(root + "/db/reader", "r3ad");
+    write_file(root + "/api-token", "t0ken");
+
+    // Run tests
+    all_tests();
+
+    std::string command = "rm -rf " + root;
+    return system(command.c_str()) == 0 ? 0 : 1;
+}
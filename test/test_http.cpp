@@ -0,0 +1,252 @@
+// Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// libcred includes
+#include <libcred_http.hpp>
+
+#include "kv_stub_server.hpp"
+
+
+#define TEST_ASSERT(msg, test)                                                                     \
+    if (!(test))                                                                                   \
+    {                                                                                              \
+        std::cout << msg << ": " << errStr << std::endl;                                           \
+        exit(1);                                                                                   \
+    }
+
+
+const std::string token("libcred-test-token");
+
+libcred::HttpOptions
+options_for(const KvStubServer& server)
+{
+    libcred::HttpOptions options;
+    options.address = server.address();
+    options.token = token;
+    options.prefix = "libcred";
+    return options;
+}
+
+// Make sure the standard add/get/find/delete works against the KV engine
+void
+test_password_lifecycle()
+{
+    KvStubServer server(token);
+    libcred::HttpBackend backend(options_for(server));
+
+    const std::string service("libcred-test-service");
+    const std::string account("libcred@example.org");
+    const std::string password("$uP3R \"seCr1t\"!");
+    std::string password_retrieved, errStr;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password(service, account, password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: unable to get password",
+                backend.get_password(service, account, &password_retrieved, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: retrieved password doesn't match password stored",
+                password_retrieved == password);
+
+    TEST_ASSERT("error: unable to find password",
+                backend.find_password(service, &password_retrieved, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: found password doesn't match password stored",
+                password_retrieved == password);
+
+    TEST_ASSERT("error: unable to delete password",
+                backend.delete_password(service, account, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected non fatal fail for deleted password",
+                backend.get_password(service, account, &password_retrieved, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: expected non fatal fail deleting a missing password",
+                backend.delete_password(service, account, &errStr) == libcred::FAIL_NONFATAL);
+
+    libcred::HttpOptions bad_options = options_for(server);
+    bad_options.token = "wrong";
+    libcred::HttpBackend unauthorized(bad_options);
+    TEST_ASSERT("error: expected fatal fail with a bad token",
+                unauthorized.get_password(service, account, &password_retrieved, &errStr)
+                    == libcred::FAIL_ERROR);
+}
+
+// Make sure batch reads run in parallel over a bounded, reused set of connections
+void
+test_batched_find()
+{
+    KvStubServer server(token);
+    libcred::HttpOptions options = options_for(server);
+    options.max_connections = 4;
+    libcred::HttpBackend backend(options);
+    std::string errStr;
+
+    for (int i = 0; i < 40; ++i)
+    {
+        char account[32];
+        snprintf(account, sizeof(account), "user%02d", i);
+        TEST_ASSERT("error: set_password didnt succeed",
+                    backend.set_password("batch", account, account, &errStr) == libcred::SUCCESS);
+    }
+    TEST_ASSERT("error: sequential writes should reuse one connection", server.connections() == 1);
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: unable to find credentials",
+                backend.find_credentials("batch", &credentials, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong number of credentials", credentials.size() == 40);
+    TEST_ASSERT("error: credentials out of order or mismatched",
+                credentials[0].first == "user00" && credentials[39].second == "user39");
+    TEST_ASSERT("error: batch opened more connections than allowed",
+                server.connections() <= options.max_connections);
+
+    std::vector<libcred::Credentials> page;
+    std::string next_cursor;
+    TEST_ASSERT("error: unable to find a page of credentials",
+                backend.find_credentials("batch", 10, "", &page, &next_cursor, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong page", page.size() == 10 && !next_cursor.empty());
+}
+
+// Make sure a bulk delete lists the service once and deletes its secrets in
+// parallel, without reading them
+void
+test_bulk_delete()
+{
+    KvStubServer server(token);
+    libcred::HttpOptions options = options_for(server);
+    options.max_connections = 4;
+    libcred::HttpBackend backend(options);
+    std::string errStr;
+
+    for (int i = 0; i < 20; ++i)
+    {
+        char account[32];
+        snprintf(account, sizeof(account), "user%02d", i);
+        TEST_ASSERT("error: set_password didnt succeed",
+                    backend.set_password("bulk", account, account, &errStr) == libcred::SUCCESS);
+    }
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password("kept", "app", "k3pt", &errStr) == libcred::SUCCESS);
+
+    size_t before = server.requests();
+    size_t deleted = 0;
+    TEST_ASSERT("error: unable to delete credentials",
+                backend.delete_credentials("bulk", &deleted, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong number of credentials deleted", deleted == 20);
+    TEST_ASSERT("error: expected one listing and one request per credential",
+                server.requests() == before + 21);
+    TEST_ASSERT("error: bulk delete opened more connections than allowed",
+                server.connections() <= options.max_connections);
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: expected non fatal fail finding deleted credentials",
+                backend.find_credentials("bulk", &credentials, &errStr) == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: expected non fatal fail deleting them again",
+                backend.delete_credentials("bulk", &deleted, &errStr) == libcred::FAIL_NONFATAL
+                    && deleted == 0);
+
+    std::string password;
+    TEST_ASSERT("error: expected another service's password kept",
+                backend.get_password("kept", "app", &password, &errStr) == libcred::SUCCESS
+                    && password == "k3pt");
+}
+
+// Make sure leases from the server bound how long values are cached
+void
+test_lease_caching()
+{
+    KvStubServer server(token);
+    libcred::HttpBackend backend(options_for(server));
+    std::string password, errStr;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password("leased", "app", "v1", &errStr) == libcred::SUCCESS);
+
+    // Without a lease or cache_ttl_ms nothing is cached.
+    backend.get_password("leased", "app", &password, &errStr);
+    size_t before = server.requests();
+    backend.get_password("leased", "app", &password, &errStr);
+    TEST_ASSERT("error: value cached without a lease", server.requests() == before + 1);
+
+    server.set_lease(1);
+    backend.get_password("leased", "app", &password, &errStr);
+    before = server.requests();
+    TEST_ASSERT("error: unable to get leased password",
+                backend.get_password("leased", "app", &password, &errStr) == libcred::SUCCESS
+                    && password == "v1");
+    TEST_ASSERT("error: leased value not served from cache", server.requests() == before);
+
+    usleep(1100000);
+    backend.get_password("leased", "app", &password, &errStr);
+    TEST_ASSERT("error: expired lease still served from cache", server.requests() == before + 1);
+}
+
+// Make sure a read racing a write or delete does not cache the value it replaced
+void
+test_write_race()
+{
+    KvStubServer server(token);
+    libcred::HttpBackend backend(options_for(server));
+    std::string password, errStr;
+
+    server.set_lease(60);
+    backend.set_password("racy", "app", "0ld", &errStr);
+    backend.get_password("racy", "app", &password, &errStr);
+
+    std::string raced;
+    server.before_next_write([&] {
+        std::string error;
+        backend.get_password("racy", "app", &raced, &error);
+    });
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password("racy", "app", "n3w", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the racing read to see the old password", raced == "0ld");
+    TEST_ASSERT("error: expected the new password, not the one cached by the racing read",
+                backend.get_password("racy", "app", &password, &errStr) == libcred::SUCCESS
+                    && password == "n3w");
+
+    server.before_next_write([&] {
+        std::string error;
+        backend.get_password("racy", "app", &raced, &error);
+    });
+    TEST_ASSERT("error: unable to delete password",
+                backend.delete_password("racy", "app", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the deleted password not served from the cache",
+                backend.get_password("racy", "app", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+
+    backend.set_password("racy", "app", "bulk", &errStr);
+    backend.get_password("racy", "app", &password, &errStr);
+    server.before_next_write([&] {
+        std::string error;
+        backend.get_password("racy", "app", &raced, &error);
+    });
+    size_t deleted;
+    TEST_ASSERT("error: unable to delete credentials",
+                backend.delete_credentials("racy", &deleted, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected the bulk deleted password not served from the cache",
+                backend.get_password("racy", "app", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// Test registry
+void
+all_tests()
+{
+    test_password_lifecycle();
+    test_batched_find();
+    test_bulk_delete();
+    test_lease_caching();
+    test_write_race();
+}
+
+// Main entry point
+int
+main(int argc, char** argv)
+{
+    // Run tests
+    all_tests();
+}
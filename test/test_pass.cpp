@@ -0,0 +1,263 @@
+// Standard includes
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// libcred includes
+#include <libcred_pass.hpp>
+
+
+#define TEST_ASSERT(msg, test)                                                                     \
+    if (!(test))                                                                                   \
+    {                                                                                              \
+        std::cout << msg << ": " << errStr << std::endl;                                           \
+        exit(1);                                                                                   \
+    }
+
+
+std::string root;
+
+void
+write_file(const std::string& path, const std::string& contents)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out << contents;
+}
+
+// Lines appended to the log, i.e. how many times the decrypt command ran
+size_t
+decryptions()
+{
+    std::ifstream log((root + "/decrypt.log").c_str());
+    size_t lines = 0;
+    std::string line;
+    while (std::getline(log, line))
+    {
+        ++lines;
+    }
+    return lines;
+}
+
+// Lines appended to the log, i.e. how many times the encrypt command ran
+size_t
+encryptions()
+{
+    std::ifstream log((root + "/encrypt.log").c_str());
+    size_t lines = 0;
+    std::string line;
+    while (std::getline(log, line))
+    {
+        ++lines;
+    }
+    return lines;
+}
+
+// Stand-in for gpg: "encryption" is the identity, and every run is logged
+libcred::PassOptions
+test_options()
+{
+    libcred::PassOptions options;
+    options.root = root + "/store";
+    options.decrypt_command.clear();
+    options.decrypt_command.push_back("sh");
+    options.decrypt_command.push_back("-c");
+    options.decrypt_command.push_back("echo >> '" + root + "/decrypt.log'; cat");
+    options.encrypt_command.clear();
+    options.encrypt_command.push_back("sh");
+    options.encrypt_command.push_back("-c");
+    options.encrypt_command.push_back("echo >> '" + root + "/encrypt.log'; cat");
+    options.encrypt_command.push_back("sh");
+    return options;
+}
+
+// Poll until the backend sees `expected`, giving the inotify thread time to run
+bool
+eventually_equals(libcred::PassBackend& backend,
+                  const std::string& service,
+                  const std::string& account,
+                  const std::string& expected)
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string password, errStr;
+        if (backend.get_password(service, account, &password, &errStr) == libcred::SUCCESS
+            && password == expected)
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+// Make sure the standard add/get/find/delete works on a pass layout
+void
+test_password_lifecycle()
+{
+    libcred::PassBackend backend(test_options());
+    std::string password, errStr;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password("work/email", "alice", "s3cret", &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: entry not stored as a pass file",
+                access((root + "/store/work/email/alice.gpg").c_str(), F_OK) == 0);
+    TEST_ASSERT("error: unable to get password",
+                backend.get_password("work/email", "alice", &password, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: retrieved password doesn't match password stored", password == "s3cret");
+    TEST_ASSERT("error: nested entry not reachable as a service",
+                backend.get_password("work/email/alice", "", &password, &errStr)
+                    == libcred::SUCCESS);
+
+    TEST_ASSERT("error: unable to get top-level entry",
+                backend.get_password("github.com", "", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: only the first line is the password", password == "gh-pass");
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: unable to find credentials",
+                backend.find_credentials("web", &credentials, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong credentials found",
+                credentials.size() == 2 && credentials[0].first == "admin"
+                    && credentials[1].first == "guest" && credentials[1].second == "gu3st");
+
+    TEST_ASSERT("error: unable to delete password",
+                backend.delete_password("work/email", "alice", &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: expected non fatal fail for deleted password",
+                backend.get_password("work/email", "alice", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: empty directories not removed",
+                access((root + "/store/work").c_str(), F_OK) != 0);
+
+    TEST_ASSERT("error: paths escaping the store must not resolve",
+                backend.get_password("../store/web", "admin", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+}
+
+// Make sure each entry is decrypted once and external changes invalidate it
+void
+test_decryption_cache()
+{
+    libcred::PassBackend backend(test_options());
+    std::string password, errStr;
+
+    size_t before = decryptions();
+    TEST_ASSERT("error: unable to get password",
+                backend.get_password("web", "admin", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: unable to get password",
+                backend.get_password("web", "admin", &password, &errStr) == libcred::SUCCESS);
+    TEST_ASSERT("error: warm lookup ran the decrypt command", decryptions() == before + 1);
+
+    TEST_ASSERT("error: expected non fatal fail for missing entry",
+                backend.get_password("web", "nobody", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+    TEST_ASSERT("error: missing entry ran the decrypt command", decryptions() == before + 1);
+
+    write_file(root + "/store/web/admin.gpg", "changed\n");
+    TEST_ASSERT("error: modified entry not reloaded",
+                eventually_equals(backend, "web", "admin", "changed"));
+
+    mkdir((root + "/store/db").c_str(), 0700);
+    write_file(root + "/store/db/root.gpg", "r00t\n");
+    TEST_ASSERT("error: created directory not indexed",
+                eventually_equals(backend, "db", "root", "r00t"));
+
+    std::vector<libcred::Credentials> credentials;
+    TEST_ASSERT("error: unable to find credentials",
+                backend.find_credentials("db", &credentials, &errStr) == libcred::SUCCESS
+                    && credentials.size() == 1);
+}
+
+// Make sure new entries need a .gpg-id, like pass insert
+void
+test_recipients()
+{
+    std::string errStr;
+    libcred::PassOptions options = test_options();
+    options.root = root + "/unkeyed";
+    mkdir(options.root.c_str(), 0700);
+    libcred::PassBackend backend(options);
+
+    TEST_ASSERT("error: expected fatal fail without a .gpg-id",
+                backend.set_password("svc", "acct", "pw", &errStr) == libcred::FAIL_ERROR);
+}
+
+// Make sure a rename moves the entry files without running gpg, unless the
+// new location has other recipients
+void
+test_rename_service()
+{
+    libcred::PassBackend backend(test_options());
+    std::string password, errStr;
+    std::vector<std::string> accounts;
+
+    TEST_ASSERT("error: set_password didnt succeed",
+                backend.set_password("mail", "bob", "b0b", &errStr) == libcred::SUCCESS);
+    size_t before = decryptions() + encryptions();
+    TEST_ASSERT("error: unable to rename a service",
+                backend.rename_service("mail", "post/office", &accounts, &errStr)
+                    == libcred::SUCCESS);
+    TEST_ASSERT("error: wrong accounts reported renamed",
+                accounts.size() == 1 && accounts[0] == "bob");
+    TEST_ASSERT("error: rename ran gpg", decryptions() + encryptions() == before);
+    TEST_ASSERT("error: entry not moved as a file",
+                access((root + "/store/post/office/bob.gpg").c_str(), F_OK) == 0
+                    && access((root + "/store/mail").c_str(), F_OK) != 0);
+    TEST_ASSERT("error: renamed entry not found under the new name",
+                backend.get_password("post/office", "bob", &password, &errStr) == libcred::SUCCESS
+                    && password == "b0b");
+    TEST_ASSERT("error: expected non fatal fail for the old name",
+                backend.get_password("mail", "bob", &password, &errStr)
+                    == libcred::FAIL_NONFATAL);
+
+    mkdir((root + "/store/team").c_str(), 0700);
+    write_file(root + "/store/team/.gpg-id", "team@example.org\n");
+    accounts.clear();
+    before = encryptions();
+    TEST_ASSERT("error: unable to rename a service to other recipients",
+                backend.rename_service("post/office", "team", &accounts, &errStr)
+                    == libcred::SUCCESS
+                    && accounts.size() == 1);
+    TEST_ASSERT("error: entry for other recipients not encrypted again",
+                encryptions() == before + 1);
+    TEST_ASSERT("error: renamed entry not found under the new name",
+                backend.get_password("team", "bob", &password, &errStr) == libcred::SUCCESS
+                    && password == "b0b");
+}
+
+// Test registry
+void
+all_tests()
+{
+    test_password_lifecycle();
+    test_decryption_cache();
+    test_recipients();
+    test_rename_service();
+}
+
+// Main entry point
+int
+main(int argc, char** argv)
+{
+    char root_template[] = "/tmp/libcred-test-XXXXXX";
+    root = mkdtemp(root_template);
+
+    mkdir((root + "/store").c_str(), 0700);
+    mkdir((root + "/store/web").c_str(), 0700);
+    write_file(root + "/store/.gpg-id", "libcred-test@example.org\n");
+    write_file(root + "/store/web/admin.gpg", "adm1n\n");
+    write_file(root + "/store/web/guest.gpg", "gu3st");
+    write_file(root + "/store/github.com.gpg", "gh-pass\nlogin: octocat\n");
+
+    // Run tests
+    all_tests();
+
+    std::string command = "rm -rf " + root;
+    return system(command.c_str()) == 0 ? 0 : 1;
+}
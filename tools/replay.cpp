@@ -0,0 +1,534 @@
+// Replays a trace captured through StoreOptions::trace against a backend.
+//
+//   libcred_replay [--backend B] [--speed X] [--cache-ttl MS] [--save FILE] TRACE
+//   libcred_replay --compare BASELINE TRACE
+//
+// Backends: keyring (default), memory, and on Linux directory:<root> and
+// pass:<root>. Each thread of the trace is replayed on a thread of its own at
+// the recorded start times divided by --speed (1 by default, 0 runs every
+// operation as soon as the previous one of its thread is done).
+//
+// Names are the hashes from the trace, under the service prefix
+// "libcred-replay-". Credentials that traced reads found are created first
+// with passwords of the traced length, so reads succeed as they did; every
+// credential the replay creates is deleted at the end.
+//
+// The report gives latency percentiles per operation, traced against
+// replayed; --save writes the replay as a trace, for --compare.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcred_memory.hpp>
+#include <libcred_store.hpp>
+
+#ifdef __linux__
+#include <libcred_directory.hpp>
+#include <libcred_pass.hpp>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+struct Event
+{
+    long long start_us;
+    int thread;
+    std::string operation;
+    std::string service;
+    std::string account;
+    size_t size;
+    int result;
+    long long latency_us;
+};
+
+// Reads a trace in start order, skipping comments; returns false on a
+// malformed line
+bool
+read_trace(const std::string& path, std::vector<Event>* events)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+    {
+        std::cerr << path << ": cannot open" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        Event event;
+        if (!(fields >> event.start_us >> event.thread >> event.operation >> event.service
+              >> event.account >> event.size >> event.result >> event.latency_us))
+        {
+            std::cerr << path << ":" << number << ": malformed record" << std::endl;
+            return false;
+        }
+        events->push_back(event);
+    }
+
+    // Traces are written in completion order; seeding must see writes before
+    // the reads they serve, and comparisons match records by position.
+    std::stable_sort(events->begin(),
+                     events->end(),
+                     [](const Event& a, const Event& b) { return a.start_us < b.start_us; });
+    return true;
+}
+
+void
+write_trace(const std::string& path, const std::vector<Event>& events)
+{
+    std::ofstream file(path.c_str());
+    file << "# libcred trace 1\n";
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const Event& event = events[i];
+        file << event.start_us << ' ' << event.thread << ' ' << event.operation << ' '
+             << event.service << ' ' << event.account << ' ' << event.size << ' ' << event.result
+             << ' ' << event.latency_us << '\n';
+    }
+}
+
+std::unique_ptr<libcred::Backend>
+make_backend(const std::string& spec)
+{
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string root = spec.find(':') == std::string::npos ? "" : spec.substr(spec.find(':') + 1);
+
+    if (kind == "memory")
+    {
+        return std::unique_ptr<libcred::Backend>(new libcred::MemoryBackend());
+    }
+#ifdef __linux__
+    if (kind == "directory")
+    {
+        return std::unique_ptr<libcred::Backend>(new libcred::DirectoryBackend(
+            root.empty() ? libcred::DirectoryBackend::default_root() : root));
+    }
+    if (kind == "pass")
+    {
+        libcred::PassOptions options = libcred::PassOptions::from_environment();
+        if (!root.empty())
+        {
+            options.root = root;
+        }
+        return std::unique_ptr<libcred::Backend>(new libcred::PassBackend(options));
+    }
+#endif
+    return std::unique_ptr<libcred::Backend>();
+}
+
+std::string
+service_name(const Event& event)
+{
+    return "libcred-replay-" + event.service;
+}
+
+// The new name of a rename_service, which traces record as its account
+std::string
+target_name(const Event& event)
+{
+    return "libcred-replay-" + event.account;
+}
+
+// A password of the traced length
+std::string
+filler(size_t size)
+{
+    return std::string(size, 'x');
+}
+
+typedef std::set<std::pair<std::string, std::string>> Keys;
+
+// Creates what traced reads found but earlier traced writes did not create
+bool
+seed(libcred::Store& store, const std::vector<Event>& events, Keys* created)
+{
+    Keys present;
+    std::set<std::string> services;
+    std::string error;
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const Event& event = events[i];
+        std::string service = service_name(event);
+        std::pair<std::string, std::string> key(service, event.account);
+
+        if (event.operation == "set_password" && event.result == libcred::SUCCESS)
+        {
+            present.insert(key);
+            services.insert(service);
+            continue;
+        }
+        if (event.operation == "delete_password" && event.result == libcred::SUCCESS)
+        {
+            present.erase(key);
+            continue;
+        }
+        if (event.result != libcred::SUCCESS)
+        {
+            continue;
+        }
+
+        std::vector<std::pair<std::string, size_t>> missing;
+        if (event.operation == "get_password" && present.count(key) == 0)
+        {
+            missing.push_back(std::make_pair(event.account, event.size));
+        }
+        else if (event.operation == "find_password" && services.count(service) == 0)
+        {
+            missing.push_back(std::make_pair(event.account, event.size));
+        }
+        else if ((event.operation == "find_credentials" || event.operation == "count_credentials"
+                  || event.operation == "delete_credentials"
+                  || event.operation == "rename_service")
+                 && services.count(service) == 0)
+        {
+            for (size_t n = 0; n < event.size; ++n)
+            {
+                missing.push_back(std::make_pair(event.account + "-" + std::to_string(n), 16));
+            }
+        }
+
+        for (size_t n = 0; n < missing.size(); ++n)
+        {
+            std::pair<std::string, std::string> seeded(service, missing[n].first);
+            if (store.set_password(seeded.first, seeded.second, filler(missing[n].second), &error)
+                != libcred::SUCCESS)
+            {
+                std::cerr << "seeding failed: " << error << std::endl;
+                return false;
+            }
+            created->insert(seeded);
+            present.insert(seeded);
+            services.insert(service);
+        }
+
+        if (event.operation == "delete_credentials")
+        {
+            Keys::iterator it = present.lower_bound(std::make_pair(service, std::string()));
+            while (it != present.end() && it->first == service)
+            {
+                present.erase(it++);
+            }
+            services.erase(service);
+        }
+        else if (event.operation == "rename_service")
+        {
+            std::string target = target_name(event);
+            Keys::iterator it = present.lower_bound(std::make_pair(service, std::string()));
+            while (it != present.end() && it->first == service)
+            {
+                present.insert(std::make_pair(target, it->second));
+                present.erase(it++);
+            }
+            services.erase(service);
+            services.insert(target);
+        }
+    }
+    return true;
+}
+
+// Runs one thread's events at their start times divided by speed
+void
+replay_thread(libcred::Store& store,
+              std::vector<Event*> events,
+              Clock::time_point origin,
+              double speed)
+{
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        Event& event = *events[i];
+        if (speed > 0)
+        {
+            std::this_thread::sleep_until(
+                origin + std::chrono::microseconds(static_cast<long long>(event.start_us / speed)));
+        }
+
+        std::string service = service_name(event);
+        std::string password, error;
+        std::vector<libcred::Credentials> credentials;
+
+        Clock::time_point started = Clock::now();
+        libcred::LIBCRED_RESULT result = libcred::FAIL_ERROR;
+        if (event.operation == "set_password")
+        {
+            result = store.set_password(service, event.account, filler(event.size), &error);
+        }
+        else if (event.operation == "get_password")
+        {
+            result = store.get_password(service, event.account, &password, &error);
+        }
+        else if (event.operation == "delete_password")
+        {
+            result = store.delete_password(service, event.account, &error);
+        }
+        else if (event.operation == "find_password")
+        {
+            result = store.find_password(service, &password, &error);
+        }
+        else if (event.operation == "find_credentials")
+        {
+            result = store.find_credentials(service, &credentials, &error);
+        }
+        else if (event.operation == "count_credentials")
+        {
+            size_t count;
+            result = store.count_credentials(service, &count, &error);
+        }
+        else if (event.operation == "delete_credentials")
+        {
+            size_t deleted;
+            result = store.delete_credentials(service, &deleted, &error);
+        }
+        else if (event.operation == "rename_service")
+        {
+            std::vector<std::string> accounts;
+            result = store.rename_service(service, target_name(event), &accounts, &error);
+        }
+        Clock::time_point finished = Clock::now();
+
+        event.start_us
+            = std::chrono::duration_cast<std::chrono::microseconds>(started - origin).count();
+        event.latency_us
+            = std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count();
+        event.result = result;
+    }
+}
+
+long long
+percentile(std::vector<long long>& values, double fraction)
+{
+    size_t index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// Prints latency percentiles per operation, and how the second run compares
+void
+report(const std::vector<Event>& baseline, const std::vector<Event>& run)
+{
+    std::map<std::string, std::vector<long long>> before, after;
+    std::map<std::string, size_t> changed;
+    for (size_t i = 0; i < baseline.size(); ++i)
+    {
+        before[baseline[i].operation].push_back(baseline[i].latency_us);
+    }
+    for (size_t i = 0; i < run.size(); ++i)
+    {
+        after[run[i].operation].push_back(run[i].latency_us);
+        if (i < baseline.size() && run[i].result != baseline[i].result)
+        {
+            ++changed[run[i].operation];
+        }
+    }
+
+    printf("%-18s %8s %21s %21s %21s %21s %8s\n",
+           "operation (us)",
+           "count",
+           "p50",
+           "p90",
+           "p99",
+           "max",
+           "results");
+    for (std::map<std::string, std::vector<long long>>::iterator it = after.begin();
+         it != after.end();
+         ++it)
+    {
+        std::vector<long long>& old_values = before[it->first];
+        std::vector<long long>& new_values = it->second;
+        printf("%-18s %8zu", it->first.c_str(), new_values.size());
+
+        const double fractions[] = { 0.5, 0.9, 0.99, 1.0 };
+        for (size_t f = 0; f < sizeof(fractions) / sizeof(fractions[0]); ++f)
+        {
+            char cell[64];
+            if (old_values.empty())
+            {
+                snprintf(cell, sizeof(cell), "%lld", percentile(new_values, fractions[f]));
+            }
+            else
+            {
+                long long old_value = percentile(old_values, fractions[f]);
+                long long new_value = percentile(new_values, fractions[f]);
+                snprintf(cell,
+                         sizeof(cell),
+                         "%lld -> %lld (%+.0f%%)",
+                         old_value,
+                         new_value,
+                         old_value > 0 ? 100.0 * (new_value - old_value) / old_value : 0.0);
+            }
+            printf(" %21s", cell);
+        }
+        printf(" %8zu\n", changed[it->first]);
+    }
+    printf("(results: operations whose result differs from the baseline)\n");
+}
+
+int
+usage()
+{
+    std::cerr << "usage: libcred_replay [--backend keyring|memory|directory:<root>|pass:<root>]\n"
+                 "                      [--speed X] [--cache-ttl MS] [--save FILE] TRACE\n"
+                 "       libcred_replay --compare BASELINE TRACE"
+              << std::endl;
+    return 2;
+}
+
+int
+main(int argc, char** argv)
+{
+    std::string backend_spec = "keyring";
+    std::string save_path, trace_path, baseline_path;
+    double speed = 1;
+    long cache_ttl_ms = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--backend" && has_value)
+        {
+            backend_spec = argv[++i];
+        }
+        else if (arg == "--speed" && has_value)
+        {
+            speed = atof(argv[++i]);
+        }
+        else if (arg == "--cache-ttl" && has_value)
+        {
+            cache_ttl_ms = atol(argv[++i]);
+        }
+        else if (arg == "--save" && has_value)
+        {
+            save_path = argv[++i];
+        }
+        else if (arg == "--compare" && has_value)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (arg[0] != '-' && trace_path.empty())
+        {
+            trace_path = arg;
+        }
+        else
+        {
+            return usage();
+        }
+    }
+    if (trace_path.empty())
+    {
+        return usage();
+    }
+
+    std::vector<Event> events;
+    if (!read_trace(trace_path, &events))
+    {
+        return 1;
+    }
+
+    if (!baseline_path.empty())
+    {
+        std::vector<Event> baseline;
+        if (!read_trace(baseline_path, &baseline))
+        {
+            return 1;
+        }
+        report(baseline, events);
+        return 0;
+    }
+
+    libcred::StoreOptions options;
+    options.cache_ttl_ms = cache_ttl_ms;
+    std::unique_ptr<libcred::Store> store;
+    if (backend_spec == "keyring")
+    {
+        store.reset(new libcred::Store(options));
+    }
+    else
+    {
+        std::unique_ptr<libcred::Backend> backend = make_backend(backend_spec);
+        if (!backend)
+        {
+            std::cerr << "unknown backend: " << backend_spec << std::endl;
+            return usage();
+        }
+        store.reset(new libcred::Store(std::move(backend), options));
+    }
+
+    std::vector<Event> traced = events;
+
+    Keys created;
+    if (!seed(*store, events, &created))
+    {
+        return 1;
+    }
+
+    std::map<int, std::vector<Event*>> threads;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        threads[events[i].thread].push_back(&events[i]);
+        if (events[i].operation == "set_password")
+        {
+            created.insert(std::make_pair(service_name(events[i]), events[i].account));
+        }
+        else if (events[i].operation == "rename_service")
+        {
+            // What it moves is deleted under the new name.
+            std::string service = service_name(events[i]);
+            Keys moved;
+            for (Keys::const_iterator it
+                 = created.lower_bound(std::make_pair(service, std::string()));
+                 it != created.end() && it->first == service;
+                 ++it)
+            {
+                moved.insert(std::make_pair(target_name(events[i]), it->second));
+            }
+            created.insert(moved.begin(), moved.end());
+        }
+    }
+
+    Clock::time_point origin = Clock::now();
+    std::vector<std::thread> workers;
+    for (std::map<int, std::vector<Event*>>::iterator it = threads.begin(); it != threads.end();
+         ++it)
+    {
+        workers.push_back(
+            std::thread(replay_thread, std::ref(*store), it->second, origin, speed));
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+
+    for (Keys::const_iterator it = created.begin(); it != created.end(); ++it)
+    {
+        std::string error;
+        store->delete_password(it->first, it->second, &error);
+    }
+
+    report(traced, events);
+    if (!save_path.empty())
+    {
+        write_trace(save_path, events);
+    }
+    return 0;
+}